@@ -0,0 +1,342 @@
+/*The append-only command log and its writer thread*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<time.h>
+#include<pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "aof.h"
+
+struct s_aof{
+    pthread_mutex_t lock;
+    pthread_cond_t work;    //the writer has records to write or must stop
+    pthread_cond_t synced;  //the durable sequence number moved
+
+    char *buf;              //records appended since the writer last took them
+    size_t len;
+    size_t cap;
+    char *spare;            //the buffer the writer hands back, kept for reuse
+    size_t sparecap;
+
+    unsigned long long appended;    //sequence number of the last record in buf
+    unsigned long long durable;     //last record that is written, and fsynced
+                                    //if the policy asks for it
+    int fd;
+    Fsync policy;
+    int error;              //errno of a failed write; no records are taken after it
+    bool open;
+    bool stop;
+    bool idle;              //the writer sleeps on work and needs a signal
+    pthread_t writer;
+};
+typedef struct s_aof Aof;
+
+Aof aof = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .synced = PTHREAD_COND_INITIALIZER,
+    .fd = -1
+};
+
+//Last record this thread appended, so it knows what to wait for
+_Thread_local unsigned long long aof_mine;
+
+int aof_parse_policy(const char *name, Fsync *policy){
+    if(!strcmp(name, "always"))
+        *policy = FsyncAlways;
+    else if(!strcmp(name, "everysec"))
+        *policy = FsyncEverysec;
+    else if(!strcmp(name, "no"))
+        *policy = FsyncNo;
+    else{
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*Run every record of the log through apply. A record cut short by a crash
+is dropped from the file so new records follow the last complete one. A
+record that does not parse is corruption, not a torn tail: replay fails
+with EPROTO and the file is left as it is, since cutting it there would
+lose every good record after it. Returns the number of records replayed
+(0 for a missing log), or -1 with errno set.*/
+long aof_replay(const char *path, Apply apply, void *ctx){
+    static RespCmd cmd;
+    struct stat st;
+    char *map;
+    size_t off;
+    long used, n;
+    int fd, err;
+
+    fd = open(path, O_RDWR);
+    if(fd < 0)
+        return (errno == ENOENT) ? 0 : -1;
+    if(fstat(fd, &st)){
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if(!st.st_size){
+        close(fd);
+        return 0;
+    }
+
+    //A private mapping: the parser writes terminators into it, not the file
+    map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    n = 0;
+    for(off = 0; off < (size_t)st.st_size; off += used, n++){
+        used = resp_parse(map + off, st.st_size - off, &cmd);
+        if(!used)
+            break;
+        if(used < 0 || !cmd.framed){
+            fprintf(stderr, "aof: malformed record at offset %zu of %s\n", off, path);
+            errno = EPROTO;
+            n = -1;
+            break;
+        }
+        if(apply(ctx, &cmd) < 0){
+            n = -1;
+            break;
+        }
+    }
+
+    //Only an incomplete record running to the end of the file is cut
+    if(n >= 0 && off < (size_t)st.st_size){
+        fprintf(stderr, "aof: dropping %zu bytes of an incomplete record at the end of %s\n",
+            (size_t)st.st_size - off, path);
+        if(ftruncate(fd, off))
+            n = -1;
+    }
+
+    munmap(map, st.st_size);
+    close(fd);
+
+    return n;
+}
+
+/*Body of the writer thread. It takes the whole buffer at once, so every
+record that was appended while the last write or fsync ran goes out in
+the next single write and shares the next fsync.*/
+void *aof_writer(void *arg){
+    struct timespec now, deadline;
+    unsigned long long seq, written, synced;
+    time_t lastsync;
+    char *buf;
+    size_t len, cap, off;
+    ssize_t n;
+    int err;
+
+    (void)arg;
+    lastsync = time(NULL);
+    written = synced = 0;
+
+    pthread_mutex_lock(&aof.lock);
+    while(1){
+        while(!aof.len && !aof.stop){
+            aof.idle = true;
+            if(aof.policy == FsyncEverysec && written > synced){
+                //Nothing new, but what was written still has to reach the disk
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += 1;
+                if(pthread_cond_timedwait(&aof.work, &aof.lock, &deadline) == ETIMEDOUT)
+                    break;
+            }
+            else
+                pthread_cond_wait(&aof.work, &aof.lock);
+        }
+        aof.idle = false;
+        if(!aof.len && aof.stop)
+            break;
+
+        //Swap buffers so appenders keep going while this one is written
+        buf = aof.buf;
+        len = aof.len;
+        cap = aof.cap;
+        seq = aof.appended;
+        aof.buf = aof.spare;
+        aof.cap = aof.sparecap;
+        aof.len = 0;
+        aof.spare = NULL;
+        pthread_mutex_unlock(&aof.lock);
+
+        err = 0;
+        for(off = 0; off < len; off += n){
+            n = write(aof.fd, buf + off, len - off);
+            if(n < 0){
+                if(errno == EINTR){
+                    n = 0;
+                    continue;
+                }
+                err = errno;
+                break;
+            }
+        }
+        if(!err)
+            written = seq;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        if(!err && written > synced && (aof.policy == FsyncAlways
+            || (aof.policy == FsyncEverysec && now.tv_sec - lastsync >= 1))){
+            if(fdatasync(aof.fd))
+                err = errno;
+            else
+                synced = written;
+            lastsync = now.tv_sec;
+        }
+
+        pthread_mutex_lock(&aof.lock);
+        aof.spare = buf;
+        aof.sparecap = cap;
+        if(err && !aof.error){
+            fprintf(stderr, "aof: %s, no longer accepting writes\n", strerror(err));
+            aof.error = err;
+        }
+        aof.durable = (aof.policy == FsyncAlways) ? synced : written;
+        pthread_cond_broadcast(&aof.synced);
+    }
+    pthread_mutex_unlock(&aof.lock);
+
+    if(written > synced && aof.policy != FsyncNo)
+        fdatasync(aof.fd);
+
+    return NULL;
+}
+
+/*Start logging to path. Call it after aof_replay and before any thread
+changes the store.*/
+int aof_open(const char *path, Fsync policy){
+    aof.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(aof.fd < 0)
+        return -1;
+
+    aof.policy = policy;
+    aof.open = true;
+    if(pthread_create(&aof.writer, NULL, aof_writer, NULL)){
+        close(aof.fd);
+        aof.fd = -1;
+        aof.open = false;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+bool aof_enabled(void){
+    return aof.open;
+}
+
+/*Queue one command for the log. Called while the store still holds the
+lock of whatever the command changed, so records of one key are logged
+in the order they were applied. Returns 0 or -1 with errno = EIO once the
+log has failed.*/
+int aof_append(uint32_t argc, const char **argv, const size_t *argl){
+    char head[RESP_MAX_HEADER];
+    size_t need, len;
+    uint32_t i;
+    char *p;
+    int n;
+
+    need = RESP_MAX_HEADER;
+    for(i=0; i<argc; i++)
+        need += RESP_MAX_HEADER + argl[i] + 2;
+
+    pthread_mutex_lock(&aof.lock);
+    if(aof.error){
+        pthread_mutex_unlock(&aof.lock);
+        errno = EIO;
+        return -1;
+    }
+
+    if(aof.len + need > aof.cap){
+        for(len = aof.cap ? aof.cap : 65536; len < aof.len + need; len *= 2);
+        p = (char *)realloc(aof.buf, len);
+        if(!p){
+            pthread_mutex_unlock(&aof.lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        aof.buf = p;
+        aof.cap = len;
+    }
+
+    p = aof.buf + aof.len;
+    n = resp_header(head, '*', argc);
+    memcpy(p, head, n);
+    p += n;
+    for(i=0; i<argc; i++){
+        n = resp_header(head, '$', (long long)argl[i]);
+        memcpy(p, head, n);
+        memcpy(p + n, argv[i], argl[i]);
+        p += n + argl[i];
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    aof.len = p - aof.buf;
+    aof_mine = ++aof.appended;
+
+    //A busy writer picks the record up when it comes back for the next batch
+    if(aof.idle){
+        aof.idle = false;
+        pthread_cond_signal(&aof.work);
+    }
+    pthread_mutex_unlock(&aof.lock);
+
+    return 0;
+}
+
+/*With the always policy, wait until every record this thread appended is
+on disk. The I/O threads call it once per batch of requests, before any
+reply of that batch goes out. Returns 0 or -1 with errno = EIO.*/
+int aof_sync(void){
+    int ret;
+
+    if(!aof.open || aof.policy != FsyncAlways)
+        return 0;
+
+    pthread_mutex_lock(&aof.lock);
+    while(aof.durable < aof_mine && !aof.error)
+        pthread_cond_wait(&aof.synced, &aof.lock);
+    ret = aof.error ? -1 : 0;
+    pthread_mutex_unlock(&aof.lock);
+
+    if(ret)
+        errno = EIO;
+    return ret;
+}
+
+/*Write out what is left, stop the writer and close the file*/
+void aof_close(void){
+    if(!aof.open)
+        return;
+
+    pthread_mutex_lock(&aof.lock);
+    aof.stop = true;
+    pthread_cond_signal(&aof.work);
+    pthread_mutex_unlock(&aof.lock);
+    pthread_join(aof.writer, NULL);
+
+    close(aof.fd);
+    free(aof.buf);
+    free(aof.spare);
+    aof.buf = aof.spare = NULL;
+    aof.len = aof.cap = aof.sparecap = 0;
+    aof.fd = -1;
+    aof.open = aof.stop = false;
+}
@@ -0,0 +1,26 @@
+/*aof.h*/
+//Append-only log of the commands that change the store. Every record is a
+//framed request (see ../tree/resp.h), so replaying the log is just parsing
+//it again. One writer thread owns the file; appending only copies the
+//record into memory, and everyone whose records went out in the same
+//write shares one fsync.
+
+#include "../tree/resp.h"
+
+enum e_fsync{
+    FsyncNo,        //leave flushing to the kernel
+    FsyncEverysec,  //fsync at most once a second in the background
+    FsyncAlways     //no reply before its command is on disk
+};
+typedef enum e_fsync Fsync;
+
+//Called for every record during replay; a negative return stops it
+typedef int (*Apply)(void *, RespCmd *);
+
+int aof_parse_policy(const char *, Fsync *);
+long aof_replay(const char *, Apply, void *);
+int aof_open(const char *, Fsync);
+bool aof_enabled(void);
+int aof_append(uint32_t, const char **, const size_t *);
+int aof_sync(void);
+void aof_close(void);
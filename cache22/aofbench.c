@@ -0,0 +1,134 @@
+/*aofbench: SET throughput with the append-only log off and under each fsync policy*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<time.h>
+#include<stdatomic.h>
+
+#include <sys/stat.h>
+
+#include "store.h"
+
+#define DIRS    16      //every thread count divides this
+#define KEYS    10000   //keys per directory
+#define VALUE   100     //bytes per value
+#define MAXT    16
+
+struct s_worker{
+    pthread_t tid;
+    int id;
+    int nthreads;
+    unsigned long ops;
+};
+typedef struct s_worker Worker;
+
+atomic_bool running;
+
+/*Each thread stands in for one client that waits for its reply, so with
+"always" every SET waits for an fsync, shared with whatever the other
+threads logged meanwhile.*/
+void *worker(void *arg){
+    Worker *w;
+    char dir[32], key[32], value[VALUE + 1];
+    unsigned int seed;
+    unsigned long ops;
+    int d;
+
+    w = (Worker *)arg;
+    seed = (unsigned int)w->id * 2654435761u + 1;
+    memset(value, 'v', VALUE);
+    value[VALUE] = 0;
+    ops = 0;
+
+    while(running){
+        d = w->id + w->nthreads * (rand_r(&seed) % (DIRS / w->nthreads));
+        snprintf(dir, sizeof(dir), "/bench/d%d", d);
+        snprintf(key, sizeof(key), "k%d", rand_r(&seed) % KEYS);
+        if(store_set(dir, key, value, VALUE) || aof_sync()){
+            perror("SET");
+            exit(1);
+        }
+        ops++;
+    }
+
+    w->ops = ops;
+    return NULL;
+}
+
+double run(int nthreads, double seconds){
+    Worker w[MAXT];
+    struct timespec ts, start, end;
+    unsigned long total;
+    int i;
+
+    running = true;
+    for(i=0; i<nthreads; i++){
+        w[i].id = i;
+        w[i].nthreads = nthreads;
+        w[i].ops = 0;
+        pthread_create(&w[i].tid, NULL, worker, &w[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    running = false;
+
+    total = 0;
+    for(i=0; i<nthreads; i++){
+        pthread_join(w[i].tid, NULL);
+        total += w[i].ops;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)total / ((double)(end.tv_sec - start.tv_sec) +
+        (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char *argv[]){
+    static const int threads[] = {1, 4, 16};
+    static const char *policies[] = {"off", "no", "everysec", "always"};
+    char dir[32], *path;
+    double seconds, sets;
+    struct stat st;
+    Fsync policy;
+    int d, t, p;
+
+    seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+    path = (argc > 2) ? argv[2] : "aofbench.aof";
+
+    store_init();
+    store_mkdir("/bench");
+    for(d=0; d<DIRS; d++){
+        snprintf(dir, sizeof(dir), "/bench/d%d", d);
+        store_mkdir(dir);
+    }
+
+    printf("%d-byte values, %.1fs per run, log at %s\n", VALUE, seconds, path);
+    printf("%10s %8s %14s %14s\n", "policy", "threads", "SET/s", "log bytes");
+
+    for(p=0; p<(int)(sizeof(policies)/sizeof(policies[0])); p++){
+        for(t=0; t<(int)(sizeof(threads)/sizeof(threads[0])); t++){
+            unlink(path);
+            if(p && (aof_parse_policy(policies[p], &policy) || aof_open(path, policy))){
+                perror(path);
+                return 1;
+            }
+
+            sets = run(threads[t], seconds);
+            aof_close();
+
+            st.st_size = 0;
+            stat(path, &st);
+            printf("%10s %8d %14.0f %14lld\n", policies[p], threads[t], sets, (long long)st.st_size);
+        }
+    }
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,682 @@
+/*cache22-bench: load generator for a running cache22. N connections,
+each keeping a pipeline of GETs and SETs in flight, report throughput and
+the latency distribution, optionally appended to a CSV file.*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<time.h>
+#include<math.h>
+#include<pthread.h>
+#include<stdatomic.h>
+#include<limits.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define HOST        "127.0.0.1"
+#define PORT        12049
+#define MAXCONNS    4096
+#define MAXTHREADS  64
+#define MAXDEPTH    1024        //requests one connection may have in flight
+#define MAXVALUE    (64UL * 1024 * 1024)
+#define HBITS       6           //2^HBITS sub-buckets per power of two: under 1.6% error
+#define HBUCKETS    (64 << HBITS)
+
+enum e_dist{
+    DistFixed,
+    DistUniform,
+    DistExp
+};
+typedef enum e_dist Dist;
+
+struct s_config{
+    const char *host;
+    int port;
+    int conns;
+    int threads;
+    int depth;
+    unsigned long long requests;    //0 when running for seconds instead
+    double seconds;
+    unsigned long keys;
+    unsigned long dirs;             //fan-out: keys are spread over this many directories
+    Dist dist;
+    unsigned long vmin;             //fixed size, or the uniform range
+    unsigned long vmax;
+    double vmean;                   //mean of the exponential
+    char vspec[64];
+    int reads;                      //percent of requests that are GETs
+    const char *csv;
+};
+typedef struct s_config Config;
+
+//Latency histogram in nanoseconds, log-linear like HdrHistogram
+struct s_hist{
+    unsigned long long counts[HBUCKETS];
+    unsigned long long n;
+    unsigned long long max;
+    double sum;
+};
+typedef struct s_hist Hist;
+
+struct s_conn{
+    int s;
+    char *out;                  //requests not yet written
+    size_t outlen;
+    size_t outoff;
+    size_t outcap;
+    char *in;                   //replies not yet parsed
+    size_t inlen;
+    size_t incap;
+    unsigned long long sent[MAXDEPTH];  //send time of each request in flight, oldest at head
+    bool isget[MAXDEPTH];
+    unsigned int head;
+    unsigned int inflight;
+    bool pollout;
+};
+typedef struct s_conn Conn;
+
+struct s_worker{
+    pthread_t tid;
+    int id;
+    Conn **conns;
+    int nconns;
+    bool load;                  //filling the key space: SET every key once, in order
+    unsigned long long quota;   //requests to issue, or ULLONG_MAX until time is up
+    unsigned long long issued;
+    unsigned long next;         //next key while loading
+    unsigned int seed;
+    Hist hist;
+    unsigned long long gets;
+    unsigned long long sets;
+    unsigned long long misses;
+    unsigned long long errors;
+};
+typedef struct s_worker Worker;
+
+Config cfg;
+char *value;                    //the bytes every SET takes its value from
+atomic_bool expired;            //a timed run is over
+
+unsigned long long now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void die(const char *what){
+    perror(what);
+    exit(1);
+}
+
+unsigned int hist_index(unsigned long long v){
+    int e;
+
+    if(v < (1ULL << HBITS))
+        return (unsigned int)v;
+    e = 63 - __builtin_clzll(v) - HBITS;
+    return (unsigned int)((e + 1) << HBITS) + (unsigned int)((v >> e) - (1ULL << HBITS));
+}
+
+//The middle of what bucket i holds
+double hist_value(unsigned int i){
+    int e;
+
+    if(i < (1U << HBITS))
+        return (double)i;
+    e = (int)(i >> HBITS) - 1;
+    return ((double)((i & ((1U << HBITS) - 1)) + (1U << HBITS)) + 0.5) * (double)(1ULL << e);
+}
+
+void hist_add(Hist *h, unsigned long long v){
+    h->counts[hist_index(v)]++;
+    h->n++;
+    h->sum += (double)v;
+    if(v > h->max)
+        h->max = v;
+}
+
+void hist_merge(Hist *to, const Hist *from){
+    unsigned int i;
+
+    for(i=0; i<HBUCKETS; i++)
+        to->counts[i] += from->counts[i];
+    to->n += from->n;
+    to->sum += from->sum;
+    if(from->max > to->max)
+        to->max = from->max;
+}
+
+//Latency at quantile q in microseconds
+double hist_quantile(const Hist *h, double q){
+    unsigned long long want, seen;
+    unsigned int i;
+
+    if(!h->n)
+        return 0;
+    want = (unsigned long long)ceil(q * (double)h->n);
+    if(!want)
+        want = 1;
+    for(seen=0, i=0; i<HBUCKETS; i++){
+        seen += h->counts[i];
+        if(seen >= want)
+            return fmin(hist_value(i), (double)h->max) / 1000.0;
+    }
+    return (double)h->max / 1000.0;
+}
+
+int connectto(void){
+    struct sockaddr_in sock;
+    char c;
+    int s, one;
+    ssize_t n;
+
+    sock.sin_family = AF_INET;
+    sock.sin_port = htons(cfg.port);
+    sock.sin_addr.s_addr = inet_addr(cfg.host);
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if(s < 0 || connect(s, (struct sockaddr *)&sock, sizeof(sock)))
+        die("connect");
+
+    //Without this depth 1 measures Nagle's delay instead of the server
+    one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    //The greeting is one inline line
+    do{
+        n = read(s, &c, 1);
+        if(n <= 0){
+            fprintf(stderr, "server closed the connection\n");
+            exit(1);
+        }
+    }while(c != '\n');
+
+    return s;
+}
+
+//Send one inline request on a blocking socket and return the status code
+int command(int s, const char *line){
+    char buf[256];
+    size_t len, got;
+    ssize_t n;
+
+    len = strlen(line);
+    if(write(s, line, len) != (ssize_t)len)
+        die("write");
+    for(got=0; got < sizeof(buf) - 1 && (!got || buf[got - 1] != '\n'); got += (size_t)n){
+        n = read(s, buf + got, 1);
+        if(n <= 0){
+            fprintf(stderr, "server closed the connection\n");
+            exit(1);
+        }
+    }
+    buf[got] = 0;
+
+    return atoi(buf);
+}
+
+unsigned long value_size(unsigned int *seed){
+    double u;
+    unsigned long size;
+
+    switch(cfg.dist){
+        case DistUniform:
+            return cfg.vmin + (unsigned long)rand_r(seed) % (cfg.vmax - cfg.vmin + 1);
+        case DistExp:
+            u = ((double)rand_r(seed) + 1.0) / ((double)RAND_MAX + 2.0);
+            size = (unsigned long)(-cfg.vmean * log(u)) + 1;
+            return (size > cfg.vmax) ? cfg.vmax : size;
+        default:
+            return cfg.vmin;
+    }
+}
+
+bool reserve(char **buf, size_t *cap, size_t need){
+    char *p;
+    size_t size;
+
+    if(need <= *cap)
+        return true;
+    for(size = *cap ? *cap : 16384; size < need; size *= 2);
+    p = (char *)realloc(*buf, size);
+    if(!p)
+        return false;
+    *buf = p;
+    *cap = size;
+    return true;
+}
+
+//Queue one request on c: framed, so values may be any size
+void enqueue(Worker *w, Conn *c, unsigned long long t){
+    char dir[32], key[32];
+    unsigned long k, size;
+    size_t dlen, klen, need;
+    unsigned int slot;
+    bool get;
+    int n;
+
+    if(w->load){
+        k = w->next++;
+        get = false;
+    }
+    else{
+        k = ((unsigned long)rand_r(&w->seed) << 16 ^ (unsigned long)rand_r(&w->seed)) % cfg.keys;
+        get = rand_r(&w->seed) % 100 < cfg.reads;
+    }
+    dlen = (size_t)snprintf(dir, sizeof(dir), "/bench/d%lu", k % cfg.dirs);
+    klen = (size_t)snprintf(key, sizeof(key), "key:%lu", k);
+    size = get ? 0 : value_size(&w->seed);
+
+    need = c->outlen + 96 + dlen + klen + size;
+    if(!reserve(&c->out, &c->outcap, need))
+        die("realloc");
+    if(get)
+        n = sprintf(c->out + c->outlen, "*3\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n", dlen, dir, klen, key);
+    else
+        n = sprintf(c->out + c->outlen, "*4\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n$%lu\r\n",
+            dlen, dir, klen, key, size);
+    c->outlen += (size_t)n;
+    if(!get){
+        memcpy(c->out + c->outlen, value, size);
+        memcpy(c->out + c->outlen + size, "\r\n", 2);
+        c->outlen += size + 2;
+    }
+
+    slot = (c->head + c->inflight) % MAXDEPTH;
+    c->sent[slot] = t;
+    c->isget[slot] = get;
+    c->inflight++;
+    w->issued++;
+}
+
+bool more(Worker *w){
+    return w->issued < w->quota && !atomic_load_explicit(&expired, memory_order_relaxed);
+}
+
+void fill(Worker *w, Conn *c){
+    unsigned long long t;
+
+    t = now();
+    while(c->inflight < (unsigned int)cfg.depth && more(w))
+        enqueue(w, c, t);
+}
+
+//Write what is queued. Returns 1 when all of it went, 0 if the socket is full.
+int flush(Conn *c){
+    ssize_t n;
+
+    while(c->outoff < c->outlen){
+        n = write(c->s, c->out + c->outoff, c->outlen - c->outoff);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                return 0;
+            die("write");
+        }
+        c->outoff += (size_t)n;
+    }
+    c->outoff = c->outlen = 0;
+    return 1;
+}
+
+/*Length of the reply at the front of buf, 0 if it is not all there.
+GET answers $<len> and the value, or $-1; SET answers +OK; errors are -.*/
+size_t reply_length(const char *buf, size_t len){
+    const char *nl;
+    size_t head;
+    long n;
+
+    nl = (const char *)memchr(buf, '\n', len);
+    if(!nl)
+        return 0;
+    head = (size_t)(nl + 1 - buf);
+    if(buf[0] != '$')
+        return head;
+    n = strtol(buf + 1, NULL, 10);
+    if(n < 0)
+        return head;
+    return (head + (size_t)n + 2 <= len) ? head + (size_t)n + 2 : 0;
+}
+
+void receive(Worker *w, Conn *c){
+    unsigned long long t;
+    size_t used, n, off;
+    ssize_t got;
+    bool get;
+
+    for(;;){
+        if(!reserve(&c->in, &c->incap, c->inlen + 65536))
+            die("realloc");
+        got = read(c->s, c->in + c->inlen, c->incap - c->inlen);
+        if(got < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                break;
+            die("read");
+        }
+        if(!got){
+            fprintf(stderr, "server closed the connection\n");
+            exit(1);
+        }
+        c->inlen += (size_t)got;
+    }
+
+    t = now();
+    for(off=0; off < c->inlen && (n = reply_length(c->in + off, c->inlen - off)); off += n){
+        if(!c->inflight){
+            fprintf(stderr, "unexpected reply: %.*s\n", (int)(c->inlen - off), c->in + off);
+            exit(1);
+        }
+        get = c->isget[c->head];
+        if(!w->load)
+            hist_add(&w->hist, t - c->sent[c->head]);
+        c->head = (c->head + 1) % MAXDEPTH;
+        c->inflight--;
+
+        if(c->in[off] == '-')
+            w->errors++;
+        else if(get && c->in[off + 1] == '-')
+            w->misses++;
+        if(get)
+            w->gets++;
+        else
+            w->sets++;
+    }
+    used = off;
+    memmove(c->in, c->in + used, c->inlen - used);
+    c->inlen -= used;
+}
+
+void watch(int ep, Conn *c, bool out){
+    struct epoll_event ev;
+
+    if(c->pollout == out)
+        return;
+    ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if(epoll_ctl(ep, EPOLL_CTL_MOD, c->s, &ev))
+        die("epoll_ctl");
+    c->pollout = out;
+}
+
+//Top up c's pipeline and send it
+void pump(int ep, Worker *w, Conn *c){
+    fill(w, c);
+    watch(ep, c, !flush(c));
+}
+
+void *worker(void *arg){
+    struct epoll_event ev, events[256];
+    Worker *w;
+    Conn *c;
+    unsigned long long busy;
+    int ep, i, n;
+
+    w = (Worker *)arg;
+    ep = epoll_create1(0);
+    if(ep < 0)
+        die("epoll_create1");
+    for(i=0; i<w->nconns; i++){
+        ev.events = EPOLLIN;
+        ev.data.ptr = w->conns[i];
+        if(epoll_ctl(ep, EPOLL_CTL_ADD, w->conns[i]->s, &ev))
+            die("epoll_ctl");
+        w->conns[i]->pollout = false;
+        pump(ep, w, w->conns[i]);
+    }
+
+    for(;;){
+        for(busy=0, i=0; i<w->nconns; i++)
+            busy += w->conns[i]->inflight;
+        if(!busy && !more(w))
+            break;
+
+        n = epoll_wait(ep, events, 256, 100);
+        if(n < 0 && errno != EINTR)
+            die("epoll_wait");
+        for(i=0; i<n; i++){
+            c = (Conn *)events[i].data.ptr;
+            if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                receive(w, c);
+            pump(ep, w, c);
+        }
+    }
+
+    close(ep);
+    return NULL;
+}
+
+//Run every worker to the end of its quota; returns the seconds it took
+double run(Worker *workers, bool load){
+    unsigned long long start, per, extra;
+    unsigned long keys, from;
+    int i;
+
+    per = cfg.requests / (unsigned long long)cfg.threads;
+    extra = cfg.requests % (unsigned long long)cfg.threads;
+    keys = cfg.keys / (unsigned long)cfg.threads;
+    from = 0;
+    for(i=0; i<cfg.threads; i++){
+        workers[i].load = load;
+        workers[i].issued = 0;
+        if(load){
+            //Each worker loads its own slice of the key space
+            workers[i].next = from;
+            workers[i].quota = keys + ((i == cfg.threads - 1) ? cfg.keys % (unsigned long)cfg.threads : 0);
+            from += (unsigned long)workers[i].quota;
+        }
+        else
+            workers[i].quota = cfg.requests ? per + ((unsigned long long)i < extra) : ULLONG_MAX;
+    }
+
+    atomic_store(&expired, false);
+    start = now();
+    for(i=0; i<cfg.threads; i++)
+        if(pthread_create(&workers[i].tid, NULL, worker, &workers[i]))
+            die("pthread_create");
+    if(!load && !cfg.requests){
+        usleep((useconds_t)(cfg.seconds * 1e6));
+        atomic_store(&expired, true);
+    }
+    for(i=0; i<cfg.threads; i++)
+        pthread_join(workers[i].tid, NULL);
+
+    return (double)(now() - start) / 1e9;
+}
+
+//fixed size N, uniform:MIN:MAX or exp:MEAN
+bool parse_sizes(const char *spec){
+    char *end;
+
+    snprintf(cfg.vspec, sizeof(cfg.vspec), "%s", spec);
+    if(!strncmp(spec, "uniform:", 8)){
+        cfg.dist = DistUniform;
+        cfg.vmin = strtoul(spec + 8, &end, 10);
+        if(*end != ':')
+            return false;
+        cfg.vmax = strtoul(end + 1, &end, 10);
+        return !*end && cfg.vmin && cfg.vmin <= cfg.vmax && cfg.vmax <= MAXVALUE;
+    }
+    if(!strncmp(spec, "exp:", 4)){
+        cfg.dist = DistExp;
+        cfg.vmean = strtod(spec + 4, &end);
+        //The tail is cut at twenty times the mean
+        cfg.vmin = 1;
+        cfg.vmax = (cfg.vmean * 20 < (double)MAXVALUE) ? (unsigned long)(cfg.vmean * 20) + 1 : MAXVALUE;
+        return !*end && cfg.vmean >= 1 && cfg.vmean <= MAXVALUE;
+    }
+    if(!strncmp(spec, "fixed:", 6))
+        spec += 6;
+    cfg.dist = DistFixed;
+    cfg.vmin = cfg.vmax = strtoul(spec, &end, 10);
+    return !*end && cfg.vmin && cfg.vmin <= MAXVALUE;
+}
+
+void usage(char *prog){
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-c connections 1-%d] [-t threads 1-%d]"
+        " [-P pipeline 1-%d] [-n requests | -T seconds] [-k keys] [-d directories]"
+        " [-s N | uniform:MIN:MAX | exp:MEAN] [-r read%%] [-C csvfile]\n",
+        prog, MAXCONNS, MAXTHREADS, MAXDEPTH);
+    exit(1);
+}
+
+//One row per run, with a header when the file is new
+void write_csv(double secs, const Hist *h, const Worker *total){
+    struct stat st;
+    FILE *f;
+    bool fresh;
+
+    fresh = stat(cfg.csv, &st) || !st.st_size;
+    f = fopen(cfg.csv, "a");
+    if(!f)
+        die(cfg.csv);
+    if(fresh)
+        fprintf(f, "timestamp,connections,threads,pipeline,keys,directories,values,read_pct,"
+            "requests,seconds,rps,avg_us,p50_us,p99_us,p999_us,max_us,misses,errors\n");
+    fprintf(f, "%lld,%d,%d,%d,%lu,%lu,%s,%d,%llu,%.3f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%llu\n",
+        (long long)time(NULL), cfg.conns, cfg.threads, cfg.depth, cfg.keys, cfg.dirs, cfg.vspec,
+        cfg.reads, h->n, secs, (double)h->n / secs, h->n ? h->sum / (double)h->n / 1000.0 : 0.0,
+        hist_quantile(h, 0.50), hist_quantile(h, 0.99), hist_quantile(h, 0.999),
+        (double)h->max / 1000.0, total->misses, total->errors);
+    fclose(f);
+}
+
+int main(int argc, char *argv[]){
+    static Worker workers[MAXTHREADS], total;
+    char line[64];
+    Conn *conns;
+    double secs;
+    unsigned long d;
+    int opt, i, s;
+
+    cfg = (Config){
+        .host = HOST, .port = PORT, .conns = 50, .threads = 1, .depth = 1,
+        .requests = 1000000, .keys = 10000, .dirs = 1, .reads = 90
+    };
+    parse_sizes("100");
+    while((opt = getopt(argc, argv, "h:p:c:t:P:n:T:k:d:s:r:C:")) != -1){
+        if(opt == 'h')
+            cfg.host = optarg;
+        else if(opt == 'p')
+            cfg.port = atoi(optarg);
+        else if(opt == 'c')
+            cfg.conns = atoi(optarg);
+        else if(opt == 't')
+            cfg.threads = atoi(optarg);
+        else if(opt == 'P')
+            cfg.depth = atoi(optarg);
+        else if(opt == 'n')
+            cfg.requests = strtoull(optarg, NULL, 10);
+        else if(opt == 'T'){
+            cfg.seconds = atof(optarg);
+            cfg.requests = 0;
+        }
+        else if(opt == 'k')
+            cfg.keys = strtoul(optarg, NULL, 10);
+        else if(opt == 'd')
+            cfg.dirs = strtoul(optarg, NULL, 10);
+        else if(opt == 's'){
+            if(!parse_sizes(optarg))
+                usage(argv[0]);
+        }
+        else if(opt == 'r')
+            cfg.reads = atoi(optarg);
+        else if(opt == 'C')
+            cfg.csv = optarg;
+        else
+            usage(argv[0]);
+    }
+    if(optind != argc || cfg.conns < 1 || cfg.conns > MAXCONNS || cfg.threads < 1
+        || cfg.threads > MAXTHREADS || cfg.depth < 1 || cfg.depth > MAXDEPTH
+        || (!cfg.requests && cfg.seconds <= 0) || !cfg.keys || !cfg.dirs || cfg.dirs > cfg.keys
+        || cfg.reads < 0 || cfg.reads > 100)
+        usage(argv[0]);
+    if(cfg.threads > cfg.conns)
+        cfg.threads = cfg.conns;
+
+    value = (char *)malloc(cfg.vmax + 1);
+    conns = (Conn *)calloc((size_t)cfg.conns, sizeof(Conn));
+    if(!value || !conns)
+        die("malloc");
+    memset(value, 'x', cfg.vmax + 1);
+
+    //The directories may be there from an earlier run
+    s = connectto();
+    command(s, "MKDIR /bench\n");
+    for(d=0; d<cfg.dirs; d++){
+        snprintf(line, sizeof(line), "MKDIR /bench/d%lu\n", d);
+        i = command(s, line);
+        if(i != 200 && i != 409){
+            fprintf(stderr, "MKDIR /bench/d%lu failed with %d\n", d, i);
+            return 1;
+        }
+    }
+    close(s);
+
+    for(i=0; i<cfg.threads; i++){
+        workers[i].conns = (Conn **)calloc((size_t)(cfg.conns / cfg.threads + 1), sizeof(Conn *));
+        if(!workers[i].conns)
+            die("malloc");
+    }
+    for(i=0; i<cfg.conns; i++){
+        conns[i].s = connectto();
+        if(fcntl(conns[i].s, F_SETFL, O_NONBLOCK))
+            die("fcntl");
+        workers[i % cfg.threads].conns[workers[i % cfg.threads].nconns++] = &conns[i];
+    }
+    for(i=0; i<cfg.threads; i++){
+        workers[i].id = i;
+        workers[i].seed = (unsigned int)i * 2654435761u + 1;
+    }
+
+    printf("%d connections, %d threads, pipeline %d, %lu keys over %lu directories, values %s, %d%% reads\n",
+        cfg.conns, cfg.threads, cfg.depth, cfg.keys, cfg.dirs, cfg.vspec, cfg.reads);
+
+    //Every key exists before the measured run, so GETs hit
+    secs = run(workers, true);
+    printf("loaded %lu keys in %.2f s\n", cfg.keys, secs);
+    for(i=0; i<cfg.threads; i++)
+        workers[i].gets = workers[i].sets = workers[i].misses = workers[i].errors = 0;
+
+    secs = run(workers, false);
+    for(i=0; i<cfg.threads; i++){
+        hist_merge(&total.hist, &workers[i].hist);
+        total.gets += workers[i].gets;
+        total.sets += workers[i].sets;
+        total.misses += workers[i].misses;
+        total.errors += workers[i].errors;
+    }
+
+    printf("%llu requests in %.2f s: %.0f requests/s (GET %llu, SET %llu, misses %llu, errors %llu)\n",
+        total.hist.n, secs, (double)total.hist.n / secs, total.gets, total.sets, total.misses, total.errors);
+    printf("latency us: avg %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+        total.hist.n ? total.hist.sum / (double)total.hist.n / 1000.0 : 0.0,
+        hist_quantile(&total.hist, 0.50), hist_quantile(&total.hist, 0.99),
+        hist_quantile(&total.hist, 0.999), (double)total.hist.max / 1000.0);
+    if(cfg.csv)
+        write_csv(secs, &total.hist, &total);
+
+    for(i=0; i<cfg.conns; i++){
+        close(conns[i].s);
+        free(conns[i].out);
+        free(conns[i].in);
+    }
+    for(i=0; i<cfg.threads; i++)
+        free(workers[i].conns);
+    free(conns);
+    free(value);
+
+    return total.errors ? 2 : 0;
+}
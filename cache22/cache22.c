@@ -1,25 +1,73 @@
 #include "cache22.h"
 
-bool scontinuation;
-bool ccontinuation;
-int32 handle_hello(Client *, int8 * , int8 *);
+atomic_bool scontinuation;
+int stopfd;//Written once on SIGINT/SIGTERM; readable from then on in every reactor's epoll
+_Thread_local int epfd;//THe epoll instance of this I/O thread; a client never leaves its thread
+int32 handle_hello(Client *, RespCmd *);
+int32 handle_get(Client *, RespCmd *);
+int32 handle_set(Client *, RespCmd *);
+int32 handle_del(Client *, RespCmd *);
+int32 handle_exists(Client *, RespCmd *);
+int32 handle_mkdir(Client *, RespCmd *);
+int32 handle_ls(Client *, RespCmd *);
+int32 handle_getrange(Client *, RespCmd *);
+int32 handle_setrange(Client *, RespCmd *);
+int32 handle_save(Client *, RespCmd *);
+int32 handle_bgsave(Client *, RespCmd *);
+int32 handle_lastsave(Client *, RespCmd *);
+int32 handle_expire(Client *, RespCmd *);
+int32 handle_ttl(Client *, RespCmd *);
+int32 handle_dirttl(Client *, RespCmd *);
+int32 handle_info(Client *, RespCmd *);
+int32 handle_mget(Client *, RespCmd *);
+int32 handle_mset(Client *, RespCmd *);
+int32 handle_mdel(Client *, RespCmd *);
+int32 handle_rmdir(Client *, RespCmd *);
+int32 handle_unlink(Client *, RespCmd *);
+int32 handle_scan(Client *, RespCmd *);
+int32 handle_find(Client *, RespCmd *);
+int32 handle_count(Client *, RespCmd *);
 
+/*Every command is "CMD folder args". folder is the directory the command
+works on (absolute, or relative to /), and args is the key, or for SET the
+key followed by the value. The arguments come either framed
+(*3\r\n$3\r\nGET\r\n...) or as one inline line, see ../tree/resp.h.*/
 CmdHandler handlers[] = {
-    {(int8 *)"hello",handle_hello}
+    {(int8 *)"hello",handle_hello},
+    {(int8 *)"GET",handle_get},
+    {(int8 *)"SET",handle_set},
+    {(int8 *)"DEL",handle_del},
+    {(int8 *)"EXISTS",handle_exists},
+    {(int8 *)"MKDIR",handle_mkdir},
+    {(int8 *)"LS",handle_ls},
+    {(int8 *)"GETRANGE",handle_getrange},
+    {(int8 *)"SETRANGE",handle_setrange},
+    {(int8 *)"SAVE",handle_save},
+    {(int8 *)"BGSAVE",handle_bgsave},
+    {(int8 *)"LASTSAVE",handle_lastsave},
+    {(int8 *)"EXPIRE",handle_expire},
+    {(int8 *)"TTL",handle_ttl},
+    {(int8 *)"DIRTTL",handle_dirttl},
+    {(int8 *)"INFO",handle_info},
+    {(int8 *)"MGET",handle_mget},
+    {(int8 *)"MSET",handle_mset},
+    {(int8 *)"MDEL",handle_mdel},
+    {(int8 *)"RMDIR",handle_rmdir},
+    {(int8 *)"UNLINK",handle_unlink},
+    {(int8 *)"SCAN",handle_scan},
+    {(int8 *)"FIND",handle_find},
+    {(int8 *)"COUNT",handle_count}
 };
 
 Callback getcmd(int8 *cmd){
     Callback cb;
     int16 n,arrlen;
 
-    if(sizeof(handlers)<16){
-        return 0;
-    }
-    arrlen = (sizeof(handlers)/16);
+    arrlen = (int16)(sizeof(handlers)/sizeof(handlers[0]));
 
     cb = 0;
     for(n=0; n<arrlen; n++){
-        if(!strcmp((char *)cmd, (char *)handlers[n].cmd)){
+        if(!strcasecmp((char *)cmd, (char *)handlers[n].cmd)){
             cb = handlers[n].handler;
             break;
 
@@ -29,8 +77,741 @@ Callback getcmd(int8 *cmd){
     return cb;
 }
 
-int32 handle_hello(Client *cli, int8 *folder, int8 *args){
-    dprintf(cli->s, "hello, '%s'\n",folder );
+/*Replies come back in the framing the request used: numbered status
+lines for inline requests, RESP types (+, -, :, $, *) for framed ones.*/
+void reply_ok(Client *cli){
+    if(cli->framed)
+        cwrite(cli, "+OK\r\n", 5);
+    else
+        cwrite(cli, "200 OK\n", 7);
+}
+
+void reply_int(Client *cli, long long n){
+    if(cli->framed)
+        cprintf(cli, ":%lld\r\n", n);
+    else
+        cprintf(cli, "200 %lld\n", n);
+}
+
+//Values are written by length, so they may hold anything
+int reply_value(Client *cli, const char *buf, unsigned long len){
+    char head[RESP_MAX_HEADER];
+
+    if(cli->framed){
+        if(cwrite(cli, head, resp_header(head, '$', (long long)len)) < 0
+            || cwrite(cli, buf, (int32)len) < 0)
+            return -1;
+        return cwrite(cli, "\r\n", 2);
+    }
+
+    if(cwrite(cli, "200 ", 4) < 0 || cwrite(cli, buf, (int32)len) < 0)
+        return -1;
+    return cwrite(cli, "\n", 1);
+}
+
+void reply_error(Client *cli, int code, const char *fmt, ...){
+    char msg[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    if(cli->framed)
+        cprintf(cli, "-%d %s\r\n", code, msg);
+    else
+        cprintf(cli, "%d %s\n", code, msg);
+}
+
+/*Argument i as a C string: the tree keeps directory names and keys NUL
+terminated, so only values may contain NUL bytes.*/
+char *textarg(RespCmd *cmd, uint32_t i){
+    if(i >= cmd->argc || !cmd->argl[i] || strlen(cmd->argv[i]) != cmd->argl[i])
+        return NULL;
+    return cmd->argv[i];
+}
+
+int32 handle_hello(Client *cli, RespCmd *cmd){
+    char *folder;
+
+    folder = (cmd->argc > 1) ? cmd->argv[1] : "";
+    if(cli->framed)
+        cprintf(cli, "+hello, '%s'\r\n", folder);
+    else
+        cprintf(cli, "hello, '%s'\n",folder );
+    return 0;
+}
+
+/*Turn a failed store call into a status line*/
+void senderror(Client *cli){
+    switch(errno){
+        case ENOENT:
+            reply_error(cli, 404, "No such directory");
+            break;
+        case EEXIST:
+            reply_error(cli, 409, "Already exists");
+            break;
+        case EBUSY:
+            reply_error(cli, 409, "A save is already running");
+            break;
+        case ENOTEMPTY:
+            reply_error(cli, 409, "Directory not empty");
+            break;
+        case ENOMEM:
+            reply_error(cli, 507, "Out of memory");
+            break;
+        case EINVAL:
+        case ENAMETOOLONG:
+        case E2BIG:
+            reply_error(cli, 400, "%s", strerror(errno));
+            break;
+        default:
+            reply_error(cli, 500, "%s", strerror(errno));
+    }
+}
+
+//Store callbacks run under the directory lock and write straight into the output queue
+int emitvalue(void *ctx, const char *buf, unsigned long len){
+    return reply_value((Client *)ctx, buf, len);
+}
+
+int emitentry(void *ctx, char type, const char *name, unsigned long size){
+    Client *cli = (Client *)ctx;
+
+    if(!cli->framed){
+        if(type == 'n')
+            return cprintf(cli, "200 %lu\n", size);
+        if(type == 'd')
+            return cprintf(cli, "d %s\n", name);
+        return cprintf(cli, "f %s %lu\n", name, size);
+    }
+
+    //Framed: an array of [d, name] and [f, key, size] entries
+    if(type == 'n')
+        return cprintf(cli, "*%lu\r\n", size);
+    if(type == 'd')
+        return cprintf(cli, "*2\r\n$1\r\nd\r\n$%zu\r\n%s\r\n", strlen(name), name);
+    return cprintf(cli, "*3\r\n$1\r\nf\r\n$%zu\r\n%s\r\n:%lu\r\n", strlen(name), name, size);
+}
+
+int32 handle_get(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 3){
+        reply_error(cli, 400, "Usage: GET <folder> <key>");
+        return 1;
+    }
+
+    ret = store_get(folder, key, emitvalue, cli);
+    if(!ret){
+        if(cli->framed)
+            cwrite(cli, "$-1\r\n", 5);
+        else
+            cprintf(cli, "404 Not found\n");
+    }
+    else if(ret < 0)
+        senderror(cli);
+
+    return 0;
+}
+
+//A whole argument as a decimal number
+bool numarg(RespCmd *cmd, uint32_t i, long long *out){
+    char *end;
+
+    if(i >= cmd->argc || !cmd->argl[i])
+        return false;
+    errno = 0;
+    *out = strtoll(cmd->argv[i], &end, 10);
+    return !errno && end == cmd->argv[i] + cmd->argl[i];
+}
+
+/*SET folder key value [EX seconds | PX ms]. An inline value runs to the
+end of the line, so only framed requests can carry a lifetime.*/
+int32 handle_set(Client *cli, RespCmd *cmd){
+    char *folder, *key, *value;
+    long long ttl;
+    size_t len;
+    int ret;
+
+    ttl = 0;
+    if(cli->framed && cmd->argc == 6){
+        if(!numarg(cmd, 5, &ttl) || ttl <= 0 || ttl > 1000000000000LL
+            || (strcasecmp(cmd->argv[4], "EX") && strcasecmp(cmd->argv[4], "PX"))){
+            reply_error(cli, 400, "Usage: SET <folder> <key> <value> [EX <seconds> | PX <ms>]");
+            return 1;
+        }
+        if(!strcasecmp(cmd->argv[4], "EX"))
+            ttl *= 1000;
+        cmd->argc = 4;
+    }
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    value = resp_rest(cmd, 3, &len);
+    if(!folder || !key || !value || cmd->argc != 4){
+        reply_error(cli, 400, "Usage: SET <folder> <key> <value> [EX <seconds> | PX <ms>]");
+        return 1;
+    }
+
+    //A streamed value is handed to the store as is, without another copy
+    if(value == cli->bulk){
+        cli->bulk = NULL;
+        ret = store_adopt(folder, key, value, len, cli->bulklen);
+        if(!ret && ttl)
+            ret = (store_pexpireat(folder, key, expire_now() + (unsigned long long)ttl) < 0) ? -1 : 0;
+    }
+    else
+        ret = store_setex(folder, key, value, len, (unsigned long long)ttl);
+
+    if(ret)
+        senderror(cli);
+    else
+        reply_ok(cli);
+
+    return 0;
+}
+
+/*GETRANGE folder key start end: bytes start..end, both included; negative
+positions count back from the end of the value*/
+int32 handle_getrange(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    long long start, end;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 5 || !numarg(cmd, 3, &start) || !numarg(cmd, 4, &end)){
+        reply_error(cli, 400, "Usage: GETRANGE <folder> <key> <start> <end>");
+        return 1;
+    }
+
+    ret = store_getrange(folder, key, start, end, emitvalue, cli);
+    if(!ret){
+        if(cli->framed)
+            cwrite(cli, "$-1\r\n", 5);
+        else
+            cprintf(cli, "404 Not found\n");
+    }
+    else if(ret < 0)
+        senderror(cli);
+
+    return 0;
+}
+
+/*SETRANGE folder key offset value: replies with the new length*/
+int32 handle_setrange(Client *cli, RespCmd *cmd){
+    char *folder, *key, *value;
+    long long offset, ret;
+    size_t len;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || !numarg(cmd, 3, &offset) || offset < 0
+        || !(value = resp_rest(cmd, 4, &len)) || cmd->argc != 5){
+        reply_error(cli, 400, "Usage: SETRANGE <folder> <key> <offset> <value>");
+        return 1;
+    }
+
+    ret = store_setrange(folder, key, (unsigned long)offset, value, len);
+    if(ret < 0)
+        senderror(cli);
+    else
+        reply_int(cli, ret);
+
+    return 0;
+}
+
+int32 handle_del(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 3){
+        reply_error(cli, 400, "Usage: DEL <folder> <key>");
+        return 1;
+    }
+
+    ret = store_del(folder, key);
+    if(ret < 0)
+        senderror(cli);
+    else
+        reply_int(cli, ret);
+
+    return 0;
+}
+
+/*UNLINK folder key: DEL that leaves freeing a large value to the reclaim
+thread, so the reply does not wait for it*/
+int32 handle_unlink(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 3){
+        reply_error(cli, 400, "Usage: UNLINK <folder> <key>");
+        return 1;
+    }
+
+    ret = store_unlink(folder, key);
+    if(ret < 0)
+        senderror(cli);
+    else
+        reply_int(cli, ret);
+
+    return 0;
+}
+
+int32 handle_exists(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 3){
+        reply_error(cli, 400, "Usage: EXISTS <folder> <key>");
+        return 1;
+    }
+
+    ret = store_exists(folder, key);
+    if(ret < 0)
+        senderror(cli);
+    else
+        reply_int(cli, ret);
+
+    return 0;
+}
+
+int32 handle_mkdir(Client *cli, RespCmd *cmd){
+    char *folder;
+
+    folder = textarg(cmd, 1);
+    if(!folder || cmd->argc != 2){
+        reply_error(cli, 400, "Usage: MKDIR <folder>");
+        return 1;
+    }
+
+    if(store_mkdir(folder))
+        senderror(cli);
+    else
+        reply_ok(cli);
+
+    return 0;
+}
+
+/*A SCAN page: the cursor, then the keys as LS lists them. Inline, the
+status line reads "200 <cursor> <count>".*/
+int emitscan(void *ctx, char type, const char *name, unsigned long size){
+    Client *cli = (Client *)ctx;
+
+    if(type == 'c'){
+        //A sorted scan resumes after a key, marked with '>'
+        if(cli->framed)
+            return name ? cprintf(cli, "*2\r\n$%zu\r\n>%s\r\n", strlen(name) + 1, name)
+                : cprintf(cli, "*2\r\n$%d\r\n%lu\r\n", snprintf(NULL, 0, "%lu", size), size);
+        return name ? cprintf(cli, "200 >%s", name) : cprintf(cli, "200 %lu", size);
+    }
+    if(type == 'n' && !cli->framed)
+        return cprintf(cli, " %lu\n", size);
+
+    return emitentry(ctx, type, name, size);
+}
+
+/*SCAN folder cursor [MATCH pattern] [COUNT n] [PREFIX prefix]: one page
+of keys and the cursor to pass next, 0 once the scan is done. Start with
+cursor 0. With PREFIX the page is sorted and the cursor is ">" and the
+last key looked at; the first pages of a big directory may come back
+empty with the same cursor while its key order is built.*/
+int32 handle_scan(Client *cli, RespCmd *cmd){
+    char *folder, *cursor, *opt, *match, *prefix;
+    long long count, number;
+    uint32_t i;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    cursor = textarg(cmd, 2);
+    match = prefix = NULL;
+    count = STORE_SCAN;
+    for(i = 3; i + 1 < cmd->argc && (opt = textarg(cmd, i)); i += 2){
+        if(!strcasecmp(opt, "MATCH"))
+            match = textarg(cmd, i + 1);
+        else if(!strcasecmp(opt, "PREFIX"))
+            prefix = textarg(cmd, i + 1);
+        else if(strcasecmp(opt, "COUNT") || !numarg(cmd, i + 1, &count) || count < 1 || count > STORE_SCAN_MAX)
+            break;
+    }
+    if(!folder || !cursor || cmd->argc < 3 || i != cmd->argc
+        || (prefix ? strcmp(cursor, "0") && cursor[0] != '>' : !numarg(cmd, 2, &number) || number < 0)){
+        reply_error(cli, 400, "Usage: SCAN <folder> <cursor> [MATCH <pattern>] [COUNT <n>] [PREFIX <prefix>]");
+        return 1;
+    }
+
+    if(prefix)
+        ret = store_scanprefix(folder, prefix, (cursor[0] == '>') ? cursor + 1 : NULL, match,
+            (unsigned long)count, emitscan, cli);
+    else
+        ret = store_scan(folder, (unsigned long)number, match, (unsigned long)count, emitscan, cli);
+    if(ret)
+        senderror(cli);
+
+    return 0;
+}
+
+/*RMDIR [-r] folder: without -r the directory must be empty; with it,
+everything below goes too. Either way the reply comes once the directory
+is unlinked, before its contents are freed.*/
+int32 handle_rmdir(Client *cli, RespCmd *cmd){
+    char *folder, *flag;
+    bool recursive;
+
+    flag = textarg(cmd, 1);
+    recursive = cmd->argc == 3 && flag && !strcmp(flag, "-r");
+    folder = textarg(cmd, recursive ? 2 : 1);
+    if(!folder || cmd->argc != (recursive ? 3 : 2)){
+        reply_error(cli, 400, "Usage: RMDIR [-r] <folder>");
+        return 1;
+    }
+
+    if(store_rmdir(folder, recursive))
+        senderror(cli);
+    else
+        reply_ok(cli);
+
+    return 0;
+}
+
+/*FIND folder pattern [cursor]: every directory and key below folder whose
+name matches the glob, as full paths, a page at a time: answered like SCAN
+with the cursor to pass next (0 once done), then the page like LS in no
+particular order. Start with cursor 0 or none. A page is up to STORE_FIND
+directories, walked on the pool, a directory per task.*/
+int32 handle_find(Client *cli, RespCmd *cmd){
+    char *folder, *match, *cursor;
+
+    folder = textarg(cmd, 1);
+    match = textarg(cmd, 2);
+    cursor = (cmd->argc == 4) ? textarg(cmd, 3) : "0";
+    if(!folder || !match || !cursor || cmd->argc < 3 || cmd->argc > 4
+        || (strcmp(cursor, "0") && cursor[0] != '>')){
+        reply_error(cli, 400, "Usage: FIND <folder> <pattern> [<cursor>]");
+        return 1;
+    }
+
+    if(store_find(folder, match, (cursor[0] == '>') ? cursor + 1 : NULL, emitscan, cli))
+        senderror(cli);
+
+    return 0;
+}
+
+/*COUNT [-r] folder: how many keys the folder holds, and with -r how many
+its whole subtree does, counted on the pool*/
+int32 handle_count(Client *cli, RespCmd *cmd){
+    char *folder, *flag;
+    bool recursive;
+    long long n;
+
+    flag = textarg(cmd, 1);
+    recursive = cmd->argc == 3 && flag && !strcmp(flag, "-r");
+    folder = textarg(cmd, recursive ? 2 : 1);
+    if(!folder || cmd->argc != (recursive ? 3 : 2)){
+        reply_error(cli, 400, "Usage: COUNT [-r] <folder>");
+        return 1;
+    }
+
+    n = store_count(folder, recursive);
+    if(n < 0)
+        senderror(cli);
+    else
+        reply_int(cli, n);
+
+    return 0;
+}
+
+/*Inline: "200 <count>" followed by one "d <name>" or "f <key> <size>" line each*/
+int32 handle_ls(Client *cli, RespCmd *cmd){
+    char *folder;
+
+    folder = (cmd->argc > 1) ? textarg(cmd, 1) : "/";
+    if(!folder || cmd->argc > 2){
+        reply_error(cli, 400, "Usage: LS [folder]");
+        return 1;
+    }
+
+    if(store_ls(folder, emitentry, cli))
+        senderror(cli);
+
+    return 0;
+}
+
+//A save's figures as one line of name=value pairs
+int32 savestats(char *buf, size_t size, SaveStats *st){
+    return (int32)snprintf(buf, size,
+        "%s dirs=%llu keys=%llu bytes=%llu ms=%.1f fork_ms=%.2f cow_kb=%llu finished=%lld",
+        st->ok ? "ok" : "failed", st->dump.dirs, st->dump.keys, st->dump.bytes,
+        st->ms, st->forkms, st->cowkb, st->finished);
+}
+
+/*Blocks every client until the snapshot is on disk, and answers with its figures*/
+int32 handle_save(Client *cli, RespCmd *cmd){
+    char line[256];
+    SaveStats st;
+
+    if(cmd->argc != 1){
+        reply_error(cli, 400, "Usage: SAVE");
+        return 1;
+    }
+
+    if(save_now(&st))
+        senderror(cli);
+    else
+        reply_value(cli, line, savestats(line, sizeof(line), &st));
+
+    return 0;
+}
+
+/*Replies once the child is forked; LASTSAVE tells when it is done*/
+int32 handle_bgsave(Client *cli, RespCmd *cmd){
+    if(cmd->argc != 1){
+        reply_error(cli, 400, "Usage: BGSAVE");
+        return 1;
+    }
+
+    if(save_background())
+        senderror(cli);
+    else
+        reply_ok(cli);
+
+    return 0;
+}
+
+int32 handle_lastsave(Client *cli, RespCmd *cmd){
+    char line[256];
+    SaveStats st;
+
+    if(cmd->argc != 1){
+        reply_error(cli, 400, "Usage: LASTSAVE");
+        return 1;
+    }
+
+    if(save_last(&st))
+        reply_value(cli, "running", 7);
+    else if(!st.finished)
+        reply_error(cli, 404, "No save yet");
+    else
+        reply_value(cli, line, savestats(line, sizeof(line), &st));
+
+    return 0;
+}
+
+/*EXPIRE folder key seconds: 1 if the key now has a deadline, 0 if there is
+no such key. A lifetime of 0 or less deletes it.*/
+int32 handle_expire(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    long long secs;
+    unsigned long long when;
+    int ret;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 4 || !numarg(cmd, 3, &secs) || secs > 1000000000LL){
+        reply_error(cli, 400, "Usage: EXPIRE <folder> <key> <seconds>");
+        return 1;
+    }
+
+    when = (secs > 0) ? expire_now() + (unsigned long long)secs * 1000 : 1;
+    ret = store_pexpireat(folder, key, when);
+    if(ret < 0)
+        senderror(cli);
+    else
+        reply_int(cli, ret);
+
+    return 0;
+}
+
+/*TTL folder key: seconds left, rounded up; -1 for a key that never
+expires and -2 for one that does not exist*/
+int32 handle_ttl(Client *cli, RespCmd *cmd){
+    char *folder, *key;
+    long long ms;
+
+    folder = textarg(cmd, 1);
+    key = textarg(cmd, 2);
+    if(!folder || !key || cmd->argc != 3){
+        reply_error(cli, 400, "Usage: TTL <folder> <key>");
+        return 1;
+    }
+
+    ms = store_pttl(folder, key);
+    if(ms == -3)
+        senderror(cli);
+    else
+        reply_int(cli, (ms < 0) ? ms : (ms + 999) / 1000);
+
+    return 0;
+}
+
+/*DIRTTL folder [seconds]: the lifetime new keys in folder get, 0 for
+none. Without seconds it replies with the current one.*/
+int32 handle_dirttl(Client *cli, RespCmd *cmd){
+    char *folder;
+    long long secs;
+
+    folder = textarg(cmd, 1);
+    if(!folder || cmd->argc < 2 || cmd->argc > 3
+        || (cmd->argc == 3 && (!numarg(cmd, 2, &secs) || secs < 0 || secs > 1000000000LL))){
+        reply_error(cli, 400, "Usage: DIRTTL <folder> [seconds]");
+        return 1;
+    }
+
+    if(cmd->argc == 2){
+        secs = store_getdirttl(folder);
+        if(secs < 0)
+            senderror(cli);
+        else
+            reply_int(cli, (secs + 999) / 1000);
+    }
+    else if(store_dirttl(folder, (unsigned long long)secs * 1000))
+        senderror(cli);
+    else
+        reply_ok(cli);
+
+    return 0;
+}
+
+/*Memory use, the eviction policy and its effect as one line of name=value
+pairs; hit_ratio covers every GET and GETRANGE since startup*/
+int32 handle_info(Client *cli, RespCmd *cmd){
+    char line[512];
+    EvictStats st;
+    unsigned long long lookups;
+
+    if(cmd->argc != 1){
+        reply_error(cli, 400, "Usage: INFO");
+        return 1;
+    }
+
+    evict_stats(&st);
+    lookups = st.hits + st.misses;
+    reply_value(cli, line, (unsigned long)snprintf(line, sizeof(line),
+        "used_memory=%llu maxmemory=%llu policy=%s hits=%llu misses=%llu hit_ratio=%.4f"
+        " evicted=%llu evicted_per_sec=%llu expiring=%llu freeing=%llu walkers=%u",
+        st.used, st.max, st.policy, st.hits, st.misses,
+        lookups ? (double)st.hits / lookups : 0.0, st.evicted, st.persec, expire_pending(),
+        reclaim_pending(), pool_threads()));
+
+    return 0;
+}
+
+/*A full path /dir/.../key split in place into its directory and its key*/
+bool splitpath(char *path, char **dir, char **key){
+    char *slash;
+
+    slash = strrchr(path, '/');
+    if(!slash || !slash[1])
+        return false;
+    *key = slash + 1;
+    if(slash == path)
+        *dir = "/";
+    else{
+        *slash = 0;
+        *dir = path;
+    }
+
+    return true;
+}
+
+//Every argument from the first on as a full path; false if one is not
+bool splitpaths(RespCmd *cmd, uint32_t first, uint32_t step, const char **dirs, const char **keys){
+    char *path, *dir, *key;
+    uint32_t i;
+
+    for(i = first; i < cmd->argc; i += step){
+        if(!(path = textarg(cmd, i)) || !splitpath(path, &dir, &key))
+            return false;
+        dirs[(i - first) / step] = dir;
+        keys[(i - first) / step] = key;
+    }
+
+    return true;
+}
+
+//One value of an MGET reply; a missing key is a nil
+int emititem(void *ctx, const char *buf, unsigned long len){
+    Client *cli = (Client *)ctx;
+
+    if(buf)
+        return reply_value(cli, buf, len);
+    if(cli->framed)
+        return cwrite(cli, "$-1\r\n", 5);
+    return cprintf(cli, "404 Not found\n");
+}
+
+/*MGET path [path ...], each path /dir/.../key, possibly across
+directories. The whole batch is one reply: framed, an array holding a nil
+for every missing key; inline, "200 <count>" and then one GET reply line
+per key.*/
+int32 handle_mget(Client *cli, RespCmd *cmd){
+    const char *dirs[RESP_MAX_ARGS], *keys[RESP_MAX_ARGS];
+
+    if(cmd->argc < 2 || !splitpaths(cmd, 1, 1, dirs, keys)){
+        reply_error(cli, 400, "Usage: MGET <path> [path ...]");
+        return 1;
+    }
+
+    if(cli->framed)
+        cprintf(cli, "*%u\r\n", cmd->argc - 1);
+    else
+        cprintf(cli, "200 %u\n", cmd->argc - 1);
+    store_mget(cmd->argc - 1, dirs, keys, emititem, cli);
+
+    return 0;
+}
+
+/*MSET path value [path value ...]. Inline values are single words here,
+since every pair needs its own.*/
+int32 handle_mset(Client *cli, RespCmd *cmd){
+    const char *dirs[RESP_MAX_ARGS / 2], *keys[RESP_MAX_ARGS / 2], *values[RESP_MAX_ARGS / 2];
+    unsigned long lens[RESP_MAX_ARGS / 2];
+    uint32_t i;
+
+    if(cmd->argc < 3 || !(cmd->argc & 1) || !splitpaths(cmd, 1, 2, dirs, keys)){
+        reply_error(cli, 400, "Usage: MSET <path> <value> [path value ...]");
+        return 1;
+    }
+    for(i=2; i<cmd->argc; i+=2){
+        values[i / 2 - 1] = cmd->argv[i];
+        lens[i / 2 - 1] = cmd->argl[i];
+    }
+
+    if(store_mset(cmd->argc / 2, dirs, keys, values, lens))
+        senderror(cli);
+    else
+        reply_ok(cli);
+
+    return 0;
+}
+
+//MDEL path [path ...]: replies with how many of the keys were there
+int32 handle_mdel(Client *cli, RespCmd *cmd){
+    const char *dirs[RESP_MAX_ARGS], *keys[RESP_MAX_ARGS];
+    long ret;
+
+    if(cmd->argc < 2 || !splitpaths(cmd, 1, 1, dirs, keys)){
+        reply_error(cli, 400, "Usage: MDEL <path> [path ...]");
+        return 1;
+    }
+
+    ret = store_mdel(cmd->argc - 1, dirs, keys);
+    if(ret < 0)
+        senderror(cli);
+    else
+        reply_int(cli, ret);
+
     return 0;
 }
 
@@ -46,160 +827,486 @@ void zero(int8* buf, int16 size){
     return;
 }
 
+/*Make sure buf can hold `need` bytes. The buffers start at RBUFSIZE and
+double, so a connection only pays for what it actually has in flight.*/
+int grow(int8 **buf, size_t *cap, size_t need){
+    int8 *p;
+    size_t size;
+
+    if(need <= *cap)
+        return 0;
+
+    for(size = *cap ? *cap : RBUFSIZE; size < need; size *= 2);
+    p = (int8 *)realloc(*buf, size);
+    if(!p)
+        return -1;
+
+    *buf = p;
+    *cap = size;
+    return 0;
+}
+
+/*Room for `len` more bytes at the end of the output queue. A new chunk is
+started when the last one cannot take them all; the caller must then fill
+exactly `len` bytes and add them to the chunk's len and to wlen.*/
+int8 *wreserve(Client *cli, int32 len){
+    Chunk *c;
+    int32 cap;
+
+    c = cli->wtail;
+    if(c && c->cap - c->len >= len)
+        return c->data + c->len;
+
+    cap = (len > WCHUNK) ? len : WCHUNK;
+    c = (Chunk *)malloc(sizeof(Chunk) + cap);
+    if(!c){
+        cli->closing = true;
+        return NULL;
+    }
+    c->next = NULL;
+    c->off = c->len = 0;
+    c->cap = cap;
+
+    if(cli->wtail)
+        cli->wtail->next = c;
+    else
+        cli->whead = c;
+    cli->wtail = c;
+
+    return c->data;
+}
+
+/*Append raw bytes to the client's output queue*/
+int cwrite(Client *cli, const void *buf, int32 len){
+    int8 *p;
+
+    p = wreserve(cli, len);
+    if(!p)
+        return -1;
+
+    memcpy(p, buf, len);
+    cli->wtail->len += len;
+    cli->wlen += len;
+
+    return (int)len;
+}
+
+/*Append a formatted response to the client's output queue. Nothing touches
+the socket here; flushclient() sends it once the whole read batch is done.*/
+int cprintf(Client *cli, const char *fmt, ...){
+    va_list ap;
+    int8 *p;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if(n < 0)
+        return -1;
+
+    p = wreserve(cli, n + 1);
+    if(!p)
+        return -1;
+
+    va_start(ap, fmt);
+    vsnprintf((char *)p, n + 1, fmt, ap);
+    va_end(ap);
+    cli->wtail->len += n;
+    cli->wlen += (size_t)n;
+
+    return n;
+}
+
+void freeclient(Client *cli){
+    epoll_ctl(epfd, EPOLL_CTL_DEL, cli->s, NULL);
+    close(cli->s);
+    free(cli->rbuf);
+    if(cli->bulk)
+        store_free(cli->bulk, cli->bulklen);
+    while(cli->whead){
+        cli->wtail = cli->whead->next;
+        free(cli->whead);
+        cli->whead = cli->wtail;
+    }
+    free(cli);
+}
+
+/*Write as much of the output queue as the socket takes, up to MAXIOV
+chunks per writev. Returns 1 if bytes are still pending (we then ask epoll
+for EPOLLOUT), 0 when empty and -1 on error. A held client is watched for
+EPOLLOUT only, even once its queue is empty, so its requests stay in the
+socket until the next turn lets it go.*/
+int flushclient(Client *cli){
+    struct iovec iov[MAXIOV];
+    struct epoll_event ev;
+    uint32_t events;
+    Chunk *c;
+    ssize_t n;
+    int i;
+
+    while(cli->wlen){
+        for(i=0, c=cli->whead; c && i<MAXIOV; c=c->next, i++){
+            iov[i].iov_base = c->data + c->off;
+            iov[i].iov_len = c->len - c->off;
+        }
+
+        n = writev(cli->s, iov, i);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        if(!n)
+            break;
+        cli->wlen -= (size_t)n;
+
+        //Drop the chunks that went out; the last one is kept for reuse
+        while(n > 0){
+            c = cli->whead;
+            if(n < (ssize_t)(c->len - c->off)){
+                c->off += (int32)n;
+                break;
+            }
+            n -= c->len - c->off;
+            if(c == cli->wtail){
+                c->off = c->len = 0;
+                break;
+            }
+            cli->whead = c->next;
+            free(c);
+        }
+    }
+
+    //Only touch the registration when the state actually changes
+    events = cli->held ? EPOLLOUT : (EPOLLIN | (cli->wlen ? EPOLLOUT : 0));
+    if(cli->events != events){
+        cli->events = events;
+        ev.events = events;
+        ev.data.ptr = cli;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, cli->s, &ev);
+    }
+
+    return cli->wlen ? 1 : 0;
+}
+
+/*Dispatch one parsed request*/
+void execute(Client *cli, RespCmd *cmd){
+    Callback cb;
+
+    cli->framed = cmd->framed;
+    if(!cmd->argc)
+        return;
+
+    cb = getcmd((int8 *)cmd->argv[0]);
+    if(!cb){
+        reply_error(cli, 500, "Unknown command '%s'", cmd->argv[0]);
+        return;
+    }
+
+    cb(cli, cmd);
+    return;
+}
+
+/*Once the header of a big framed value is in, stop growing rbuf: the
+payload bytes already received move to a buffer of the value's final size
+and readclient() reads the rest straight into it.*/
+void startbulk(Client *cli, RespCmd *cmd){
+    RespBulk b;
+    unsigned long have;
+
+    if(!resp_pending((char *)cli->rbuf, cli->rlen, cmd, &b) || b.len < STREAMMIN)
+        return;
+
+    cli->bulklen = b.len + 2;
+    cli->bulk = store_alloc(cli->bulklen);
+    if(!cli->bulk){
+        cli->framed = true;
+        reply_error(cli, 500, "%s", strerror(ENOMEM));
+        cli->closing = true;
+        return;
+    }
+
+    have = cli->rlen - b.offset;
+    memcpy(cli->bulk, cli->rbuf + b.offset, have);
+    cli->bulkgot = have;
+    cli->bulkoff = b.offset;
+    cli->rlen = b.offset;
+}
+
+/*The streamed payload is complete: run its request and drop the header*/
+void finishbulk(Client *cli, RespCmd *cmd){
+    RespBulk b;
+    unsigned long len;
+
+    cli->framed = true;
+    len = cli->bulklen - 2;
+    if(cli->bulk[len] != '\r' || cli->bulk[len + 1] != '\n'
+        || !resp_pending((char *)cli->rbuf, cli->bulkoff, cmd, &b)){
+        reply_error(cli, 500, "Protocol error: %s", strerror(EPROTO));
+        cli->closing = true;
+        return;
+    }
+
+    resp_attach(cmd, cli->bulk, len);
+    execute(cli, cmd);
+
+    //Unless SET kept the buffer, the value only lived for this one request
+    if(cli->bulk)
+        store_free(cli->bulk, cli->bulklen);
+    cli->bulk = NULL;
+
+    cli->rlen -= cli->bulkoff;
+    memmove(cli->rbuf, cli->rbuf + cli->bulkoff, cli->rlen);
+}
+
+/*This used to be the body of the forked child: one read, one command.
+Now it runs every complete request that is sitting in the client's read
+buffer, so a client that sends several commands at once gets all of them
+answered. The arguments are parsed in place, nothing is copied out.*/
 void childloop(Client *cli){
-    int8 buf[256];//creation of a buffer of 256 bytes
-    int8 *p , *f;//p is the pointer in the buffer, f is for the folder.
-    int16 n;//This is count of buffer size
-    int8 cmd[256], folder[256], args[256];
-
-
-    zero(buf,256);
-    //To read from a file descriptor, we use the read function call.
-    read(cli->s, (char *)buf, 255);
-    n = (int16)strlen((char *)buf);
-    if(n>254){
-        n = 254;
-    }
-
-    for(p = buf;
-        (*p)//This returns 1 if p points to something and 0 if p points to null.
-            && (n--)//If the number is +ve, the n-- will be true for the && operator.
-            && (*p != ' ')
-            && (*p != '\n')
-            && (*p != '\r');
-        p++     
-        );//This doesn't even need a body. It just brings the p pointer to a certain place.
-    /*Once the above loop is done, there are cases:
-    1. If p =0, it means that the command has filled out the whole buffer.*/
-    zero(cmd,256);zero(folder,256);zero(args,256);
-
-    if(!(*p)|| (!n)){
-        strncpy((char *)cmd, (char *)buf , 255);
-        goto done;
-    }   
-
-    else if((*p == '\n') || (*p =='\r')){
-        *p = 0;
-        strncpy((char*)cmd, (char*)buf, 255);
-        goto done;
-    }
-    else if((*p = ' ')){
-        *p = 0;
-        strncpy((char*)cmd, (char*)buf, 255);
-    }
-    
-    for(p++, f = p;
-        (*p)
-            && (n--)
-            && (*p != ' ')
-            && (*p != '\n')
-            && (*p != '\r');
-        p++     
-        );
-
-    if(!(*p)|| (!n)){
-        strncpy((char *)folder, (char *)f , 255);
-        goto done;
-    }
-    else if((*p == ' ')|| (*p == '\n') || (*p == '\r')){
-        
-        *p =0;
-        strncpy((char *)folder, (char *)f , 255);
-    }
-
-    p++;
-    if(*p){
-        strncpy((char*)args , (char*)p , 255);
-        for(p = args; (*p) && (*p !='\n') && (*p != '\r'); p++);
-        *p = 0;
-
-    }
-
-    done:
-        dprintf(cli->s, "\ncmd:\t%s\n", cmd);
-        dprintf(cli->s, "folder:\t%s\n", folder);
-        dprintf(cli->s, "args:\t%s\n", args);
-    return; 
+    static _Thread_local RespCmd cmd;
+    int8 *start, *end;
+    size_t left;
+    long used;
+
+    if(cli->bulk){
+        if(cli->bulkgot < cli->bulklen)
+            return;
+        finishbulk(cli, &cmd);
+    }
+
+    start = cli->rbuf;
+    end = cli->rbuf + cli->rlen;
+
+    while(start < end && !cli->closing){
+        used = resp_parse((char *)start, end - start, &cmd);
+        if(used < 0){
+            cli->framed = (*start == '*');
+            reply_error(cli, 500, "Protocol error: %s", strerror(errno));
+            cli->closing = true;
+            break;
+        }
+        if(!used)
+            break;
+
+        execute(cli, &cmd);
+        start += used;
+
+        //A client that does not read its answers gets no more of them
+        if(cli->wlen >= WMAX){
+            cli->held = true;
+            break;
+        }
+    }
+
+    //Keep the unfinished tail for the next read
+    left = (size_t)(end - start);
+    if(left && start != cli->rbuf)
+        memmove(cli->rbuf, start, left);
+    cli->rlen = left;
+
+    if(cli->rlen && *cli->rbuf == '*' && !cli->closing && !cli->held)
+        startbulk(cli, &cmd);
+
+    //A framed request announces its size up front; only inline lines can run away
+    if(cli->rlen >= MAXLINE && *cli->rbuf != '*' && !cli->closing && !cli->held){
+        cli->framed = false;
+        reply_error(cli, 500, "Line too long");
+        cli->closing = true;
+    }
+
+    return;
 }
 
-void mainloop(int s){
+/*Read everything the socket has for us (it is non-blocking, so this stops
+at EAGAIN), running the commands each read completes. Parsing after every
+read is what lets a big value switch to streaming early; the responses
+still go out together once the socket is drained. A held client is let go
+once its queue is back under WMAX, starting with the requests it left in
+rbuf.*/
+void readclient(Client *cli){
+    ssize_t n;
+
+    if(cli->held){
+        if(cli->wlen >= WMAX)
+            return;
+        cli->held = false;
+        childloop(cli);
+    }
+
+    while(!cli->closing && !cli->held){
+        //A value being streamed takes every byte until it is complete
+        if(cli->bulk && cli->bulkgot < cli->bulklen){
+            n = read(cli->s, cli->bulk + cli->bulkgot, cli->bulklen - cli->bulkgot);
+            if(n > 0){
+                cli->bulkgot += (unsigned long)n;
+                if(cli->bulkgot == cli->bulklen)
+                    childloop(cli);
+                continue;
+            }
+        }
+        else{
+            if(grow(&cli->rbuf, &cli->rcap, cli->rlen + RBUFSIZE)){
+                cli->closing = true;
+                break;
+            }
+
+            n = read(cli->s, (char *)cli->rbuf + cli->rlen, cli->rcap - cli->rlen);
+            if(n > 0){
+                cli->rlen += (size_t)n;
+                childloop(cli);
+                continue;
+            }
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        //0 means the peer closed the connection; anything else is an error
+        cli->closing = true;
+        break;
+    }
+
+    return;
+}
+
+int nonblock(int s){
+    int flags;
+
+    flags = fcntl(s, F_GETFL, 0);
+    if(flags < 0)
+        return -1;
+
+    return fcntl(s, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*Accept every pending connection on the listening socket and register it
+with epoll. No fork any more: all clients live in this one process and see
+the same memory.*/
+void acceptclients(int s){
     struct sockaddr_in cli;
     int s2;
     /*Note: Even though s2 is a socket, we are representing it using an int. THis is because
     sockets are treated as file descriptors that are represented as integers.*/
-    int32 len;
+    socklen_t len;
     char *ip;
     int16 port;
     Client *client;
-    pid_t pid;
+    struct epoll_event ev;
 
-    s2 = accept(s, (struct sockaddr *)&cli , (unsigned int *)&len);
-    /*This extracts the first connection request on the queue of pending connections
-    for the listening socket, sockfd, creates a new socket and returns a new file 
-    de-scriptor referring to that socket.*/
-    if(s2<0){
-        return;
-    }
+    while(1){
+        len = sizeof(cli);
+        s2 = accept(s, (struct sockaddr *)&cli , &len);
+        /*This extracts the first connection request on the queue of pending connections
+        for the listening socket, sockfd, creates a new socket and returns a new file
+        de-scriptor referring to that socket.*/
+        if(s2<0){
+            return;
+        }
 
-    port = (int16)htons((int)cli.sin_port);
-    ip = inet_ntoa(cli.sin_addr);
+        port = (int16)ntohs(cli.sin_port);
+        ip = inet_ntoa(cli.sin_addr);
 
-    printf("connection from %s:%d\n", ip , port);
+        printf("connection from %s:%d\n", ip , port);
 
-    client = (Client*)malloc(sizeof(Client));
-    assert(client);
+        client = (Client*)malloc(sizeof(Client));
+        if(!client || nonblock(s2)){
+            free(client);
+            close(s2);
+            continue;
+        }
 
-    zero((int8*)client, sizeof(Client));
-    client->s = s2;
-    client->port = port;
-    strncpy(client->ip, ip, 15);
+        zero((int8*)client, sizeof(Client));
+        client->s = s2;
+        client->port = port;
+        strncpy(client->ip, ip, 15);
+        client->events = EPOLLIN;
 
-    pid = fork();
-    /*The main use of the above function is that we have the above code for mainloop. Now,
-    We want it to work for multiple clients. Thus, we make multiple copies of it. This can
-    be done using fork. This is at the OS level, whereas different class instances happen
-    during run time. Forked processes are completely independent of each other, whereas 
-    instances of a class share the same memory and space and can easily interact.But this
-    is heavy on the system. In multi core, these can run parallely rather than on a single
-    thread like class instances.*/
-    
-    if(pid){
-        //If pid returns 1 it means we are in the parent loop.
-        free(client);
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, s2, &ev)){
+            close(s2);
+            free(client);
+            continue;
+        }
 
-        return;
+        cprintf(client, "100 Connected to Cache22 server\n");
+        if(flushclient(client) < 0)
+            freeclient(client);
     }
-    else{
-        //If pid returns 0, it means we are in the child loop.
-        dprintf(s2,"100 Connected to Cache22 server\n");//check in man3
-        ccontinuation = true;
-        while(ccontinuation)
-            childloop(client);
-        
-        close(s2);
-        free(client);
+}
 
+/*One turn of the reactor: wait for sockets that are ready and serve them.
+The listening socket is registered with a NULL pointer and the stop
+eventfd with &stopfd, so both can be told apart from the clients.*/
+void mainloop(int s){
+    struct epoll_event events[MAXEVENTS];
+    int n, i;
+    Client *cli;
+
+    n = epoll_wait(epfd, events, MAXEVENTS, -1);
+    if(n < 0){
+        if(errno != EINTR)
+            scontinuation = false;
         return;
     }
 
-    return;
+    for(i=0; i<n; i++){
+        cli = (Client *)events[i].data.ptr;
+        if((void *)cli == &stopfd){
+            scontinuation = false;
+            continue;
+        }
+        if(!cli){
+            acceptclients(s);
+            continue;
+        }
+
+        //A held client only hears EPOLLOUT; what it sends waits for its queue to drain
+        if(cli->held && (events[i].events & EPOLLOUT))
+            flushclient(cli);
+        if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) || cli->held)
+            readclient(cli);
+    }
+
+    /*With appendfsync always nothing is answered before it is on disk. All
+    the changes of this turn wait together, and share their fsync with
+    what the other I/O threads logged meanwhile.*/
+    if(aof_sync()){
+        fprintf(stderr, "Cannot make the log durable: %s\n", strerror(errno));
+        exit(1);
+    }
 
+    for(i=0; i<n; i++){
+        cli = (Client *)events[i].data.ptr;
+        if(!cli || (void *)cli == &stopfd)
+            continue;
 
+        if(flushclient(cli) < 0 || (cli->closing && !cli->wlen))
+            freeclient(cli);
+    }
+
+    return;
 }
 
 int initserver(int16 port){
     struct sockaddr_in sock;
     int s;//THis is to hold our file scripter
-    
+    int one;
+    struct epoll_event ev;
+
 
 
     sock.sin_family = AF_INET;
-    /*the above line tells that the socket is used for IPv4 addresses. Also, it determines 
+    /*the above line tells that the socket is used for IPv4 addresses. Also, it determines
     the domain or the scope of the socket. */
 
     sock.sin_port = htons(port);
-    /* The sin_port field stores the port number in network byte order (big-endian). 
-   If the host uses little-endian (common on x86), htons ("Host to Network Short") 
+    /* The sin_port field stores the port number in network byte order (big-endian).
+   If the host uses little-endian (common on x86), htons ("Host to Network Short")
    converts the value to big-endian.
 
    Example: 0xFF05 in host byte order (stored as 05 FF) becomes 0x05FF in network byte order. */
@@ -213,44 +1320,156 @@ int initserver(int16 port){
 
 
     s = socket(AF_INET , SOCK_STREAM , 0);
-    /*THis creates an endpoint for communication. On success, the file descriptor for the 
+    /*THis creates an endpoint for communication. On success, the file descriptor for the
     socket is returned. On error -1 is returned and errno is set to indicate that error.*/
     assert(s>0);
 
+    one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    //Lets the server restart right away instead of waiting out TIME_WAIT
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    /*Every I/O thread binds its own socket to the same port and the kernel
+    spreads new connections across them, so there is no shared accept queue.*/
+
     //Now we must bind the socket to the structure using bind
     errno =0;
     if(bind(s, (struct sockaddr *)&sock , sizeof(sock)) !=0){
-    //This is a little weird. It returns 0 on success. 
+    //This is a little weird. It returns 0 on success.
         assert_perror(errno);
     };/*Bind is used to associate the socket to the specific IP address and port.
     The reason we typecasted sock here is because we specially mentioned sock to be of
     IPV4 address type, whereas bind can take care of any address type. THus it was changed.
     This works because the fields in both are the same.*/
-    
+
 
 
     errno =0;
-    if(listen(s , 20)){//THis is used to check for connections on a socket.
+    if(listen(s , SOMAXCONN)){//THis is used to check for connections on a socket.
         assert_perror(errno);
-    };//This means we can accept 20 connections at a time. 
+    };//The backlog is the queue of connections waiting for accept().
+
+    //The listening socket is non-blocking too, so acceptclients() can drain it
+    assert(!nonblock(s));
+
+    epfd = epoll_create1(0);
+    assert(epfd >= 0);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    assert(!epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev));
+
+    //Level-triggered and never read, so one write wakes every reactor
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stopfd;
+    assert(!epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev));
 
     printf("server listening on %s:%d\n", HOST , port);
 
     return s;
 }
 
-int main(int argc, char *argv[]){
-    char *sport;
+/*Body of every I/O thread: its own listening socket, its own epoll, and
+the one shared store behind the handlers.*/
+void *serverloop(void *arg){
     int16 port;
     int s;
 
-    Callback x;
+    port = *(int16 *)arg;
+    s = initserver(port);
 
-    x = getcmd((int8*)"hello");
-    printf("%p\n");
-    return 0;
+    while(scontinuation){
+        mainloop(s);
+    }
+    close(epfd);
+    close(s);
+
+    return NULL;
+}
+
+/*SIGINT and SIGTERM: stop every reactor after its current turn, so main
+runs the shutdown (last checkpoint, log flush) instead of dying mid-way*/
+void onstop(int sig){
+    uint64_t one;
+    int saved;
+
+    (void)sig;
+    saved = errno;
+    scontinuation = false;
+    one = 1;
+    if(write(stopfd, &one, sizeof(one)) < 0){
+        //Already signalled: the counter is all that could be full
+    }
+    errno = saved;
+}
+
+void usage(char *prog){
+    fprintf(stderr, "usage: %s [-s snapshot | -m image] [-a logfile [-f always|everysec|no] | -c dir [-i seconds]]"
+        " [-M maxmemory[k|m|g] [-e noeviction|allkeys-lru|allkeys-lfu|volatile-lru|volatile-lfu]]"
+        " [-w walkers 1-%d] [port] [threads 1-%d]\n",
+        prog, POOL_MAX, MAXTHREADS);
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    char *sport, *logfile, *ckptdir, *imagefile;
+    int16 port;
+    int nthreads, i, opt, interval, walkers;
+    long replayed;
+    Fsync policy;
+    Policy eviction;
+    unsigned long long maxmemory;
+    pthread_t tids[MAXTHREADS];
+    struct sigaction sa;
+
+    //-a turns on the append-only log, -f picks when it is fsynced;
+    //-c checkpoints into a directory instead, every -i seconds;
+    //-s names the file SAVE and BGSAVE write; -m makes that file an image
+    //the next start maps instead of loading; -M caps the memory keys and
+    //values may take and -e picks what is evicted to stay under it; -w
+    //sizes the pool recursive commands walk on (one per CPU by default)
+    logfile = ckptdir = imagefile = NULL;
+    policy = FsyncEverysec;
+    interval = CKPT_INTERVAL;
+    maxmemory = 0;
+    eviction = EvictNone;
+    walkers = 0;
+    while((opt = getopt(argc, argv, "a:f:c:i:s:m:M:e:w:")) != -1){
+        if(opt == 'a')
+            logfile = optarg;
+        else if(opt == 'c')
+            ckptdir = optarg;
+        else if(opt == 's')
+            save_init(optarg);
+        else if(opt == 'm'){
+            save_init(optarg);
+            imagefile = optarg;
+        }
+        else if(opt == 'i'){
+            interval = atoi(optarg);
+            if(interval < 1)
+                usage(argv[0]);
+        }
+        else if(opt == 'M'){
+            if(evict_parse_size(optarg, &maxmemory))
+                usage(argv[0]);
+        }
+        else if(opt == 'e'){
+            if(evict_parse_policy(optarg, &eviction))
+                usage(argv[0]);
+        }
+        else if(opt == 'w'){
+            walkers = atoi(optarg);
+            if(walkers < 1 || walkers > POOL_MAX)
+                usage(argv[0]);
+        }
+        else if(opt != 'f' || aof_parse_policy(optarg, &policy))
+            usage(argv[0]);
+    }
+    if((logfile && ckptdir) || (imagefile && (logfile || ckptdir)))
+        usage(argv[0]);
+    argc -= optind - 1;
+    argv += optind - 1;
 
-    
     if(argc < 2){
         sport = PORT;
     }
@@ -259,13 +1478,78 @@ int main(int argc, char *argv[]){
     }
     port = (int16)atoi(sport);
 
-    s = initserver(port);
+    nthreads = (argc > 2) ? atoi(argv[2]) : 1;
+    if(nthreads < 1 || nthreads > MAXTHREADS)
+        usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+    //A client vanishing mid-write must not take the whole server down with it
+
+    stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(stopfd < 0){
+        perror("eventfd");
+        return 1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onstop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    store_init();
+
+    //Rebuild the tree before anything can change it: from the log or the
+    //checkpoints when there are any, otherwise from the last snapshot
+    if(imagefile && image_open(imagefile)){
+        perror(imagefile);
+        return 1;
+    }
+    if(!logfile && !ckptdir && !imagefile && save_load()){
+        perror("snapshot");
+        return 1;
+    }
+    if(logfile){
+        replayed = aof_replay(logfile, store_apply, NULL);
+        if(replayed < 0 || aof_open(logfile, policy)){
+            fprintf(stderr, "%s: %s\n", logfile, strerror(errno));
+            return 1;
+        }
+        printf("replayed %ld commands from %s\n", replayed, logfile);
+    }
+    if(ckptdir && (ckpt_restore(ckptdir) || ckpt_start((unsigned int)interval))){
+        fprintf(stderr, "%s: %s\n", ckptdir, strerror(errno));
+        return 1;
+    }
+    if(expire_start(store_expired)){
+        perror("expiry");
+        return 1;
+    }
+    if(pool_start((unsigned int)walkers)){
+        perror("pool");
+        return 1;
+    }
+    if(reclaim_start()){
+        perror("reclaim");
+        return 1;
+    }
+    //Whatever was loaded stays; the limit applies from the first write on
+    evict_init(maxmemory, eviction);
 
     scontinuation = true;
-    while(scontinuation){
-        mainloop(s);
+    for(i=1; i<nthreads; i++){
+        pthread_create(&tids[i], NULL, serverloop, &port);
+    }
+    serverloop(&port);//The main thread is I/O thread 0
+
+    for(i=1; i<nthreads; i++){
+        pthread_join(tids[i], NULL);
     }
+    expire_stop();
+    reclaim_stop();
+    pool_stop();
+    aof_close();
+    ckpt_stop();
     printf("Shutting down...\n");
-    close(s);
 
-}  
\ No newline at end of file
+    return 0;
+}
@@ -1,7 +1,7 @@
-
 #define _GNU_SOURCE
 #include<stdio.h>
 #include<string.h>
+#include<strings.h>
 #include<unistd.h>
 #include<stdbool.h>
 #include<stdlib.h>
@@ -10,30 +10,83 @@
 #include<errno.h>
 #include<stddef.h>
 #include<stdarg.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<pthread.h>
+#include<limits.h>
+#include<stdatomic.h>
 
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "store.h"
+#include "ckpt.h"
+#include "save.h"
+#include "image.h"
+#include "../tree/resp.h"
+
 
 #define HOST    "127.0.0.1"
 #define PORT    "12049"
 //THis is an identifying factor to our protocol.
 
+#define RBUFSIZE    4096    //initial size of the per-connection buffers
+#define MAXLINE     65536   //a client sending a longer line without '\n' is dropped
+#define MAXEVENTS   256     //events handled per epoll_wait
+#define MAXTHREADS  64      //I/O threads, each with its own epoll and listening socket
+#define WCHUNK      16384   //responses are queued in chunks of at least this size
+#define MAXIOV      64      //chunks handed to one writev
+#define STREAMMIN   65536   //framed values at least this big are read straight into their final buffer
+#define WMAX        (1UL << 20) //output queued past which a client's requests wait for it to drain
+
 
 typedef unsigned int int32;
 typedef unsigned short int int16;
 typedef unsigned char int8;
 
+/*One piece of queued output. Responses are appended to the last chunk and
+a full chunk is never moved, so a deep pipeline does not keep copying
+everything it has answered so far into a bigger buffer.*/
+struct s_chunk{
+    struct s_chunk *next;
+    int32 off;      //first byte not yet written to the socket
+    int32 len;
+    int32 cap;
+    int8 data[];
+};
+typedef struct s_chunk Chunk;
+
 struct s_client{
     int s;
     char ip[16];
     int16 port;
+
+    int8 *rbuf;     //bytes received but not yet parsed
+    size_t rlen;
+    size_t rcap;
+
+    char *bulk;     //last argument of the request at the front of rbuf,
+    unsigned long bulklen;  //read here directly: payload plus its \r\n
+    unsigned long bulkgot;
+    size_t bulkoff; //where that request's header ends in rbuf
+
+    Chunk *whead;   //responses not yet written to the socket,
+    Chunk *wtail;   //flushed with one writev per read batch
+    size_t wlen;    //bytes queued across all chunks
+
+    bool framed;    //the request being answered was length-prefixed
+    uint32_t events;    //what epoll watches the socket for
+    bool held;      //over WMAX bytes queued: rbuf is left unparsed and the socket unread
+    bool closing;   //drop the client once its output is flushed
 };
 typedef struct s_client Client;
 
-typedef int32 (*Callback)(Client*, int8*, int8*);
+typedef int32 (*Callback)(Client*, RespCmd*);
 
 struct s_cmdhandler{
     int8* cmd;
@@ -42,8 +95,16 @@ struct s_cmdhandler{
 typedef struct s_cmdhandler CmdHandler;
 
 void zero(int8 *, int16);
+int cwrite(Client *, const void *, int32);
+int cprintf(Client *, const char *, ...);
+void reply_ok(Client *);
+void reply_int(Client *, long long);
+int reply_value(Client *, const char *, unsigned long);
+void reply_error(Client *, int, const char *, ...);
+int grow(int8 **, size_t *, size_t);
+int8 *wreserve(Client *, int32);
 void childloop(Client *);
 void mainloop(int);
 int initserver(int16);
+void *serverloop(void *);
 int main(int , char**);
-
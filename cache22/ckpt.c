@@ -0,0 +1,322 @@
+/*Incremental checkpoints: a base dump, deltas of what changed, and merging*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<unistd.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<dirent.h>
+#include<time.h>
+#include<pthread.h>
+
+#include <sys/stat.h>
+
+#include "dump.h"
+#include "ckpt.h"
+
+struct s_ckpt{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    //the thread must stop
+
+    char dir[PATH_MAX];
+    unsigned int interval;
+    unsigned long long since;   //generation everything on disk is current to
+    unsigned int first;     //number of the oldest delta on disk
+    unsigned int next;      //number the next delta gets
+    bool base;              //base.dump exists
+    bool running;
+    bool stop;
+    pthread_t thread;
+};
+typedef struct s_ckpt Ckpt;
+
+Ckpt ckpt = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+void ckpt_name(char *buf, size_t size, const char *file, unsigned int delta){
+    if(file)
+        snprintf(buf, size, "%s/%s", ckpt.dir, file);
+    else
+        snprintf(buf, size, "%s/delta.%06u.dump", ckpt.dir, delta);
+}
+
+double ms_since(struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e3 +
+        (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*Make a finished tmp.dump durable, close it and give it its name. A crash before the
+rename leaves only tmp.dump behind, which restore ignores.*/
+int ckpt_commit(int fd, const char *name){
+    char tmp[PATH_MAX + 16];
+    int dfd, ret;
+
+    ckpt_name(tmp, sizeof(tmp), "tmp.dump", 0);
+    ret = fdatasync(fd);
+    if(close(fd) || ret || rename(tmp, name))
+        return -1;
+
+    //The rename itself has to reach the disk too
+    dfd = open(ckpt.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dfd < 0)
+        return -1;
+    ret = fsync(dfd);
+    close(dfd);
+
+    return ret;
+}
+
+int ckpt_tmp(void){
+    char tmp[PATH_MAX + 16];
+
+    ckpt_name(tmp, sizeof(tmp), "tmp.dump", 0);
+    return open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+/*Replace base.dump with itself plus every delta, then drop the deltas.
+Should we crash before they are gone, restore applies them once more on
+top of the new base, which changes nothing: each directory still ends up
+with its newest record.*/
+int ckpt_merge(void){
+    char base[PATH_MAX + 16], **deltas;
+    struct timespec start;
+    DumpStats st;
+    unsigned int n, i;
+    int fd, ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = ckpt.next - ckpt.first;
+    deltas = (char **)calloc(n, sizeof(char *));
+    if(!deltas)
+        return -1;
+    ret = -1;
+    for(i=0; i<n; i++){
+        deltas[i] = (char *)malloc(PATH_MAX + 32);
+        if(!deltas[i])
+            goto out;
+        ckpt_name(deltas[i], PATH_MAX + 32, NULL, ckpt.first + i);
+    }
+
+    ckpt_name(base, sizeof(base), "base.dump", 0);
+    fd = ckpt_tmp();
+    if(fd < 0)
+        goto out;
+    if(dump_merge(base, deltas, (int)n, fd, &st)){
+        close(fd);
+        goto out;
+    }
+    if(ckpt_commit(fd, base))
+        goto out;
+
+    for(i=0; i<n; i++)
+        unlink(deltas[i]);
+    ckpt.first = ckpt.next;
+    ret = 0;
+    printf("checkpoint: merged %u deltas, base now %llu dirs, %llu bytes, %.1f ms\n",
+        n, st.dirs, st.bytes, ms_since(&start));
+
+out:
+    for(i=0; i<n; i++)
+        free(deltas[i]);
+    free(deltas);
+    return ret;
+}
+
+/*Write what changed since the last checkpoint: everything the first time,
+after that a delta of the directories whose generation moved. Each
+directory is copied to memory a bounded piece at a time under its lock
+and written with no lock held, so writers are never held up for longer
+than one piece takes to copy. Returns 0 or -1 with errno set.*/
+int ckpt_now(void){
+    char name[PATH_MAX + 32];
+    struct timespec start;
+    unsigned long long gen;
+    DumpStats st;
+    int fd;
+
+    pthread_mutex_lock(&ckpt.lock);
+    gen = dump_generation();
+    if(ckpt.base && gen == ckpt.since){
+        pthread_mutex_unlock(&ckpt.lock);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(ckpt.base)
+        ckpt_name(name, sizeof(name), NULL, ckpt.next);
+    else
+        ckpt_name(name, sizeof(name), "base.dump", 0);
+
+    fd = ckpt_tmp();
+    if(fd < 0)
+        goto fail;
+    if(dump_write(fd, ckpt.base ? ckpt.since : 0, true, &st)){
+        close(fd);
+        goto fail;
+    }
+    if(ckpt_commit(fd, name))
+        goto fail;
+
+    printf("checkpoint: %s, %llu dirs, %llu keys, %llu bytes, %.1f ms\n",
+        strrchr(name, '/') + 1, st.dirs, st.keys, st.bytes, ms_since(&start));
+
+    //Changes made during the walk are newer than st.gen and go in the next one
+    ckpt.since = st.gen;
+    if(!ckpt.base)
+        ckpt.base = true;
+    else if(++ckpt.next - ckpt.first >= CKPT_MERGE && ckpt_merge())
+        fprintf(stderr, "checkpoint: merge failed: %s\n", strerror(errno));
+    pthread_mutex_unlock(&ckpt.lock);
+
+    return 0;
+
+fail:
+    fprintf(stderr, "checkpoint: %s: %s\n", name, strerror(errno));
+    pthread_mutex_unlock(&ckpt.lock);
+    return -1;
+}
+
+int cmp_uint(const void *a, const void *b){
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*Point the checkpoints at dir, creating it if needed, and load what it
+holds: the base, then every delta oldest first. Call it before any thread
+changes the store. Returns 0 or -1 with errno set.*/
+int ckpt_restore(const char *dir){
+    char name[PATH_MAX + 32];
+    struct dirent *e;
+    unsigned int *nums, n, cap, num, i;
+    unsigned long long dirs, keys;
+    DumpStats st;
+    DIR *d;
+    char end;
+
+    if(strlen(dir) >= sizeof(ckpt.dir) - 32){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(ckpt.dir, dir);
+    if(mkdir(dir, 0755) && errno != EEXIST)
+        return -1;
+    d = opendir(dir);
+    if(!d)
+        return -1;
+
+    nums = NULL;
+    n = cap = 0;
+    while((e = readdir(d))){
+        if(sscanf(e->d_name, "delta.%u.dum%c", &num, &end) != 2 || end != 'p')
+            continue;
+        if(n == cap){
+            unsigned int *p;
+
+            cap = cap ? cap * 2 : 16;
+            p = (unsigned int *)realloc(nums, cap * sizeof(unsigned int));
+            if(!p){
+                free(nums);
+                closedir(d);
+                errno = ENOMEM;
+                return -1;
+            }
+            nums = p;
+        }
+        nums[n++] = num;
+    }
+    closedir(d);
+    qsort(nums, n, sizeof(unsigned int), cmp_uint);
+
+    dirs = keys = 0;
+    ckpt_name(name, sizeof(name), "base.dump", 0);
+    if(!dump_load(name, &st)){
+        ckpt.base = true;
+        dirs += st.dirs;
+        keys += st.keys;
+    }
+    else if(errno != ENOENT)
+        goto fail;
+
+    for(i=0; i<n; i++){
+        ckpt_name(name, sizeof(name), NULL, nums[i]);
+        if(dump_load(name, &st))
+            goto fail;
+        dirs += st.dirs;
+        keys += st.keys;
+    }
+
+    ckpt.first = n ? nums[0] : 0;
+    ckpt.next = n ? nums[n-1] + 1 : 0;
+    ckpt.since = dump_fence();
+    free(nums);
+    if(ckpt.base || n)
+        printf("restored %llu directories, %llu keys from %s (%u deltas)\n", dirs, keys, dir, n);
+
+    return 0;
+
+fail:
+    fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    free(nums);
+    return -1;
+}
+
+void *ckpt_loop(void *arg){
+    struct timespec deadline;
+
+    (void)arg;
+    pthread_mutex_lock(&ckpt.lock);
+    while(!ckpt.stop){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ckpt.interval;
+        if(pthread_cond_timedwait(&ckpt.wake, &ckpt.lock, &deadline) != ETIMEDOUT)
+            continue;
+
+        pthread_mutex_unlock(&ckpt.lock);
+        ckpt_now();
+        pthread_mutex_lock(&ckpt.lock);
+    }
+    pthread_mutex_unlock(&ckpt.lock);
+
+    return NULL;
+}
+
+/*Checkpoint every interval seconds from a thread of its own, starting
+with a full base if the directory has none*/
+int ckpt_start(unsigned int interval){
+    ckpt.interval = interval ? interval : CKPT_INTERVAL;
+    if(ckpt_now())
+        return -1;
+
+    ckpt.running = true;
+    if(pthread_create(&ckpt.thread, NULL, ckpt_loop, NULL)){
+        ckpt.running = false;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*Stop the thread and take a last checkpoint of whatever is left*/
+void ckpt_stop(void){
+    if(!ckpt.running)
+        return;
+
+    pthread_mutex_lock(&ckpt.lock);
+    ckpt.stop = true;
+    pthread_cond_signal(&ckpt.wake);
+    pthread_mutex_unlock(&ckpt.lock);
+    pthread_join(ckpt.thread, NULL);
+
+    ckpt.running = false;
+    ckpt_now();
+}
@@ -0,0 +1,13 @@
+/*ckpt.h*/
+//Periodic incremental checkpoints into a directory of dumps (see dump.h):
+//base.dump holds a full image and delta.NNNNNN.dump the directories that
+//changed since the file before it. Deltas are folded into the base once
+//there are CKPT_MERGE of them.
+
+#define CKPT_MERGE      8
+#define CKPT_INTERVAL   60  //default seconds between checkpoints
+
+int ckpt_restore(const char *);
+int ckpt_start(unsigned int);
+int ckpt_now(void);
+void ckpt_stop(void);
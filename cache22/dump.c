@@ -0,0 +1,843 @@
+/*Writing, loading and merging binary directory images*/
+#define _GNU_SOURCE
+#include "../tree/tree.h"
+#include "../tree/lock.h"
+#include "dump.h"
+#include "expire.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<stdatomic.h>
+#include<fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DUMPMAGIC   "C22DUMP3"
+#define DUMPBUF     (1 << 20)
+#define DUMPPIECE   (256 * 1024)    //bytes of leaves staged at a time
+#define DUMPSTEP    4096            //directories the dirty scan looks at per hold of the tree lock
+
+struct s_out{
+    int fd;
+    int err;
+    unsigned long long bytes;
+    unsigned long long records;
+    size_t len;
+    char buf[DUMPBUF];
+};
+typedef struct s_out Out;
+
+/*A growable buffer: a piece of a directory is copied into it under its
+locks, then written out with none held*/
+struct s_stage{
+    char *p;
+    size_t len;
+    size_t cap;
+    int err;
+};
+typedef struct s_stage Stage;
+
+struct s_in{
+    const char *p;
+    const char *end;
+};
+typedef struct s_in In;
+
+unsigned long long dump_generation(void){
+    return tree_generation();
+}
+
+/*Like dump_generation, but a later dump_write may take it as since. Only
+for when no other thread changes the tree, as after loading at start-up.*/
+unsigned long long dump_fence(void){
+    return tree_fence();
+}
+
+static void out_init(Out *o, int fd){
+    o->fd = fd;
+    o->err = 0;
+    o->bytes = 0;
+    o->records = 0;
+    o->len = 0;
+}
+
+static void flush(Out *o){
+    size_t off;
+    ssize_t n;
+
+    for(off = 0; off < o->len && !o->err; off += n){
+        n = write(o->fd, o->buf + off, o->len - off);
+        if(n < 0){
+            if(errno == EINTR){
+                n = 0;
+                continue;
+            }
+            o->err = errno;
+        }
+    }
+    o->len = 0;
+}
+
+static void put(Out *o, const void *p, size_t n){
+    size_t room;
+
+    o->bytes += n;
+    while(n && !o->err){
+        room = DUMPBUF - o->len;
+        if(!room){
+            flush(o);
+            continue;
+        }
+        if(room > n)
+            room = n;
+        memcpy(o->buf + o->len, p, room);
+        o->len += room;
+        p = (const char *)p + room;
+        n -= room;
+    }
+}
+
+#define PUT(o, v) put((o), &(v), sizeof(v))
+
+static void stage(Stage *s, const void *p, size_t n){
+    size_t cap;
+    char *b;
+
+    if(s->err)
+        return;
+    if(s->len + n > s->cap){
+        for(cap = s->cap ? s->cap : 4096; cap < s->len + n; cap *= 2);
+        b = (char *)realloc(s->p, cap);
+        if(!b){
+            s->err = ENOMEM;
+            return;
+        }
+        s->p = b;
+        s->cap = cap;
+    }
+    memcpy(s->p + s->len, p, n);
+    s->len += n;
+}
+
+#define STAGE(s, v) stage((s), &(v), sizeof(v))
+
+/*The head of a 'D' record, up to its first piece of leaves; the caller
+holds the directory's lock*/
+static void put_head(Stage *s, const Node *n, DumpStats *st){
+    int8 path[MAX_PATH_LENGTH];
+    const Node *d;
+    uint16_t plen;
+    uint8_t nlen;
+    char tag;
+
+    node_path(n, path, sizeof(path));
+    plen = (uint16_t)strlen((char *)path);
+    tag = 'D';
+    STAGE(s, tag);
+    STAGE(s, plen);
+    stage(s, path, plen);
+    STAGE(s, n->ttl);
+
+    STAGE(s, n->ndirs);
+    for(d = n->west; d; d = d->next){
+        nlen = (uint8_t)strlen((const char *)d->path);
+        STAGE(s, nlen);
+        stage(s, d->path, nlen);
+    }
+
+    st->dirs++;
+}
+
+/*One piece of leaves from l on: as many as fit in DUMPPIECE bytes, but at
+least one. Returns the leaf after it, NULL once the directory is done. The
+caller holds the directory's lock.*/
+static const Leaf *put_leaves(Stage *s, const Leaf *l, DumpStats *st){
+    uint64 count, vlen;
+    uint32_t klen;
+    size_t at, start;
+
+    at = s->len;
+    start = s->len;
+    count = 0;
+    STAGE(s, count);
+    for(; l && (!count || s->len - start < DUMPPIECE) && !s->err; l = l->east){
+        klen = (uint32_t)strlen((const char *)l->key);
+        vlen = l->size - 1;
+        STAGE(s, klen);
+        stage(s, l->key, klen);
+        STAGE(s, vlen);
+        stage(s, l->value, vlen);
+        STAGE(s, l->expires);
+        count++;
+    }
+    if(!s->err)
+        memcpy(s->p + at, &count, sizeof(count));
+
+    st->keys += count;
+    return l;
+}
+
+//The empty piece that closes a record
+static void put_end(Stage *s){
+    uint64 zero;
+
+    zero = 0;
+    STAGE(s, zero);
+}
+
+//Directories in depth-first order without recursion; !down skips those below n
+static Node *next_dir(Node *n, bool down){
+    if(down && n->west)
+        return n->west;
+    while(!(n->tag & TagRoot)){
+        if(n->next)
+            return n->next;
+        n = n->north;
+    }
+    return NULL;
+}
+
+//Whether anything under n, itself included, changed after fence since
+static bool dirty_below(const Node *n, unsigned long long since){
+    return !since || atomic_load_explicit(&n->subgen, memory_order_relaxed) > since;
+}
+
+/*Find the directory at path again after the tree lock was dropped. If it
+went away meanwhile, back off to the nearest parent still there and go on
+with its first subdirectory, which may list some a second time; a later
+record for a path wins on load, so that only costs bytes.*/
+static Node *walk_again(int8 *path, unsigned long long since){
+    Node *n;
+    int8 *slash;
+
+    n = search_node(&root.n, path);
+    if(n)
+        return n;
+    do{
+        slash = (int8 *)strrchr((char *)path, '/');
+        if(slash == path)
+            slash++;
+        *slash = 0;
+        n = search_node(&root.n, path);
+    }while(!n);
+    return next_dir(n, dirty_below(n, since));
+}
+
+/*The paths of every directory that changed after generation since, one
+after another with their terminators, in the order next_dir visits them,
+and in *gen the generation they are complete up to. since is 0 or the gen
+of an earlier call. Every change takes the tree lock shared, so holding
+it exclusively for a moment fences out the writers between bumping the
+generation and storing it on their directories, and starts a new round
+of tree_fence. The walk itself holds the lock shared, DUMPSTEP directories
+at a time, and skips every subtree with nothing that changed: that costs
+the directories that changed and their siblings, not the whole tree.*/
+static int dirty_dirs(unsigned long long since, Stage *paths, uint64 *gen){
+    int8 path[MAX_PATH_LENGTH];
+    Node *n;
+    bool down;
+    int len, i;
+
+    tree_wrlock();
+    *gen = tree_fence();
+    tree_unlock();
+
+    strcpy((char *)path, "/");
+    do{
+        tree_rdlock();
+        n = walk_again(path, since);
+        for(i=0; n && i<DUMPSTEP && !paths->err; i++){
+            down = dirty_below(n, since);
+            if(down && (!since || n->gen > since)){
+                len = node_path(n, path, sizeof(path));
+                if(len >= 0)
+                    stage(paths, path, len + 1);
+            }
+            n = next_dir(n, down);
+        }
+        if(n && node_path(n, path, sizeof(path)) < 0)
+            n = NULL;
+        tree_unlock();
+    }while(n && !paths->err);
+
+    if(paths->err){
+        errno = paths->err;
+        return -1;
+    }
+    return 0;
+}
+
+/*Write every directory that changed after generation `since` (0 for all
+of them); st->gen gets the generation the dump is complete up to. The
+dirty directories are listed first, then each one is looked up again and
+copied a piece at a time under the tree and its own lock, which are
+dropped before the piece goes to disk. So writers never wait for more
+than one piece, and memory stays bounded however big a directory is.
+The image is not one instant of the tree, nor even of one directory:
+between pieces the directory's resume leaf marks where its walk goes on,
+and removing that leaf moves the mark on, so a key that lives through
+the walk is always in it and none is copied twice. Any change made
+meanwhile carries a newer generation and is picked up next time. A
+directory removed in between is cut short, since its parent's record
+changed too. Pass lock = false only when no other thread can
+touch the tree, as in a forked child: the tree is then walked directly.
+Returns 0 or -1 with errno set.*/
+int dump_write(int fd, unsigned long long since, bool lock, DumpStats *st){
+    Stage dir, paths;
+    const Leaf *l;
+    const char *p;
+    Out *o;
+    Node *n;
+    uint64 gen;
+    char tag;
+    int err;
+
+    o = (Out *)malloc(sizeof(Out));
+    if(!o){
+        errno = ENOMEM;
+        return -1;
+    }
+    out_init(o, fd);
+    memset(st, 0, sizeof(*st));
+    memset(&dir, 0, sizeof(dir));
+    memset(&paths, 0, sizeof(paths));
+
+    if(!lock)
+        gen = tree_generation();
+    else if(dirty_dirs(since, &paths, &gen))
+        o->err = errno;
+    st->gen = gen;
+    put(o, DUMPMAGIC, 8);
+    PUT(o, gen);
+    PUT(o, since);
+
+    if(!lock){
+        for(n = &root.n; n && !o->err && !dir.err; n = next_dir(n, dirty_below(n, since))){
+            if(since && n->gen <= since)
+                continue;
+            put_head(&dir, n, st);
+            for(l = (const Leaf *)n->east; l && !o->err && !dir.err; dir.len = 0){
+                l = put_leaves(&dir, l, st);
+                put(o, dir.p, dir.len);
+            }
+            put_end(&dir);
+            put(o, dir.p, dir.len);
+            dir.len = 0;
+        }
+    }
+    for(p = paths.p; p < paths.p + paths.len && !o->err && !dir.err; p += strlen(p) + 1){
+        tree_rdlock();
+        n = search_node(&root.n, (const int8 *)p);
+        if(!n){
+            tree_unlock();
+            continue;
+        }
+        node_rdlock(n);
+        put_head(&dir, n, st);
+        l = (const Leaf *)n->east;
+        for(;;){
+            if(l)
+                l = put_leaves(&dir, l, st);
+            //Only this walk uses resume, and removals need the write lock
+            n->resume = (Leaf *)l;
+            node_unlock(n);
+            tree_unlock();
+            if(!l)
+                break;
+
+            put(o, dir.p, dir.len);
+            dir.len = 0;
+            if(o->err || dir.err)
+                break;
+
+            //A directory made anew in between has no resume and ends here
+            tree_rdlock();
+            n = search_node(&root.n, (const int8 *)p);
+            if(!n){
+                tree_unlock();
+                break;
+            }
+            node_rdlock(n);
+            l = n->resume;
+            n->resume = NULL;
+        }
+
+        put_end(&dir);
+        put(o, dir.p, dir.len);
+        dir.len = 0;
+    }
+    if(!o->err)
+        o->err = dir.err;
+
+    tag = 'E';
+    PUT(o, tag);
+    PUT(o, st->dirs);
+    flush(o);
+
+    st->bytes = o->bytes;
+    err = o->err;
+    free(o);
+    free(dir.p);
+    free(paths.p);
+    if(err){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static bool get(In *in, void *dst, size_t n){
+    if((size_t)(in->end - in->p) < n)
+        return false;
+    if(dst)
+        memcpy(dst, in->p, n);
+    in->p += n;
+    return true;
+}
+
+#define GET(in, v) get((in), &(v), sizeof(v))
+
+/*Skip over one 'D' record, returning its path. False if it is cut short.*/
+static bool skip_dir(In *in, const char **path, uint16_t *plen){
+    uint32_t ndirs, klen, i;
+    uint64 nkeys, vlen, k, ttl;
+    uint8_t nlen;
+
+    if(!GET(in, *plen))
+        return false;
+    *path = in->p;
+    if(!get(in, NULL, *plen) || !GET(in, ttl) || !GET(in, ndirs))
+        return false;
+    for(i=0; i<ndirs; i++)
+        if(!GET(in, nlen) || !get(in, NULL, nlen))
+            return false;
+    do{
+        if(!GET(in, nkeys))
+            return false;
+        for(k=0; k<nkeys; k++)
+            if(!GET(in, klen) || !get(in, NULL, klen) || !GET(in, vlen) || !get(in, NULL, vlen)
+                || !get(in, NULL, sizeof(uint64)))
+                return false;
+    }while(nkeys);
+
+    return true;
+}
+
+//The directory at an absolute path, created along with its parents
+static Node *make_path(const char *path, size_t len){
+    int8 name[MAX_NAME_LENGTH + 1];
+    Node *n, *c;
+    size_t i, j;
+
+    n = &root.n;
+    for(i = 0; i < len; i = j){
+        for(; i < len && path[i] == '/'; i++);
+        for(j = i; j < len && path[j] != '/'; j++);
+        if(i == j)
+            break;
+        if(j - i > MAX_NAME_LENGTH){
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+
+        memcpy(name, path + i, j - i);
+        name[j - i] = 0;
+        c = search_node(n, name);
+        if(!c && !(c = create_node(n, name)))
+            return NULL;
+        n = c;
+    }
+
+    return n;
+}
+
+/*Free the subdirectories of n that a record's list of names leaves out:
+they were removed after whatever older record created them*/
+static void prune_dirs(Node *n, const char *names, uint32_t ndirs){
+    const char *p;
+    Node *c, *next;
+    size_t len;
+    uint32_t i;
+    uint8_t nlen;
+
+    for(c = n->west; c; c = next){
+        next = c->next;
+        len = strlen((const char *)c->path);
+        for(p = names, i = 0; i < ndirs; i++, p += 1 + nlen){
+            nlen = (uint8_t)*p;
+            if(nlen == len && !memcmp(p + 1, c->path, len))
+                break;
+        }
+        if(i == ndirs && !detach_node(c))
+            reclaim_node(c, UINT32_MAX);
+    }
+}
+
+/*Load one piece of nkeys leaves into n, whose absolute path is path; key
+is a buffer kept across pieces. Keys that expired while they were on disk
+are skipped. False if the piece is cut short or a key cannot be made.*/
+static bool load_leaves(In *in, Node *n, const char *path, uint64 nkeys,
+        int8 **key, uint32_t *keycap, uint64 now, DumpStats *st){
+    const char *value;
+    uint64 vlen, k, expires;
+    uint32_t klen;
+    int8 *p;
+    Leaf *l;
+
+    for(k=0; k<nkeys; k++){
+        if(!GET(in, klen) || klen >= UINT32_MAX)
+            return false;
+        if(klen + 1 > *keycap){
+            p = (int8 *)realloc(*key, klen + 1);
+            if(!p)
+                return false;
+            *key = p;
+            *keycap = klen + 1;
+        }
+        if(!get(in, *key, klen))
+            return false;
+        (*key)[klen] = 0;
+
+        //Values are copied straight out of the mapping
+        if(!GET(in, vlen) || (uint64)(in->end - in->p) < vlen)
+            return false;
+        value = in->p;
+        in->p += vlen;
+        if(!GET(in, expires))
+            return false;
+        if(expires && expires <= now)
+            continue;
+        if(!(l = create_leaf(n, *key, (const int8 *)value, vlen + 1)))
+            return false;
+        if(expires){
+            l->expires = l->timer = expires;
+            if(expire_add(path, (const char *)*key, expires))
+                return false;
+        }
+        st->keys++;
+    }
+
+    return true;
+}
+
+/*Replace one directory with the contents of its 'D' record*/
+static bool load_dir(In *in, DumpStats *st){
+    int8 name[MAX_NAME_LENGTH + 1];
+    char path[MAX_PATH_LENGTH];
+    int8 *key;
+    uint32_t ndirs, keycap, i;
+    uint64 nkeys, now;
+    const char *names;
+    uint16_t plen;
+    uint8_t nlen;
+    Node *n;
+    bool ok;
+
+    if(!GET(in, plen) || plen >= sizeof(path) || !get(in, path, plen))
+        return false;
+    path[plen] = 0;
+    n = make_path(path, plen);
+    if(!n || !GET(in, n->ttl))
+        return false;
+
+    if(!GET(in, ndirs))
+        return false;
+    names = in->p;
+    for(i=0; i<ndirs; i++){
+        if(!GET(in, nlen) || !get(in, name, nlen))
+            return false;
+        name[nlen] = 0;
+        if(!search_node(n, name) && !create_node(n, name))
+            return false;
+    }
+    if(n->ndirs > ndirs)
+        prune_dirs(n, names, ndirs);
+
+    //The first piece is known up front, so the index is sized once for it
+    clear_leaves(n);
+    if(!GET(in, nkeys) || nkeys > UINT32_MAX || index_reserve(&n->index, (uint32)nkeys))
+        return false;
+
+    key = NULL;
+    keycap = 0;
+    now = expire_now();
+    //Pieces of leaves until an empty one
+    while((ok = load_leaves(in, n, path, nkeys, &key, &keycap, now, st)) && nkeys)
+        if(!GET(in, nkeys)){
+            ok = false;
+            break;
+        }
+    free(key);
+
+    st->dirs++;
+    return ok;
+}
+
+//Map a dump and check its header; in points at the first record
+static char *map_dump(const char *path, size_t *size, In *in, uint64 *gen){
+    struct stat st;
+    char *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st)){
+        close(fd);
+        return NULL;
+    }
+    if((size_t)st.st_size < 8 + 2 * sizeof(uint64)){
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return NULL;
+    //Read ahead the whole file: every byte of it is about to be used
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    if(memcmp(map, DUMPMAGIC, 8)){
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    memcpy(gen, map + 8, sizeof(*gen));
+    in->p = map + 8 + 2 * sizeof(uint64);
+    in->end = map + st.st_size;
+    *size = st.st_size;
+    return map;
+}
+
+//True if in is at a valid trailer for `records` records
+static bool check_end(In *in, unsigned long long records){
+    unsigned long long count;
+
+    return GET(in, count) && count == records && in->p == in->end;
+}
+
+/*Apply a dump to the tree: every directory in it is created if needed
+and gets exactly the keys of its record. Returns 0 or -1 with errno set
+(EPROTO for a damaged file).*/
+int dump_load(const char *path, DumpStats *st){
+    In in;
+    char *map;
+    size_t size;
+    uint64 gen;
+    char tag;
+    bool ok;
+
+    memset(st, 0, sizeof(*st));
+    map = map_dump(path, &size, &in, &gen);
+    if(!map)
+        return -1;
+
+    tree_wrlock();
+    ok = false;
+    errno = 0;
+    while(GET(&in, tag)){
+        if(tag == 'E'){
+            ok = check_end(&in, st->dirs);
+            break;
+        }
+        if(tag != 'D' || !load_dir(&in, st))
+            break;
+    }
+    tree_unlock();
+
+    st->bytes = size;
+    munmap(map, size);
+    if(!ok){
+        if(!errno)
+            errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+struct s_record{
+    const char *path;
+    uint16_t plen;
+    const char *start;
+    size_t len;
+};
+typedef struct s_record Record;
+
+//Path table for merging: the newest record of every path in the deltas
+struct s_pathtable{
+    Record *recs;
+    unsigned long long nrecs;
+    unsigned long long *slots;  //index into recs plus one, 0 is empty
+    unsigned long long mask;
+};
+typedef struct s_pathtable PathTable;
+
+static uint64 hash_path(const char *p, uint16_t len){
+    uint64 h = 1469598103934665603ULL;
+
+    while(len--){
+        h ^= (unsigned char)*p++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long long *find_slot(PathTable *t, const char *path, uint16_t plen){
+    unsigned long long *s;
+    Record *r;
+    uint64 i;
+
+    for(i = hash_path(path, plen) & t->mask;; i = (i + 1) & t->mask){
+        s = &t->slots[i];
+        if(!*s)
+            return s;
+        r = &t->recs[*s - 1];
+        if(r->plen == plen && !memcmp(r->path, path, plen))
+            return s;
+    }
+}
+
+/*Walk the records of one mapped dump. With add, each record goes into the
+table, replacing an older one of the same path (so feed the deltas oldest
+first); the older one stays behind with len 0, so the table lists the
+survivors in the order they were written. Otherwise every record whose
+path is not in the table is copied to o. Returns the number of records,
+or -1 if the file is damaged.*/
+static long long scan_dump(In in, PathTable *t, bool add, Out *o){
+    unsigned long long *s, records;
+    const char *start, *path;
+    uint16_t plen;
+    char tag;
+
+    records = 0;
+    while(GET(&in, tag)){
+        if(tag == 'E')
+            return check_end(&in, records) ? (long long)records : -1;
+        start = in.p - 1;
+        if(tag != 'D' || !skip_dir(&in, &path, &plen))
+            return -1;
+        records++;
+        if(!t)
+            continue;
+
+        s = find_slot(t, path, plen);
+        if(add){
+            if(*s)
+                t->recs[*s - 1].len = 0;
+            t->recs[t->nrecs] = (Record){path, plen, start, in.p - start};
+            *s = ++t->nrecs;
+        }
+        else if(!*s){
+            put(o, start, in.p - start);
+            o->records++;
+        }
+    }
+
+    return -1;
+}
+
+/*Fold deltas (oldest first) into base and write the result to fd without
+loading anything into the tree: a directory's newest record wins, every
+other base record is copied as it is. Returns 0 or -1 with errno set.*/
+int dump_merge(const char *base, char **deltas, int ndeltas, int fd, DumpStats *st){
+    char **maps;
+    size_t *sizes;
+    In *ins;
+    PathTable t;
+    Out *o;
+    uint64 gen, g, since;
+    unsigned long long i, total;
+    long long n;
+    char tag;
+    int err, d;
+
+    memset(st, 0, sizeof(*st));
+    memset(&t, 0, sizeof(t));
+    maps = (char **)calloc(ndeltas + 1, sizeof(char *));
+    sizes = (size_t *)calloc(ndeltas + 1, sizeof(size_t));
+    ins = (In *)calloc(ndeltas + 1, sizeof(In));
+    o = (Out *)malloc(sizeof(Out));
+    err = 0;
+    if(!maps || !sizes || !ins || !o){
+        err = ENOMEM;
+        goto out;
+    }
+
+    //Map and check everything first; slot 0 is the base
+    gen = 0;
+    total = 0;
+    for(d=0; d<=ndeltas; d++){
+        maps[d] = map_dump(d ? deltas[d-1] : base, &sizes[d], &ins[d], &g);
+        if(!maps[d]){
+            err = errno;
+            goto out;
+        }
+        n = scan_dump(ins[d], NULL, false, NULL);
+        if(n < 0){
+            err = EPROTO;
+            goto out;
+        }
+        if(d)
+            total += n;
+        if(g > gen)
+            gen = g;
+    }
+
+    for(t.mask = 15; t.mask < 2 * total; t.mask = t.mask * 2 + 1);
+    t.recs = (Record *)malloc((total + 1) * sizeof(Record));
+    t.slots = (unsigned long long *)calloc(t.mask + 1, sizeof(unsigned long long));
+    if(!t.recs || !t.slots){
+        err = ENOMEM;
+        goto out;
+    }
+    for(d=1; d<=ndeltas; d++)
+        scan_dump(ins[d], &t, true, NULL);
+
+    out_init(o, fd);
+    since = 0;
+    put(o, DUMPMAGIC, 8);
+    PUT(o, gen);
+    PUT(o, since);
+
+    /*Base records nobody replaced, then the newest version of the rest in
+    the order it was written. dump_load lets a directory's record drop the
+    subdirectories it does not list, so a parent written after RMDIR must
+    come after any older record of what was removed.*/
+    scan_dump(ins[0], &t, false, o);
+    for(i=0; i<t.nrecs; i++)
+        if(t.recs[i].len){
+            put(o, t.recs[i].start, t.recs[i].len);
+            o->records++;
+        }
+    st->dirs = o->records;
+
+    tag = 'E';
+    PUT(o, tag);
+    PUT(o, st->dirs);
+    flush(o);
+    st->bytes = o->bytes;
+    err = o->err;
+
+out:
+    for(d=0; maps && d<=ndeltas; d++)
+        if(maps[d])
+            munmap(maps[d], sizes[d]);
+    free(maps);
+    free(sizes);
+    free(ins);
+    free(o);
+    free(t.recs);
+    free(t.slots);
+    if(err){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+/*dump.h*/
+//Binary images of whole directories, used by the checkpoints. A file is
+//
+//  "C22DUMP3" | u64 generation | u64 since
+//  'D' records, one per directory, in any order:
+//      'D' | u16 pathlen | path | u64 ttl | u32 ndirs | (u8 len | name) * ndirs
+//          | pieces of keys, the last one with nkeys 0:
+//            u64 nkeys | (u32 keylen | key | u64 vallen | value | u64 expires) * nkeys
+//  'E' | u64 number of 'D' records
+//
+//with integers in host byte order. A 'D' record holds everything a
+//directory has, so loading one replaces that directory's keys wholesale
+//and a later record for the same path wins over an earlier one.
+
+#include<stdbool.h>
+
+struct s_dumpstats{
+    unsigned long long dirs;
+    unsigned long long keys;
+    unsigned long long bytes;
+    unsigned long long gen;     //dump_write: the generation it is complete up to
+};
+typedef struct s_dumpstats DumpStats;
+
+unsigned long long dump_generation(void);
+unsigned long long dump_fence(void);
+int dump_write(int, unsigned long long, bool, DumpStats *);
+int dump_load(const char *, DumpStats *);
+int dump_merge(const char *, char **, int, int, DumpStats *);
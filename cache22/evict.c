@@ -0,0 +1,324 @@
+/*Picking and deleting keys once the store is over maxmemory*/
+#define _GNU_SOURCE
+#include "../tree/tree.h"
+#include "../tree/lock.h"
+#include "store.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<pthread.h>
+#include<stdatomic.h>
+
+//A candidate for eviction: the directory's absolute path and the key, back to back
+struct s_victim{
+    unsigned long long score;   //higher goes first
+    unsigned int pathlen;
+    char *names;
+};
+typedef struct s_victim Victim;
+
+struct s_evictor{
+    pthread_mutex_t lock;       //one thread evicts at a time
+    unsigned long long max;     //0 for no limit
+    Policy policy;
+    Node *hand;                 //next directory to sample, NULL for the root
+    Victim pool[EVICT_POOL];    //sorted by score, the best candidate last
+    int npool;
+    unsigned long long evicted;
+    unsigned long long second;  //unix second the count below belongs to
+    unsigned long long thissec;
+    unsigned long long lastsec;
+    _Atomic unsigned long long hits;
+    _Atomic unsigned long long misses;
+};
+typedef struct s_evictor Evictor;
+
+Evictor evictor = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static const char *policies[] = {"noeviction", "allkeys-lru", "allkeys-lfu", "volatile-lru", "volatile-lfu"};
+
+_Thread_local unsigned int seed;
+
+int evict_parse_policy(const char *name, Policy *policy){
+    unsigned int i;
+
+    for(i=0; i<sizeof(policies)/sizeof(policies[0]); i++){
+        if(!strcmp(name, policies[i])){
+            *policy = (Policy)i;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+//A byte count with an optional k, m or g (powers of 1024)
+int evict_parse_size(const char *s, unsigned long long *out){
+    unsigned long long n, unit;
+    char *end;
+
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if(errno || end == s){
+        errno = EINVAL;
+        return -1;
+    }
+    if(!*end)
+        unit = 1;
+    else if(!end[1] && (*end == 'k' || *end == 'K'))
+        unit = 1ULL << 10;
+    else if(!end[1] && (*end == 'm' || *end == 'M'))
+        unit = 1ULL << 20;
+    else if(!end[1] && (*end == 'g' || *end == 'G'))
+        unit = 1ULL << 30;
+    else{
+        errno = EINVAL;
+        return -1;
+    }
+
+    *out = n * unit;
+    return 0;
+}
+
+//Call before any thread uses the store; a limit of 0 turns eviction off
+void evict_init(unsigned long long max, Policy policy){
+    evictor.max = max;
+    evictor.policy = policy;
+}
+
+static bool lfu(void){
+    return evictor.policy == EvictAllLfu || evictor.policy == EvictVolatileLfu;
+}
+
+static uint32 clock_now(void){
+    return (uint32)(expire_now() / EVICT_CLOCK);
+}
+
+//The LFU counter after the decay owed since its last access. A key never
+//accessed since it was loaded counts as new.
+static unsigned int decayed(const Leaf *l, uint32 now){
+    unsigned long long periods;
+    unsigned int counter;
+    uint32 atime;
+
+    atime = atomic_load_explicit(&l->atime, memory_order_relaxed);
+    if(!atime)
+        return LFU_INIT;
+    counter = atomic_load_explicit(&l->freq, memory_order_relaxed);
+    periods = (unsigned long long)(uint32)(now - atime) * EVICT_CLOCK / 1000 / LFU_DECAY;
+
+    return (periods >= counter) ? 0 : counter - (unsigned int)periods;
+}
+
+/*Record an access to a leaf. Readers call this under a shared lock, so
+two of them may race; losing one of the updates is harmless.*/
+void evict_access(Leaf *l){
+    unsigned int counter, base;
+    uint32 now;
+
+    if(!evictor.max || evictor.policy == EvictNone)
+        return;
+
+    now = clock_now();
+    if(lfu()){
+        //Logarithmic: the higher the counter, the less likely a hit raises it
+        counter = decayed(l, now);
+        base = (counter > LFU_INIT) ? counter - LFU_INIT : 0;
+        if(!seed)
+            seed = (unsigned int)time(NULL) ^ (unsigned int)pthread_self();
+        if(counter < 255 && (double)rand_r(&seed) / RAND_MAX < 1.0 / (base * LFU_LOG_FACTOR + 1))
+            counter++;
+        atomic_store_explicit(&l->freq, (uint8_t)counter, memory_order_relaxed);
+    }
+    atomic_store_explicit(&l->atime, now, memory_order_relaxed);
+}
+
+//Count a lookup for the hit ratio
+void evict_lookup(bool hit){
+    atomic_fetch_add_explicit(hit ? &evictor.hits : &evictor.misses, 1, memory_order_relaxed);
+}
+
+//How much a key deserves to go: idle time for LRU, rarity for LFU
+static unsigned long long score(const Leaf *l, uint32 now, unsigned long long ms){
+    if(l->expires && l->expires <= ms)
+        return ~0ULL;
+    if(lfu())
+        return 255 - decayed(l, now);
+    return (uint32)(now - atomic_load_explicit(&l->atime, memory_order_relaxed));
+}
+
+//Put a sampled key into the pool if it beats the worst one there
+static void consider(const char *path, unsigned int pathlen, const char *key, unsigned long long sc){
+    size_t keylen;
+    Victim v;
+    int i;
+
+    keylen = strlen(key);
+    for(i=0; i<evictor.npool; i++){
+        v = evictor.pool[i];
+        if(v.pathlen == pathlen && !memcmp(v.names, path, pathlen) && !strcmp(v.names + pathlen + 1, key)){
+            memmove(&evictor.pool[i], &evictor.pool[i + 1], (evictor.npool - i - 1) * sizeof(Victim));
+            evictor.npool--;
+            free(v.names);
+            break;
+        }
+    }
+    if(evictor.npool == EVICT_POOL){
+        if(sc <= evictor.pool[0].score)
+            return;
+        free(evictor.pool[0].names);
+        memmove(&evictor.pool[0], &evictor.pool[1], (EVICT_POOL - 1) * sizeof(Victim));
+        evictor.npool--;
+    }
+
+    v.names = (char *)malloc(pathlen + keylen + 2);
+    if(!v.names)
+        return;
+    memcpy(v.names, path, pathlen + 1);
+    memcpy(v.names + pathlen + 1, key, keylen + 1);
+    v.pathlen = pathlen;
+    v.score = sc;
+
+    for(i = evictor.npool; i > 0 && evictor.pool[i - 1].score > sc; i--)
+        evictor.pool[i] = evictor.pool[i - 1];
+    evictor.pool[i] = v;
+    evictor.npool++;
+}
+
+//The directory after n in a depth-first walk, NULL after the last one
+static Node *next_dir(Node *n){
+    if(n->west)
+        return n->west;
+    while(!(n->tag & TagRoot) && !n->next)
+        n = n->north;
+    return (n->tag & TagRoot) ? NULL : n->next;
+}
+
+/*Sample up to EVICT_SAMPLES keys from the directories under the hand and
+move the hand on. Only keys in memory are sampled; directories still read
+from an image are skipped. Returns how many keys were considered.*/
+static int sample(void){
+    char path[MAX_PATH_LENGTH];
+    unsigned long long ms;
+    Node *n;
+    Leaf *l;
+    uint32 now;
+    int dirs, tries, got, len;
+
+    ms = expire_now();
+    now = (uint32)(ms / EVICT_CLOCK);
+    if(!seed)
+        seed = (unsigned int)time(NULL) ^ (unsigned int)pthread_self();
+
+    got = 0;
+    tree_rdlock();
+    for(dirs = 0; dirs < EVICT_DIRS && got < EVICT_SAMPLES; dirs++){
+        n = evictor.hand ? evictor.hand : &root.n;
+        evictor.hand = next_dir(n);
+
+        node_rdlock(n);
+        if(n->nleaves && !n->image && (len = node_path(n, (int8 *)path, sizeof(path))) >= 0){
+            for(tries = 0; tries < EVICT_SAMPLES && got < EVICT_SAMPLES; tries++){
+                l = index_sample(&n->index, (uint32)rand_r(&seed));
+                if(!l)
+                    break;
+                if(!l->expires && (evictor.policy == EvictVolatileLru || evictor.policy == EvictVolatileLfu))
+                    continue;
+                consider(path, (unsigned int)len, (const char *)l->key, score(l, now, ms));
+                got++;
+            }
+        }
+        node_unlock(n);
+    }
+    tree_unlock();
+
+    return got;
+}
+
+//Count one eviction in the per-second figures; needs evictor.lock
+static void counted(void){
+    unsigned long long sec;
+
+    sec = expire_now() / 1000;
+    if(sec != evictor.second){
+        evictor.lastsec = (sec == evictor.second + 1) ? evictor.thissec : 0;
+        evictor.thissec = 0;
+        evictor.second = sec;
+    }
+    evictor.thissec++;
+    evictor.evicted++;
+}
+
+/*Called before a write that may take memory, with no lock held. While the
+store is over maxmemory it evicts up to EVICT_BATCH keys, one directory
+lock at a time, so no single write pays for a large backlog. Returns 0 if
+the write may go ahead, or -1 with errno = ENOMEM if the store is over the
+limit and nothing could be evicted.*/
+int evict_reclaim(void){
+    unsigned long long max;
+    int evicted, tries, ret;
+    Victim v;
+
+    max = evictor.max;
+    if(!max || tree_memory() <= max)
+        return 0;
+    if(evictor.policy == EvictNone){
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pthread_mutex_lock(&evictor.lock);
+    evicted = 0;
+    for(tries = 0; tries < 2 * EVICT_BATCH && evicted < EVICT_BATCH && tree_memory() > max; tries++){
+        if(!sample() && !evictor.npool)
+            break;
+        if(!evictor.npool)
+            continue;
+
+        //The pool may hold keys that are gone or were written since
+        v = evictor.pool[--evictor.npool];
+        if(store_del(v.names, v.names + v.pathlen + 1) == 1){
+            counted();
+            evicted++;
+        }
+        free(v.names);
+    }
+    ret = (!evicted && tree_memory() > max) ? -1 : 0;
+    pthread_mutex_unlock(&evictor.lock);
+
+    if(ret)
+        errno = ENOMEM;
+    return ret;
+}
+
+/*Called by RMDIR with the tree write-locked, which keeps sample() out: the
+hand may point into the subtree being taken away, so it starts over*/
+void evict_forget(void){
+    evictor.hand = NULL;
+}
+
+void evict_stats(EvictStats *st){
+    unsigned long long sec;
+
+    st->used = tree_memory();
+    st->max = evictor.max;
+    st->policy = policies[evictor.policy];
+    st->hits = atomic_load_explicit(&evictor.hits, memory_order_relaxed);
+    st->misses = atomic_load_explicit(&evictor.misses, memory_order_relaxed);
+
+    sec = expire_now() / 1000;
+    pthread_mutex_lock(&evictor.lock);
+    st->evicted = evictor.evicted;
+    if(sec == evictor.second)
+        st->persec = evictor.lastsec;
+    else if(sec == evictor.second + 1)
+        st->persec = evictor.thissec;
+    else
+        st->persec = 0;
+    pthread_mutex_unlock(&evictor.lock);
+}
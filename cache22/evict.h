@@ -0,0 +1,47 @@
+/*evict.h*/
+//Bounded memory. The engine counts the bytes its leaves hold as they are
+//allocated (tree_memory); once that passes maxmemory, every write first
+//evicts a few keys. Victims are picked the way redis does it: a handful of
+//keys is sampled, from a few directories at a time, and the best candidates
+//seen so far wait in a small pool. A key's score comes from the access
+//clock (LRU) or the decaying access counter (LFU) kept on its leaf.
+
+enum e_policy{
+    EvictNone,          //refuse writes that need memory
+    EvictAllLru,
+    EvictAllLfu,
+    EvictVolatileLru,   //only keys with a deadline
+    EvictVolatileLfu
+};
+typedef enum e_policy Policy;
+
+#define EVICT_SAMPLES   5       //keys sampled per round
+#define EVICT_DIRS      16      //most directories one round looks at
+#define EVICT_POOL      16      //best candidates kept between rounds
+#define EVICT_BATCH     32      //most keys one write evicts
+#define EVICT_CLOCK     100     //ms per tick of the access clock
+#define LFU_INIT        5       //counter of a new key, so it is not the first to go
+#define LFU_LOG_FACTOR  10      //higher takes more hits to raise the counter
+#define LFU_DECAY       60      //seconds for the counter to drop by one
+
+typedef struct s_leaf Leaf;
+
+struct s_evictstats{
+    unsigned long long used;
+    unsigned long long max;
+    unsigned long long hits;        //lookups that found their key
+    unsigned long long misses;
+    unsigned long long evicted;
+    unsigned long long persec;      //evictions in the last whole second
+    const char *policy;
+};
+typedef struct s_evictstats EvictStats;
+
+int evict_parse_policy(const char *, Policy *);
+int evict_parse_size(const char *, unsigned long long *);
+void evict_init(unsigned long long, Policy);
+void evict_access(Leaf *);
+void evict_lookup(bool);
+int evict_reclaim(void);
+void evict_forget(void);
+void evict_stats(EvictStats *);
@@ -0,0 +1,223 @@
+/*The timer wheel behind key expiry and the thread that empties it*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<errno.h>
+#include<time.h>
+#include<pthread.h>
+
+#include "expire.h"
+
+#define SLOTS   (1 << EXPIRE_BITS)
+#define MASK    (SLOTS - 1)
+
+//One deadline: the directory's absolute path and the key, back to back
+struct s_timer{
+    struct s_timer *next;
+    unsigned long long when;    //ms
+    unsigned long long tick;    //when in ticks, rounded up
+    unsigned int pathlen;
+    char names[];
+};
+typedef struct s_timer Timer;
+
+struct s_wheel{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        //only for stopping
+    Timer *slots[EXPIRE_LEVELS][SLOTS];
+    unsigned long long tick;    //the next tick to run
+    unsigned long long pending;
+    Reap reap;
+    bool running;
+    bool stop;
+    pthread_t thread;
+};
+typedef struct s_wheel Wheel;
+
+Wheel wheel = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+unsigned long long expire_now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+/*File a timer in the slot its tick falls in: the lowest level whose
+range reaches it, or the current slot if it is already due. Deadlines
+past the top level wait in its farthest slot and are filed again when it
+comes round. Needs wheel.lock.*/
+void place(Timer *t){
+    unsigned long long delta;
+    Timer **slot;
+    int level;
+
+    if(t->tick < wheel.tick){
+        slot = &wheel.slots[0][wheel.tick & MASK];
+    }
+    else{
+        delta = t->tick - wheel.tick;
+        for(level = 0; level < EXPIRE_LEVELS - 1 && delta >= (1ULL << (EXPIRE_BITS * (level + 1))); level++);
+        if(delta >= (1ULL << (EXPIRE_BITS * EXPIRE_LEVELS)))
+            slot = &wheel.slots[level][((wheel.tick + (1ULL << (EXPIRE_BITS * EXPIRE_LEVELS)) - 1)
+                >> (EXPIRE_BITS * level)) & MASK];
+        else
+            slot = &wheel.slots[level][(t->tick >> (EXPIRE_BITS * level)) & MASK];
+    }
+
+    t->next = *slot;
+    *slot = t;
+}
+
+/*Queue a deadline for dir/key; dir must be the directory's absolute path.
+The store keeps one queued per key (Leaf.timer) and ignores any other
+that falls due. Returns 0 or -1 with errno set.*/
+int expire_add(const char *dir, const char *key, unsigned long long when){
+    size_t pathlen, keylen;
+    Timer *t;
+
+    pathlen = strlen(dir);
+    keylen = strlen(key);
+    t = (Timer *)malloc(sizeof(Timer) + pathlen + keylen + 2);
+    if(!t){
+        errno = ENOMEM;
+        return -1;
+    }
+    t->when = when;
+    t->tick = (when + EXPIRE_TICK - 1) / EXPIRE_TICK;
+    t->pathlen = (unsigned int)pathlen;
+    memcpy(t->names, dir, pathlen + 1);
+    memcpy(t->names + pathlen + 1, key, keylen + 1);
+
+    pthread_mutex_lock(&wheel.lock);
+    if(!wheel.tick)
+        wheel.tick = expire_now() / EXPIRE_TICK;
+    place(t);
+    wheel.pending++;
+    pthread_mutex_unlock(&wheel.lock);
+
+    return 0;
+}
+
+//Refile a whole slot of an upper level one level down; returns its index
+unsigned int cascade(int level){
+    unsigned int idx;
+    Timer *t, *next;
+
+    idx = (unsigned int)(wheel.tick >> (EXPIRE_BITS * level)) & MASK;
+    t = wheel.slots[level][idx];
+    wheel.slots[level][idx] = NULL;
+    for(; t; t = next){
+        next = t->next;
+        place(t);
+    }
+
+    return idx;
+}
+
+/*Run the wheel up to now and return every timer that fell due, as one
+list. Needs wheel.lock.*/
+Timer *advance(unsigned long long now){
+    Timer *due, *t, *next;
+    unsigned int idx;
+    int level;
+
+    due = NULL;
+    while(wheel.tick <= now){
+        //Each time a level wraps, the next slot of the level above comes down
+        idx = (unsigned int)(wheel.tick & MASK);
+        for(level = 1; !idx && level < EXPIRE_LEVELS; level++)
+            idx = cascade(level);
+
+        t = wheel.slots[0][wheel.tick & MASK];
+        wheel.slots[0][wheel.tick & MASK] = NULL;
+        for(; t; t = next){
+            next = t->next;
+            t->next = due;
+            due = t;
+        }
+        wheel.tick++;
+    }
+
+    return due;
+}
+
+void *expire_loop(void *arg){
+    struct timespec deadline;
+    Timer *due, *t;
+    unsigned long long n;
+
+    (void)arg;
+    pthread_mutex_lock(&wheel.lock);
+    while(!wheel.stop){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += EXPIRE_TICK * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if(pthread_cond_timedwait(&wheel.wake, &wheel.lock, &deadline) != ETIMEDOUT)
+            continue;
+
+        if(!wheel.tick)
+            continue;
+        due = advance(expire_now() / EXPIRE_TICK);
+        if(!due)
+            continue;
+
+        //The wheel is free again while the keys are deleted
+        pthread_mutex_unlock(&wheel.lock);
+        for(n = 0; due; n++){
+            t = due;
+            due = t->next;
+            wheel.reap(t->names, t->names + t->pathlen + 1, t->when);
+            free(t);
+        }
+        pthread_mutex_lock(&wheel.lock);
+        wheel.pending -= n;
+    }
+    pthread_mutex_unlock(&wheel.lock);
+
+    return NULL;
+}
+
+/*Start deleting expired keys through reap. Returns 0 or -1 with errno set.*/
+int expire_start(Reap reap){
+    wheel.reap = reap;
+    wheel.running = true;
+    if(pthread_create(&wheel.thread, NULL, expire_loop, NULL)){
+        wheel.running = false;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+void expire_stop(void){
+    if(!wheel.running)
+        return;
+
+    pthread_mutex_lock(&wheel.lock);
+    wheel.stop = true;
+    pthread_cond_signal(&wheel.wake);
+    pthread_mutex_unlock(&wheel.lock);
+    pthread_join(wheel.thread, NULL);
+    wheel.running = wheel.stop = false;
+}
+
+//Deadlines queued and not yet handled, stale ones included
+unsigned long long expire_pending(void){
+    unsigned long long n;
+
+    pthread_mutex_lock(&wheel.lock);
+    n = wheel.pending;
+    pthread_mutex_unlock(&wheel.lock);
+
+    return n;
+}
@@ -0,0 +1,22 @@
+/*expire.h*/
+//Key expiry. A key's deadline is kept on its leaf (Leaf.expires, unix ms),
+//so every access can tell an expired key from a live one on the spot. The
+//keys nobody asks for again are found by a hierarchical timer wheel: four
+//levels of 256 slots, EXPIRE_TICK ms apart at the bottom, each level 256
+//times coarser than the one below. Adding a deadline and finding the due
+//ones both cost O(1) per key; a deadline is only moved down a level when
+//its slot comes round, at most three times. A thread of its own deletes
+//what falls due, one directory lock at a time.
+
+#define EXPIRE_TICK     10      //ms
+#define EXPIRE_BITS     8
+#define EXPIRE_LEVELS   4
+
+//Handles the timer of dir/key due at when: deletes the key or queues it again; see store_expired
+typedef int (*Reap)(const char *, const char *, unsigned long long);
+
+unsigned long long expire_now(void);
+int expire_add(const char *, const char *, unsigned long long);
+int expire_start(Reap);
+void expire_stop(void);
+unsigned long long expire_pending(void);
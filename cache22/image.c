@@ -0,0 +1,528 @@
+/*Writing and reading the mmap-able tree image*/
+#define _GNU_SOURCE
+#include "../tree/tree.h"
+#include "../tree/lock.h"
+#include "dump.h"
+#include "store.h"
+#include "image.h"
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<stddef.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGEMAGIC  "C22IMG02"
+#define IMAGEBUF    (1 << 20)
+
+struct s_imghead{
+    char magic[8];
+    uint64 size;
+    uint64 root;
+    uint64 dirs;
+    uint64 keys;
+    uint64 skeleton;    //the directory records, all together
+};
+typedef struct s_imghead ImgHead;
+
+struct s_imgdir{
+    uint64 children;
+    uint64 keys;
+    uint64 table;
+    uint64 nkeys;
+    uint64 ttl;         //lifetime of new keys in ms, 0 for none
+    uint32 nslots;
+    uint32 ndirs;
+    uint8_t namelen;
+    char name[];
+};
+typedef struct s_imgdir ImgDir;
+
+struct s_imgkey{
+    uint64 vallen;
+    uint64 expires;     //unix ms, 0 for never
+    uint32 hash;
+    uint32 keylen;
+    char key[];         //then the value, both NUL terminated
+};
+typedef struct s_imgkey ImgKey;
+
+struct s_image{
+    char *map;
+    size_t size;
+    bool enabled;
+};
+typedef struct s_image Image;
+
+//The image the server started from; it stays mapped for as long as any
+//directory still reads from it
+Image image;
+
+//A directory whose keys are written but whose record is not, yet
+struct s_dirmeta{
+    ImgDir rec;
+    const char *name;
+    uint64 *kids;       //indices of the children in ImgOut.dirs, by name
+    uint64 off;         //where the record goes
+};
+typedef struct s_dirmeta DirMeta;
+
+struct s_imgout{
+    int fd;
+    int err;
+    uint64 off;         //file offset of buf[0]
+    size_t len;
+    char *old;          //mapping of the previous image, for unloaded directories
+    DumpStats *st;
+    DirMeta *dirs;      //every directory so far, children before parents
+    uint64 ndirs;
+    uint64 capdirs;
+    char buf[IMAGEBUF];
+};
+typedef struct s_imgout ImgOut;
+
+static void out_flush(ImgOut *o){
+    size_t done;
+    ssize_t n;
+
+    for(done = 0; done < o->len && !o->err; done += n){
+        n = write(o->fd, o->buf + done, o->len - done);
+        if(n < 0){
+            if(errno == EINTR){
+                n = 0;
+                continue;
+            }
+            o->err = errno;
+        }
+    }
+    o->off += o->len;
+    o->len = 0;
+}
+
+//Append n bytes and return the offset they landed at
+static uint64 out_put(ImgOut *o, const void *p, size_t n){
+    uint64 at;
+    size_t room;
+
+    at = o->off + o->len;
+    while(n && !o->err){
+        room = IMAGEBUF - o->len;
+        if(!room){
+            out_flush(o);
+            continue;
+        }
+        if(room > n)
+            room = n;
+        memcpy(o->buf + o->len, p, room);
+        o->len += room;
+        p = (const char *)p + room;
+        n -= room;
+    }
+
+    return at;
+}
+
+static void out_align(ImgOut *o){
+    static const char pad[8];
+    uint64 at;
+
+    at = o->off + o->len;
+    if(at & 7)
+        out_put(o, pad, 8 - (at & 7));
+}
+
+#define ALIGN8(x)   (((x) + 7) & ~(uint64)7)
+
+static uint64 put_key(ImgOut *o, uint32 hash, const char *key, uint32 keylen,
+    const char *value, uint64 vallen, uint64 expires){
+    ImgKey k;
+    uint64 at;
+
+    out_align(o);
+    k.vallen = vallen;
+    k.expires = expires;
+    k.hash = hash;
+    k.keylen = keylen;
+    at = out_put(o, &k, offsetof(ImgKey, key));
+    out_put(o, key, keylen + 1);
+    out_put(o, value, vallen);
+    out_put(o, "", 1);
+    o->st->keys++;
+
+    return at;
+}
+
+static ImgOut *sort_out;
+
+static int cmp_kid(const void *a, const void *b){
+    return strcmp(sort_out->dirs[*(const uint64 *)a].name, sort_out->dirs[*(const uint64 *)b].name);
+}
+
+/*Write the keys of a directory and everything below it, children first,
+and return its index in o->dirs. Keys come from the tree, or from the old
+image if they were never loaded.*/
+static uint64 put_keys(ImgOut *o, const Node *n){
+    const ImgDir *od;
+    const ImgKey *ok;
+    const Leaf *l;
+    const Node *d;
+    const uint64 *okeys;
+    uint64 *kids, *keys, *table, nkeys, i, s;
+    uint32 *hashes, nslots, c;
+    DirMeta *m;
+
+    kids = (uint64 *)malloc((n->ndirs + 1) * sizeof(uint64));
+    if(!kids){
+        o->err = ENOMEM;
+        return 0;
+    }
+    for(c = 0, d = n->west; d && !o->err; d = d->next, c++)
+        kids[c] = put_keys(o, d);
+    sort_out = o;
+    qsort(kids, c, sizeof(uint64), cmp_kid);
+
+    od = n->image ? (const ImgDir *)(o->old + n->image) : NULL;
+    nkeys = od ? od->nkeys : n->nleaves;
+    for(nslots = 1; nslots < 2 * nkeys && nslots < (1u << 31); nslots <<= 1);
+    keys = (uint64 *)malloc((nkeys + 1) * sizeof(uint64));
+    hashes = (uint32 *)malloc((nkeys + 1) * sizeof(uint32));
+    table = (uint64 *)calloc(nslots, sizeof(uint64));
+    if(o->ndirs == o->capdirs){
+        o->capdirs = o->capdirs ? o->capdirs * 2 : 1024;
+        m = (DirMeta *)realloc(o->dirs, o->capdirs * sizeof(DirMeta));
+        if(m)
+            o->dirs = m;
+        else
+            o->capdirs = 0;
+    }
+    if(!keys || !hashes || !table || !o->capdirs){
+        o->err = ENOMEM;
+        free(kids);
+        free(keys);
+        free(hashes);
+        free(table);
+        return 0;
+    }
+
+    if(od){
+        okeys = (const uint64 *)(o->old + od->keys);
+        for(i=0; i<nkeys; i++){
+            ok = (const ImgKey *)(o->old + okeys[i]);
+            hashes[i] = ok->hash;
+            keys[i] = put_key(o, ok->hash, ok->key, ok->keylen,
+                ok->key + ok->keylen + 1, ok->vallen, ok->expires);
+        }
+    }
+    else{
+        for(i = 0, l = (const Leaf *)n->east; l; l = l->east, i++){
+            hashes[i] = l->hash;
+            keys[i] = put_key(o, l->hash, (const char *)l->key,
+                (uint32)strlen((const char *)l->key), (const char *)l->value, l->size - 1,
+                l->expires);
+        }
+    }
+
+    for(i=0; i<nkeys; i++){
+        for(s = hashes[i] & (nslots - 1); table[s]; s = (s + 1) & (nslots - 1));
+        table[s] = keys[i];
+    }
+
+    m = &o->dirs[o->ndirs];
+    memset(m, 0, sizeof(*m));
+    out_align(o);
+    m->rec.keys = out_put(o, keys, nkeys * sizeof(uint64));
+    m->rec.table = out_put(o, table, nslots * sizeof(uint64));
+    m->rec.nkeys = nkeys;
+    m->rec.ttl = n->ttl;
+    m->rec.nslots = nslots;
+    m->rec.ndirs = c;
+    m->name = (n->tag & TagRoot) ? "" : (const char *)n->path;
+    m->rec.namelen = (uint8_t)strlen(m->name);
+    m->kids = kids;
+    o->st->dirs++;
+
+    free(keys);
+    free(hashes);
+    free(table);
+    return o->ndirs++;
+}
+
+/*Write the whole tree as an image. Nothing may change the tree meanwhile:
+call it with the tree locked or from a forked child. Returns 0 or -1 with
+errno set.*/
+int image_write(int fd, DumpStats *st){
+    DirMeta *m;
+    ImgOut *o;
+    ImgHead h;
+    uint64 i, k, at;
+    int err;
+
+    o = (ImgOut *)calloc(1, sizeof(ImgOut));
+    if(!o){
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    o->fd = fd;
+    o->old = image.map;
+    o->st = st;
+
+    //The header goes in last, once the root's offset is known
+    memset(&h, 0, sizeof(h));
+    out_put(o, &h, sizeof(h));
+    put_keys(o, &root.n);
+
+    //All directory records together at the end, so opening the image
+    //reads one stretch of the file
+    out_align(o);
+    h.skeleton = at = o->off + o->len;
+    for(i=0; !o->err && i<o->ndirs; i++){
+        m = &o->dirs[i];
+        m->off = at;
+        m->rec.children = at + ALIGN8(offsetof(ImgDir, name) + m->rec.namelen + 1);
+        at = m->rec.children + m->rec.ndirs * sizeof(uint64);
+    }
+    for(i=0; !o->err && i<o->ndirs; i++){
+        m = &o->dirs[i];
+        out_put(o, &m->rec, offsetof(ImgDir, name));
+        out_put(o, m->name, m->rec.namelen + 1);
+        out_align(o);
+        for(k=0; k<m->rec.ndirs; k++)
+            out_put(o, &o->dirs[m->kids[k]].off, sizeof(uint64));
+    }
+    if(o->ndirs)
+        h.root = o->dirs[o->ndirs - 1].off;
+    out_flush(o);
+
+    memcpy(h.magic, IMAGEMAGIC, 8);
+    h.size = o->off;
+    h.dirs = st->dirs;
+    h.keys = st->keys;
+    st->bytes = o->off;
+    if(!o->err && pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+        o->err = errno ? errno : EIO;
+
+    err = o->err;
+    for(i=0; i<o->ndirs; i++)
+        free(o->dirs[i].kids);
+    free(o->dirs);
+    free(o);
+    if(err){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+//The record at off, if it and its fixed part lie inside the mapping
+static const void *rec(uint64 off, size_t len){
+    if(off < sizeof(ImgHead) || off > image.size || len > image.size - off || (off & 7))
+        return NULL;
+    return image.map + off;
+}
+
+/*Create the directories of an image record and mark which of them still
+have their keys in the mapping. Only the fixed parts are checked here;
+the key records are checked as they are read.*/
+static int attach(Node *n, uint64 off, int depth){
+    const ImgDir *d, *c;
+    const uint64 *kids;
+    Node *child;
+    uint32 i;
+
+    d = (const ImgDir *)rec(off, offsetof(ImgDir, name) + 1);
+    if(!d || depth > MAX_PATH_LENGTH / 2
+        || !rec(d->children, (size_t)d->ndirs * sizeof(uint64))
+        || !rec(d->keys, d->nkeys * sizeof(uint64))
+        || !d->nslots || (d->nslots & (d->nslots - 1))
+        || !rec(d->table, (size_t)d->nslots * sizeof(uint64))){
+        errno = EPROTO;
+        return -1;
+    }
+
+    kids = (const uint64 *)(image.map + d->children);
+    for(i=0; i<d->ndirs; i++){
+        c = (const ImgDir *)rec(kids[i], offsetof(ImgDir, name) + 1);
+        if(!c || !rec(kids[i], offsetof(ImgDir, name) + c->namelen + 1) || !c->namelen
+            || c->name[c->namelen]){
+            errno = EPROTO;
+            return -1;
+        }
+        child = search_node(n, (const int8 *)c->name);
+        if(!child && !(child = create_node(n, (const int8 *)c->name)))
+            return -1;
+        if(attach(child, kids[i], depth + 1))
+            return -1;
+    }
+
+    n->image = d->nkeys ? off : 0;
+    n->ttl = d->ttl;
+    return 0;
+}
+
+/*Map the image at path and build its directories; keys stay in the file.
+A missing file is an empty image. Either way SAVE and BGSAVE write images
+from here on. Call it before any thread uses the store. Returns 0 or -1
+with errno set.*/
+int image_open(const char *path){
+    const ImgHead *h;
+    uint64 page;
+    struct stat st;
+    char *map;
+    int fd;
+
+    image.enabled = true;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return (errno == ENOENT) ? 0 : -1;
+    if(fstat(fd, &st)){
+        close(fd);
+        return -1;
+    }
+    if((size_t)st.st_size < sizeof(ImgHead)){
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    h = (const ImgHead *)map;
+    if(memcmp(h->magic, IMAGEMAGIC, 8) || h->size != (uint64)st.st_size
+        || h->skeleton > h->size){
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+
+    //The keys fault in as they are read; the directories are needed now
+    page = h->skeleton & ~(uint64)(sysconf(_SC_PAGESIZE) - 1);
+    madvise(map + page, h->size - page, MADV_WILLNEED);
+
+    image.map = map;
+    image.size = st.st_size;
+    tree_wrlock();
+    if(attach(&root.n, h->root, 0)){
+        tree_unlock();
+        return -1;
+    }
+    tree_unlock();
+
+    return 0;
+}
+
+bool image_enabled(void){
+    return image.enabled;
+}
+
+static const ImgKey *key_at(uint64 off){
+    const ImgKey *k;
+
+    k = (const ImgKey *)rec(off, offsetof(ImgKey, key));
+    if(!k || k->vallen > image.size || !rec(off, offsetof(ImgKey, key) + (uint64)k->keylen + k->vallen + 2))
+        return NULL;
+    return k;
+}
+
+/*The value of key in a directory still read from the image and its
+deadline, or NULL with errno = ENOENT. Keys past their deadline are gone.*/
+const char *image_value(const Node *n, const char *key, unsigned long *len,
+    unsigned long long *expires){
+    const ImgDir *d;
+    const ImgKey *k;
+    const uint64 *table;
+    uint32 hash, s, mask;
+    size_t klen;
+
+    d = (const ImgDir *)(image.map + n->image);
+    table = (const uint64 *)(image.map + d->table);
+    hash = index_hash((const int8 *)key);
+    klen = strlen(key);
+    mask = d->nslots - 1;
+
+    for(s = hash & mask; table[s]; s = (s + 1) & mask){
+        k = key_at(table[s]);
+        if(!k)
+            break;
+        if(k->hash == hash && k->keylen == klen && !memcmp(k->key, key, klen)){
+            if(k->expires && k->expires <= expire_now())
+                break;
+            *len = (unsigned long)k->vallen;
+            *expires = k->expires;
+            return k->key + klen + 1;
+        }
+    }
+
+    errno = ENOENT;
+    return NULL;
+}
+
+//Pass every live key and its value size to cb, in creation order
+int image_each(const Node *n, Entry cb, void *ctx){
+    const ImgDir *d;
+    const ImgKey *k;
+    const uint64 *keys;
+    uint64 i, now;
+
+    now = expire_now();
+    d = (const ImgDir *)(image.map + n->image);
+    keys = (const uint64 *)(image.map + d->keys);
+    for(i=0; i<d->nkeys; i++){
+        k = key_at(keys[i]);
+        if(!k){
+            errno = EPROTO;
+            return -1;
+        }
+        if(k->expires && k->expires <= now)
+            continue;
+        if(cb(ctx, 'f', k->key, (unsigned long)k->vallen) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*Copy a directory's keys out of the image into the tree, before the first
+change to it. Expired keys are left behind and the rest go on the timer
+wheel. Needs the directory's write lock. Returns 0 or -1 with errno set,
+in which case the directory still reads from the image.*/
+int image_fault(Node *n){
+    char path[MAX_PATH_LENGTH];
+    const ImgDir *d;
+    const ImgKey *k;
+    const uint64 *keys;
+    uint64 i, now;
+    Leaf *l;
+
+    d = (const ImgDir *)(image.map + n->image);
+    keys = (const uint64 *)(image.map + d->keys);
+    if(d->nkeys > UINT32_MAX || index_reserve(&n->index, (uint32)d->nkeys)
+        || node_path(n, (int8 *)path, sizeof(path)) < 0)
+        return -1;
+
+    now = expire_now();
+    for(i=0; i<d->nkeys; i++){
+        k = key_at(keys[i]);
+        if(!k)
+            errno = EPROTO;
+        else if(k->expires && k->expires <= now)
+            continue;
+        if(!k || !(l = create_leaf(n, (const int8 *)k->key, (const int8 *)k->key + k->keylen + 1,
+            k->vallen + 1)) || (k->expires && expire_add(path, k->key, k->expires))){
+            clear_leaves(n);
+            return -1;
+        }
+        l->expires = l->timer = k->expires;
+    }
+
+    n->image = 0;
+    return 0;
+}
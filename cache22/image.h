@@ -0,0 +1,35 @@
+/*image.h*/
+//A pointer-free image of the tree that is used straight from an mmap of
+//the file. Everything refers to everything else by its offset from the
+//start of the file, so a mapping anywhere in memory is ready to read:
+//
+//  header      "C22IMG02" | u64 size | u64 root | u64 dirs | u64 keys
+//              | u64 skeleton
+//  key         u64 vallen | u64 expires | u32 hash | u32 keylen | key NUL
+//              | value NUL
+//  directory   u64 children | u64 keys | u64 table | u64 nkeys | u64 ttl
+//              | u32 nslots | u32 ndirs | u8 namelen | name NUL
+//
+//children points at ndirs directory offsets sorted by name, keys at nkeys
+//key offsets in creation order and table at nslots key offsets placed by
+//hash (0 is an empty slot). Every record starts 8-byte aligned. The keys
+//and their arrays come first; the directory records follow together from
+//skeleton on, children before parents, so the root comes last.
+//
+//Opening an image only creates the directories. Their keys are read from
+//the mapping, faulting pages in as they are touched, until something
+//changes the directory; then its keys are copied into the tree first.
+//Keys keep their deadlines in the file and expire lazily: readers skip
+//them and they are dropped when the directory is copied in.
+
+//Include after dump.h and store.h
+typedef struct s_node Node;
+
+int image_open(const char *);
+bool image_enabled(void);
+int image_write(int, DumpStats *);
+
+//These take a directory whose image field is set, with its lock held
+const char *image_value(const Node *, const char *, unsigned long *, unsigned long long *);
+int image_each(const Node *, Entry, void *);
+int image_fault(Node *);
@@ -0,0 +1,192 @@
+/*imagebench: startup time of loading a dump against mapping an image*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<time.h>
+
+#include <sys/resource.h>
+
+#include "store.h"
+#include "dump.h"
+#include "image.h"
+
+#define DIRS    1000
+#define VALUE   16      //bytes per value
+#define GETS    1000    //random reads right after startup
+
+double now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+int noop(void *ctx, const char *buf, unsigned long len){
+    (void)ctx;
+    (void)buf;
+    (void)len;
+    return 0;
+}
+
+//Fill the store with n keys and write it out both ways
+int build(unsigned long n, const char *dump, const char *img){
+    char dir[32], key[32], value[VALUE + 24];
+    DumpStats st;
+    unsigned long i;
+    int fd;
+
+    store_init();
+    store_mkdir("/bench");
+    for(i=0; i<DIRS; i++){
+        snprintf(dir, sizeof(dir), "/bench/d%lu", i);
+        store_mkdir(dir);
+    }
+    for(i=0; i<n; i++){
+        snprintf(dir, sizeof(dir), "/bench/d%lu", i % DIRS);
+        snprintf(key, sizeof(key), "k%lu", i);
+        snprintf(value, sizeof(value), "%0*lu", VALUE, i);
+        if(store_set(dir, key, value, VALUE)){
+            perror("SET");
+            return 1;
+        }
+    }
+
+    fd = open(dump, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || dump_write(fd, 0, false, &st) || close(fd)){
+        perror(dump);
+        return 1;
+    }
+    fd = open(img, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || image_write(fd, &st) || close(fd)){
+        perror(img);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*One startup in a fresh process: load or map the file, then read GETS
+random keys. Cold runs drop the file from the page cache first.*/
+int start(const char *mode, const char *path, unsigned long n, bool cold){
+    char dir[32], key[32];
+    struct rusage ru;
+    double t0, t1, t2;
+    unsigned int seed;
+    unsigned long i, k;
+    DumpStats st;
+    int fd, ret;
+
+    if(cold){
+        fd = open(path, O_RDONLY);
+        if(fd >= 0){
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+
+    store_init();
+    t0 = now_ms();
+    ret = strcmp(mode, "image") ? dump_load(path, &st) : image_open(path);
+    t1 = now_ms();
+    if(ret){
+        perror(path);
+        return 1;
+    }
+
+    seed = 42;
+    for(i=0; i<GETS; i++){
+        k = (unsigned long)rand_r(&seed) % n;
+        snprintf(dir, sizeof(dir), "/bench/d%lu", k % DIRS);
+        snprintf(key, sizeof(key), "k%lu", k);
+        if(store_get(dir, key, noop, NULL) != 1){
+            fprintf(stderr, "%s: %s/%s missing\n", path, dir, key);
+            return 1;
+        }
+    }
+    t2 = now_ms();
+
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%.1f %.2f %ld\n", t1 - t0, t2 - t1, ru.ru_maxrss / 1024);
+    return 0;
+}
+
+//Run this program again with args and read its one line of output
+bool child(char *args, double *open_ms, double *get_ms, long *rss){
+    char cmd[1100], line[128];
+    FILE *p;
+    bool ok;
+
+    snprintf(cmd, sizeof(cmd), "/proc/%d/exe %s", (int)getpid(), args);
+    p = popen(cmd, "r");
+    if(!p)
+        return false;
+    ok = fgets(line, sizeof(line), p) && sscanf(line, "%lf %lf %ld", open_ms, get_ms, rss) == 3;
+    return !pclose(p) && ok;
+}
+
+int main(int argc, char *argv[]){
+    static const unsigned long defaults[] = {1000000, 10000000};
+    static const char *modes[] = {"dump", "image"};
+    char args[1024], dump[256], img[256], *files[2];
+    double open_ms, get_ms;
+    unsigned long counts[8], n;
+    int ncounts, c, m, cold;
+    long rss;
+    FILE *f;
+
+    //Internal: imagebench -build n dump image / -start mode path n cold
+    if(argc == 5 && !strcmp(argv[1], "-build"))
+        return build(strtoul(argv[2], NULL, 10), argv[3], argv[4]);
+    if(argc == 6 && !strcmp(argv[1], "-start"))
+        return start(argv[2], argv[3], strtoul(argv[4], NULL, 10), atoi(argv[5]));
+
+    //imagebench [dir] [keys...]
+    ncounts = 0;
+    for(c=2; c<argc && ncounts<8; c++)
+        counts[ncounts++] = strtoul(argv[c], NULL, 10);
+    if(!ncounts){
+        memcpy(counts, defaults, sizeof(defaults));
+        ncounts = 2;
+    }
+    snprintf(dump, sizeof(dump), "%s/imagebench.dump", argc > 1 ? argv[1] : ".");
+    snprintf(img, sizeof(img), "%s/imagebench.img", argc > 1 ? argv[1] : ".");
+    files[0] = dump;
+    files[1] = img;
+
+    printf("%d directories, %d-byte values, %d random GETs after startup\n", DIRS, VALUE, GETS);
+    printf("%10s %6s %9s %6s %12s %12s %9s\n", "keys", "file", "MB", "cache", "startup ms", "GETs ms", "RSS MB");
+
+    for(c=0; c<ncounts; c++){
+        n = counts[c];
+        snprintf(args, sizeof(args), "/proc/%d/exe -build %lu %s %s", (int)getpid(), n, dump, img);
+        if(system(args)){
+            fprintf(stderr, "building %lu keys failed\n", n);
+            return 1;
+        }
+
+        for(m=0; m<2; m++){
+            for(cold=1; cold>=0; cold--){
+                snprintf(args, sizeof(args), "-start %s %s %lu %d", modes[m], files[m], n, cold);
+                if(!child(args, &open_ms, &get_ms, &rss)){
+                    fprintf(stderr, "%s run failed\n", modes[m]);
+                    return 1;
+                }
+                f = fopen(files[m], "r");
+                fseek(f, 0, SEEK_END);
+                printf("%10lu %6s %9.1f %6s %12.1f %12.2f %9ld\n", n, modes[m],
+                    (double)ftell(f) / 1e6, cold ? "cold" : "warm", open_ms, get_ms, rss);
+                fclose(f);
+            }
+        }
+    }
+    unlink(dump);
+    unlink(img);
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*lockbench: GET throughput of the shared store at 1, 2, 4, 8 and 16 threads,
+and how MKDIR/RMDIR fare against those readers*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<pthread.h>
+#include<time.h>
+#include<stdatomic.h>
+
+#include "store.h"
+
+#define DIRS    64      //every thread count divides this
+#define KEYS    10000   //keys per directory
+#define MAXT    16
+
+struct s_worker{
+    pthread_t tid;
+    int id;
+    int nthreads;
+    bool shared;        //all threads read one directory instead of their own
+    unsigned long ops;
+};
+typedef struct s_worker Worker;
+
+atomic_bool running;
+
+//The one writer of a mixed run: MKDIR and RMDIR of a scratch directory
+struct s_writer{
+    pthread_t tid;
+    unsigned long ops;
+    double worst;       //longest single MKDIR or RMDIR, in ms
+};
+typedef struct s_writer Writer;
+
+double ms_since(const struct timespec *t){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - t->tv_sec) * 1e3 + (double)(now.tv_nsec - t->tv_nsec) / 1e6;
+}
+
+void *writer(void *arg){
+    struct timespec t;
+    Writer *w;
+    double ms;
+
+    w = (Writer *)arg;
+    while(running){
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if(store_mkdir("/bench/scratch") || store_rmdir("/bench/scratch", false)){
+            fprintf(stderr, "mkdir/rmdir failed\n");
+            exit(1);
+        }
+        ms = ms_since(&t);
+        if(ms > w->worst)
+            w->worst = ms;
+        w->ops++;
+    }
+
+    return NULL;
+}
+
+int sink(void *ctx, const char *buf, unsigned long len){
+    (void)ctx; (void)buf;
+    return (int)len;
+}
+
+void *worker(void *arg){
+    Worker *w;
+    char dir[32], key[32];
+    unsigned int seed;
+    unsigned long ops;
+    int d;
+
+    w = (Worker *)arg;
+    seed = (unsigned int)w->id * 2654435761u + 1;
+    ops = 0;
+
+    while(running){
+        //Own mode: thread i only touches directories i, i+n, i+2n, ...
+        d = w->shared ? 0 : w->id + w->nthreads * (rand_r(&seed) % (DIRS / w->nthreads));
+        snprintf(dir, sizeof(dir), "/bench/d%d", d);
+        snprintf(key, sizeof(key), "k%d", rand_r(&seed) % KEYS);
+        if(store_get(dir, key, sink, NULL) != 1){
+            fprintf(stderr, "lookup of %s/%s failed\n", dir, key);
+            exit(1);
+        }
+        ops++;
+    }
+
+    w->ops = ops;
+    return NULL;
+}
+
+/*GET/s of nthreads readers over `seconds`; with wr, one more thread
+creates and removes a directory all along*/
+double run(int nthreads, bool shared, double seconds, Writer *wr){
+    Worker w[MAXT];
+    struct timespec ts, start, end;
+    unsigned long total;
+    int i;
+
+    running = true;
+    if(wr){
+        wr->ops = 0;
+        wr->worst = 0;
+        pthread_create(&wr->tid, NULL, writer, wr);
+    }
+    for(i=0; i<nthreads; i++){
+        w[i].id = i;
+        w[i].nthreads = nthreads;
+        w[i].shared = shared;
+        w[i].ops = 0;
+        pthread_create(&w[i].tid, NULL, worker, &w[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    running = false;
+
+    total = 0;
+    for(i=0; i<nthreads; i++){
+        pthread_join(w[i].tid, NULL);
+        total += w[i].ops;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if(wr)
+        pthread_join(wr->tid, NULL);
+
+    return (double)total / ((double)(end.tv_sec - start.tv_sec) +
+        (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char *argv[]){
+    static const int threads[] = {1, 2, 4, 8, 16};
+    char dir[32], key[32], value[32];
+    double seconds, base_own, base_shared, own, shared;
+    Writer wr;
+    int d, k, i;
+
+    seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+
+    store_init();
+    store_mkdir("/bench");
+    for(d=0; d<DIRS; d++){
+        snprintf(dir, sizeof(dir), "/bench/d%d", d);
+        store_mkdir(dir);
+        for(k=0; k<KEYS; k++){
+            snprintf(key, sizeof(key), "k%d", k);
+            snprintf(value, sizeof(value), "value-%d-%d", d, k);
+            store_set(dir, key, value, strlen(value));
+        }
+    }
+
+    printf("%d directories x %d keys, %.1fs per run\n", DIRS, KEYS, seconds);
+    printf("%8s %16s %8s %16s %8s\n", "threads", "own dirs GET/s", "scale", "one dir GET/s", "scale");
+
+    base_own = base_shared = 0;
+    for(i=0; i<(int)(sizeof(threads)/sizeof(threads[0])); i++){
+        own = run(threads[i], false, seconds, NULL);
+        shared = run(threads[i], true, seconds, NULL);
+        if(!i){
+            base_own = own;
+            base_shared = shared;
+        }
+        printf("%8d %16.0f %7.2fx %16.0f %7.2fx\n", threads[i],
+            own, own / base_own, shared, shared / base_shared);
+    }
+
+    //A writer must get through however many readers keep the tree busy
+    printf("\n%8s %16s %16s %12s\n", "threads", "own dirs GET/s", "MKDIR+RMDIR/s", "worst ms");
+    for(i=0; i<(int)(sizeof(threads)/sizeof(threads[0])); i++){
+        own = run(threads[i], false, seconds, &wr);
+        printf("%8d %16.0f %16.0f %12.2f\n", threads[i], own, (double)wr.ops / seconds, wr.worst);
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*pipebench: GET throughput against a running cache22 at pipeline depth 1 and 64*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<time.h>
+#include<errno.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define KEYS    1000
+#define MAXDEPTH 64
+
+char rbuf[1 << 20];
+int rlen;
+
+int connectto(const char *host, int port){
+    struct sockaddr_in sock;
+    int s, one;
+
+    sock.sin_family = AF_INET;
+    sock.sin_port = htons(port);
+    sock.sin_addr.s_addr = inet_addr(host);
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if(s < 0 || connect(s, (struct sockaddr *)&sock, sizeof(sock))){
+        perror("connect");
+        exit(1);
+    }
+
+    //Without this depth 1 measures Nagle's delay instead of the server
+    one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return s;
+}
+
+void sendall(int s, const char *buf, size_t len){
+    ssize_t n;
+
+    while(len){
+        n = write(s, buf, len);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+/*Read until `lines` full response lines have arrived*/
+void readlines(int s, int lines){
+    char *nl;
+    ssize_t n;
+
+    while(lines){
+        while(lines && (nl = memchr(rbuf, '\n', rlen))){
+            rlen -= (int)(nl + 1 - rbuf);
+            memmove(rbuf, nl + 1, rlen);
+            lines--;
+        }
+        if(!lines)
+            break;
+
+        n = read(s, rbuf + rlen, sizeof(rbuf) - rlen);
+        if(n <= 0){
+            fprintf(stderr, "server closed the connection\n");
+            exit(1);
+        }
+        rlen += (int)n;
+    }
+}
+
+double run(int s, int depth, int requests){
+    static char batch[MAXDEPTH * 64];
+    struct timespec start, end;
+    int done, i, len;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(done=0; done<requests; done+=depth){
+        len = 0;
+        for(i=0; i<depth; i++){
+            len += snprintf(batch + len, sizeof(batch) - len,
+                "GET /pipebench k%d\n", (done + i) % KEYS);
+        }
+        sendall(s, batch, len);
+        readlines(s, depth);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)done / ((double)(end.tv_sec - start.tv_sec) +
+        (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char *argv[]){
+    char line[128];
+    int s, port, requests, k, len;
+    double one, deep;
+
+    port = (argc > 1) ? atoi(argv[1]) : 12049;
+    requests = (argc > 2) ? atoi(argv[2]) : 200000;
+    requests -= requests % MAXDEPTH;
+
+    s = connectto("127.0.0.1", port);
+    readlines(s, 1);//the greeting
+
+    len = snprintf(line, sizeof(line), "MKDIR /pipebench\n");
+    sendall(s, line, len);
+    readlines(s, 1);
+    for(k=0; k<KEYS; k++){
+        len = snprintf(line, sizeof(line), "SET /pipebench k%d value-%d\n", k, k);
+        sendall(s, line, len);
+    }
+    readlines(s, KEYS);
+
+    one = run(s, 1, requests);
+    deep = run(s, MAXDEPTH, requests);
+
+    printf("%d GETs per run\n", requests);
+    printf("%8s %14s %8s\n", "depth", "GET/s", "speedup");
+    printf("%8d %14.0f %7.2fx\n", 1, one, 1.0);
+    printf("%8d %14.0f %7.2fx\n", MAXDEPTH, deep, deep / one);
+
+    close(s);
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*The work-stealing pool behind recursive walks (see pool.h)*/
+#include "../tree/tree.h"
+#include "../tree/lock.h"
+#include "pool.h"
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<errno.h>
+#include<sched.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<stdatomic.h>
+
+struct s_job{
+    PoolVisit visit;
+    void *ctx;
+    atomic_ulong pending;       //directories queued or being visited
+    atomic_bool failed;
+    bool flat;                  //visit the given directories only, not what is below
+    int err;                    //errno of the visit that failed
+};
+typedef struct s_job Job;
+
+struct s_task{
+    Node *dir;
+    Job *job;
+};
+typedef struct s_task Task;
+
+/*One worker's deque: the owner pushes and pops at the bottom, thieves
+take from the top. A plain mutex guards it, and it is only contended
+while someone steals.*/
+struct s_deque{
+    pthread_mutex_t lock;
+    Task *tasks;
+    unsigned long top;          //oldest task
+    unsigned long bottom;       //one past the newest
+    unsigned long cap;
+    unsigned int id;
+    pthread_t thread;
+};
+typedef struct s_deque Deque;
+
+struct s_pool{
+    pthread_mutex_t lock;       //guards sleeping and waking, not the deques
+    pthread_cond_t work;        //idle workers wait here
+    pthread_cond_t done;        //callers of pool_walk wait here
+    Deque workers[POOL_MAX];
+    unsigned int nthreads;
+    atomic_ulong queued;        //tasks in all deques
+    atomic_uint idle;           //workers asleep or about to be
+    atomic_uint next;           //deque the next walk starts on
+    bool running;
+    bool stop;
+};
+typedef struct s_pool Pool;
+
+Pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+
+//Queue a task at the bottom of q. Returns 0 or -1 if there is no room.
+int pool_push(Deque *q, Task t){
+    Task *p;
+    unsigned long cap;
+
+    pthread_mutex_lock(&q->lock);
+    if(q->bottom == q->cap){
+        if(q->top){
+            memmove(q->tasks, q->tasks + q->top, (q->bottom - q->top) * sizeof(Task));
+            q->bottom -= q->top;
+            q->top = 0;
+        }
+        else{
+            cap = q->cap ? q->cap * 2 : 64;
+            p = (Task *)realloc(q->tasks, cap * sizeof(Task));
+            if(!p){
+                pthread_mutex_unlock(&q->lock);
+                return -1;
+            }
+            q->tasks = p;
+            q->cap = cap;
+        }
+    }
+    q->tasks[q->bottom++] = t;
+    pthread_mutex_unlock(&q->lock);
+
+    //Pairs with the check a worker makes before sleeping
+    atomic_fetch_add(&pool.queued, 1);
+    if(atomic_load(&pool.idle)){
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_signal(&pool.work);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    return 0;
+}
+
+//The newest task of q from its own worker, or the oldest for a thief
+bool pool_take(Deque *q, bool own, Task *t){
+    bool found;
+
+    pthread_mutex_lock(&q->lock);
+    found = q->bottom > q->top;
+    if(found)
+        *t = own ? q->tasks[--q->bottom] : q->tasks[q->top++];
+    if(q->top == q->bottom)
+        q->top = q->bottom = 0;
+    pthread_mutex_unlock(&q->lock);
+
+    if(found)
+        atomic_fetch_sub(&pool.queued, 1);
+    return found;
+}
+
+//Own deque first, then every other one in turn
+bool pool_find(Deque *w, Task *t){
+    unsigned int i;
+
+    if(pool_take(w, true, t))
+        return true;
+    for(i=1; i<pool.nthreads; i++)
+        if(pool_take(&pool.workers[(w->id + i) % pool.nthreads], false, t))
+            return true;
+
+    return false;
+}
+
+void pool_finish(Job *job){
+    if(atomic_fetch_sub(&job->pending, 1) == 1){
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_broadcast(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+/*Queue a directory's subdirectories, then visit it. They are queued last
+first, so this worker goes on in creation order (the order they sit in
+memory) while thieves take from the far end. Each link is read before its
+directory is queued, since a thief may free it at once. A walk reads the
+links under the tree lock, held for this one directory and dropped before
+the visit; a subdirectory that finds no room in the deque then fails the
+walk, as it cannot be run here with the lock held.*/
+void pool_run(Deque *w, Task t){
+    Job *job;
+    Node *d, *prev;
+
+    job = t.job;
+    if(!atomic_load(&job->failed)){
+        if(!job->flat)
+            tree_rdlock();
+        for(d = job->flat ? NULL : t.dir->last_dir; d; d = prev){
+            prev = d->prev;
+            atomic_fetch_add(&job->pending, 1);
+            if(!pool_push(w, (Task){d, job}))
+                continue;
+            pool_finish(job);
+            if(!atomic_exchange(&job->failed, true))
+                job->err = ENOMEM;
+            break;
+        }
+        if(!job->flat)
+            tree_unlock();
+        if(job->visit(job->ctx, w->id, t.dir) < 0 && !atomic_exchange(&job->failed, true))
+            job->err = errno;
+    }
+
+    pool_finish(job);
+}
+
+void *pool_loop(void *arg){
+    Deque *w;
+    Task t;
+    bool stopping;
+
+    w = (Deque *)arg;
+    for(;;){
+        if(pool_find(w, &t)){
+            pool_run(w, t);
+            continue;
+        }
+        //Counted but not popped yet: someone is about to take it
+        if(atomic_load(&pool.queued)){
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        atomic_fetch_add(&pool.idle, 1);
+        while(!atomic_load(&pool.queued) && !pool.stop)
+            pthread_cond_wait(&pool.work, &pool.lock);
+        atomic_fetch_sub(&pool.idle, 1);
+        stopping = pool.stop && !atomic_load(&pool.queued);
+        pthread_mutex_unlock(&pool.lock);
+        if(stopping)
+            break;
+    }
+
+    return NULL;
+}
+
+/*Start the workers, one per online CPU when n is 0. Until then, and after
+pool_stop, walks run on the caller's thread. Returns 0 or -1 with errno set.*/
+int pool_start(unsigned int n){
+    long cpus;
+    unsigned int i;
+
+    if(!n){
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (cpus < 1) ? 1 : (cpus > POOL_MAX) ? POOL_MAX : (unsigned int)cpus;
+    }
+    if(n > POOL_MAX){
+        errno = EINVAL;
+        return -1;
+    }
+
+    pool.nthreads = n;
+    for(i=0; i<n; i++){
+        pthread_mutex_init(&pool.workers[i].lock, NULL);
+        pool.workers[i].id = i;
+    }
+    for(i=0; i<n; i++){
+        if(pthread_create(&pool.workers[i].thread, NULL, pool_loop, &pool.workers[i])){
+            pool.nthreads = i;
+            pool_stop();
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    pool.running = true;
+
+    return 0;
+}
+
+//Finishes whatever is queued, then joins the workers
+void pool_stop(void){
+    unsigned int i;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    //Every worker may look into every deque until it exits
+    for(i=0; i<pool.nthreads; i++)
+        pthread_join(pool.workers[i].thread, NULL);
+    for(i=0; i<pool.nthreads; i++){
+        free(pool.workers[i].tasks);
+        pool.workers[i].tasks = NULL;
+        pool.workers[i].top = pool.workers[i].bottom = pool.workers[i].cap = 0;
+    }
+    pool.running = pool.stop = false;
+    pool.nthreads = 0;
+}
+
+//Workers running, 0 when walks run on the caller's thread
+unsigned int pool_threads(void){
+    return pool.running ? pool.nthreads : 0;
+}
+
+//Without the pool (the benches): children first, under the tree lock throughout
+int pool_walk_here(Node *n, PoolVisit visit, void *ctx){
+    Node *d, *next;
+
+    for(d = n->west; d; d = next){
+        next = d->next;
+        if(pool_walk_here(d, visit, ctx))
+            return -1;
+    }
+
+    return (visit(ctx, 0, n) < 0) ? -1 : 0;
+}
+
+/*Visit top and every directory below it, in no particular order, and
+return once all are done. The caller must not hold the tree lock: each
+task takes it only to read its own directory's subdirectories, and visits
+run without it (node locks are theirs to take), so MKDIR and RMDIR wait
+for one directory's links at most. The directories must stay in memory
+for the call, detached or not (reclaim_hold). Returns 0, or -1 with the
+errno of the first visit that failed; the walk stops there, with some
+directories left unvisited.*/
+int pool_walk(Node *top, PoolVisit visit, void *ctx){
+    Job job;
+    Deque *q;
+    int ret;
+
+    if(!pool.running){
+        tree_rdlock();
+        ret = pool_walk_here(top, visit, ctx);
+        tree_unlock();
+        return ret;
+    }
+
+    job.visit = visit;
+    job.ctx = ctx;
+    job.flat = false;
+    job.err = 0;
+    atomic_init(&job.pending, 1);
+    atomic_init(&job.failed, false);
+
+    //Walks start on the deques in turn, to be stolen from there
+    q = &pool.workers[atomic_fetch_add(&pool.next, 1) % pool.nthreads];
+    if(pool_push(q, (Task){top, &job})){
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    while(atomic_load(&job.pending))
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    if(atomic_load(&job.failed)){
+        errno = job.err;
+        return -1;
+    }
+    return 0;
+}
+
+/*Visit each of the n directories in dirs, but nothing below them, spread
+over the workers, and return once all are done. Each is one task, so a
+batch of bounded visits holds the deques only briefly and never gets in
+front of a walk for long. Returns as pool_walk.*/
+int pool_each(Node **dirs, unsigned int n, PoolVisit visit, void *ctx){
+    Job job;
+    unsigned int i, first;
+    int ret;
+
+    ret = 0;
+    if(!pool.running){
+        for(i=0; i<n; i++)
+            if(visit(ctx, 0, dirs[i]) < 0)
+                ret = -1;
+        return ret;
+    }
+
+    job.visit = visit;
+    job.ctx = ctx;
+    job.flat = true;
+    job.err = 0;
+    atomic_init(&job.pending, n);
+    atomic_init(&job.failed, false);
+
+    //One task per deque in turn, so idle workers need not steal them
+    first = atomic_fetch_add(&pool.next, 1);
+    for(i=0; i<n; i++){
+        if(!pool_push(&pool.workers[(first + i) % pool.nthreads], (Task){dirs[i], &job}))
+            continue;
+        if(visit(ctx, 0, dirs[i]) < 0 && !atomic_exchange(&job.failed, true))
+            job.err = errno;
+        pool_finish(&job);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    while(atomic_load(&job.pending))
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    if(atomic_load(&job.failed)){
+        errno = job.err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*pool.h*/
+//A work-stealing pool for walks over whole subtrees. A walk is split at
+//directory boundaries: each directory is one task, and running it first
+//queues its subdirectories on the worker's own deque, then visits it.
+//A worker takes its newest task first and an idle one steals the oldest
+//from another, so a deep or lopsided tree still spreads over every core.
+//Several walks may run at once; the caller waits for its own. A walk
+//holds the tree lock one directory's links at a time, never throughout.
+//pool_each runs a batch of single directories the same way, without the
+//descent and without the tree lock.
+
+#define POOL_MAX    64      //most worker threads
+
+typedef struct s_node Node;
+
+//Called once per directory, on any worker, with that worker's number
+//(below POOL_MAX) so results can be kept per worker without locking. The
+//directory's subdirectories are already queued, so a visit may free it.
+//A negative return stops the walk. A visit must not start a walk itself.
+typedef int (*PoolVisit)(void *, unsigned int, Node *);
+
+int pool_start(unsigned int);
+void pool_stop(void);
+unsigned int pool_threads(void);
+int pool_walk(Node *, PoolVisit, void *);
+int pool_each(Node **, unsigned int, PoolVisit, void *);
@@ -0,0 +1,262 @@
+/*The thread that frees detached subtrees and large values*/
+#include "../tree/tree.h"
+#include "reclaim.h"
+#include "pool.h"
+#include<stdbool.h>
+#include<errno.h>
+#include<pthread.h>
+
+#define RECLAIM_BATCH   (2 * POOL_MAX)  //most directories in one step
+
+struct s_reclaimer{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    Node *fresh;                //detached subtrees that walks may still hold
+    Node *lastfresh;
+    Node *dirs;                 //detached subtrees, linked through next
+    Node *lastdir;
+    Leaf *leaves;               //detached leaves, linked through east
+    unsigned long long pending;
+    bool running;
+    bool stop;
+    pthread_t thread;
+};
+typedef struct s_reclaimer Reclaimer;
+
+/*Walks holding directories without the tree lock, counted in two slots:
+new holds go in the current one*/
+struct s_holds{
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    unsigned long walks[2];
+    unsigned int slot;
+};
+typedef struct s_holds Holds;
+
+Reclaimer reclaimer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+Holds holds = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .released = PTHREAD_COND_INITIALIZER
+};
+
+/*Keep every directory reachable now in memory, detached or not, until
+reclaim_release is called with what this returns. Take it under the tree
+lock, then drop the lock as often as you like.*/
+unsigned int reclaim_hold(void){
+    unsigned int slot;
+
+    pthread_mutex_lock(&holds.lock);
+    slot = holds.slot;
+    holds.walks[slot]++;
+    pthread_mutex_unlock(&holds.lock);
+
+    return slot;
+}
+
+void reclaim_release(unsigned int slot){
+    pthread_mutex_lock(&holds.lock);
+    if(!--holds.walks[slot])
+        pthread_cond_broadcast(&holds.released);
+    pthread_mutex_unlock(&holds.lock);
+}
+
+/*Wait until every hold taken before the call is released. Flipping the
+slot and draining the old one, twice, gets holds of both slots; the new
+ones meanwhile go to the other slot, so the wait is bounded. Only one
+thread at a time may call it (the reclaim thread, or the caller while
+it does not run).*/
+void reclaim_wait(void){
+    unsigned int i, slot;
+
+    pthread_mutex_lock(&holds.lock);
+    for(i=0; i<2; i++){
+        slot = holds.slot;
+        holds.slot ^= 1;
+        while(holds.walks[slot])
+            pthread_cond_wait(&holds.released, &holds.lock);
+    }
+    pthread_mutex_unlock(&holds.lock);
+}
+
+/*Free a subtree detach_node took out: on the thread if it runs, right
+away otherwise (AOF replay, the benches). Either way not before the walks
+that may hold it are over.*/
+void reclaim_dir(Node *n){
+    if(!reclaimer.running){
+        reclaim_wait();
+        reclaim_node(n, UINT32_MAX);
+        return;
+    }
+
+    n->next = NULL;
+    pthread_mutex_lock(&reclaimer.lock);
+    if(reclaimer.lastfresh)
+        reclaimer.lastfresh->next = n;
+    else
+        reclaimer.fresh = n;
+    reclaimer.lastfresh = n;
+    reclaimer.pending++;
+    pthread_cond_signal(&reclaimer.wake);
+    pthread_mutex_unlock(&reclaimer.lock);
+}
+
+//Free a leaf detach_leaf took out; only a large value is worth the handoff
+void reclaim_leaf(Leaf *l){
+    if(!reclaimer.running || l->size < RECLAIM_LARGE){
+        free_leaf(l);
+        return;
+    }
+
+    pthread_mutex_lock(&reclaimer.lock);
+    l->east = reclaimer.leaves;
+    reclaimer.leaves = l;
+    reclaimer.pending++;
+    pthread_cond_signal(&reclaimer.wake);
+    pthread_mutex_unlock(&reclaimer.lock);
+}
+
+//One step of the loop: queued directories, and which of them are gone
+struct s_batch{
+    Node *dirs[RECLAIM_BATCH];
+    bool done[RECLAIM_BATCH];
+};
+typedef struct s_batch Batch;
+
+//A pool task: up to RECLAIM_CHUNK leaves of one queued directory
+int reclaim_visit(void *ctx, unsigned int worker, Node *n){
+    Batch *b;
+    unsigned int i;
+
+    (void)worker;
+    b = (Batch *)ctx;
+    for(i=0; b->dirs[i] != n; i++);
+    b->done[i] = reclaim_node(n, RECLAIM_CHUNK);
+    return 0;
+}
+
+/*Leaves first, since each is one free. Fresh subtrees join the queue once
+the walks that may hold them are over; the thread waits for those with
+nothing locked, while clients go on. Each directory taken off the queue
+first hands its subdirectories to the back of it as subtrees of their own
+(they are linked through next already), so every step frees at most
+RECLAIM_CHUNK leaves of one directory. A step takes a batch, two per pool
+worker, and spreads it over the pool; what is not done after its chunk
+goes to the back of the queue, so one huge RMDIR holds up neither what is
+queued after it nor the walks that share the pool.*/
+void *reclaim_loop(void *arg){
+    Batch b;
+    Node *n, *last;
+    Leaf *l;
+    unsigned int i, nb, most;
+
+    (void)arg;
+    pthread_mutex_lock(&reclaimer.lock);
+    for(;;){
+        while(!reclaimer.fresh && !reclaimer.dirs && !reclaimer.leaves && !reclaimer.stop)
+            pthread_cond_wait(&reclaimer.wake, &reclaimer.lock);
+        //Stopping drains the queue first
+        if(!reclaimer.fresh && !reclaimer.dirs && !reclaimer.leaves)
+            break;
+
+        if((n = reclaimer.fresh)){
+            last = reclaimer.lastfresh;
+            reclaimer.fresh = reclaimer.lastfresh = NULL;
+            pthread_mutex_unlock(&reclaimer.lock);
+            reclaim_wait();
+            pthread_mutex_lock(&reclaimer.lock);
+            if(reclaimer.lastdir)
+                reclaimer.lastdir->next = n;
+            else
+                reclaimer.dirs = n;
+            reclaimer.lastdir = last;
+        }
+
+        if((l = reclaimer.leaves)){
+            reclaimer.leaves = l->east;
+            pthread_mutex_unlock(&reclaimer.lock);
+            free_leaf(l);
+            pthread_mutex_lock(&reclaimer.lock);
+            reclaimer.pending--;
+            continue;
+        }
+
+        most = pool_threads() ? 2 * pool_threads() : 1;
+        for(nb = 0; nb < most && reclaimer.dirs; nb++){
+            n = reclaimer.dirs;
+            reclaimer.dirs = n->next;
+            if(!reclaimer.dirs)
+                reclaimer.lastdir = NULL;
+            if(n->west){
+                if(reclaimer.lastdir)
+                    reclaimer.lastdir->next = n->west;
+                else
+                    reclaimer.dirs = n->west;
+                reclaimer.lastdir = n->last_dir;
+                reclaimer.pending += n->ndirs;
+                n->west = n->last_dir = NULL;
+                n->ndirs = 0;
+            }
+            b.dirs[nb] = n;
+            b.done[nb] = false;
+        }
+        pthread_mutex_unlock(&reclaimer.lock);
+        pool_each(b.dirs, nb, reclaim_visit, &b);
+        pthread_mutex_lock(&reclaimer.lock);
+        for(i=0; i<nb; i++){
+            if(b.done[i]){
+                reclaimer.pending--;
+                continue;
+            }
+            n = b.dirs[i];
+            n->next = NULL;
+            if(reclaimer.lastdir)
+                reclaimer.lastdir->next = n;
+            else
+                reclaimer.dirs = n;
+            reclaimer.lastdir = n;
+        }
+    }
+    pthread_mutex_unlock(&reclaimer.lock);
+
+    return NULL;
+}
+
+/*Start freeing in the background. Returns 0 or -1 with errno set.*/
+int reclaim_start(void){
+    reclaimer.running = true;
+    if(pthread_create(&reclaimer.thread, NULL, reclaim_loop, NULL)){
+        reclaimer.running = false;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+//Waits until everything queued is freed
+void reclaim_stop(void){
+    if(!reclaimer.running)
+        return;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    reclaimer.stop = true;
+    pthread_cond_signal(&reclaimer.wake);
+    pthread_mutex_unlock(&reclaimer.lock);
+    pthread_join(reclaimer.thread, NULL);
+    reclaimer.running = reclaimer.stop = false;
+}
+
+//Subtrees and values queued and not yet freed
+unsigned long long reclaim_pending(void){
+    unsigned long long n;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    n = reclaimer.pending;
+    pthread_mutex_unlock(&reclaimer.lock);
+
+    return n;
+}
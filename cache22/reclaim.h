@@ -0,0 +1,25 @@
+/*reclaim.h*/
+//Freeing what RMDIR and UNLINK take out of the tree. Both only unlink
+//under their locks, which is O(1) however much hangs below; the subtree
+//or the value is then queued here, and a thread of its own frees it, so a
+//huge directory never stalls the clients that share its locks. Subtrees
+//are split into single directories and freed RECLAIM_CHUNK leaves at a
+//time, in batches spread over the walk pool (pool.h) when it runs.
+//Nothing queued can be reached from the tree any more, so freeing it
+//takes no tree lock. Walks that drop the tree lock partway (FIND, COUNT)
+//may still hold directories taken out meanwhile: they take a hold, and a
+//subtree is only freed once every hold older than its RMDIR is released.
+
+#define RECLAIM_CHUNK   1024            //leaves freed per directory and step
+#define RECLAIM_LARGE   (64UL * 1024)   //values this long or longer go to the thread
+
+typedef struct s_node Node;
+typedef struct s_leaf Leaf;
+
+int reclaim_start(void);
+void reclaim_stop(void);
+void reclaim_dir(Node *);
+void reclaim_leaf(Leaf *);
+unsigned int reclaim_hold(void);
+void reclaim_release(unsigned int);
+unsigned long long reclaim_pending(void);
@@ -0,0 +1,262 @@
+/*SAVE and BGSAVE: full snapshots, in the foreground or from a forked child*/
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<unistd.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<time.h>
+#include<pthread.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../tree/lock.h"
+#include "store.h"
+#include "save.h"
+#include "image.h"
+
+struct s_save{
+    pthread_mutex_t lock;
+    char path[PATH_MAX];
+    bool busy;              //a save is running, SAVE or BGSAVE
+    SaveStats last;
+    pid_t child;
+    int pipe;               //the child writes its SaveStats here
+    struct timespec start;
+    double forkms;
+};
+typedef struct s_save Save;
+
+Save save = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .path = SAVE_FILE,
+    .pipe = -1
+};
+
+double save_ms(struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e3 +
+        (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+void save_init(const char *path){
+    if(path && strlen(path) < sizeof(save.path) - 16)
+        strcpy(save.path, path);
+}
+
+/*Write the snapshot to a temporary name, make it durable and rename it
+over the old one, so a crash never leaves a half-written file in place.
+The caller makes sure nothing changes the tree meanwhile.*/
+int save_write(DumpStats *st){
+    char tmp[PATH_MAX + 32];
+    int fd, ret;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", save.path, (int)getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return -1;
+
+    //With -m the snapshot is the image the next start maps
+    ret = image_enabled() ? image_write(fd, st) : dump_write(fd, 0, false, st);
+    if(!ret)
+        ret = fdatasync(fd);
+    if(close(fd) || ret || rename(tmp, save.path)){
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*Private memory of this process that is no longer shared with its parent,
+in kB. In a forked child that is every page copied on a write by either
+side since the fork.*/
+unsigned long long private_dirty(void){
+    unsigned long long kb, total;
+    char line[256];
+    FILE *f;
+
+    f = fopen("/proc/self/smaps_rollup", "r");
+    if(!f)
+        return 0;
+    total = 0;
+    while(fgets(line, sizeof(line), f))
+        if(sscanf(line, "Private_Dirty: %llu kB", &kb) == 1)
+            total += kb;
+    fclose(f);
+
+    return total;
+}
+
+/*Load the snapshot file, if there is one. Call it before any thread
+changes the store. Returns 0 or -1 with errno set.*/
+int save_load(void){
+    struct timespec start;
+    DumpStats st;
+    double ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(dump_load(save.path, &st))
+        return (errno == ENOENT) ? 0 : -1;
+
+    ms = save_ms(&start);
+    printf("loaded %llu directories, %llu keys, %llu bytes from %s in %.1f ms (%.0f MB/s)\n",
+        st.dirs, st.keys, st.bytes, save.path, ms,
+        ms > 0 ? (double)st.bytes / 1e3 / ms : 0.0);
+
+    return 0;
+}
+
+/*SAVE: write the snapshot in this thread with the tree locked, so it is
+one exact instant and nobody else gets in until it is done. Returns 0 or
+-1 with errno set (EBUSY while another save runs).*/
+int save_now(SaveStats *st){
+    struct timespec start;
+    int ret, err;
+
+    pthread_mutex_lock(&save.lock);
+    if(save.busy){
+        pthread_mutex_unlock(&save.lock);
+        errno = EBUSY;
+        return -1;
+    }
+    save.busy = true;
+    pthread_mutex_unlock(&save.lock);
+
+    memset(st, 0, sizeof(*st));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tree_wrlock();
+    ret = save_write(&st->dump);
+    err = errno;
+    tree_unlock();
+    st->ms = save_ms(&start);
+    st->finished = (long long)time(NULL);
+    st->ok = !ret;
+
+    pthread_mutex_lock(&save.lock);
+    save.last = *st;
+    save.busy = false;
+    pthread_mutex_unlock(&save.lock);
+
+    if(ret)
+        errno = err;
+    return ret;
+}
+
+//Child side of BGSAVE: write, report through the pipe, never return
+void save_child(int fd){
+    SaveStats st;
+    ssize_t n;
+
+    memset(&st, 0, sizeof(st));
+    st.ok = !save_write(&st.dump);
+    st.cowkb = private_dirty();
+    n = write(fd, &st, sizeof(st));
+    _exit((st.ok && n == (ssize_t)sizeof(st)) ? 0 : 1);
+}
+
+//Waits for the BGSAVE child and records how it went
+void *save_reaper(void *arg){
+    SaveStats st;
+    ssize_t n;
+    int status;
+
+    (void)arg;
+    memset(&st, 0, sizeof(st));
+    n = read(save.pipe, &st, sizeof(st));
+    while(waitpid(save.child, &status, 0) < 0 && errno == EINTR);
+    close(save.pipe);
+
+    st.ok = st.ok && n == (ssize_t)sizeof(st) && WIFEXITED(status) && !WEXITSTATUS(status);
+    st.background = true;
+    st.forkms = save.forkms;
+    st.ms = save_ms(&save.start);
+    st.finished = (long long)time(NULL);
+    if(st.ok)
+        printf("bgsave: %llu directories, %llu keys, %llu bytes in %.1f ms, fork %.2f ms, %llu kB copied on write\n",
+            st.dump.dirs, st.dump.keys, st.dump.bytes, st.ms, st.forkms, st.cowkb);
+    else
+        fprintf(stderr, "bgsave: the child failed writing %s\n", save.path);
+
+    pthread_mutex_lock(&save.lock);
+    save.last = st;
+    save.pipe = -1;
+    save.busy = false;
+    pthread_mutex_unlock(&save.lock);
+
+    return NULL;
+}
+
+/*BGSAVE: fork with the tree locked, so the child's copy is one instant
+with no directory half changed, and let it write that copy out. The
+parent only holds the lock for the fork itself; the pages it changes
+afterwards are copied and the child keeps the old ones. Returns 0 once
+the child runs, or -1 with errno set.*/
+int save_background(void){
+    pthread_t reaper;
+    int fds[2], err;
+    pid_t pid;
+
+    pthread_mutex_lock(&save.lock);
+    if(save.busy){
+        pthread_mutex_unlock(&save.lock);
+        errno = EBUSY;
+        return -1;
+    }
+    if(pipe2(fds, O_CLOEXEC)){
+        pthread_mutex_unlock(&save.lock);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &save.start);
+    tree_wrlock();
+    pid = fork();
+    err = errno;
+    if(!pid){
+        //The child has only this thread; it reads the tree without locking
+        close(fds[0]);
+        save_child(fds[1]);
+    }
+    tree_unlock();
+    save.forkms = save_ms(&save.start);
+    close(fds[1]);
+
+    if(pid < 0){
+        close(fds[0]);
+        pthread_mutex_unlock(&save.lock);
+        errno = err;
+        return -1;
+    }
+
+    save.child = pid;
+    save.pipe = fds[0];
+    save.busy = true;
+    if(pthread_create(&reaper, NULL, save_reaper, NULL)){
+        //Without a reaper, wait for the child right here
+        pthread_mutex_unlock(&save.lock);
+        save_reaper(NULL);
+        return 0;
+    }
+    pthread_detach(reaper);
+    pthread_mutex_unlock(&save.lock);
+
+    return 0;
+}
+
+/*The outcome of the last save that finished. True while one is running.*/
+bool save_last(SaveStats *st){
+    bool busy;
+
+    pthread_mutex_lock(&save.lock);
+    *st = save.last;
+    busy = save.busy;
+    pthread_mutex_unlock(&save.lock);
+
+    return busy;
+}
@@ -0,0 +1,25 @@
+/*save.h*/
+//Point-in-time snapshots of the whole tree in the dump format (see dump.h).
+//SAVE writes one with every client held off; BGSAVE forks and lets the
+//child write it from its copy-on-write view while the parent serves on.
+
+#include "dump.h"
+
+#define SAVE_FILE   "cache22.dump"
+
+struct s_savestats{
+    DumpStats dump;
+    double ms;                  //from the request to the file being renamed
+    double forkms;              //the tree was locked this long for fork()
+    unsigned long long cowkb;   //memory the child ended up not sharing
+    long long finished;         //unix time, 0 if no save finished yet
+    bool background;
+    bool ok;
+};
+typedef struct s_savestats SaveStats;
+
+void save_init(const char *);
+int save_load(void);
+int save_now(SaveStats *);
+int save_background(void);
+bool save_last(SaveStats *);
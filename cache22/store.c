@@ -0,0 +1,1507 @@
+/*Thread-safe access to the tree engine for cache22*/
+#include "../tree/tree.h"
+#include "../tree/lock.h"
+#include "../tree/slab.h"
+#include "../tree/art.h"
+#include "store.h"
+#include "dump.h"
+#include "image.h"
+#include<string.h>
+#include<errno.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<stdio.h>
+#include<fnmatch.h>
+
+int store_init(void){
+    lock_init();
+    return 0;
+}
+
+//A whole argument of a logged command as an unsigned number
+bool logged_number(RespCmd *cmd, uint32_t i, unsigned long long *out){
+    char *end;
+
+    *out = strtoull(cmd->argv[i], &end, 10);
+    return cmd->argl[i] && !*end;
+}
+
+/*Apply one logged command during aof_replay. Only changes that succeeded
+were logged, so any failure means the log does not match the tree.*/
+int store_apply(void *ctx, RespCmd *cmd){
+    unsigned long long number;
+    int ret;
+
+    (void)ctx;
+    ret = -1;
+    errno = EPROTO;
+    if(cmd->argc == 4 && !strcmp(cmd->argv[0], "SET"))
+        ret = store_set(cmd->argv[1], cmd->argv[2], cmd->argv[3], cmd->argl[3]);
+    else if(cmd->argc == 3 && !strcmp(cmd->argv[0], "DEL"))
+        ret = store_del(cmd->argv[1], cmd->argv[2]);
+    else if(cmd->argc == 2 && !strcmp(cmd->argv[0], "MKDIR"))
+        ret = store_mkdir(cmd->argv[1]);
+    else if(cmd->argc == 2 && !strcmp(cmd->argv[0], "RMDIR"))
+        ret = store_rmdir(cmd->argv[1], true);
+    else if(cmd->argc == 5 && !strcmp(cmd->argv[0], "SETRANGE")){
+        if(!logged_number(cmd, 3, &number))
+            return -1;
+        ret = (store_setrange(cmd->argv[1], cmd->argv[2], number, cmd->argv[4], cmd->argl[4]) < 0) ? -1 : 0;
+    }
+    //A deadline that passed while the server was down deletes the key
+    else if(cmd->argc == 4 && !strcmp(cmd->argv[0], "PEXPIREAT")){
+        if(!logged_number(cmd, 3, &number))
+            return -1;
+        ret = (store_pexpireat(cmd->argv[1], cmd->argv[2], number) < 0) ? -1 : 0;
+    }
+    else if(cmd->argc == 3 && !strcmp(cmd->argv[0], "PDIRTTL")){
+        if(!logged_number(cmd, 2, &number))
+            return -1;
+        ret = store_dirttl(cmd->argv[1], number);
+    }
+
+    if(ret < 0)
+        fprintf(stderr, "aof: cannot apply %s %s: %s\n", cmd->argc ? cmd->argv[0] : "",
+            cmd->argc > 1 ? cmd->argv[1] : "", strerror(errno));
+    return ret;
+}
+
+//A key whose deadline has passed is gone, whether or not it is deleted yet
+bool leaf_expired(const Leaf *l, unsigned long long now){
+    return l->expires && l->expires <= now;
+}
+
+/*Queue the leaf's timer for when. Called with the directory write-locked.*/
+int queue_timer(Node *n, Leaf *l, unsigned long long when){
+    char path[MAX_PATH_LENGTH];
+
+    if(node_path(n, (int8 *)path, sizeof(path)) < 0 || expire_add(path, (const char *)l->key, when))
+        return -1;
+    l->timer = when;
+    return 0;
+}
+
+/*Give a leaf a deadline (0 for none), queue it on the timer wheel and log
+it. A leaf has one timer queued at most: a deadline that moves later keeps
+the one there, which store_expired queues again when it finds the key
+still alive. Called with the directory write-locked.*/
+int set_deadline(Node *n, const char *dir, Leaf *l, unsigned long long when){
+    char soff[24];
+    int ret;
+
+    if(!when && !l->expires)
+        return 0;
+    l->expires = when;
+    mark_changed(n);
+    if(!when)
+        return 0;
+
+    ret = (!l->timer || when < l->timer) ? queue_timer(n, l, when) : 0;
+    if(!ret && aof_enabled()){
+        //An absolute time, so replaying the log later gives the same deadline
+        const char *argv[] = {"PEXPIREAT", dir, (const char *)l->key, soff};
+        size_t argl[] = {9, strlen(dir), strlen((const char *)l->key), 0};
+
+        argl[3] = snprintf(soff, sizeof(soff), "%llu", when);
+        ret = aof_append(4, argv, argl);
+    }
+
+    return ret;
+}
+
+//Log the deletion of dir/key
+int log_del(const char *dir, const char *key){
+    if(aof_enabled()){
+        const char *argv[] = {"DEL", dir, key};
+        size_t argl[] = {3, strlen(dir), strlen(key)};
+        return aof_append(3, argv, argl);
+    }
+
+    return 0;
+}
+
+//Delete a key under the directory's write lock and log it
+int drop_leaf(Node *n, const char *dir, const char *key){
+    if(delete_leaf(n, (const int8 *)key))
+        return -1;
+    return log_del(dir, key);
+}
+
+/*The live leaf of key, or NULL with errno = ENOENT. With the write lock
+held, an expired leaf found on the way is deleted. Counts as an access for
+eviction.*/
+Leaf *live_leaf(Node *n, const char *dir, const char *key, bool write){
+    Leaf *l;
+
+    l = search_leaf(n, (const int8 *)key);
+    if(l && leaf_expired(l, expire_now())){
+        if(write)
+            drop_leaf(n, dir, key);
+        errno = ENOENT;
+        return NULL;
+    }
+    if(l)
+        evict_access(l);
+
+    return l;
+}
+
+/*Look up dir/key and hand the value to emit while it is still locked, so
+it can be copied straight into a client buffer. Returns 1 if found, 0 if
+not and -1 with errno set on error.*/
+int store_get(const char *dir, const char *key, Emit emit, void *ctx){
+    const char *value;
+    unsigned long len;
+    unsigned long long expires;
+    Node *n;
+    Leaf *l;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_rdlock(n);
+    if(n->image){
+        value = image_value(n, key, &len, &expires);
+        ret = value ? ((emit(ctx, value, len) < 0) ? -1 : 1) : 0;
+    }
+    else if((l = live_leaf(n, dir, key, false))){
+        ret = emit(ctx, (const char *)l->value, (unsigned long)(l->size - 1));
+        ret = (ret < 0) ? -1 : 1;
+    }
+    else{
+        ret = (errno == ENOENT) ? 0 : -1;
+    }
+    node_unlock(n);
+    tree_unlock();
+    if(ret >= 0)
+        evict_lookup(ret == 1);
+
+    return ret;
+}
+
+/*Create or overwrite dir/key with len bytes of value, which may include
+NULs. It lives for ttl ms, or as long as the directory's default if ttl is
+0. Returns 0 or -1 with errno set.*/
+int store_setex(const char *dir, const char *key, const char *value, unsigned long len, unsigned long long ttl){
+    unsigned long long now;
+    Node *n;
+    Leaf *l;
+    int ret;
+
+    len++;//the engine keeps a terminator after every value
+    if(evict_reclaim())
+        return -1;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_wrlock(n);
+    now = expire_now();
+    l = (n->image && image_fault(n)) ? NULL : set_leaf(n, (const int8 *)key, (const int8 *)value, len);
+    ret = l ? 0 : -1;
+    if(l)
+        evict_access(l);
+    if(!ret && aof_enabled()){
+        //Logged under the directory lock: the log sees changes in apply order
+        const char *argv[] = {"SET", dir, key, value};
+        size_t argl[] = {3, strlen(dir), strlen(key), len - 1};
+        ret = aof_append(4, argv, argl);
+    }
+    if(!ret){
+        if(!ttl)
+            ttl = n->ttl;
+        ret = set_deadline(n, dir, l, ttl ? now + ttl : 0);
+    }
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+int store_set(const char *dir, const char *key, const char *value, unsigned long len){
+    return store_setex(dir, key, value, len, 0);
+}
+
+/*A buffer for a value that is still arriving; hand it to store_adopt or
+give it back with store_free using the same size.*/
+char *store_alloc(unsigned long size){
+    return (char *)slab_alloc(size);
+}
+
+void store_free(char *buf, unsigned long size){
+    slab_free(buf, size);
+}
+
+/*Like store_set, but the value already sits in a buffer from
+store_alloc(cap) with room for a terminator at value[len]. The store owns
+the buffer from here on, whether or not this succeeds.*/
+int store_adopt(const char *dir, const char *key, char *value, unsigned long len, unsigned long cap){
+    unsigned long long now;
+    Node *n;
+    Leaf *l;
+    int ret;
+
+    if(evict_reclaim()){
+        slab_free(value, cap);
+        return -1;
+    }
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        slab_free(value, cap);
+        return -1;
+    }
+
+    node_wrlock(n);
+    if(n->image && image_fault(n)){
+        node_unlock(n);
+        tree_unlock();
+        slab_free(value, cap);
+        return -1;
+    }
+    now = expire_now();
+    l = adopt_leaf(n, (const int8 *)key, (int8 *)value, len + 1, cap);
+    ret = l ? 0 : -1;
+    if(l)
+        evict_access(l);
+    if(!ret && aof_enabled()){
+        const char *argv[] = {"SET", dir, key, value};
+        size_t argl[] = {3, strlen(dir), strlen(key), len};
+        ret = aof_append(4, argv, argl);
+    }
+    if(!ret)
+        ret = set_deadline(n, dir, l, n->ttl ? now + n->ttl : 0);
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*Emit bytes start..end (inclusive, negative counts from the end) of
+dir/key. Returns 1 if found, 0 if not and -1 on error.*/
+int store_getrange(const char *dir, const char *key, long long start, long long end, Emit emit, void *ctx){
+    const char *value;
+    unsigned long vlen;
+    unsigned long long expires;
+    Node *n;
+    Leaf *l;
+    long long len;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_rdlock(n);
+    value = NULL;
+    if(n->image){
+        value = image_value(n, key, &vlen, &expires);
+        len = (long long)vlen;
+    }
+    else if((l = live_leaf(n, dir, key, false))){
+        value = (const char *)l->value;
+        len = (long long)l->size - 1;
+    }
+    if(value){
+        if(start < 0)
+            start = (start < -len) ? 0 : start + len;
+        if(end < 0)
+            end += len;
+        if(end >= len)
+            end = len - 1;
+
+        if(start > end)
+            ret = emit(ctx, "", 0);
+        else
+            ret = emit(ctx, value + start, (unsigned long)(end - start + 1));
+        ret = (ret < 0) ? -1 : 1;
+    }
+    else{
+        ret = (errno == ENOENT) ? 0 : -1;
+    }
+    node_unlock(n);
+    tree_unlock();
+    if(ret >= 0)
+        evict_lookup(ret == 1);
+
+    return ret;
+}
+
+/*Overwrite len bytes of dir/key at offset, creating or zero-extending it;
+an empty write to a missing key creates nothing and returns 0.
+An existing key keeps its deadline. Returns the new length of the value or
+-1 with errno set.*/
+long long store_setrange(const char *dir, const char *key, unsigned long offset, const char *buf, unsigned long len){
+    unsigned long long now;
+    Node *n;
+    Leaf *l;
+    long long ret;
+    bool fresh;
+
+    fresh = false;
+    if(offset > STORE_MAX_VALUE || len > STORE_MAX_VALUE - offset){
+        errno = E2BIG;
+        return -1;
+    }
+    if(evict_reclaim())
+        return -1;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_wrlock(n);
+    now = expire_now();
+    l = NULL;
+    if(!n->image || !image_fault(n)){
+        fresh = !live_leaf(n, dir, key, true);
+        l = setrange_leaf(n, (const int8 *)key, offset, (const int8 *)buf, len);
+        if(l)
+            evict_access(l);
+        //An empty write to a missing key leaves it missing, and logs nothing
+        else if(errno == ENOENT && !len){
+            node_unlock(n);
+            tree_unlock();
+            return 0;
+        }
+    }
+    ret = l ? (long long)(l->size - 1) : -1;
+    if(l && aof_enabled()){
+        char soff[24];
+        const char *argv[] = {"SETRANGE", dir, key, soff, buf};
+        size_t argl[] = {8, strlen(dir), strlen(key), 0, len};
+
+        argl[3] = snprintf(soff, sizeof(soff), "%lu", offset);
+        if(aof_append(5, argv, argl))
+            ret = -1;
+    }
+    if(ret >= 0 && fresh && n->ttl && set_deadline(n, dir, l, now + n->ttl))
+        ret = -1;
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*Remove dir/key. Returns 1 if it was there, 0 if not, -1 on error.*/
+int store_del(const char *dir, const char *key){
+    Node *n;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_wrlock(n);
+    if(n->image && image_fault(n))
+        ret = -1;
+    else if(live_leaf(n, dir, key, true))
+        ret = drop_leaf(n, dir, key) ? -1 : 1;
+    else
+        ret = (errno == ENOENT) ? 0 : -1;
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*UNLINK: delete dir/key like store_del, but only unlink it under the
+lock; a large value is freed afterwards by the reclaim thread. Returns 1
+if the key was there, 0 if not, -1 on error.*/
+int store_unlink(const char *dir, const char *key){
+    Node *n;
+    Leaf *gone;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    gone = NULL;
+    node_wrlock(n);
+    if(n->image && image_fault(n))
+        ret = -1;
+    else if(!live_leaf(n, dir, key, true))
+        ret = (errno == ENOENT) ? 0 : -1;
+    else if(!(gone = detach_leaf(n, (const int8 *)key)))
+        ret = -1;
+    else
+        ret = log_del(dir, key) ? -1 : 1;
+    node_unlock(n);
+    tree_unlock();
+
+    if(gone)
+        reclaim_leaf(gone);
+    return ret;
+}
+
+/*Returns 1 if dir/key exists, 0 if not, -1 on error.*/
+int store_exists(const char *dir, const char *key){
+    unsigned long len;
+    unsigned long long expires;
+    Node *n;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_rdlock(n);
+    if(n->image)
+        ret = image_value(n, key, &len, &expires) ? 1 : 0;
+    else if(live_leaf(n, dir, key, false))
+        ret = 1;
+    else
+        ret = (errno == ENOENT) ? 0 : -1;
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*EXPIRE: give dir/key a deadline in unix ms, or delete it right away if
+that is already past. Returns 1 if the key exists, 0 if not, -1 on error.*/
+int store_pexpireat(const char *dir, const char *key, unsigned long long when){
+    Node *n;
+    Leaf *l;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_wrlock(n);
+    if(n->image && image_fault(n))
+        ret = -1;
+    else if(!(l = live_leaf(n, dir, key, true)))
+        ret = (errno == ENOENT) ? 0 : -1;
+    else if(when <= expire_now())
+        ret = drop_leaf(n, dir, key) ? -1 : 1;
+    else
+        ret = set_deadline(n, dir, l, when) ? -1 : 1;
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*Milliseconds dir/key has left: -1 if it never expires, -2 if there is no
+such key, -3 with errno set on error*/
+long long store_pttl(const char *dir, const char *key){
+    unsigned long long expires, now;
+    unsigned long len;
+    Node *n;
+    Leaf *l;
+    long long ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -3;
+    }
+
+    node_rdlock(n);
+    now = expire_now();
+    ret = -2;
+    if(n->image){
+        if(image_value(n, key, &len, &expires))
+            ret = expires ? (long long)(expires - now) : -1;
+    }
+    else if((l = live_leaf(n, dir, key, false)))
+        ret = l->expires ? (long long)(l->expires - now) : -1;
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*Set how long keys created or overwritten in dir live from then on, in
+ms; 0 makes them permanent again. Keys already there keep their deadline.
+Returns 0 or -1 with errno set.*/
+int store_dirttl(const char *dir, unsigned long long ttl){
+    char sttl[24];
+    Node *n;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_wrlock(n);
+    n->ttl = ttl;
+    mark_changed(n);
+    ret = 0;
+    if(aof_enabled()){
+        const char *argv[] = {"PDIRTTL", dir, sttl};
+        size_t argl[] = {7, strlen(dir), 0};
+
+        argl[2] = snprintf(sttl, sizeof(sttl), "%llu", ttl);
+        ret = aof_append(3, argv, argl);
+    }
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*The default lifetime of new keys in dir in ms (0 for none), or -1 with
+errno set*/
+long long store_getdirttl(const char *dir){
+    Node *n;
+    long long ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    node_rdlock(n);
+    ret = (long long)n->ttl;
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*Called by the timer wheel once the deadline `when` of dir/key has come.
+Only the timer the leaf has queued counts (one left by a deleted key or by
+a deadline moved earlier is ignored). The key goes if it has expired; if
+its deadline moved later meanwhile, the timer is queued again for that.
+Returns 1 if it was deleted, 0 if not.*/
+int store_expired(const char *dir, const char *key, unsigned long long when){
+    Node *n;
+    Leaf *l;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return 0;
+    }
+
+    node_wrlock(n);
+    ret = 0;
+    l = n->image ? NULL : search_leaf(n, (const int8 *)key);
+    if(l && l->timer == when){
+        l->timer = 0;
+        if(leaf_expired(l, expire_now()))
+            ret = drop_leaf(n, dir, key) ? 0 : 1;
+        else if(l->expires)
+            queue_timer(n, l, l->expires);
+    }
+    node_unlock(n);
+    tree_unlock();
+
+    return ret;
+}
+
+/*Find the directory of every key of a batch, with the tree lock held.
+Keys in the same directory back to back resolve it once; a missing one
+leaves NULL.*/
+void batch_resolve(unsigned long n, const char **dirs, Node **nodes){
+    unsigned long i;
+
+    for(i=0; i<n; i++){
+        if(i && !strcmp(dirs[i], dirs[i - 1]))
+            nodes[i] = nodes[i - 1];
+        else if((nodes[i] = search_node(&root.n, (const int8 *)dirs[i])))
+            __builtin_prefetch(&nodes[i]->index);
+    }
+}
+
+//Where the run of keys from i on that share a directory ends
+unsigned long batch_end(unsigned long n, Node **nodes, unsigned long i){
+    unsigned long j;
+
+    for(j = i + 1; j < n && nodes[j] == nodes[i]; j++);
+    return j;
+}
+
+/*Hash every key of a batch up front, and start loading the index slots
+of the first few, whichever directories they are in*/
+void batch_hash(unsigned long n, Node **nodes, const char **keys, uint32 *hashes){
+    unsigned long i;
+
+    for(i=0; i<n; i++)
+        hashes[i] = index_hash((const int8 *)keys[i]);
+    for(i=0; i<n && i<STORE_AHEAD; i++)
+        if(nodes[i])
+            index_prefetch_slot(&nodes[i]->index, hashes[i]);
+}
+
+/*With the run from..to locked: the leaves of its first few keys, whose
+slots started loading STORE_AHEAD keys back*/
+void batch_start(Node *d, const uint32 *hashes, unsigned long from, unsigned long to){
+    unsigned long i;
+
+    for(i=from; i<to && i<from + STORE_AHEAD / 2; i++)
+        index_prefetch_leaf(&d->index, hashes[i]);
+}
+
+/*Before looking up key i of run ..to: the slot of the key STORE_AHEAD on
+starts loading, even in a later run, so misses overlap across directory
+boundaries. That directory is not locked yet, but the tree lock keeps its
+Node in place and index_prefetch_slot only computes an address from it; a
+stale table just loads a line nobody needs. The leaf of the key half way
+there, whose slot should have arrived by now, is only read inside the
+locked run, since another directory may free the table it sits in.*/
+void batch_ahead(unsigned long n, Node **nodes, const uint32 *hashes, unsigned long i, unsigned long to){
+    if(i + STORE_AHEAD < n && nodes[i + STORE_AHEAD])
+        index_prefetch_slot(&nodes[i + STORE_AHEAD]->index, hashes[i + STORE_AHEAD]);
+    if(i + STORE_AHEAD / 2 < to)
+        index_prefetch_leaf(&nodes[i]->index, hashes[i + STORE_AHEAD / 2]);
+}
+
+/*MGET: look up n keys, key i in directory dirs[i], and hand each value to
+emit in order, NULL for a key that is not there (or whose directory is
+not). Keys in one directory back to back share a single lock. Every key
+is hashed up front and its index slot prefetched a few keys ahead, across
+directory boundaries too, so the cache misses of a batch overlap instead
+of following each other even when no two keys share a directory. Returns 0 or -1 with errno set.*/
+int store_mget(unsigned long n, const char **dirs, const char **keys, Emit emit, void *ctx){
+    Node *nodes[STORE_BATCH];
+    uint32 hashes[STORE_BATCH];
+    unsigned long i, end, len;
+    unsigned long long expires;
+    const char *value;
+    Node *d;
+    Leaf *l;
+    int ret;
+
+    if(n > STORE_BATCH){
+        errno = E2BIG;
+        return -1;
+    }
+
+    tree_rdlock();
+    batch_resolve(n, dirs, nodes);
+    batch_hash(n, nodes, keys, hashes);
+    ret = 0;
+    for(i = 0; i < n && ret >= 0; i = end){
+        d = nodes[i];
+        end = batch_end(n, nodes, i);
+        if(!d){
+            for(; i < end && ret >= 0; i++){
+                ret = emit(ctx, NULL, 0);
+                evict_lookup(false);
+            }
+            continue;
+        }
+
+        node_rdlock(d);
+        batch_start(d, hashes, i, end);
+        for(; i < end && ret >= 0; i++){
+            batch_ahead(n, nodes, hashes, i, end);
+            value = NULL;
+            len = 0;
+            if(d->image)
+                value = image_value(d, keys[i], &len, &expires);
+            else if((l = live_leaf(d, dirs[i], keys[i], false))){
+                value = (const char *)l->value;
+                len = (unsigned long)(l->size - 1);
+            }
+            ret = emit(ctx, value, len);
+            evict_lookup(value != NULL);
+        }
+        node_unlock(d);
+    }
+    tree_unlock();
+
+    return (ret < 0) ? -1 : 0;
+}
+
+/*MSET: set key i in directory dirs[i] to lens[i] bytes of values[i], for
+every i, with the directory's default lifetime. All the directories must
+exist before anything is set; the keys then go in run by run as in
+store_mget. A failure part way leaves the keys before it set and logged.
+Returns 0 or -1 with errno set.*/
+int store_mset(unsigned long n, const char **dirs, const char **keys, const char **values, const unsigned long *lens){
+    Node *nodes[STORE_BATCH];
+    uint32 hashes[STORE_BATCH];
+    unsigned long long now;
+    unsigned long i, end;
+    Node *d;
+    Leaf *l;
+    int ret;
+
+    if(n > STORE_BATCH){
+        errno = E2BIG;
+        return -1;
+    }
+    if(evict_reclaim())
+        return -1;
+
+    tree_rdlock();
+    batch_resolve(n, dirs, nodes);
+    for(i=0; i<n; i++){
+        if(!nodes[i]){
+            tree_unlock();
+            errno = ENOENT;
+            return -1;
+        }
+    }
+
+    now = expire_now();
+    batch_hash(n, nodes, keys, hashes);
+    ret = 0;
+    for(i = 0; i < n && !ret; i = end){
+        d = nodes[i];
+        end = batch_end(n, nodes, i);
+
+        node_wrlock(d);
+        if(d->image && image_fault(d))
+            ret = -1;
+        else
+            batch_start(d, hashes, i, end);
+        for(; i < end && !ret; i++){
+            batch_ahead(n, nodes, hashes, i, end);
+            l = set_leaf(d, (const int8 *)keys[i], (const int8 *)values[i], lens[i] + 1);
+            ret = l ? 0 : -1;
+            if(l)
+                evict_access(l);
+            if(!ret && aof_enabled()){
+                const char *argv[] = {"SET", dirs[i], keys[i], values[i]};
+                size_t argl[] = {3, strlen(dirs[i]), strlen(keys[i]), lens[i]};
+                ret = aof_append(4, argv, argl);
+            }
+            if(!ret)
+                ret = set_deadline(d, dirs[i], l, d->ttl ? now + d->ttl : 0);
+        }
+        node_unlock(d);
+    }
+    tree_unlock();
+
+    return ret;
+}
+
+/*MDEL: remove key i of directory dirs[i] for every i, run by run as in
+store_mget. Returns how many were there, or -1 with errno set.*/
+long store_mdel(unsigned long n, const char **dirs, const char **keys){
+    Node *nodes[STORE_BATCH];
+    uint32 hashes[STORE_BATCH];
+    unsigned long i, end;
+    long count;
+    Node *d;
+    int ret;
+
+    if(n > STORE_BATCH){
+        errno = E2BIG;
+        return -1;
+    }
+
+    tree_rdlock();
+    batch_resolve(n, dirs, nodes);
+    batch_hash(n, nodes, keys, hashes);
+    count = 0;
+    ret = 0;
+    for(i = 0; i < n && !ret; i = end){
+        d = nodes[i];
+        end = batch_end(n, nodes, i);
+        if(!d)
+            continue;
+
+        node_wrlock(d);
+        if(d->image && image_fault(d))
+            ret = -1;
+        else
+            batch_start(d, hashes, i, end);
+        for(; i < end && !ret; i++){
+            batch_ahead(n, nodes, hashes, i, end);
+            if(live_leaf(d, dirs[i], keys[i], true)){
+                if(drop_leaf(d, dirs[i], keys[i]))
+                    ret = -1;
+                else
+                    count++;
+            }
+            else if(errno != ENOENT)
+                ret = -1;
+        }
+        node_unlock(d);
+    }
+    tree_unlock();
+
+    return ret ? -1 : count;
+}
+
+/*Create one directory; its parent must exist. Returns 0 or -1 with errno
+set (EEXIST if it is already there).*/
+int store_mkdir(const char *path){
+    char parent[MAX_PATH_LENGTH];
+    char last[MAX_NAME_LENGTH + 1];
+    const char *name;
+    size_t len;
+    Node *n;
+    int ret;
+
+    len = strlen(path);
+    while(len > 1 && path[len-1] == '/')
+        len--;
+    for(name = path + len; name > path && name[-1] != '/'; name--);
+
+    if(!len || name == path + len || (size_t)(path + len - name) > MAX_NAME_LENGTH
+        || (size_t)(name - path) >= sizeof(parent)){
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(parent, path, name - path);
+    parent[name - path] = 0;
+    if(!parent[0])
+        strcpy(parent, ".");
+
+    memcpy(last, name, path + len - name);
+    last[path + len - name] = 0;
+    if(!strcmp(last, ".") || !strcmp(last, "..")){
+        errno = EINVAL;
+        return -1;
+    }
+
+    //Directory structure changes are the only writers of the tree lock
+    tree_wrlock();
+    n = search_node(&root.n, (const int8 *)parent);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    if(search_node(n, (const int8 *)last)){
+        errno = EEXIST;
+        ret = -1;
+    }
+    else{
+        ret = create_node(n, (const int8 *)last) ? 0 : -1;
+    }
+    if(!ret && aof_enabled()){
+        const char *argv[] = {"MKDIR", path};
+        size_t argl[] = {5, strlen(path)};
+        ret = aof_append(2, argv, argl);
+    }
+    tree_unlock();
+
+    return ret;
+}
+
+int count_entry(void *ctx, char type, const char *name, unsigned long size){
+    (void)type;
+    (void)name;
+    (void)size;
+    (*(unsigned long *)ctx)++;
+    return 0;
+}
+
+/*RMDIR: take a directory out of the tree, and with recursive everything
+below it as well. Unlinking it is O(1) under the tree write lock; the
+subtree is freed afterwards by the reclaim thread. Returns 0 or -1 with
+errno set: ENOTEMPTY if it holds anything and recursive is false, EINVAL
+for the root.*/
+int store_rmdir(const char *path, bool recursive){
+    Node *n, *gone;
+    int ret;
+
+    tree_wrlock();
+    n = search_node(&root.n, (const int8 *)path);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    gone = NULL;
+    if(!recursive && (n->ndirs || n->nleaves || n->image)){
+        errno = ENOTEMPTY;
+        ret = -1;
+    }
+    else if(detach_node(n))
+        ret = -1;
+    else{
+        gone = n;
+        evict_forget();
+        ret = 0;
+        if(aof_enabled()){
+            //Replayed recursively: whatever it held was logged before it
+            const char *argv[] = {"RMDIR", path};
+            size_t argl[] = {5, strlen(path)};
+            ret = aof_append(2, argv, argl);
+        }
+    }
+    tree_unlock();
+
+    if(gone)
+        reclaim_dir(gone);
+    return ret;
+}
+
+/*List a directory through cb: subdirectories first, then keys, each in
+creation order. Returns 0 or -1 with errno set.*/
+int store_ls(const char *dir, Entry cb, void *ctx){
+    unsigned long long now;
+    unsigned long count;
+    Node *n, *d;
+    Leaf *l;
+    int ret;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+
+    //Expired keys that are not deleted yet are left out of the count too
+    node_rdlock(n);
+    now = expire_now();
+    count = n->ndirs;
+    if(n->image)
+        image_each(n, count_entry, &count);
+    for(l = (Leaf *)n->east; l; l = l->east)
+        count += !leaf_expired(l, now);
+
+    ret = cb(ctx, 'n', NULL, count);
+    for(d = n->west; d && ret >= 0; d = d->next)
+        ret = cb(ctx, 'd', (const char *)d->path, 0);
+    if(n->image && ret >= 0)
+        ret = image_each(n, cb, ctx);
+    for(l = (Leaf *)n->east; l && ret >= 0; l = l->east)
+        if(!leaf_expired(l, now))
+            ret = cb(ctx, 'f', (const char *)l->key, (unsigned long)(l->size - 1));
+    node_unlock(n);
+    tree_unlock();
+
+    return (ret < 0) ? -1 : 0;
+}
+
+//The keys one SCAN page gathers under the directory lock
+struct s_page{
+    Leaf **leaves;
+    unsigned long n;
+    unsigned long cap;
+    const char *match;          //glob, NULL for any key
+    unsigned long long now;
+    bool full;                  //out of memory for more
+};
+typedef struct s_page Page;
+
+bool page_wants(Page *pg, const Leaf *l){
+    return !leaf_expired(l, pg->now) && (!pg->match || !fnmatch(pg->match, (const char *)l->key, 0));
+}
+
+bool page_grow(Page *pg){
+    Leaf **p;
+    unsigned long cap;
+
+    cap = pg->cap ? pg->cap * 2 : STORE_SCAN;
+    p = (Leaf **)realloc(pg->leaves, cap * sizeof(Leaf *));
+    if(!p){
+        pg->full = true;
+        return false;
+    }
+    pg->leaves = p;
+    pg->cap = cap;
+    return true;
+}
+
+void page_visit(void *ctx, Leaf *l){
+    Page *pg = (Page *)ctx;
+
+    if(!page_wants(pg, l) || (pg->n == pg->cap && !page_grow(pg)))
+        return;
+    pg->leaves[pg->n++] = l;
+}
+
+//Whether every key of n is in its key order (see order_leaves)
+static bool ordered(const Node *n){
+    return n->order && !n->sorting;
+}
+
+/*Pin a directory for a page: keys still in a mapped image have no place
+in its index yet, so such a directory is faulted in once, under the write
+lock. A sorted page (build > 0) needs the key order as well, which is
+built under the write lock too, up to build keys at a time, each page
+going on where the last one stopped. Leaves it locked and returns 0 (with
+ordered(n) telling whether a sorted page can be read yet), or -1 with
+nothing locked.*/
+int page_lock(Node *n, unsigned long build){
+    node_rdlock(n);
+    if(!n->image && (!build || ordered(n))){
+        if(build)
+            order_used(n);
+        return 0;
+    }
+
+    node_unlock(n);
+    node_wrlock(n);
+    if((n->image && image_fault(n)) || (build && order_leaves(n, (uint32)build) < 0)){
+        node_unlock(n);
+        return -1;
+    }
+    return 0;
+}
+
+int page_emit(Page *pg, Entry cb, void *ctx){
+    unsigned long i;
+    int ret;
+
+    ret = cb(ctx, 'n', NULL, pg->n);
+    for(i=0; i<pg->n && ret >= 0; i++)
+        ret = cb(ctx, 'f', (const char *)pg->leaves[i]->key, (unsigned long)(pg->leaves[i]->size - 1));
+    return ret;
+}
+
+/*SCAN: one page of the keys of dir, through cb ('c' with the next cursor,
+then as store_ls does for keys). The cursor walks the directory's index
+(see index_scan), so every key that is there for the whole scan comes up
+at least once, whatever is added or deleted in between, and no page costs
+more than count * 10 index slots. Only keys matching the glob match (NULL
+for any) are returned. A page may hold fewer than count keys, or none,
+before the scan is over; it is over when the cursor comes back 0.
+Returns 0 or -1 with errno set.*/
+int store_scan(const char *dir, unsigned long cursor, const char *match, unsigned long count,
+    Entry cb, void *ctx){
+    unsigned long steps;
+    uint32 next;
+    Node *n;
+    Page pg;
+    int ret;
+
+    if(cursor > UINT32_MAX || !count || count > STORE_SCAN_MAX){
+        errno = EINVAL;
+        return -1;
+    }
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n || page_lock(n, 0)){
+        tree_unlock();
+        return -1;
+    }
+
+    memset(&pg, 0, sizeof(pg));
+    pg.match = match;
+    pg.now = expire_now();
+    next = (uint32)cursor;
+    steps = 0;
+    do
+        next = index_scan(&n->index, next, page_visit, &pg);
+    while(next && pg.n < count && ++steps < count * 10);
+
+    if(pg.full){
+        errno = ENOMEM;
+        ret = -1;
+    }
+    else if((ret = cb(ctx, 'c', NULL, next)) >= 0)
+        ret = page_emit(&pg, cb, ctx);
+    node_unlock(n);
+    tree_unlock();
+
+    free(pg.leaves);
+    return (ret < 0) ? -1 : 0;
+}
+
+//A sorted page: where it stands in its walk over the key order
+struct s_seek{
+    Page pg;
+    const char *prefix;
+    size_t plen;
+    const char *after;          //the cursor key, NULL from the start
+    unsigned long count;
+    unsigned long steps;
+    const Leaf *last;           //last key looked at
+    bool more;
+};
+typedef struct s_seek Seek;
+
+int seek_visit(void *ctx, const uint8_t *key, uint32 len, void *value){
+    Seek *sk = (Seek *)ctx;
+    Leaf *l = (Leaf *)value;
+
+    (void)len;
+    //Sorted, so the first key without the prefix is past all of them
+    if(strncmp((const char *)key, sk->prefix, sk->plen))
+        return 1;
+    if(sk->after && !strcmp((const char *)key, sk->after))
+        return 0;
+    if(page_wants(&sk->pg, l)){
+        if(sk->pg.n == sk->count){
+            sk->more = true;
+            return 1;
+        }
+        sk->pg.leaves[sk->pg.n++] = l;
+    }
+    sk->last = l;
+    //Like store_scan, a page looks at no more than count * 10 keys
+    if(++sk->steps == sk->count * 10){
+        sk->more = true;
+        return 1;
+    }
+    return 0;
+}
+
+/*SCAN with a prefix: up to count keys of dir that start with prefix and
+sort after `after` (NULL to start), in byte order, through cb ('c' with
+the last key looked at if there may be more, else NULL; then as store_ls
+does for keys). Resuming after a key instead of at a position keeps pages
+right across inserts and deletes. Such scans keep a key order on the
+directory (order_leaves), so every page seeks straight to its cursor and
+looks at no more than count * 10 keys. Until the order is built, each
+page adds count * 10 keys to it and comes back empty with the cursor it
+was given (the key it resumes after, or "" at the start).
+Returns 0 or -1 with errno set.*/
+int store_scanprefix(const char *dir, const char *prefix, const char *after, const char *match,
+    unsigned long count, Entry cb, void *ctx){
+    const char *from;
+    Node *n;
+    Seek sk;
+    int ret;
+
+    if(!count || count > STORE_SCAN_MAX){
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&sk, 0, sizeof(sk));
+    sk.pg.leaves = (Leaf **)malloc(count * sizeof(Leaf *));
+    if(!sk.pg.leaves){
+        errno = ENOMEM;
+        return -1;
+    }
+    sk.pg.cap = count;
+    sk.pg.match = match;
+    sk.prefix = prefix;
+    sk.plen = strlen(prefix);
+    sk.after = after;
+    sk.count = count;
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n || page_lock(n, count * 10)){
+        tree_unlock();
+        free(sk.pg.leaves);
+        return -1;
+    }
+
+    if(!ordered(n))
+        ret = cb(ctx, 'c', after ? after : "", 0);
+    else{
+        //From the cursor if it is past the prefix's first key, else the prefix
+        sk.pg.now = expire_now();
+        from = (after && strcmp(after, prefix) > 0) ? after : prefix;
+        art_seek(n->order, (const uint8_t *)from, (uint32)strlen(from), seek_visit, &sk);
+        ret = cb(ctx, 'c', sk.more ? (const char *)sk.last->key : NULL, 0);
+    }
+    if(ret >= 0)
+        ret = page_emit(&sk.pg, cb, ctx);
+    node_unlock(n);
+    tree_unlock();
+
+    free(sk.pg.leaves);
+    return (ret < 0) ? -1 : 0;
+}
+
+//Live keys of a directory, the image's included; its lock must be held
+unsigned long live_keys(Node *n, unsigned long long now){
+    unsigned long count;
+    Leaf *l;
+
+    count = 0;
+    if(n->image)
+        image_each(n, count_entry, &count);
+    for(l = (Leaf *)n->east; l; l = l->east)
+        count += !leaf_expired(l, now);
+
+    return count;
+}
+
+//COUNT's running totals, one per pool worker
+struct s_tally{
+    unsigned long long now;
+    unsigned long keys[POOL_MAX];
+};
+typedef struct s_tally Tally;
+
+int tally_visit(void *ctx, unsigned int worker, Node *n){
+    Tally *t = (Tally *)ctx;
+
+    node_rdlock(n);
+    t->keys[worker] += live_keys(n, t->now);
+    node_unlock(n);
+
+    return 0;
+}
+
+/*COUNT: the live keys of a directory, and with recursive of every
+directory below it as well, counted on the pool. The tree lock is only
+held to find the directory: a hold keeps the subtree in memory for the
+count, so MKDIR and RMDIR go on meanwhile. Returns the count or -1 with
+errno set.*/
+long long store_count(const char *dir, bool recursive){
+    Tally t;
+    Node *n;
+    unsigned int i, hold;
+    long long total;
+    int ret;
+
+    memset(&t, 0, sizeof(t));
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    if(!n){
+        tree_unlock();
+        return -1;
+    }
+    hold = reclaim_hold();
+    tree_unlock();
+    t.now = expire_now();
+    ret = recursive ? pool_walk(n, tally_visit, &t) : tally_visit(&t, 0, n);
+    reclaim_release(hold);
+    if(ret)
+        return -1;
+
+    for(total = 0, i = 0; i < POOL_MAX; i++)
+        total += (long long)t.keys[i];
+    return total;
+}
+
+/*What one pool worker has found: records of a type byte, the size and
+the NUL-terminated full path, back to back*/
+struct s_found{
+    char *buf;
+    unsigned long len;
+    unsigned long cap;
+    unsigned long n;
+    bool full;                  //out of memory for more
+};
+typedef struct s_found Found;
+
+struct s_finder{
+    const char *match;
+    const Node *top;
+    unsigned long long now;
+    Found found[POOL_MAX];
+};
+typedef struct s_finder Finder;
+
+//The directory a worker is in, for the image keys' callback
+struct s_findctx{
+    Finder *f;
+    Found *out;
+    const char *path;           //"" for the root
+    int plen;
+};
+typedef struct s_findctx FindCtx;
+
+int find_add(FindCtx *fc, char type, const char *name, unsigned long size){
+    Found *out = fc->out;
+    unsigned long need, cap;
+    char *p;
+
+    if(fnmatch(fc->f->match, name, 0))
+        return 0;
+
+    need = 1 + sizeof(size) + (unsigned long)fc->plen + 1 + strlen(name) + 1;
+    if(out->len + need > out->cap){
+        for(cap = out->cap ? out->cap * 2 : 4096; cap < out->len + need; cap *= 2);
+        p = (char *)realloc(out->buf, cap);
+        if(!p){
+            out->full = true;
+            errno = ENOMEM;
+            return -1;
+        }
+        out->buf = p;
+        out->cap = cap;
+    }
+
+    p = out->buf + out->len;
+    *p++ = type;
+    memcpy(p, &size, sizeof(size));
+    p += sizeof(size);
+    memcpy(p, fc->path, fc->plen);
+    p += fc->plen;
+    *p++ = '/';
+    strcpy(p, name);
+    out->len += need;
+    out->n++;
+
+    return 0;
+}
+
+int find_image(void *ctx, char type, const char *name, unsigned long size){
+    return find_add((FindCtx *)ctx, type, name, size);
+}
+
+/*One directory of a page: itself, as every directory below the top comes
+up once, then its keys. Runs without the tree lock; the page's hold keeps
+n and its parents in memory.*/
+int find_visit(void *ctx, unsigned int worker, Node *n){
+    char path[MAX_PATH_LENGTH];
+    FindCtx fc;
+    Leaf *l;
+    int len, ret;
+
+    fc.f = (Finder *)ctx;
+    fc.out = &fc.f->found[worker];
+    fc.path = path;
+    len = node_path(n, (int8 *)path, sizeof(path));
+    if(len < 0)
+        return -1;
+
+    ret = 0;
+    if(n != fc.f->top){
+        fc.plen = len - (int)strlen((const char *)n->path) - 1;
+        ret = find_add(&fc, 'd', (const char *)n->path, 0);
+    }
+    fc.plen = (len == 1) ? 0 : len;
+
+    node_rdlock(n);
+    if(n->image && ret >= 0)
+        ret = image_each(n, find_image, &fc);
+    for(l = (Leaf *)n->east; l && ret >= 0; l = l->east)
+        if(!leaf_expired(l, fc.f->now))
+            ret = find_add(&fc, 'f', (const char *)l->key, (unsigned long)(l->size - 1));
+    node_unlock(n);
+
+    return ret;
+}
+
+//Directories of top's subtree in depth-first order; !down skips those below n
+Node *find_next(const Node *top, Node *n, bool down){
+    if(down && n->west)
+        return n->west;
+    for(; n != top; n = n->north)
+        if(n->next)
+            return n->next;
+    return NULL;
+}
+
+/*Where a FIND page goes on: the directory at path if it is still there,
+else the first one below its nearest parent that is (NULL if none is left
+to look at), which may list some a second time. Returns 0, or -1 with
+EINVAL if path is not below top.*/
+int find_again(const Node *top, char *path, Node **at){
+    Node *n, *p;
+    char *slash;
+    bool gone;
+
+    for(gone = false; !(n = search_node(&root.n, (const int8 *)path)); gone = true){
+        slash = strrchr(path, '/');
+        if(!slash){
+            errno = EINVAL;
+            return -1;
+        }
+        slash[slash == path] = 0;
+    }
+    for(p = n; p != top && !(p->tag & TagRoot); p = p->north);
+    if(p != top){
+        errno = EINVAL;
+        return -1;
+    }
+
+    *at = gone ? find_next(top, n, true) : n;
+    return 0;
+}
+
+/*FIND: every directory and key below dir whose name matches the glob, as
+full paths, a page at a time. A page is up to STORE_FIND directories in
+depth-first order, from the one at `from` (NULL for dir itself), picked
+under the tree lock and then visited on the pool with a hold instead
+(reclaim_hold), so neither the lock nor the reply covers more than one
+page. Through cb: 'c' with the directory the next page starts at (NULL
+once done), then as store_ls passes entries, the count first, the rest
+in no particular order. A directory there for the whole walk comes up
+once; if the next page's directory is removed meanwhile, the walk goes
+back to the first one below its nearest parent, and some come up twice.
+Returns 0 or -1 with errno set.*/
+int store_find(const char *dir, const char *match, const char *from, Entry cb, void *ctx){
+    char next[MAX_PATH_LENGTH];
+    Node *dirs[STORE_FIND];
+    Finder *f;
+    Node *n;
+    unsigned long total, size, i, j;
+    unsigned int nb, hold;
+    const char *p;
+    int ret;
+
+    if(from && strlen(from) >= sizeof(next)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    f = (Finder *)calloc(1, sizeof(Finder));
+    if(!f){
+        errno = ENOMEM;
+        return -1;
+    }
+    f->match = match;
+    if(from)
+        strcpy(next, from);
+
+    tree_rdlock();
+    n = search_node(&root.n, (const int8 *)dir);
+    f->top = n;
+    ret = (!n || (from && find_again(f->top, next, &n))) ? -1 : 0;
+    for(nb = 0; !ret && n && nb < STORE_FIND; nb++){
+        dirs[nb] = n;
+        n = find_next(f->top, n, true);
+    }
+    if(!ret && n && node_path(n, (int8 *)next, sizeof(next)) < 0)
+        ret = -1;
+    hold = reclaim_hold();
+    tree_unlock();
+
+    if(!ret){
+        f->now = expire_now();
+        ret = pool_each(dirs, nb, find_visit, f);
+    }
+    reclaim_release(hold);
+
+    for(total = 0, i = 0; i < POOL_MAX; i++)
+        total += f->found[i].n;
+    if(!ret)
+        ret = cb(ctx, 'c', n ? next : NULL, 0);
+    if(ret >= 0)
+        ret = cb(ctx, 'n', NULL, total);
+    for(i = 0; i < POOL_MAX && ret >= 0; i++){
+        for(p = f->found[i].buf, j = 0; j < f->found[i].n && ret >= 0; j++){
+            memcpy(&size, p + 1, sizeof(size));
+            ret = cb(ctx, p[0], p + 1 + sizeof(size), size);
+            p += 1 + sizeof(size) + strlen(p + 1 + sizeof(size)) + 1;
+        }
+    }
+
+    for(i = 0; i < POOL_MAX; i++)
+        free(f->found[i].buf);
+    free(f);
+    return (ret < 0) ? -1 : 0;
+}
@@ -0,0 +1,59 @@
+/*store.h*/
+//The bridge between the protocol handlers and the tree engine in ../tree.
+//It only speaks plain char so cache22's own int8/int16 never meet the
+//engine's, and it does all of the locking, so handlers on different
+//threads can call it freely.
+
+#include "aof.h"
+#include "expire.h"
+#include "evict.h"
+#include "reclaim.h"
+#include "pool.h"
+
+#define STORE_MAX_VALUE MAX_VALUE_SIZE          //longest value SETRANGE may build (../tree/tree.h)
+#define STORE_BATCH     RESP_MAX_ARGS           //most keys one MGET, MSET or MDEL names
+#define STORE_AHEAD     8                       //keys a batch prefetches ahead of its lookups
+#define STORE_SCAN      10                      //keys a SCAN page aims for by default
+#define STORE_SCAN_MAX  10000                   //most keys one SCAN page may ask for
+#define STORE_FIND      256                     //directories one FIND page looks at
+
+//Called with a value while the directory lock is held; store_mget passes
+//NULL for a key that is not there
+typedef int (*Emit)(void *, const char *, unsigned long);
+
+//Called by store_ls: once with type 'n' and the entry count, then once per
+//entry with 'd' (directory, size 0) or 'f' (key and value size); store_find
+//does the same with full paths. store_scan, store_scanprefix and store_find
+//first call it with 'c' and the next cursor: a number in size for
+//store_scan, the key to resume after for store_scanprefix, the directory
+//to go on at for store_find (NULL once done for both).
+typedef int (*Entry)(void *, char, const char *, unsigned long);
+
+int store_init(void);
+int store_apply(void *, RespCmd *);
+int store_get(const char *, const char *, Emit, void *);
+int store_set(const char *, const char *, const char *, unsigned long);
+int store_setex(const char *, const char *, const char *, unsigned long, unsigned long long);
+char *store_alloc(unsigned long);
+void store_free(char *, unsigned long);
+int store_adopt(const char *, const char *, char *, unsigned long, unsigned long);
+int store_getrange(const char *, const char *, long long, long long, Emit, void *);
+long long store_setrange(const char *, const char *, unsigned long, const char *, unsigned long);
+int store_del(const char *, const char *);
+int store_unlink(const char *, const char *);
+int store_exists(const char *, const char *);
+int store_pexpireat(const char *, const char *, unsigned long long);
+long long store_pttl(const char *, const char *);
+int store_dirttl(const char *, unsigned long long);
+long long store_getdirttl(const char *);
+int store_expired(const char *, const char *, unsigned long long);
+int store_mget(unsigned long, const char **, const char **, Emit, void *);
+int store_mset(unsigned long, const char **, const char **, const char **, const unsigned long *);
+long store_mdel(unsigned long, const char **, const char **);
+int store_mkdir(const char *);
+int store_rmdir(const char *, bool);
+int store_ls(const char *, Entry, void *);
+int store_find(const char *, const char *, const char *, Entry, void *);
+long long store_count(const char *, bool);
+int store_scan(const char *, unsigned long, const char *, unsigned long, Entry, void *);
+int store_scanprefix(const char *, const char *, const char *, const char *, unsigned long, Entry, void *);
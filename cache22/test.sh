@@ -0,0 +1,445 @@
+#!/bin/bash
+#test.sh: start cache22 on a spare port and check its replies, one section
+#per feature. make test runs it; ./test.sh section... runs only those, and
+#KEEP=1 leaves the scratch directory (logs, dumps) behind. Replies are the
+#inline ones ("200 OK", "200 <n>", "200 <value>") unless a request is framed.
+
+port=${PORT:-12079}
+dir=$(mktemp -d)
+server=
+failed=0
+checked=0
+
+trap 'stop; [ -n "$KEEP" ] || rm -rf "$dir"' EXIT
+trap '' PIPE
+
+#start [flags...]: run the server with two I/O threads and connect to it.
+#Each section snapshots into a file of its own, never ./cache22.dump.
+start(){
+    ./cache22 -s "$dir/$section.dump" "$@" $port 2 > "$dir/log" 2>&1 &
+    server=$!
+    for i in $(seq 100); do
+        if exec 3<>/dev/tcp/127.0.0.1/$port; then
+            read -r -t 5 reply <&3
+            return 0
+        fi 2>/dev/null
+        kill -0 $server 2>/dev/null || break
+        sleep 0.1
+    done
+    echo "cache22 $* did not start:"
+    cat "$dir/log"
+    exit 1
+}
+
+#stop: SIGTERM, which shuts down cleanly (last checkpoint, log flushed)
+stop(){
+    exec 3>&- 2>/dev/null
+    if [ -n "$server" ]; then
+        kill $server 2>/dev/null
+        wait $server 2>/dev/null
+        server=
+    fi
+}
+
+#ask command: its first reply line into $reply
+ask(){
+    printf '%s\n' "$1" >&3
+    if ! read -r -t 5 reply <&3; then
+        reply="(no reply)"
+    fi
+    reply=${reply%$'\r'}
+}
+
+#lines n: the next n reply lines into $body, sorted, one per line
+lines(){
+    local i line
+
+    body=
+    for((i = 0; i < $1; i++)); do
+        read -r -t 5 line <&3 || break
+        body+="${line%$'\r'}"$'\n'
+    done
+    body=$(printf '%s' "$body" | sort)
+}
+
+#framed arg...: send the arguments as a framed request, like values too
+#long or too odd for an inline line, and read its first reply line
+framed(){
+    local arg
+
+    printf '*%d\r\n' $# >&3
+    for arg in "$@"; do
+        printf '$%d\r\n%s\r\n' ${#arg} "$arg" >&3
+    done
+    if ! read -r -t 5 reply <&3; then
+        reply="(no reply)"
+    fi
+    reply=${reply%$'\r'}
+}
+
+#check what got wanted
+check(){
+    checked=$((checked + 1))
+    if [ "$2" != "$3" ]; then
+        printf 'FAIL %s: %s\n  got:  %s\n  want: %s\n' "$section" "$1" "$2" "$3"
+        failed=$((failed + 1))
+    fi
+}
+
+#expect command reply: ask and check the first line
+expect(){
+    ask "$1"
+    check "$1" "$reply" "$2"
+}
+
+#A second connection lands on whichever thread the kernel picks; a key set
+#on one must read back on the other
+threads(){
+    start
+    expect "MKDIR /t" "200 OK"
+    expect "SET /t k across" "200 OK"
+    exec 4<>/dev/tcp/127.0.0.1/$port
+    read -r -t 5 reply <&4
+    printf 'GET /t k\n' >&4
+    read -r -t 5 reply <&4
+    check "GET /t k on a second connection" "$reply" "200 across"
+    exec 4>&-
+    for i in $(seq 200); do
+        printf 'SET /t k%d v%d\n' $i $i >&3
+    done
+    for i in $(seq 200); do
+        read -r -t 5 reply <&3
+    done
+    check "200 pipelined SETs" "$reply" "200 OK"
+    expect "GET /t k200" "200 v200"
+    stop
+}
+
+#The store's commands over the protocol
+store(){
+    start
+    expect "MKDIR /s" "200 OK"
+    expect "MKDIR /s" "409 Already exists"
+    expect "SET /s k hello world" "200 OK"
+    expect "GET /s k" "200 hello world"
+    expect "GET /s nope" "404 Not found"
+    expect "GET /nope k" "404 No such directory"
+    expect "EXISTS /s k" "200 1"
+    expect "EXISTS /s nope" "200 0"
+    expect "GETRANGE /s k 0 4" "200 hello"
+    expect "GETRANGE /s k -5 -1" "200 world"
+    expect "SETRANGE /s k 6 there" "200 11"
+    expect "GET /s k" "200 hello there"
+    expect "MKDIR /s/d" "200 OK"
+    expect "LS /s" "200 2"
+    lines 2
+    check "LS /s entries" "$body" $'d d\nf k 11'
+    expect "MSET /s/a 1 /s/d/b 2" "200 OK"
+    expect "MGET /s/a /s/d/b /s/d/c" "200 3"
+    lines 3
+    check "MGET /s/a /s/d/b /s/d/c values" "$body" $'200 1\n200 2\n404 Not found'
+    expect "MDEL /s/a /s/d/b /s/d/c" "200 2"
+    expect "DEL /s k" "200 1"
+    expect "DEL /s k" "200 0"
+    expect "GET /s" "400 Usage: GET <folder> <key>"
+    stop
+}
+
+#Every change goes to the log; a restart replays it. A record cut short at
+#the end is dropped, while one that does not parse stops the start.
+aof(){
+    start -a "$dir/aof" -f always
+    expect "MKDIR /a" "200 OK"
+    expect "SET /a k1 one" "200 OK"
+    expect "SET /a k2 two" "200 OK"
+    expect "DEL /a k1" "200 1"
+    stop
+    grep -q "replayed 0 commands" "$dir/log"
+    check "first start replays nothing" $? 0
+
+    printf '*4\r\n$3\r\nSET\r\n$2\r\n/a' >> "$dir/aof"
+    start -a "$dir/aof"
+    expect "GET /a k2" "200 two"
+    expect "GET /a k1" "404 Not found"
+    expect "SET /a k3 three" "200 OK"
+    stop
+    check "torn tail" "$(grep -c "dropping 19 bytes" "$dir/log") $(grep -c "replayed 4 commands" "$dir/log")" "1 1"
+
+    start -a "$dir/aof"
+    expect "GET /a k3" "200 three"
+    expect "GET /a k2" "200 two"
+    stop
+
+    cp "$dir/aof" "$dir/bad"
+    printf 'SET /a k4 four\r\n' >> "$dir/bad"
+    cat "$dir/aof" >> "$dir/bad"
+    timeout 10 ./cache22 -a "$dir/bad" $port > "$dir/log" 2>&1
+    check "malformed record fails the start" "$? $(grep -c "malformed record" "$dir/log")" "1 1"
+}
+
+#A checkpoint writes the directories that changed since the one before; a
+#restart loads the base and then every delta in order
+ckpt(){
+    start -c "$dir/ckpt" -i 1
+    expect "MKDIR /c" "200 OK"
+    expect "MKDIR /c/a" "200 OK"
+    expect "MKDIR /c/b" "200 OK"
+    expect "SET /c/a k one" "200 OK"
+    expect "SET /c/b k two" "200 OK"
+    sleep 1.5
+    expect "SET /c/a k uno" "200 OK"
+    sleep 1.5
+    expect "SET /c/b j three" "200 OK"
+    expect "MKDIR /c/d" "200 OK"
+    stop
+    check "base" "$(ls "$dir/ckpt" | grep -c '^base.dump$')" 1
+    [ "$(ls "$dir/ckpt" | grep -c '^delta\.')" -ge 2 ]
+    check "deltas" $? 0
+
+    start -c "$dir/ckpt" -i 1
+    expect "GET /c/a k" "200 uno"
+    expect "GET /c/b k" "200 two"
+    expect "GET /c/b j" "200 three"
+    expect "MKDIR /c/d" "409 Already exists"
+    expect "COUNT -r /c" "200 3"
+    stop
+}
+
+#SAVE writes a snapshot the next start loads; BGSAVE writes it from a child
+save(){
+    start
+    expect "MKDIR /v" "200 OK"
+    expect "SET /v k one" "200 OK"
+    expect "LASTSAVE" "404 No save yet"
+    ask "SAVE"
+    check "SAVE" "${reply%% bytes=*}" "200 ok dirs=2 keys=1"
+    expect "SET /v j two" "200 OK"
+    expect "BGSAVE" "200 OK"
+    for i in $(seq 50); do
+        ask "LASTSAVE"
+        [ "$reply" = "200 running" ] || break
+        sleep 0.1
+    done
+    check "LASTSAVE" "${reply%% bytes=*}" "200 ok dirs=2 keys=2"
+    expect "SET /v k changed" "200 OK"
+    stop
+
+    start
+    expect "GET /v k" "200 one"
+    expect "GET /v j" "200 two"
+    stop
+}
+
+#Deadlines sit on the timer wheel until they fire and the key goes
+expire(){
+    start
+    expect "MKDIR /e" "200 OK"
+    expect "SET /e k v" "200 OK"
+    expect "TTL /e k" "200 -1"
+    expect "TTL /e nope" "200 -2"
+    expect "EXPIRE /e k 1" "200 1"
+    expect "EXPIRE /e nope 1" "200 0"
+    expect "TTL /e k" "200 1"
+    expect "SET /e gone v" "200 OK"
+    expect "EXPIRE /e gone 0" "200 1"
+    expect "GET /e gone" "404 Not found"
+    for i in $(seq 100); do
+        printf 'SET /e k%d v\nEXPIRE /e k%d 1\n' $i $i >&3
+    done
+    lines 200
+    expect "DIRTTL /e" "200 0"
+    expect "MKDIR /f" "200 OK"
+    expect "DIRTTL /f 1" "200 OK"
+    expect "DIRTTL /f" "200 1"
+    expect "SET /f k v" "200 OK"
+    expect "TTL /f k" "200 1"
+    framed SET /e px v PX 300
+    check "framed SET PX" "$reply" "+OK"
+    sleep 2.5
+    expect "GET /e k" "404 Not found"
+    expect "GET /e px" "404 Not found"
+    expect "GET /f k" "404 Not found"
+    expect "COUNT /e" "200 0"
+    ask "INFO"
+    check "nothing left to expire" "$(grep -o ' expiring=[0-9]*' <<< "$reply")" " expiring=0"
+    stop
+}
+
+#Over maxmemory, allkeys-lru makes room by evicting; noeviction refuses
+evict(){
+    local value
+
+    value=$(printf '%0100d' 0)
+    start -M 256k -e allkeys-lru
+    expect "MKDIR /m" "200 OK"
+    for i in $(seq 4000); do
+        printf 'SET /m k%d %s\n' $i "$value" >&3
+    done
+    lines 4000
+    check "SETs under allkeys-lru" "$(sort -u <<< "$body")" "200 OK"
+    expect "GET /m k4000" "200 $value"
+    ask "INFO"
+    used=$(grep -o 'used_memory=[0-9]*' <<< "$reply")
+    [ ${used#*=} -le $((262144 + 512)) ] && ! grep -q ' evicted=0 ' <<< "$reply"
+    check "evicted down to maxmemory: $reply" $? 0
+    ask "COUNT /m"
+    [ "${reply#200 }" -lt 4000 ]
+    check "keys evicted" $? 0
+    stop
+
+    start -M 64k -e noeviction
+    expect "MKDIR /m" "200 OK"
+    for i in $(seq 2000); do
+        printf 'SET /m k%d %s\n' $i "$value" >&3
+    done
+    lines 2000
+    check "SETs under noeviction" "$(sort -u <<< "$body" | tail -1)" "507 Out of memory"
+    expect "DEL /m k1" "200 1"
+    ask "INFO"
+    check "nothing evicted" "$(grep -o ' evicted=[0-9]*' <<< "$reply")" " evicted=0"
+    stop
+}
+
+#RMDIR -r and UNLINK reply once the keys are out of the tree and leave the
+#freeing to the reclaim thread
+reclaim(){
+    local value
+
+    value=$(printf '%0200000d' 0)
+    start
+    expect "MKDIR /r" "200 OK"
+    expect "MKDIR /r/a" "200 OK"
+    expect "MKDIR /r/a/b" "200 OK"
+    for i in $(seq 300); do
+        printf 'SET /r/a/b k%d v\n' $i >&3
+    done
+    lines 300
+    expect "SET /r k v" "200 OK"
+    expect "RMDIR /r" "409 Directory not empty"
+    expect "RMDIR -r /r" "200 OK"
+    expect "GET /r k" "404 No such directory"
+    expect "GET /r/a/b k1" "404 No such directory"
+    expect "RMDIR -r /r" "404 No such directory"
+    expect "MKDIR /r" "200 OK"
+    expect "RMDIR /r" "200 OK"
+    expect "LS /" "200 0"
+
+    expect "MKDIR /u" "200 OK"
+    framed SET /u big "$value"
+    check "framed SET of 200000 bytes" "$reply" "+OK"
+    expect "UNLINK /u big" "200 1"
+    expect "UNLINK /u big" "200 0"
+    expect "GET /u big" "404 Not found"
+    expect "SET /u big again" "200 OK"
+    expect "GET /u big" "200 again"
+    stop
+}
+
+#A key that is there for the whole scan comes back at least once however
+#the directory changes under the cursor; PREFIX pages come back sorted
+scan(){
+    local cursor n page keys
+
+    start
+    expect "MKDIR /n" "200 OK"
+    for i in $(seq 100); do
+        printf 'SET /n k%03d v\n' $i >&3
+    done
+    lines 100
+
+    cursor=0
+    keys=
+    page=0
+    while :; do
+        ask "SCAN /n $cursor COUNT 10"
+        read -r _ cursor n <<< "$reply"
+        lines $n
+        keys+="$body"$'\n'
+        page=$((page + 1))
+        if [ $page = 3 ]; then
+            for i in $(seq 101 200); do
+                printf 'SET /n k%03d v\n' $i >&3
+            done
+            for i in $(seq 91 100); do
+                printf 'DEL /n k%03d\n' $i >&3
+            done
+            lines 110
+        fi
+        [ "$cursor" = 0 ] && break
+    done
+    keys=$(grep -o 'k[0-9]*' <<< "$keys" | sort -u)
+    check "keys there throughout" "$(comm -23 <(printf 'k%03d\n' $(seq 90)) - <<< "$keys")" ""
+    expect "SCAN /n x" "400 Usage: SCAN <folder> <cursor> [MATCH <pattern>] [COUNT <n>] [PREFIX <prefix>]"
+
+    ask "SCAN /n 0 MATCH k19* COUNT 1000"
+    read -r _ cursor n <<< "$reply"
+    lines $n
+    check "SCAN MATCH" "$cursor $(grep -o 'k[0-9]*' <<< "$body" | paste -sd' ')" \
+        "0 k190 k191 k192 k193 k194 k195 k196 k197 k198 k199"
+
+    cursor=0
+    keys=
+    while :; do
+        ask "SCAN /n $cursor PREFIX k1 COUNT 7"
+        read -r _ cursor n <<< "$reply"
+        for((i = 0; i < n; i++)); do
+            read -r -t 5 line <&3
+            keys+="${line#f }"$'\n'
+        done
+        [ "$cursor" = 0 ] && break
+    done
+    keys=$(grep -o 'k[0-9]*' <<< "$keys")
+    check "PREFIX pages in order" "$keys" "$(sort <<< "$keys")"
+    check "PREFIX keys" "$(wc -l <<< "$keys")" 99
+    stop
+}
+
+#FIND lists matching paths a page of directories at a time; COUNT -r adds
+#up the whole subtree
+walk(){
+    local cursor n paths pages
+
+    start
+    expect "MKDIR /g" "200 OK"
+    for i in $(seq 300); do
+        printf 'MKDIR /g/d%d\nSET /g/d%d key%d v\n' $i $i $i >&3
+    done
+    lines 600
+    expect "MKDIR /g/d1/x" "200 OK"
+    expect "SET /g/d1/x other v" "200 OK"
+    expect "SET /g top v" "200 OK"
+    expect "COUNT /g" "200 1"
+    expect "COUNT -r /g" "200 302"
+    expect "COUNT -r /g/d1" "200 2"
+    expect "COUNT /nope" "404 No such directory"
+
+    cursor=0
+    paths=
+    pages=0
+    while :; do
+        ask "FIND /g key1* $cursor"
+        read -r _ cursor n <<< "$reply"
+        lines $n
+        paths+="$body"$'\n'
+        pages=$((pages + 1))
+        [ "$cursor" = 0 ] && break
+    done
+    paths=$(grep . <<< "$paths" | sort)
+    check "FIND key1* pages" "$pages" 2
+    check "FIND key1* count" "$(wc -l <<< "$paths")" 111
+    check "FIND key1* first" "$(head -1 <<< "$paths")" "f /g/d1/key1 1"
+
+    ask "FIND /g/d1 x"
+    read -r _ cursor n <<< "$reply"
+    lines $n
+    check "FIND a directory" "$cursor $body" "0 d /g/d1/x"
+    expect "FIND /g x bad" "400 Usage: FIND <folder> <pattern> [<cursor>]"
+    stop
+}
+
+sections="threads store aof ckpt save expire evict reclaim scan walk"
+for section in ${@:-$sections}; do
+    $section
+done
+echo "$checked checks, $failed failed"
+[ $failed = 0 ]
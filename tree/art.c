@@ -0,0 +1,759 @@
+/*Adaptive radix tree: the ordered index behind the "art" storage engine*/
+#include "art.h"
+#include "slab.h"
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+typedef enum {
+    Art4 = 1,
+    Art16,
+    Art48,
+    Art256
+} ArtKind;
+
+// Header shared by the four inner node sizes
+typedef struct s_artnode {
+    uint8_t kind;               // ArtKind
+    uint16_t count;             // children in use
+    uint32 prefix_len;          // bytes every key below shares at this depth
+    uint8_t prefix[ART_PREFIX]; // the first of them
+} ArtNode;
+
+// Up to 4 and 16 children: key bytes kept sorted, children in the same order
+typedef struct s_artnode4 {
+    ArtNode n;
+    uint8_t keys[4];
+    void *children[4];
+} ArtNode4;
+
+typedef struct s_artnode16 {
+    ArtNode n;
+    uint8_t keys[16];
+    void *children[16];
+} ArtNode16;
+
+// Up to 48: a byte-indexed table of child slots (slot + 1, 0 for none)
+typedef struct s_artnode48 {
+    ArtNode n;
+    uint8_t index[256];
+    void *children[48];
+} ArtNode48;
+
+// A child per byte value
+typedef struct s_artnode256 {
+    ArtNode n;
+    void *children[256];
+} ArtNode256;
+
+// Leaves carry the whole key, so a lookup ends with one compare
+typedef struct s_artleaf {
+    void *value;
+    uint32 len;
+    uint8_t key[];
+} ArtLeaf;
+
+// Leaves hide behind a tagged child pointer
+#define IS_LEAF(p)  ((uintptr_t)(p) & 1)
+#define LEAF(p)     ((ArtLeaf *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define TAG(l)      ((void *)((uintptr_t)(l) | 1))
+
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+
+static const size_t node_size[] = {
+    0, sizeof(ArtNode4), sizeof(ArtNode16), sizeof(ArtNode48), sizeof(ArtNode256)
+};
+
+static ArtNode *alloc_node(ArtKind kind) {
+    ArtNode *n;
+
+    n = (ArtNode *)slab_alloc(node_size[kind]);
+    if (!n) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(n, 0, node_size[kind]);
+    n->kind = (uint8_t)kind;
+
+    return n;
+}
+
+static void free_node(ArtNode *n) {
+    slab_free(n, node_size[n->kind]);
+}
+
+static ArtLeaf *make_leaf(const uint8_t *key, uint32 len, void *value) {
+    ArtLeaf *l;
+
+    l = (ArtLeaf *)slab_alloc(sizeof(ArtLeaf) + len);
+    if (!l) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    l->value = value;
+    l->len = len;
+    memcpy(l->key, key, len);
+
+    return l;
+}
+
+static void release_leaf(ArtLeaf *l) {
+    slab_free(l, sizeof(ArtLeaf) + l->len);
+}
+
+static bool leaf_matches(const ArtLeaf *l, const uint8_t *key, uint32 len) {
+    return l->len == len && memcmp(l->key, key, len) == 0;
+}
+
+// The child slot for byte c, NULL if there is none
+static void **find_child(ArtNode *n, uint8_t c) {
+    uint32 i;
+
+    switch (n->kind) {
+    case Art4: {
+        ArtNode4 *p = (ArtNode4 *)n;
+        for (i = 0; i < n->count; i++) {
+            if (p->keys[i] == c) {
+                return &p->children[i];
+            }
+        }
+        break;
+    }
+    case Art16: {
+        ArtNode16 *p = (ArtNode16 *)n;
+        for (i = 0; i < n->count && p->keys[i] <= c; i++) {
+            if (p->keys[i] == c) {
+                return &p->children[i];
+            }
+        }
+        break;
+    }
+    case Art48: {
+        ArtNode48 *p = (ArtNode48 *)n;
+        if (p->index[c]) {
+            return &p->children[p->index[c] - 1];
+        }
+        break;
+    }
+    case Art256: {
+        ArtNode256 *p = (ArtNode256 *)n;
+        if (p->children[c]) {
+            return &p->children[c];
+        }
+        break;
+    }
+    }
+
+    return NULL;
+}
+
+// The leaf with the smallest key below n
+static ArtLeaf *minimum(const void *p) {
+    const ArtNode *n;
+    uint32 i;
+
+    while (!IS_LEAF(p)) {
+        n = (const ArtNode *)p;
+        switch (n->kind) {
+        case Art4:
+            p = ((const ArtNode4 *)n)->children[0];
+            break;
+        case Art16:
+            p = ((const ArtNode16 *)n)->children[0];
+            break;
+        case Art48:
+            for (i = 0; !((const ArtNode48 *)n)->index[i]; i++);
+            p = ((const ArtNode48 *)n)->children[((const ArtNode48 *)n)->index[i] - 1];
+            break;
+        default:
+            for (i = 0; !((const ArtNode256 *)n)->children[i]; i++);
+            p = ((const ArtNode256 *)n)->children[i];
+            break;
+        }
+    }
+
+    return LEAF(p);
+}
+
+// How many of the prefix bytes kept in n match key at depth
+static uint32 check_prefix(const ArtNode *n, const uint8_t *key, uint32 len, uint32 depth) {
+    uint32 max, i;
+
+    max = MIN(MIN(n->prefix_len, ART_PREFIX), len - depth);
+    for (i = 0; i < max && n->prefix[i] == key[depth + i]; i++);
+
+    return i;
+}
+
+// Where key first differs from the whole prefix of n, looking at a leaf past the kept bytes
+static uint32 prefix_mismatch(const ArtNode *n, const uint8_t *key, uint32 len, uint32 depth) {
+    const ArtLeaf *l;
+    uint32 max, i;
+
+    i = check_prefix(n, key, len, depth);
+    if (i < MIN(n->prefix_len, ART_PREFIX) || n->prefix_len <= ART_PREFIX) {
+        return i;
+    }
+
+    l = minimum(n);
+    max = MIN(l->len, len) - depth;
+    for (; i < max && i < n->prefix_len && l->key[depth + i] == key[depth + i]; i++);
+
+    return i;
+}
+
+/**
+ * Find the value stored under key
+ * @param t The tree
+ * @param key The key bytes
+ * @param len The key length
+ * @return The value, NULL if the key is not there
+ */
+void *art_search(const Art *t, const uint8_t *key, uint32 len) {
+    void **slot;
+    void *p;
+    ArtNode *n;
+    uint32 depth;
+
+    p = t->root;
+    depth = 0;
+    while (p) {
+        if (IS_LEAF(p)) {
+            return leaf_matches(LEAF(p), key, len) ? LEAF(p)->value : NULL;
+        }
+
+        // Only the kept prefix bytes are compared; the leaf settles the rest
+        n = (ArtNode *)p;
+        if (n->prefix_len) {
+            if (check_prefix(n, key, len, depth) != MIN(n->prefix_len, ART_PREFIX)) {
+                return NULL;
+            }
+            depth += n->prefix_len;
+        }
+        if (depth >= len) {
+            return NULL;
+        }
+
+        slot = find_child(n, key[depth]);
+        p = slot ? *slot : NULL;
+        depth++;
+    }
+
+    return NULL;
+}
+
+static const uint32 capacity[] = {0, 4, 16, 48, 256};
+
+// Move the children of n into a node of the next size up, which replaces n at ref
+static ArtNode *grow(ArtNode *n, void **ref) {
+    ArtNode *g;
+    uint32 i;
+
+    g = alloc_node((ArtKind)(n->kind + 1));
+    if (!g) {
+        return NULL;
+    }
+    g->count = n->count;
+    g->prefix_len = n->prefix_len;
+    memcpy(g->prefix, n->prefix, MIN(n->prefix_len, ART_PREFIX));
+
+    switch (n->kind) {
+    case Art4:
+        memcpy(((ArtNode16 *)g)->keys, ((ArtNode4 *)n)->keys, n->count);
+        memcpy(((ArtNode16 *)g)->children, ((ArtNode4 *)n)->children, n->count * sizeof(void *));
+        break;
+    case Art16:
+        for (i = 0; i < n->count; i++) {
+            ((ArtNode48 *)g)->children[i] = ((ArtNode16 *)n)->children[i];
+            ((ArtNode48 *)g)->index[((ArtNode16 *)n)->keys[i]] = (uint8_t)(i + 1);
+        }
+        break;
+    default:
+        for (i = 0; i < 256; i++) {
+            if (((ArtNode48 *)n)->index[i]) {
+                ((ArtNode256 *)g)->children[i] = ((ArtNode48 *)n)->children[((ArtNode48 *)n)->index[i] - 1];
+            }
+        }
+        break;
+    }
+
+    *ref = g;
+    free_node(n);
+    return g;
+}
+
+// Add child under byte c; n must have room (see grow)
+static void add_child(ArtNode *n, uint8_t c, void *child) {
+    uint32 i;
+
+    switch (n->kind) {
+    case Art4:
+    case Art16: {
+        uint8_t *keys = (n->kind == Art4) ? ((ArtNode4 *)n)->keys : ((ArtNode16 *)n)->keys;
+        void **children = (n->kind == Art4) ? ((ArtNode4 *)n)->children : ((ArtNode16 *)n)->children;
+        for (i = 0; i < n->count && keys[i] < c; i++);
+        memmove(keys + i + 1, keys + i, n->count - i);
+        memmove(children + i + 1, children + i, (n->count - i) * sizeof(void *));
+        keys[i] = c;
+        children[i] = child;
+        break;
+    }
+    case Art48: {
+        ArtNode48 *p = (ArtNode48 *)n;
+        for (i = 0; p->children[i]; i++);
+        p->children[i] = child;
+        p->index[c] = (uint8_t)(i + 1);
+        break;
+    }
+    default:
+        ((ArtNode256 *)n)->children[c] = child;
+        break;
+    }
+    n->count++;
+}
+
+static int insert(void **ref, const uint8_t *key, uint32 len, uint32 depth, void *value, void **old) {
+    ArtLeaf *l, *nl, *ml;
+    ArtNode *n, *split;
+    void **slot;
+    uint32 i, diff;
+
+    // Empty slot: the key gets a leaf of its own
+    if (!*ref) {
+        if (!(nl = make_leaf(key, len, value))) {
+            return -1;
+        }
+        *ref = TAG(nl);
+        return 0;
+    }
+
+    // A leaf: replace its value, or split it into a node holding both keys
+    if (IS_LEAF(*ref)) {
+        l = LEAF(*ref);
+        if (leaf_matches(l, key, len)) {
+            *old = l->value;
+            l->value = value;
+            return 1;
+        }
+
+        for (i = depth; i < l->len && i < len && l->key[i] == key[i]; i++);
+        if (i == l->len || i == len) {
+            // One key is a prefix of the other
+            errno = EINVAL;
+            return -1;
+        }
+        split = alloc_node(Art4);
+        if (!split || !(nl = make_leaf(key, len, value))) {
+            if (split) {
+                free_node(split);
+            }
+            return -1;
+        }
+        split->prefix_len = i - depth;
+        memcpy(split->prefix, key + depth, MIN(split->prefix_len, ART_PREFIX));
+        add_child(split, l->key[i], *ref);
+        add_child(split, key[i], TAG(nl));
+        *ref = split;
+        return 0;
+    }
+
+    // The key leaves the node's prefix early: split the prefix there
+    n = (ArtNode *)*ref;
+    if (n->prefix_len) {
+        diff = prefix_mismatch(n, key, len, depth);
+        if (diff < n->prefix_len) {
+            if (depth + diff >= len) {
+                errno = EINVAL;
+                return -1;
+            }
+            split = alloc_node(Art4);
+            if (!split || !(nl = make_leaf(key, len, value))) {
+                if (split) {
+                    free_node(split);
+                }
+                return -1;
+            }
+            split->prefix_len = diff;
+            memcpy(split->prefix, n->prefix, MIN(diff, ART_PREFIX));
+
+            // n keeps what follows the byte it now hangs from
+            if (n->prefix_len <= ART_PREFIX) {
+                add_child(split, n->prefix[diff], n);
+                n->prefix_len -= diff + 1;
+                memmove(n->prefix, n->prefix + diff + 1, MIN(n->prefix_len, ART_PREFIX));
+            } else {
+                ml = minimum(n);
+                n->prefix_len -= diff + 1;
+                add_child(split, ml->key[depth + diff], n);
+                memcpy(n->prefix, ml->key + depth + diff + 1, MIN(n->prefix_len, ART_PREFIX));
+            }
+            add_child(split, key[depth + diff], TAG(nl));
+            *ref = split;
+            return 0;
+        }
+        depth += n->prefix_len;
+    }
+    if (depth >= len) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    slot = find_child(n, key[depth]);
+    if (slot) {
+        return insert(slot, key, len, depth + 1, value, old);
+    }
+
+    // A full node grows first, so a failure leaves the tree as it was
+    if (n->count == capacity[n->kind] && !(n = grow(n, ref))) {
+        return -1;
+    }
+    if (!(nl = make_leaf(key, len, value))) {
+        return -1;
+    }
+    add_child(n, key[depth], TAG(nl));
+    return 0;
+}
+
+/**
+ * Store value under key, replacing the value of an existing key
+ * @param t The tree
+ * @param key The key bytes; no key may be a prefix of another
+ * @param len The key length
+ * @param value The value, not NULL
+ * @param old Set to the replaced value when the key was there
+ * @return 0 for a new key, 1 if it replaced one, -1 on error
+ */
+int art_insert(Art *t, const uint8_t *key, uint32 len, void *value, void **old) {
+    int ret;
+
+    if (!len || !value) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ret = insert(&t->root, key, len, 0, value, old);
+    if (ret == 0) {
+        t->size++;
+    }
+
+    return ret;
+}
+
+// Shrink n into the next size down once it is sparse enough; the gaps avoid thrashing at the boundary
+static void shrink(ArtNode *n, void **ref) {
+    ArtNode *s;
+    void *child;
+    uint32 i, j, prefix;
+
+    switch (n->kind) {
+    case Art4:
+        if (n->count != 1) {
+            return;
+        }
+        // One child left: the node goes and its prefix and key byte move down
+        child = ((ArtNode4 *)n)->children[0];
+        if (!IS_LEAF(child)) {
+            s = (ArtNode *)child;
+            prefix = n->prefix_len;
+            if (prefix < ART_PREFIX) {
+                n->prefix[prefix++] = ((ArtNode4 *)n)->keys[0];
+            }
+            if (prefix < ART_PREFIX) {
+                j = MIN(s->prefix_len, ART_PREFIX - prefix);
+                memcpy(n->prefix + prefix, s->prefix, j);
+                prefix += j;
+            }
+            memcpy(s->prefix, n->prefix, MIN(prefix, ART_PREFIX));
+            s->prefix_len += n->prefix_len + 1;
+        }
+        *ref = child;
+        free_node(n);
+        return;
+    case Art16:
+        if (n->count != 3 || !(s = alloc_node(Art4))) {
+            return;
+        }
+        memcpy(((ArtNode4 *)s)->keys, ((ArtNode16 *)n)->keys, 3);
+        memcpy(((ArtNode4 *)s)->children, ((ArtNode16 *)n)->children, 3 * sizeof(void *));
+        break;
+    case Art48:
+        if (n->count != 12 || !(s = alloc_node(Art16))) {
+            return;
+        }
+        for (i = 0, j = 0; i < 256; i++) {
+            if (((ArtNode48 *)n)->index[i]) {
+                ((ArtNode16 *)s)->keys[j] = (uint8_t)i;
+                ((ArtNode16 *)s)->children[j++] = ((ArtNode48 *)n)->children[((ArtNode48 *)n)->index[i] - 1];
+            }
+        }
+        break;
+    default:
+        if (n->count != 37 || !(s = alloc_node(Art48))) {
+            return;
+        }
+        for (i = 0, j = 0; i < 256; i++) {
+            if (((ArtNode256 *)n)->children[i]) {
+                ((ArtNode48 *)s)->children[j] = ((ArtNode256 *)n)->children[i];
+                ((ArtNode48 *)s)->index[i] = (uint8_t)(++j);
+            }
+        }
+        break;
+    }
+
+    s->count = n->count;
+    s->prefix_len = n->prefix_len;
+    memcpy(s->prefix, n->prefix, MIN(n->prefix_len, ART_PREFIX));
+    *ref = s;
+    free_node(n);
+}
+
+// Take the child under byte c (at slot) out of n
+static void remove_child(ArtNode *n, void **ref, uint8_t c, void **slot) {
+    uint32 i;
+
+    switch (n->kind) {
+    case Art4:
+    case Art16: {
+        uint8_t *keys = (n->kind == Art4) ? ((ArtNode4 *)n)->keys : ((ArtNode16 *)n)->keys;
+        void **children = (n->kind == Art4) ? ((ArtNode4 *)n)->children : ((ArtNode16 *)n)->children;
+        i = (uint32)(slot - children);
+        memmove(keys + i, keys + i + 1, n->count - i - 1);
+        memmove(children + i, children + i + 1, (n->count - i - 1) * sizeof(void *));
+        break;
+    }
+    case Art48:
+        ((ArtNode48 *)n)->children[((ArtNode48 *)n)->index[c] - 1] = NULL;
+        ((ArtNode48 *)n)->index[c] = 0;
+        break;
+    default:
+        ((ArtNode256 *)n)->children[c] = NULL;
+        break;
+    }
+
+    n->count--;
+    shrink(n, ref);
+}
+
+static void *delete(void **ref, const uint8_t *key, uint32 len, uint32 depth) {
+    ArtLeaf *l;
+    ArtNode *n;
+    void **slot;
+    void *value;
+
+    if (!*ref) {
+        return NULL;
+    }
+    if (IS_LEAF(*ref)) {
+        // Only the root can be a bare leaf here
+        l = LEAF(*ref);
+        if (!leaf_matches(l, key, len)) {
+            return NULL;
+        }
+        value = l->value;
+        *ref = NULL;
+        release_leaf(l);
+        return value;
+    }
+
+    n = (ArtNode *)*ref;
+    if (n->prefix_len) {
+        if (check_prefix(n, key, len, depth) != MIN(n->prefix_len, ART_PREFIX)) {
+            return NULL;
+        }
+        depth += n->prefix_len;
+    }
+    if (depth >= len || !(slot = find_child(n, key[depth]))) {
+        return NULL;
+    }
+
+    if (!IS_LEAF(*slot)) {
+        return delete(slot, key, len, depth + 1);
+    }
+    l = LEAF(*slot);
+    if (!leaf_matches(l, key, len)) {
+        return NULL;
+    }
+    value = l->value;
+    remove_child(n, ref, key[depth], slot);
+    release_leaf(l);
+    return value;
+}
+
+/**
+ * Remove a key
+ * @param t The tree
+ * @param key The key bytes
+ * @param len The key length
+ * @return The value it held, NULL if the key was not there
+ */
+void *art_delete(Art *t, const uint8_t *key, uint32 len) {
+    void *value;
+
+    value = delete(&t->root, key, len, 0);
+    if (value) {
+        t->size--;
+    }
+
+    return value;
+}
+
+/*
+ * In-order walk from the lower bound `from`. While bounded, the subtree
+ * under p may hold keys on both sides of the bound, so its prefix is
+ * compared with it and children before the bound's byte are skipped; once
+ * a subtree is known to lie wholly past the bound, it is walked unchecked.
+ */
+static int seek(const void *p, const uint8_t *from, uint32 len, uint32 depth, bool bounded,
+                ArtVisit visit, void *ctx) {
+    const ArtNode *n;
+    const ArtLeaf *l, *ml;
+    const void *child;
+    uint32 i, plen;
+    int c, ret;
+
+    if (IS_LEAF(p)) {
+        l = LEAF(p);
+        if (bounded) {
+            c = memcmp(l->key, from, MIN(l->len, len));
+            if (c < 0 || (c == 0 && l->len < len)) {
+                return 0;
+            }
+        }
+        return visit(ctx, l->key, l->len, l->value);
+    }
+
+    n = (const ArtNode *)p;
+    if (bounded && n->prefix_len) {
+        // The whole prefix, taken from a leaf when it is longer than the kept bytes
+        ml = (n->prefix_len > ART_PREFIX) ? minimum(n) : NULL;
+        plen = n->prefix_len;
+        for (i = 0; i < plen; i++) {
+            if (depth + i >= len) {
+                bounded = false;
+                break;
+            }
+            c = (int)(ml ? ml->key[depth + i] : n->prefix[i]) - (int)from[depth + i];
+            if (c < 0) {
+                return 0;
+            }
+            if (c > 0) {
+                bounded = false;
+                break;
+            }
+        }
+    }
+    depth += n->prefix_len;
+    if (bounded && depth >= len) {
+        bounded = false;
+    }
+
+    for (i = 0; i < 256; i++) {
+        switch (n->kind) {
+        case Art4:
+            if (i >= n->count) {
+                return 0;
+            }
+            c = ((const ArtNode4 *)n)->keys[i];
+            child = ((const ArtNode4 *)n)->children[i];
+            break;
+        case Art16:
+            if (i >= n->count) {
+                return 0;
+            }
+            c = ((const ArtNode16 *)n)->keys[i];
+            child = ((const ArtNode16 *)n)->children[i];
+            break;
+        case Art48:
+            c = (int)i;
+            child = ((const ArtNode48 *)n)->index[i] ?
+                ((const ArtNode48 *)n)->children[((const ArtNode48 *)n)->index[i] - 1] : NULL;
+            break;
+        default:
+            c = (int)i;
+            child = ((const ArtNode256 *)n)->children[i];
+            break;
+        }
+        if (!child || (bounded && c < from[depth])) {
+            continue;
+        }
+
+        ret = seek(child, from, len, depth + 1, bounded && c == from[depth], visit, ctx);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Visit every key at or after `from`, in byte order
+ * @param t The tree
+ * @param from The lower bound; need not be a stored key (len 0 for all)
+ * @param len The bound's length
+ * @param visit Called per key until it returns non-zero
+ * @param ctx Passed to visit
+ * @return The first non-zero return of visit, or 0
+ */
+int art_seek(const Art *t, const uint8_t *from, uint32 len, ArtVisit visit, void *ctx) {
+    if (!t->root) {
+        return 0;
+    }
+
+    return seek(t->root, from, len, 0, len > 0, visit, ctx);
+}
+
+static void release_all(void *p, void (*release)(void *value)) {
+    const ArtNode *n;
+    uint32 i;
+
+    if (IS_LEAF(p)) {
+        if (release) {
+            release(LEAF(p)->value);
+        }
+        release_leaf(LEAF(p));
+        return;
+    }
+
+    n = (const ArtNode *)p;
+    switch (n->kind) {
+    case Art4:
+        for (i = 0; i < n->count; i++) {
+            release_all(((ArtNode4 *)n)->children[i], release);
+        }
+        break;
+    case Art16:
+        for (i = 0; i < n->count; i++) {
+            release_all(((ArtNode16 *)n)->children[i], release);
+        }
+        break;
+    case Art48:
+        for (i = 0; i < 48; i++) {
+            if (((ArtNode48 *)n)->children[i]) {
+                release_all(((ArtNode48 *)n)->children[i], release);
+            }
+        }
+        break;
+    default:
+        for (i = 0; i < 256; i++) {
+            if (((ArtNode256 *)n)->children[i]) {
+                release_all(((ArtNode256 *)n)->children[i], release);
+            }
+        }
+        break;
+    }
+    free_node((ArtNode *)n);
+}
+
+/**
+ * Free every node and leaf, handing each value to release first
+ * @param t The tree, empty afterwards
+ * @param release Called per value, or NULL
+ */
+void art_free(Art *t, void (*release)(void *value)) {
+    if (t->root) {
+        release_all(t->root, release);
+    }
+    t->root = NULL;
+    t->size = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef ART_H
+#define ART_H
+
+#include <stdint.h>
+
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+// Prefix bytes an inner node keeps; a longer shared prefix is checked at a leaf
+#define ART_PREFIX 10
+
+/*
+ * Adaptive radix tree (Leis et al., ICDE 2013) over byte-string keys.
+ * Inner nodes come in four sizes (4, 16, 48 and 256 children) and grow or
+ * shrink with their fanout; runs of single-child nodes are folded into
+ * the prefix of the node below (path compression). A lookup costs
+ * O(key length) whatever the number of keys, and keys come out of
+ * art_seek in byte order. No key may be a prefix of another: callers
+ * end their keys with a terminator.
+ */
+typedef struct s_art {
+    void *root;     // an inner node or a tagged leaf, NULL when empty
+    uint64 size;    // keys stored
+} Art;
+
+// Called by art_seek per key in order; a non-zero return stops the walk
+typedef int (*ArtVisit)(void *ctx, const uint8_t *key, uint32 len, void *value);
+
+void *art_search(const Art *t, const uint8_t *key, uint32 len);
+int art_insert(Art *t, const uint8_t *key, uint32 len, void *value, void **old);
+void *art_delete(Art *t, const uint8_t *key, uint32 len);
+int art_seek(const Art *t, const uint8_t *from, uint32 len, ArtVisit visit, void *ctx);
+void art_free(Art *t, void (*release)(void *value));
+
+#endif // ART_H
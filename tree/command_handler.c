@@ -1,5 +1,7 @@
 #define _GNU_SOURCE  // For strdup and strcasecmp
 #include "command_handler.h"
+#include "slab.h"
+#include "intern.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -58,351 +60,168 @@ char* strtok_r(char* str, const char* delim, char** saveptr) {
 
 // Available commands
 static const Command commands[] = {
-    {"SET", (command_handler_t)handle_set, "SET <key> <value> - Set a key-value pair"},
-    {"GET", (command_handler_t)handle_get, "GET <key> - Get the value for a key"},
-    {"DEL", (command_handler_t)handle_del, "DEL <key> - Delete a key-value pair"},
-    {"EXISTS", (command_handler_t)handle_exists, "EXISTS <key> - Check if a key exists"},
-    {"MKDIR", (command_handler_t)handle_mkdir, "MKDIR <path> - Create a new directory"},
-    {"CD", (command_handler_t)handle_cd, "CD <path> - Change current directory"},
-    {"LS", (command_handler_t)handle_ls, "LS - List contents of current directory"},
-    {"PWD", (command_handler_t)handle_pwd, "PWD - Print working directory"},
-    {"HELP", (command_handler_t)handle_help, "HELP - Show this help message"},
+    {"SET", handle_set, "SET <key> <value> - Set a key-value pair"},
+    {"GET", handle_get, "GET <key> - Get the value for a key"},
+    {"GETRANGE", handle_getrange, "GETRANGE <key> <start> <end> - Get part of a value"},
+    {"SETRANGE", handle_setrange, "SETRANGE <key> <offset> <value> - Overwrite part of a value"},
+    {"DEL", handle_del, "DEL <key> - Delete a key-value pair"},
+    {"EXISTS", handle_exists, "EXISTS <key> - Check if a key exists"},
+    {"SCAN", handle_scan, "SCAN [<from>] - List keys from <from> on in key order"},
+    {"MKDIR", handle_mkdir, "MKDIR <path> - Create a new directory"},
+    {"CD", handle_cd, "CD <path> - Change current directory"},
+    {"LS", handle_ls, "LS - List contents of current directory"},
+    {"PWD", handle_pwd, "PWD - Print working directory"},
+    {"STATS", handle_stats, "STATS - Show memory allocator statistics"},
+    {"HELP", handle_help, "HELP - Show this help message"},
     {NULL, NULL, NULL} // Sentinel
 };
 
 // Forward declarations of helper functions
 char *trim_whitespace(char *str);
-char **split_path(const char *path, int *count);
-void free_path_components(char **components, int count);
 
 // Navigation command handlers
-void handle_cd(void **root_ptr, const char *path) {
-    if (!root_ptr || !*root_ptr) {
-        printf("Error: Invalid root pointer\n");
-        return;
-    }
-    
-    // Cast the void** to Node** for safe dereferencing
-    Node **node_ptr = (Node **)root_ptr;
-    Node *root = *node_ptr;
-    
-    // Handle root directory
-    if (!path || !*path || strcmp(path, "/") == 0) {
-        while (root->north) {
-            root = root->north;
-        }
-        *node_ptr = root;
-        return;
-    }
-    
-    // Handle parent directory
-    if (strcmp(path, "..") == 0) {
-        if (root->north) {
-            *node_ptr = root->north;
-        }
-        return;
-    }
+void handle_cd(Session *s, RespCmd *cmd) {
+    const char *path = (cmd->argc > 1) ? cmd->argv[1] : "";
+    int8 abs[MAX_PATH_LENGTH];
+    uint32 ndirs, nkeys;
     
-    // Handle current directory
-    if (strcmp(path, ".") == 0) {
-        return;
+    // An empty path goes back to the root
+    if (!*path) {
+        path = "/";
     }
     
-    // Handle absolute paths
-    Node *current = *root_ptr;
-    if (path[0] == '/') {
-        // Go to root
-        while (current->north) current = current->north;
-        path++; // Skip the leading '/'
-        if (!*path) {
-            *root_ptr = current;
-            return;
+    // Resolve against the working directory, then make sure it is there
+    if (engine_path(s->cwd, (const int8 *)path, abs) < 0 ||
+        s->engine->stat(abs, &ndirs, &nkeys) < 0) {
+        if (errno == ENOENT) {
+            printf("Error: No such directory: %s\n", path);
+        } else {
+            printf("Error: Invalid path: %s\n", strerror(errno));
         }
-    }
-    
-    // Split path into components
-    int count = 0;
-    char **components = split_path(path, &count);
-    if (!components) {
-        printf("Error: Invalid path\n");
         return;
     }
     
-    // Traverse the path
-    for (int i = 0; i < count; i++) {
-        if (strcmp(components[i], "..") == 0) {
-            if (current->north) {
-                current = current->north;
-            }
-        } else if (strcmp(components[i], ".") != 0) {
-            // Look for the child node with this name
-            Tree *child = current->east;
-            Node *found = NULL;
-            
-            while (child) {
-                if (child->n.tag & TagNode) {
-                    if (strcmp((char *)child->n.path, components[i]) == 0) {
-                        found = &child->n;
-                        break;
-                    }
-                }
-                child = (child->n.tag & TagNode) ? child->n.east : (Tree *)((Leaf *)child)->east;
-            }
-            
-            if (!found) {
-                printf("Error: No such directory: %s\n", components[i]);
-                free_path_components(components, count);
-                return;
-            }
-            
-            current = found;
-        }
-    }
-    
-    *root_ptr = current;
-    free_path_components(components, count);
+    strcpy((char *)s->cwd, (const char *)abs);
 }
 
 // Create a new directory
-void handle_mkdir(void *root_ptr, const char *path) {
-    Node *root = (Node *)root_ptr;
+void handle_mkdir(Session *s, RespCmd *cmd) {
+    const char *path = (cmd->argc > 1) ? cmd->argv[1] : NULL;
     if (!path || !*path) {
         printf("Error: Missing directory name. Usage: MKDIR <path>\n");
         return;
     }
     
-    // Handle absolute paths
-    if (path[0] == '/') {
-        // Go to root
-        while (root->north) root = root->north;
-        path++; // Skip the leading '/'
-        if (!*path) {
-            printf("Error: Cannot create root directory\n");
-            return;
-        }
+    // Split off the last component without copying the path
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+    size_t name_start = len;
+    while (name_start > 0 && path[name_start - 1] != '/') name_start--;
+    size_t name_len = len - name_start;
+    
+    if (name_len == 0) {
+        printf("Error: Cannot create root directory\n");
+        return;
+    }
+    if (name_len > MAX_NAME_LENGTH ||
+        (name_len == 1 && path[name_start] == '.') ||
+        (name_len == 2 && path[name_start] == '.' && path[name_start + 1] == '.')) {
+        printf("Error: Invalid path\n");
+        return;
     }
     
-    // Split path into components
-    int count = 0;
-    char **components = split_path(path, &count);
-    if (!components || count == 0) {
+    // Resolve the parent directory
+    char parent_path[MAX_PATH_LENGTH];
+    if (name_start == 0) {
+        strcpy(parent_path, ".");
+    } else if (name_start >= sizeof(parent_path)) {
         printf("Error: Invalid path\n");
         return;
+    } else {
+        memcpy(parent_path, path, name_start);
+        parent_path[name_start] = '\0';
     }
     
-    // Navigate to the parent directory
-    Node *current = root;
-    for (int i = 0; i < count - 1; i++) {
-        Tree *child = current->east;
-        Node *found = NULL;
-        
-        while (child) {
-            if (child->n.tag & TagNode) {
-                if (strcmp((char *)child->n.path, components[i]) == 0) {
-                    found = &child->n;
-                    break;
-                }
-            }
-            child = (child->n.tag & TagNode) ? child->n.east : (Tree *)((Leaf *)child)->east;
-        }
-        
-        if (!found) {
-            printf("Error: No such directory: %s\n", components[i]);
-            free_path_components(components, count);
-            return;
-        }
-        
-        current = found;
+    int8 abs[MAX_PATH_LENGTH];
+    uint32 ndirs, nkeys;
+    int n = engine_path(s->cwd, (const int8 *)parent_path, abs);
+    if (n < 0 || s->engine->stat(abs, &ndirs, &nkeys) < 0) {
+        printf("Error: No such directory: %s\n", parent_path);
+        return;
     }
     
-    // Create the new directory
-    Node *new_node = create_node(current, (int8 *)components[count-1]);
-    if (!new_node) {
-        printf("Error: Failed to create directory: %s\n", strerror(errno));
-        free_path_components(components, count);
+    // The new directory's absolute path is its parent's plus its name
+    if ((size_t)n + name_len + 2 > sizeof(abs)) {
+        printf("Error: Invalid path\n");
         return;
     }
+    if (n > 1) {
+        abs[n++] = '/';
+    }
+    memcpy(abs + n, path + name_start, name_len);
+    abs[n + name_len] = '\0';
     
-    // Link the new node into the tree
-    if (!current->east) {
-        // First child of this node
-        current->east = (Tree *)new_node;
-    } else {
-        // Add to the end of the sibling list
-        Tree *sibling = current->east;
-        Tree *last_sibling = NULL;
-        
-        // Find the last sibling in the list
-        while (1) {
-            if (sibling->n.tag & TagNode) {
-                // It's a node
-                if (!sibling->n.east) {
-                    last_sibling = sibling;
-                    break;
-                }
-                sibling = sibling->n.east;
-            } else if (sibling->l.tag & TagLeaf) {
-                // It's a leaf
-                if (!((Leaf *)sibling)->east) {
-                    last_sibling = sibling;
-                    break;
-                }
-                sibling = (Tree *)((Leaf *)sibling)->east;
-            } else {
-                // Unknown type, should not happen
-                printf("Error: Unknown node type in sibling list\n");
-                free_path_components(components, count);
-                free(new_node);
-                return;
-            }
-        }
-        
-        // Link the new node to the last sibling
-        if (last_sibling) {
-            if (last_sibling->n.tag & TagNode) {
-                // Last sibling is a node
-                Node *last_node = (Node *)last_sibling;
-                last_node->east = (Tree *)new_node;
-                // The west pointer should be set by create_node, so we don't need to set it here
-            } else if (last_sibling->l.tag & TagLeaf) {
-                // Last sibling is a leaf - we can't have a leaf as the last sibling when adding a new node
-                // This should not happen as we should only be adding nodes to the node list
-                printf("Error: Cannot add a directory after a leaf node\n");
-                free_path_components(components, count);
-                free(new_node);
-                return;
-            }
+    if (s->engine->mkdir(abs) < 0) {
+        if (errno == EEXIST) {
+            printf("Error: Directory already exists: %.*s\n", (int)name_len, path + name_start);
+        } else {
+            printf("Error: Failed to create directory: %s\n", strerror(errno));
         }
+        return;
     }
     
     printf("OK\n");
-    
-    free_path_components(components, count);
 }
 
-void handle_ls(const void *root_ptr) {
-    const Node *root = (const Node *)root_ptr;
-    if (!root) {
-        printf("Error: Invalid directory\n");
-        return;
-    }
-    
-    Tree *current = root->east;
-    int dir_count = 0;
-    int file_count = 0;
-    
-    // First pass: count directories and files
-    Tree *iter = current;
-    while (iter) {
-        if (iter->n.tag & (TagNode | TagRoot)) {
-            dir_count++;
-        } else if (iter->l.tag & TagLeaf) {
-            file_count++;
-        }
-        iter = (iter->n.tag & (TagNode | TagRoot)) ? 
-               iter->n.east : 
-               (Tree *)((Leaf *)iter)->east;
-    }
-    
-    // Print directory contents
-    if (dir_count > 0) {
-        printf("\x1B[1;34mDirectories (%d):\x1B[0m\n", dir_count);
-        iter = current;
-        while (iter) {
-            if (iter->n.tag & (TagNode | TagRoot)) {
-                printf("  \x1B[1;34m%-20s\x1B[0m  %-8s\n", 
-                      iter->n.path, "<DIR>");
-            }
-            iter = (iter->n.tag & (TagNode | TagRoot)) ? 
-                   iter->n.east : 
-                   (Tree *)((Leaf *)iter)->east;
-        }
-    }
+// LS progress: the files' header goes out just before the first file
+typedef struct s_lsstate {
+    uint32 dirs;
+    uint32 files;
+    bool started;
+} LsState;
+
+static int print_entry(void *ctx, char type, const int8 *name, uint64 size) {
+    LsState *st = (LsState *)ctx;
     
-    // Print files
-    if (file_count > 0) {
-        if (dir_count > 0) printf("\n");
-        printf("\x1B[1;32mFiles (%d):\x1B[0m\n", file_count);
-        iter = current;
-        while (iter) {
-            if (iter->l.tag & TagLeaf) {
-                printf("  \x1B[1;32m%-20s\x1B[0m  %-8zu bytes\n", 
-                      iter->l.key, iter->l.size);
-            }
-            iter = (iter->n.tag & (TagNode | TagRoot)) ? 
-                   iter->n.east : 
-                   (Tree *)((Leaf *)iter)->east;
-        }
+    if (type == 'd') {
+        printf("  \x1B[1;34m%-20s\x1B[0m  %-8s\n", name, "<DIR>");
+        return 0;
     }
-    
-    if (dir_count == 0 && file_count == 0) {
-        printf("Empty directory\n");
-    } else {
-        printf("<empty>\n");
+    if (!st->started) {
+        if (st->dirs > 0) printf("\n");
+        printf("\x1B[1;32mFiles (%u):\x1B[0m\n", st->files);
+        st->started = true;
     }
+    printf("  \x1B[1;32m%-20s\x1B[0m  %-8llu bytes\n", name, (unsigned long long)size);
+    return 0;
 }
 
-void handle_pwd(const void *root_ptr) {
-    const Node *root = (const Node *)root_ptr;
-    if (!root) {
-        printf("/\n");
+void handle_ls(Session *s, RespCmd *cmd) {
+    LsState st = {0, 0, false};
+    (void)cmd;  // Unused parameter
+    
+    // The directory keeps its own counts, so only one pass over it is needed
+    if (s->engine->stat(s->cwd, &st.dirs, &st.files) < 0) {
+        printf("Error: Invalid directory\n");
         return;
     }
     
-    // In a full implementation, we would traverse up the tree to build the full path
-    // For now, we'll just show the current node's path
-    if (root->path[0]) {
-        printf("/%s\n", root->path);
-    } else {
-        printf("/\n");
+    if (st.dirs > 0) {
+        printf("\x1B[1;34mDirectories (%u):\x1B[0m\n", st.dirs);
     }
-}
-
-// Helper function to split a path into components
-char **split_path(const char *path, int *count) {
-    if (!path || !count) return NULL;
-    
-    // Count the number of path components
-    *count = 0;
-    const char *p = path;
-    while (*p) {
-        if (*p == '/') (*count)++;
-        p++;
-    }
-    if (path[strlen(path)-1] != '/') (*count)++;
-    
-    // Allocate array for path components
-    char **components = malloc(*count * sizeof(char *));
-    if (!components) return NULL;
-    
-    // Make a copy of the path for tokenization
-    char *path_copy = strdup(path);
-    if (!path_copy) {
-        free(components);
-        return NULL;
+    if (s->engine->list(s->cwd, print_entry, &st) < 0) {
+        printf("Error: %s\n", strerror(errno));
+        return;
     }
     
-    // Split the path into components
-    int i = 0;
-    char *token = strtok(path_copy, "/");
-    while (token && i < *count) {
-        components[i++] = strdup(token);
-        token = strtok(NULL, "/");
+    if (st.dirs == 0 && st.files == 0) {
+        printf("Empty directory\n");
     }
-    
-    free(path_copy);
-    return components;
 }
 
-// Helper function to free path components
-void free_path_components(char **components, int count) {
-    if (!components) return;
-    
-    for (int i = 0; i < count; i++) {
-        if (components[i]) free(components[i]);
-    }
-    
-    free(components);
+void handle_pwd(Session *s, RespCmd *cmd) {
+    (void)cmd;  // Unused parameter
+    printf("%s\n", s->cwd);
 }
 
 // Helper function to trim whitespace from the beginning and end of a string
@@ -436,80 +255,132 @@ char *trim_whitespace(char *str) {
     return start;
 }
 
+// Keys are C strings in the tree; only values may carry NUL bytes
+static const char *key_arg(const RespCmd *cmd, const char *usage) {
+    if (cmd->argc < 2 || !cmd->argl[1]) {
+        printf("Error: Missing key. Usage: %s\n", usage);
+        return NULL;
+    }
+    if (strlen(cmd->argv[1]) != cmd->argl[1]) {
+        printf("Error: Keys cannot contain NUL bytes\n");
+        return NULL;
+    }
+    return cmd->argv[1];
+}
+
 // Command handlers implementation
-void handle_set(void *root_ptr, const char *args) {
-    Node *root = (Node *)root_ptr;
-    if (!args || !*args) {
-        printf("Error: Missing key and value. Usage: SET <key> <value>\n");
+void handle_set(Session *s, RespCmd *cmd) {
+    const char *key = key_arg(cmd, "SET <key> <value>");
+    if (!key) {
         return;
     }
     
-    // Make a copy of args since we need to modify it
-    char *args_copy = strdup(args);  // strdup is declared in string.h with _GNU_SOURCE
-    if (!args_copy) {
-        printf("Error: Out of memory\n");
+    // An inline value runs to the end of the line; a framed one is exact
+    size_t len;
+    char *value = resp_rest(cmd, 2, &len);
+    if (!value) {
+        printf("Error: Missing value. Usage: SET <key> <value>\n");
         return;
     }
-    
-    // Find the first space to separate key and value
-    char *space = strchr(args_copy, ' ');
-    if (!space) {
-        printf("Error: Missing value. Usage: SET <key> <value>\n");
-        free(args_copy);
+    // Create or update the leaf with a single lookup
+    if (s->engine->set(s->cwd, (const int8 *)key, (const int8 *)value, len + 1) == 0) {
+        printf("OK\n");
+    } else {
+        printf("Error setting key '%s': %s\n", key, strerror(errno));
+    }
+}
+
+void handle_get(Session *s, RespCmd *cmd) {
+    const int8 *value;
+    uint64 count;
+    const char *key = key_arg(cmd, "GET <key>");
+    if (!key) {
         return;
     }
     
-    // Split key and value
-    *space = '\0';
-    char *key = args_copy;
-    char *value = space + 1;
-    
-    // Create or update the leaf
-    Leaf *leaf = search_leaf(root, (int8 *)key);
-    if (leaf) {
-        // Update existing leaf
-        if (update_leaf(root, (int8 *)key, (int8 *)value, strlen(value) + 1) == 0) {
-            printf("OK\n");
-        } else {
-            printf("Error updating key '%s': %s\n", key, strerror(errno));
-        }
+    // Find the leaf; the value is written by length since it may hold NULs
+    value = s->engine->get(s->cwd, (const int8 *)key, &count);
+    if (value) {
+        putchar('"');
+        fwrite(value, 1, count - 1, stdout);
+        printf("\"\n");
     } else {
-        // Create new leaf
-        leaf = create_leaf(root, (int8 *)key, (int8 *)value, strlen(value) + 1);
-        if (leaf) {
-            printf("OK\n");
-        } else {
-            printf("Error creating key '%s': %s\n", key, strerror(errno));
-        }
+        printf("(nil)\n");
     }
+}
+
+// Parse a whole argument as a signed decimal number
+static bool number_arg(const RespCmd *cmd, uint32 i, long long *out) {
+    char *end;
     
-    free(args_copy);
+    if (i >= cmd->argc || !cmd->argl[i]) {
+        return false;
+    }
+    errno = 0;
+    *out = strtoll(cmd->argv[i], &end, 10);
+    return !errno && end == cmd->argv[i] + cmd->argl[i];
 }
 
-void handle_get(const void *root_ptr, const char *args) {
-    const Node *root = (const Node *)root_ptr;
-    if (!args || !*args) {
-        printf("Error: Missing key. Usage: GET <key>\n");
+void handle_getrange(Session *s, RespCmd *cmd) {
+    const char *key = key_arg(cmd, "GETRANGE <key> <start> <end>");
+    const int8 *value;
+    uint64 count;
+    long long start, end, len;
+    if (!key) {
+        return;
+    }
+    if (!number_arg(cmd, 2, &start) || !number_arg(cmd, 3, &end)) {
+        printf("Error: Usage: GETRANGE <key> <start> <end>\n");
         return;
     }
     
-    // Find the leaf
-    Leaf *leaf = search_leaf(root, (int8 *)args);
-    if (leaf) {
-        printf("\"%s\"\n", leaf->value);
-    } else {
+    value = s->engine->get(s->cwd, (const int8 *)key, &count);
+    if (!value) {
         printf("(nil)\n");
+        return;
     }
+    
+    // Inclusive bounds; negative ones count back from the end
+    len = (long long)count - 1;
+    if (start < 0) start = (start < -len) ? 0 : start + len;
+    if (end < 0) end += len;
+    if (end >= len) end = len - 1;
+    
+    putchar('"');
+    if (start <= end) {
+        fwrite(value + start, 1, (size_t)(end - start + 1), stdout);
+    }
+    printf("\"\n");
 }
 
-void handle_del(void *root_ptr, const char *args) {
-    Node *root = (Node *)root_ptr;
-    if (!args || !*args) {
-        printf("Error: Missing key. Usage: DEL <key>\n");
+void handle_setrange(Session *s, RespCmd *cmd) {
+    const char *key = key_arg(cmd, "SETRANGE <key> <offset> <value>");
+    uint64 count;
+    long long offset;
+    size_t len;
+    char *value;
+    if (!key) {
+        return;
+    }
+    if (!number_arg(cmd, 2, &offset) || offset < 0 || !(value = resp_rest(cmd, 3, &len))) {
+        printf("Error: Usage: SETRANGE <key> <offset> <value>\n");
         return;
     }
     
-    if (delete_leaf(root, (int8 *)args) == 0) {
+    if (s->engine->setrange(s->cwd, (const int8 *)key, (uint64)offset, (const int8 *)value, len, &count) == 0) {
+        printf("%llu\n", (unsigned long long)(count - 1));
+    } else {
+        printf("Error setting range of '%s': %s\n", key, strerror(errno));
+    }
+}
+
+void handle_del(Session *s, RespCmd *cmd) {
+    const char *args = key_arg(cmd, "DEL <key>");
+    if (!args) {
+        return;
+    }
+    
+    if (s->engine->del(s->cwd, (const int8 *)args) == 0) {
         printf("1\n"); // Return 1 for successful deletion
     } else {
         if (errno == ENOENT) {
@@ -520,119 +391,165 @@ void handle_del(void *root_ptr, const char *args) {
     }
 }
 
-void handle_exists(const void *root_ptr, const char *args) {
-    const Node *root = (const Node *)root_ptr;
-    if (!args || !*args) {
-        printf("Error: Missing key. Usage: EXISTS <key>\n");
+void handle_exists(Session *s, RespCmd *cmd) {
+    const char *key = key_arg(cmd, "EXISTS <key>");
+    uint64 count;
+    if (!key) {
         return;
     }
     
-    Leaf *leaf = search_leaf(root, (int8 *)args);
-    printf("%d\n", leaf ? 1 : 0);
+    printf("%d\n", s->engine->get(s->cwd, (const int8 *)key, &count) ? 1 : 0);
 }
 
-void handle_help(void *root_ptr, const char *args) {
-    (void)root_ptr; // Unused parameter
-    (void)args;  // Unused parameter
-    
-    printf("Available commands:\n");
-    for (const Command *cmd = commands; cmd->name; cmd++) {
-        printf("  %s\n", cmd->usage);
-    }
+// Print one SCAN line: the key and its value size without the terminator
+static int print_key(void *ctx, char type, const int8 *name, uint64 size) {
+    (void)ctx;
+    (void)type;
+    printf("%s %llu\n", name, (unsigned long long)(size - 1));
+    return 0;
 }
 
-void process_command(void **root_ptr, const char *input) {
-    if (!input || !*input) {
-        return; // Empty input
-    }
+void handle_scan(Session *s, RespCmd *cmd) {
+    const char *from = (cmd->argc > 1) ? cmd->argv[1] : NULL;
     
-    // Make a copy of the input for tokenization
-    char input_copy[MAX_INPUT_LENGTH];
-    strncpy(input_copy, input, sizeof(input_copy) - 1);
-    input_copy[sizeof(input_copy) - 1] = '\0';
-    
-    // Trim whitespace
-    trim_whitespace(input_copy);
-    
-    // Get the command and arguments
-    char *command = input_copy;
-    char *args = strchr(input_copy, ' ');
+    if (from && strlen(from) != cmd->argl[1]) {
+        printf("Error: Keys cannot contain NUL bytes\n");
+        return;
+    }
     
-    // If there are arguments, split the string
-    if (args) {
-        *args = '\0';
-        args++;
-        trim_whitespace(args);
+    // The art engine walks its keys in order; the list engine sorts them
+    if (s->engine->scan(s->cwd, (const int8 *)from, print_key, NULL) < 0) {
+        printf("Error scanning '%s': %s\n", s->cwd, strerror(errno));
     }
+}
+
+void handle_stats(Session *s, RespCmd *cmd) {
+    (void)s;    // Unused parameter
+    (void)cmd;  // Unused parameter
     
-    // Convert void** to Node** for CD command
-    Node **node_ptr = (Node **)root_ptr;
+    SlabStats st;
+    uint64 count, bytes;
     
-    // Handle CD command specially since it needs the double pointer
-    if (strcasecmp(command, "CD") == 0) {
-        handle_cd(root_ptr, args ? args : "");
-        return;
-    }
+    printf("%-8s %6s %8s %12s %12s %6s\n", "class", "size", "slabs", "used", "capacity", "fill");
+    for (uint32 i = 0; i < slab_nclasses(); i++) {
+        if (slab_stats(i, &st) != 0 || !st.slabs) {
+            continue;
+        }
+        printf("%-8s %6u %8u %12llu %12llu %5.1f%%\n", st.name, st.size, st.slabs,
+               (unsigned long long)st.used, (unsigned long long)st.capacity,
+               100.0 * (double)st.used / (double)st.capacity);
+    }
+    
+    slab_large_stats(&count, &bytes);
+    printf("large: %llu allocations, %llu bytes\n",
+           (unsigned long long)count, (unsigned long long)bytes);
+    
+    // Every directory but the root holds one reference to its interned name
+    uint64 names, dirs, name_bytes;
+    intern_stats(&names, &dirs, &name_bytes);
+    size_t fixed = sizeof(Node) - sizeof(((Node *)0)->path) + MAX_NAME_LENGTH + 1;
+    printf("directories: %llu, %zu bytes each (%zu with a fixed %d-byte name)\n",
+           (unsigned long long)dirs, sizeof(Node), fixed, MAX_NAME_LENGTH + 1);
+    printf("names: %llu unique, %llu bytes", (unsigned long long)names,
+           (unsigned long long)name_bytes);
+    if (dirs) {
+        printf(", %.1f bytes saved per directory",
+               (double)fixed - (double)sizeof(Node) - (double)name_bytes / (double)dirs);
+    }
+    printf("\n");
+}
+
+void handle_help(Session *s, RespCmd *cmd) {
+    (void)s;    // Unused parameter
+    (void)cmd;  // Unused parameter
     
-    // Handle LS command specially since it's const
-    if (strcasecmp(command, "LS") == 0) {
-        handle_ls(*node_ptr);
-        return;
+    printf("Available commands:\n");
+    for (const Command *cmd = commands; cmd->name; cmd++) {
+        printf("  %s\n", cmd->usage);
     }
-    
-    // Handle PWD command specially since it's const
-    if (strcasecmp(command, "PWD") == 0) {
-        handle_pwd(*node_ptr);
-        return;
+}
+
+void process_command(Session *s, RespCmd *cmd) {
+    if (!cmd->argc) {
+        return; // Empty input
     }
     
+    const char *command = cmd->argv[0];
+    
     // Find and execute the command
     for (int i = 0; commands[i].name != NULL; i++) {
         if (strcasecmp(command, commands[i].name) == 0) {
-            commands[i].handler(*node_ptr, args ? args : "");
+            commands[i].handler(s, cmd);
             return;
         }
     }
     
     // If we get here, the command wasn't found
     printf("Unknown command: %s\n", command);
-    handle_help(*node_ptr, NULL);
+    handle_help(s, NULL);
 }
 
 // Start the REPL (Read-Eval-Print Loop)
-void start_repl(Node *root) {
-    char input[MAX_INPUT_LENGTH];
+void start_repl(const Engine *engine) {
+    static RespCmd cmd;
+    static Session session;
+    char *buf = NULL, *p;
+    size_t len = 0, cap = 0, off;
+    ssize_t n;
+    long used;
+    bool eof = false;
     
     printf("Database Server (Type 'HELP' for commands, 'EXIT' to quit)\n");
     
-    // Create a pointer to the root for the REPL
-    Node *current = root;
-    
-    while (1) {
-        printf("db> ");
-        fflush(stdout);
-        
-        // Read input
-        if (!fgets(input, sizeof(input), stdin)) {
-            printf("\n");
-            break; // Exit on EOF (Ctrl+D)
+    // The session starts at the root
+    session.engine = engine;
+    strcpy((char *)session.cwd, "/");
+    
+    printf("db> ");
+    fflush(stdout);
+    
+    // Requests are framed or inline lines of any length; see resp.h
+    while (!eof) {
+        if (cap - len < REPL_READ_SIZE) {
+            cap = cap ? cap * 2 : REPL_READ_SIZE * 2;
+            p = (char *)realloc(buf, cap);
+            if (!p) {
+                printf("Error: Out of memory\n");
+                break;
+            }
+            buf = p;
         }
         
-        // Remove newline
-        input[strcspn(input, "\r\n")] = '\0';
-        
-        // Create a void pointer to the current node pointer for process_command
-        void *current_void = (void *)current;
-        
-        // Process the command with the current directory
-        process_command(&current_void, input);
-        
-        // Update the current pointer from the potentially modified void pointer
-        current = (Node *)current_void;
+        n = read(STDIN_FILENO, buf + len, cap - len - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // A last line without a newline still counts (Ctrl+D ends it)
+            eof = true;
+            if (len && buf[0] != '*' && buf[len - 1] != '\n') {
+                buf[len++] = '\n';
+            }
+        } else {
+            len += (size_t)n;
+        }
         
-        // Update the root pointer in case it changed (e.g., CD command)
-        if (current->north == NULL) { // If we're at the root
-            root = current;
+        for (off = 0; (used = resp_parse(buf + off, len - off, &cmd)) > 0; off += (size_t)used) {
+            process_command(&session, &cmd);
+            printf("db> ");
+            fflush(stdout);
+        }
+        if (used < 0) {
+            printf("Error: Malformed request: %s\n", strerror(errno));
+            printf("db> ");
+            fflush(stdout);
+            off = len;
         }
+        
+        len -= off;
+        memmove(buf, buf + off, len);
     }
+    
+    printf("\n");
+    free(buf);
 }
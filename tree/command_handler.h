@@ -2,16 +2,21 @@
 #define COMMAND_HANDLER_H
 
 #include "tree.h"
+#include "engine.h"
+#include "resp.h"
 #include <stdint.h>
 
-// Maximum length for command input
-#define MAX_INPUT_LENGTH 1024
+// The REPL reads stdin in chunks of this size; requests may be any length
+#define REPL_READ_SIZE 4096
 
-// Forward declaration of Node
-typedef struct s_node Node;
+// One REPL's state: the engine it runs on and where it stands in it
+typedef struct s_session {
+    const Engine *engine;
+    int8 cwd[MAX_PATH_LENGTH];
+} Session;
 
 // Command handler function type
-typedef void (*command_handler_t)(void *root, const char *args);
+typedef void (*command_handler_t)(Session *s, RespCmd *cmd);
 
 // Command structure
 typedef struct {
@@ -21,23 +26,27 @@ typedef struct {
 } Command;
 
 // Command handlers
-void handle_set(void *root_ptr, const char *args);
-void handle_get(const void *root_ptr, const char *args);
-void handle_del(void *root_ptr, const char *args);
-void handle_exists(const void *root_ptr, const char *args);
-void handle_help(void *root_ptr, const char *args);
+void handle_set(Session *s, RespCmd *cmd);
+void handle_get(Session *s, RespCmd *cmd);
+void handle_getrange(Session *s, RespCmd *cmd);
+void handle_setrange(Session *s, RespCmd *cmd);
+void handle_del(Session *s, RespCmd *cmd);
+void handle_exists(Session *s, RespCmd *cmd);
+void handle_scan(Session *s, RespCmd *cmd);
+void handle_stats(Session *s, RespCmd *cmd);
+void handle_help(Session *s, RespCmd *cmd);
 
 // Navigation command handlers
-void handle_cd(void **root_ptr, const char *path);
-void handle_mkdir(void *root_ptr, const char *path);
-void handle_ls(const void *root_ptr);
-void handle_pwd(const void *root_ptr);
+void handle_cd(Session *s, RespCmd *cmd);
+void handle_mkdir(Session *s, RespCmd *cmd);
+void handle_ls(Session *s, RespCmd *cmd);
+void handle_pwd(Session *s, RespCmd *cmd);
 
 // Main command processing function
-void process_command(void **root_ptr, const char *input);
+void process_command(Session *s, RespCmd *cmd);
 
-// Start the REPL (Read-Eval-Print Loop)
-void start_repl(Node *root);
+// Start the REPL (Read-Eval-Print Loop) on an engine
+void start_repl(const Engine *engine);
 
 // Helper functions
 char *trim_whitespace(char *str);
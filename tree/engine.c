@@ -0,0 +1,675 @@
+/*The storage engines a front end can choose from at startup (see engine.h)*/
+#include "engine.h"
+#include "art.h"
+#include "slab.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+
+/**
+ * Split an absolute path into its parent and its last name
+ * @param path The canonical absolute path of a directory other than the root
+ * @param parent Receives the parent's path ("/" for a top-level directory)
+ * @param name Receives the last name
+ * @return 0 on success, -1 on error
+ */
+static int split_path(const int8 *path, int8 parent[MAX_PATH_LENGTH], int8 name[MAX_NAME_LENGTH + 1]) {
+    const int8 *last;
+    size_t plen, nlen;
+
+    last = (const int8 *)strrchr((const char *)path, '/');
+    if (!last || path[0] != '/') {
+        errno = EINVAL;
+        return -1;
+    }
+    plen = (size_t)(last - path);
+    nlen = strlen((const char *)last + 1);
+    if (!nlen || nlen > MAX_NAME_LENGTH || plen >= MAX_PATH_LENGTH ||
+        (nlen == 1 && last[1] == '.') || (nlen == 2 && last[1] == '.' && last[2] == '.')) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (plen) {
+        memcpy(parent, path, plen);
+        parent[plen] = '\0';
+    } else {
+        strcpy((char *)parent, "/");
+    }
+    memcpy(name, last + 1, nlen + 1);
+
+    return 0;
+}
+
+/**
+ * Resolve a path against a working directory the way search_node does:
+ * empty and "." components are dropped and ".." stops at the root
+ * @param cwd The canonical absolute working directory
+ * @param path An absolute or relative path
+ * @param out Receives the canonical absolute path
+ * @return Length of the path written, -1 on error
+ */
+int engine_path(const int8 *cwd, const int8 *path, int8 out[MAX_PATH_LENGTH]) {
+    const int8 *p, *comp;
+    uint32 len, clen;
+    int pass;
+
+    len = 0;
+    for (pass = (path[0] == '/'); pass < 2; pass++) {
+        for (p = pass ? path : cwd; *p; ) {
+            while (*p == '/') p++;
+            for (comp = p; *p && *p != '/'; p++);
+            clen = (uint32)(p - comp);
+
+            if (clen == 0 || (clen == 1 && comp[0] == '.')) {
+                continue;
+            }
+            if (clen == 2 && comp[0] == '.' && comp[1] == '.') {
+                while (len > 0 && out[len - 1] != '/') len--;
+                if (len > 0) len--;
+                continue;
+            }
+            if (len + clen + 2 > MAX_PATH_LENGTH) {
+                errno = ENAMETOOLONG;
+                return -1;
+            }
+            out[len++] = '/';
+            memcpy(out + len, comp, clen);
+            len += clen;
+        }
+    }
+
+    if (len == 0) {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+
+    return (int)len;
+}
+
+/* ---- list: the Node/Leaf tree ---- */
+
+static int list_mkdir(const int8 *path) {
+    int8 parent[MAX_PATH_LENGTH], name[MAX_NAME_LENGTH + 1];
+    Node *n;
+
+    if (split_path(path, parent, name) || !(n = search_node(&root.n, parent))) {
+        return -1;
+    }
+    if (search_node(n, name)) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    return create_node(n, name) ? 0 : -1;
+}
+
+static int list_stat(const int8 *path, uint32 *ndirs, uint32 *nkeys) {
+    Node *n;
+
+    if (!(n = search_node(&root.n, path))) {
+        return -1;
+    }
+    *ndirs = n->ndirs;
+    *nkeys = n->nleaves;
+
+    return 0;
+}
+
+static int list_set(const int8 *dir, const int8 *key, const int8 *value, uint64 count) {
+    Node *n;
+
+    if (!(n = search_node(&root.n, dir))) {
+        return -1;
+    }
+
+    return set_leaf(n, key, value, count) ? 0 : -1;
+}
+
+static const int8 *list_get(const int8 *dir, const int8 *key, uint64 *count) {
+    Node *n;
+    Leaf *leaf;
+
+    if (!(n = search_node(&root.n, dir)) || !(leaf = search_leaf(n, key))) {
+        return NULL;
+    }
+    *count = leaf->size;
+
+    return leaf->value;
+}
+
+static int list_setrange(const int8 *dir, const int8 *key, uint64 offset, const int8 *buf, uint64 len,
+                         uint64 *count) {
+    Node *n;
+    Leaf *leaf;
+
+    if (!(n = search_node(&root.n, dir))) {
+        return -1;
+    }
+    if (!(leaf = setrange_leaf(n, key, offset, buf, len))) {
+        // Nothing written to a key that is not there: it stays away
+        if (errno == ENOENT && !len) {
+            *count = 1;
+            return 0;
+        }
+        return -1;
+    }
+    *count = leaf->size;
+
+    return 0;
+}
+
+static int list_del(const int8 *dir, const int8 *key) {
+    Node *n;
+
+    if (!(n = search_node(&root.n, dir))) {
+        return -1;
+    }
+
+    return delete_leaf(n, key);
+}
+
+static int list_list(const int8 *dir, EngineEntry cb, void *ctx) {
+    const Node *n, *d;
+    const Leaf *leaf;
+
+    if (!(n = search_node(&root.n, dir))) {
+        return -1;
+    }
+    for (d = n->west; d; d = d->next) {
+        if (cb(ctx, 'd', d->path, 0) < 0) {
+            return -1;
+        }
+    }
+    for (leaf = (const Leaf *)n->east; leaf; leaf = leaf->east) {
+        if (cb(ctx, 'f', leaf->key, leaf->size) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int by_key(const void *a, const void *b) {
+    return strcmp((const char *)(*(Leaf *const *)a)->key, (const char *)(*(Leaf *const *)b)->key);
+}
+
+// No order is kept, so the keys at or after from are gathered and sorted
+static int list_scan(const int8 *dir, const int8 *from, EngineEntry cb, void *ctx) {
+    Node *n;
+    Leaf *leaf, **keys;
+    uint32 count, i;
+    int ret;
+
+    if (!(n = search_node(&root.n, dir))) {
+        return -1;
+    }
+    keys = (Leaf **)malloc((n->nleaves + 1) * sizeof(Leaf *));
+    if (!keys) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    count = 0;
+    for (leaf = (Leaf *)n->east; leaf; leaf = leaf->east) {
+        if (!from || strcmp((const char *)leaf->key, (const char *)from) >= 0) {
+            keys[count++] = leaf;
+        }
+    }
+    qsort(keys, count, sizeof(Leaf *), by_key);
+
+    for (ret = 0, i = 0; i < count && ret >= 0; i++) {
+        ret = cb(ctx, 'f', keys[i]->key, keys[i]->size);
+    }
+    free(keys);
+
+    return (ret < 0) ? -1 : 0;
+}
+
+const Engine list_engine = {
+    .name = "list",
+    .mkdir = list_mkdir,
+    .stat = list_stat,
+    .set = list_set,
+    .get = list_get,
+    .setrange = list_setrange,
+    .del = list_del,
+    .list = list_list,
+    .scan = list_scan,
+    .cleanup = tree_cleanup
+};
+
+/* ---- art: one radix tree over every full path ---- */
+
+/*
+ * Every directory and key is one ART key built from its full path: each
+ * directory name is preceded by ART_SUB, a directory ends with ART_DIR
+ * and a key follows its directory after ART_KEY, ended by a NUL. The
+ * separators sort below any name byte, so a directory's keys sit together
+ * ahead of its subdirectories, and each subdirectory's block opens with
+ * its own ART_DIR entry. Names and keys may not hold bytes up to ART_SUB.
+ */
+#define ART_DIR     0x01
+#define ART_KEY     0x02
+#define ART_SUB     0x03
+#define ART_KEY_MAX (2 * MAX_PATH_LENGTH)
+
+// What an ART key holds: a value (count > 0) or a directory's counts
+typedef struct s_artentry {
+    uint64 count;   // value bytes including the terminator, 0 for a directory
+    uint32 ndirs;
+    uint32 nkeys;
+    int8 data[];
+} ArtEntry;
+
+static Art art;
+static ArtEntry art_root;
+
+static bool art_name_ok(const int8 *p, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if ((uint8_t)p[i] <= ART_SUB) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The encoded form of a directory path, as its entries' common prefix
+static int art_encode_dir(const int8 *path, uint8_t *buf, uint32 *len) {
+    const int8 *p, *comp;
+    uint32 n, clen;
+
+    n = 0;
+    for (p = path; *p; ) {
+        while (*p == '/') p++;
+        for (comp = p; *p && *p != '/'; p++);
+        clen = (uint32)(p - comp);
+        if (!clen) {
+            continue;
+        }
+        if (!art_name_ok(comp, clen)) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (n + clen + 2 > ART_KEY_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        buf[n++] = ART_SUB;
+        memcpy(buf + n, comp, clen);
+        n += clen;
+    }
+
+    *len = n;
+    return 0;
+}
+
+// The directory entry of an encoded path, NULL with errno = ENOENT if there is none
+static ArtEntry *art_find_dir(uint8_t *buf, uint32 len) {
+    ArtEntry *d;
+
+    if (!len) {
+        return &art_root;
+    }
+    buf[len] = ART_DIR;
+    d = (ArtEntry *)art_search(&art, buf, len + 1);
+    if (!d) {
+        errno = ENOENT;
+    }
+
+    return d;
+}
+
+// The ART key of dir/key; *d is set to the directory's entry
+static int art_encode_key(const int8 *dir, const int8 *key, uint8_t *buf, uint32 *len, ArtEntry **d) {
+    uint32 n;
+    size_t klen;
+
+    if (art_encode_dir(dir, buf, &n) || !(*d = art_find_dir(buf, n))) {
+        return -1;
+    }
+    klen = strlen((const char *)key);
+    if (!art_name_ok(key, klen)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (n + klen + 2 > ART_KEY_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    buf[n++] = ART_KEY;
+    memcpy(buf + n, key, klen + 1);
+    *len = n + (uint32)klen + 1;
+
+    return 0;
+}
+
+static ArtEntry *art_alloc(uint64 count) {
+    ArtEntry *e;
+
+    e = (ArtEntry *)slab_alloc(sizeof(ArtEntry) + count);
+    if (!e) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(e, 0, sizeof(ArtEntry));
+    e->count = count;
+
+    return e;
+}
+
+static void art_release(void *value) {
+    ArtEntry *e = (ArtEntry *)value;
+
+    slab_free(e, sizeof(ArtEntry) + e->count);
+}
+
+static int art_mkdir(const int8 *path) {
+    int8 parent[MAX_PATH_LENGTH], name[MAX_NAME_LENGTH + 1];
+    uint8_t buf[ART_KEY_MAX];
+    ArtEntry *p, *d;
+    uint32 len;
+    void *old;
+
+    if (split_path(path, parent, name) || art_encode_dir(parent, buf, &len) || !(p = art_find_dir(buf, len)) ||
+        art_encode_dir(path, buf, &len)) {
+        return -1;
+    }
+    if (art_find_dir(buf, len)) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    if (!(d = art_alloc(0))) {
+        return -1;
+    }
+    if (art_insert(&art, buf, len + 1, d, &old) != 0) {
+        art_release(d);
+        return -1;
+    }
+    p->ndirs++;
+
+    return 0;
+}
+
+static int art_stat(const int8 *path, uint32 *ndirs, uint32 *nkeys) {
+    uint8_t buf[ART_KEY_MAX];
+    ArtEntry *d;
+    uint32 len;
+
+    if (art_encode_dir(path, buf, &len) || !(d = art_find_dir(buf, len))) {
+        return -1;
+    }
+    *ndirs = d->ndirs;
+    *nkeys = d->nkeys;
+
+    return 0;
+}
+
+// Store e under an encoded key, counting it in d if it is new
+static int art_put(uint8_t *buf, uint32 len, ArtEntry *d, ArtEntry *e) {
+    void *old;
+    int ret;
+
+    ret = art_insert(&art, buf, len, e, &old);
+    if (ret < 0) {
+        art_release(e);
+        return -1;
+    }
+    if (ret) {
+        art_release(old);
+    } else {
+        d->nkeys++;
+    }
+
+    return 0;
+}
+
+static int art_set(const int8 *dir, const int8 *key, const int8 *value, uint64 count) {
+    uint8_t buf[ART_KEY_MAX];
+    ArtEntry *d, *e;
+    uint32 len;
+
+    if (!count) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (art_encode_key(dir, key, buf, &len, &d) || !(e = art_alloc(count))) {
+        return -1;
+    }
+    memcpy(e->data, value, count - 1);
+    e->data[count - 1] = '\0';
+
+    return art_put(buf, len, d, e);
+}
+
+static const int8 *art_get(const int8 *dir, const int8 *key, uint64 *count) {
+    uint8_t buf[ART_KEY_MAX];
+    ArtEntry *d, *e;
+    uint32 len;
+
+    if (art_encode_key(dir, key, buf, &len, &d)) {
+        return NULL;
+    }
+    if (!(e = (ArtEntry *)art_search(&art, buf, len))) {
+        errno = ENOENT;
+        return NULL;
+    }
+    *count = e->count;
+
+    return e->data;
+}
+
+// Values are immutable in the tree: the changed one replaces the old
+static int art_setrange(const int8 *dir, const int8 *key, uint64 offset, const int8 *buf, uint64 len,
+                        uint64 *count) {
+    uint8_t kbuf[ART_KEY_MAX];
+    ArtEntry *d, *old, *e;
+    uint64 size;
+    uint32 klen;
+
+    if (!buf && len) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (offset > MAX_VALUE_SIZE || len > MAX_VALUE_SIZE - offset) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (art_encode_key(dir, key, kbuf, &klen, &d)) {
+        return -1;
+    }
+
+    old = (ArtEntry *)art_search(&art, kbuf, klen);
+    if (!old && !len) {
+        *count = 1;
+        return 0;
+    }
+    size = old ? old->count : 1;
+    if (offset + len + 1 > size) {
+        size = offset + len + 1;
+    }
+    if (!(e = art_alloc(size))) {
+        return -1;
+    }
+    memset(e->data, 0, size);
+    if (old) {
+        memcpy(e->data, old->data, old->count - 1);
+    }
+    if (len) {
+        memcpy(e->data + offset, buf, len);
+    }
+    *count = size;
+
+    return art_put(kbuf, klen, d, e);
+}
+
+static int art_del(const int8 *dir, const int8 *key) {
+    uint8_t buf[ART_KEY_MAX];
+    ArtEntry *d, *e;
+    uint32 len;
+
+    if (art_encode_key(dir, key, buf, &len, &d)) {
+        return -1;
+    }
+    if (!(e = (ArtEntry *)art_delete(&art, buf, len))) {
+        errno = ENOENT;
+        return -1;
+    }
+    art_release(e);
+    d->nkeys--;
+
+    return 0;
+}
+
+// Walk state for listing one directory block
+typedef struct s_artlist {
+    const uint8_t *prefix;
+    uint32 plen;
+    uint32 nlen;        // length of the subdirectory name found, 0 for none
+    int8 *name;         // receives that name
+    EngineEntry cb;
+    void *ctx;
+    int ret;
+} ArtList;
+
+// Keys: every entry under the prefix is one, and its name is NUL-terminated
+static int art_visit_key(void *ctx, const uint8_t *key, uint32 len, void *value) {
+    ArtList *w = (ArtList *)ctx;
+
+    if (len < w->plen || memcmp(key, w->prefix, w->plen)) {
+        return 1;
+    }
+    w->ret = w->cb(w->ctx, 'f', (const int8 *)key + w->plen, ((ArtEntry *)value)->count);
+
+    return (w->ret < 0) ? 1 : 0;
+}
+
+// Subdirectories: stop at the first entry of the next block and note its name
+static int art_visit_dir(void *ctx, const uint8_t *key, uint32 len, void *value) {
+    ArtList *w = (ArtList *)ctx;
+    uint32 i;
+
+    (void)value;
+    if (len < w->plen || memcmp(key, w->prefix, w->plen)) {
+        return 1;
+    }
+    for (i = w->plen; i < len && key[i] > ART_SUB; i++);
+    w->nlen = i - w->plen;
+    if (w->nlen > MAX_NAME_LENGTH) {
+        w->nlen = 0;
+        return 1;
+    }
+    memcpy(w->name, key + w->plen, w->nlen);
+    w->name[w->nlen] = '\0';
+
+    return 1;
+}
+
+static int art_keys(uint8_t *buf, uint32 n, const int8 *from, EngineEntry cb, void *ctx) {
+    ArtList w;
+    uint32 len;
+    size_t flen;
+
+    buf[n++] = ART_KEY;
+    len = n;
+    if (from) {
+        flen = strlen((const char *)from);
+        if (len + flen > ART_KEY_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(buf + len, from, flen);
+        len += (uint32)flen;
+    }
+
+    w = (ArtList){buf, n, 0, NULL, cb, ctx, 0};
+    art_seek(&art, buf, len, art_visit_key, &w);
+
+    return (w.ret < 0) ? -1 : 0;
+}
+
+/*
+ * Subdirectories come out by seeking: the first entry past the prefix
+ * names one, and the next seek starts just past every entry of its block
+ * (its name followed by a byte above the separators).
+ */
+static int art_list(const int8 *dir, EngineEntry cb, void *ctx) {
+    uint8_t buf[ART_KEY_MAX], from[ART_KEY_MAX];
+    int8 name[MAX_NAME_LENGTH + 1];
+    uint32 n, len;
+    ArtList w;
+
+    if (art_encode_dir(dir, buf, &n) || !art_find_dir(buf, n)) {
+        return -1;
+    }
+
+    buf[n] = ART_SUB;
+    memcpy(from, buf, n + 1);
+    len = n + 1;
+    for (;;) {
+        w = (ArtList){buf, n + 1, 0, name, cb, ctx, 0};
+        art_seek(&art, from, len, art_visit_dir, &w);
+        if (!w.nlen) {
+            break;
+        }
+
+        if (cb(ctx, 'd', name, 0) < 0) {
+            return -1;
+        }
+        len = n + 1 + w.nlen;
+        memcpy(from + n + 1, name, w.nlen);
+        from[len++] = ART_SUB + 1;
+    }
+
+    return art_keys(buf, n, NULL, cb, ctx);
+}
+
+static int art_scan(const int8 *dir, const int8 *from, EngineEntry cb, void *ctx) {
+    uint8_t buf[ART_KEY_MAX];
+    uint32 n;
+
+    if (art_encode_dir(dir, buf, &n) || !art_find_dir(buf, n)) {
+        return -1;
+    }
+
+    return art_keys(buf, n, from, cb, ctx);
+}
+
+static void art_cleanup(void) {
+    art_free(&art, art_release);
+    memset(&art_root, 0, sizeof(art_root));
+}
+
+const Engine art_engine = {
+    .name = "art",
+    .mkdir = art_mkdir,
+    .stat = art_stat,
+    .set = art_set,
+    .get = art_get,
+    .setrange = art_setrange,
+    .del = art_del,
+    .list = art_list,
+    .scan = art_scan,
+    .cleanup = art_cleanup
+};
+
+/**
+ * Look up an engine by name
+ * @param name "list" or "art"
+ * @return The engine, NULL if there is none by that name
+ */
+const Engine *engine_find(const char *name) {
+    if (strcmp(name, list_engine.name) == 0) {
+        return &list_engine;
+    }
+    if (strcmp(name, art_engine.name) == 0) {
+        return &art_engine;
+    }
+
+    errno = EINVAL;
+    return NULL;
+}
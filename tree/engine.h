@@ -0,0 +1,39 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "tree.h"
+
+/*
+ * Storage engines behind one interface keyed by absolute path, so a
+ * front end can pick one at startup:
+ *   list - the Node/Leaf tree of tree.c: per-directory sibling lists and
+ *          a hash index, keys in creation order
+ *   art  - one adaptive radix tree (art.h) over every full path: keys come
+ *          out in byte order and a prefix scan is a range walk
+ * Paths are absolute and canonical ("/", "/a/b"); values are counted with
+ * their terminator, as in set_leaf. Neither engine locks.
+ */
+
+// Called per directory entry: 'd' with a subdirectory, 'f' with a key and its value size
+typedef int (*EngineEntry)(void *ctx, char type, const int8 *name, uint64 size);
+
+typedef struct s_engine {
+    const char *name;
+    int (*mkdir)(const int8 *path);
+    int (*stat)(const int8 *path, uint32 *ndirs, uint32 *nkeys);
+    int (*set)(const int8 *dir, const int8 *key, const int8 *value, uint64 count);
+    const int8 *(*get)(const int8 *dir, const int8 *key, uint64 *count);
+    int (*setrange)(const int8 *dir, const int8 *key, uint64 offset, const int8 *buf, uint64 len, uint64 *count);
+    int (*del)(const int8 *dir, const int8 *key);
+    int (*list)(const int8 *dir, EngineEntry cb, void *ctx);
+    int (*scan)(const int8 *dir, const int8 *from, EngineEntry cb, void *ctx);
+    void (*cleanup)(void);
+} Engine;
+
+extern const Engine list_engine;
+extern const Engine art_engine;
+
+const Engine *engine_find(const char *name);
+int engine_path(const int8 *cwd, const int8 *path, int8 out[MAX_PATH_LENGTH]);
+
+#endif // ENGINE_H
@@ -0,0 +1,161 @@
+/*enginebench: the list and art engines side by side on one directory of keys*/
+#define _GNU_SOURCE
+#include "engine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define BENCH_KEYS  200000  // default key count, override with argv[1]
+#define BENCH_DIR   "/bench"
+
+typedef enum {
+    OpInsert,
+    OpGetHit,
+    OpGetMiss,
+    OpScan,
+    OpDelete,
+    OpCount
+} BenchOp;
+
+static const char *op_names[OpCount] = {"insert", "get hit", "get miss", "sorted scan", "delete"};
+
+static uint32 *order;
+static uint32 nkeys;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void key_of(uint32 i, int8 *buf, size_t size) {
+    snprintf((char *)buf, size, "user:%08u", i);
+}
+
+static int count_entry(void *ctx, char type, const int8 *name, uint64 size) {
+    (void)type;
+    (void)name;
+    (void)size;
+    (*(uint32 *)ctx)++;
+    return 0;
+}
+
+static void fail(const Engine *e, const char *what) {
+    fprintf(stderr, "%s: %s failed: %s\n", e->name, what, strerror(errno));
+    exit(1);
+}
+
+/**
+ * Time every operation over all keys, visiting them in a shuffled order
+ * @param e The engine to run
+ * @param ns Receives ns/op per operation; the scan is per key returned
+ */
+static void run(const Engine *e, double ns[OpCount]) {
+    int8 key[32];
+    const int8 *value;
+    uint64 count;
+    uint32 i, seen;
+    double t;
+
+    if (e->mkdir((const int8 *)BENCH_DIR) < 0) {
+        fail(e, "mkdir");
+    }
+
+    t = now();
+    for (i = 0; i < nkeys; i++) {
+        key_of(order[i] * 2, key, sizeof(key));
+        if (e->set((const int8 *)BENCH_DIR, key, key, 14) < 0) {
+            fail(e, "set");
+        }
+    }
+    ns[OpInsert] = (now() - t) / nkeys;
+
+    t = now();
+    for (i = 0; i < nkeys; i++) {
+        key_of(order[nkeys - 1 - i] * 2, key, sizeof(key));
+        value = e->get((const int8 *)BENCH_DIR, key, &count);
+        if (!value || count != 14) {
+            fail(e, "get");
+        }
+    }
+    ns[OpGetHit] = (now() - t) / nkeys;
+
+    // Odd numbers were never stored
+    t = now();
+    for (i = 0; i < nkeys; i++) {
+        key_of(order[i] * 2 + 1, key, sizeof(key));
+        if (e->get((const int8 *)BENCH_DIR, key, &count)) {
+            fail(e, "get miss");
+        }
+    }
+    ns[OpGetMiss] = (now() - t) / nkeys;
+
+    seen = 0;
+    t = now();
+    if (e->scan((const int8 *)BENCH_DIR, NULL, count_entry, &seen) < 0 || seen != nkeys) {
+        fail(e, "scan");
+    }
+    ns[OpScan] = (now() - t) / nkeys;
+
+    t = now();
+    for (i = 0; i < nkeys; i++) {
+        key_of(order[i] * 2, key, sizeof(key));
+        if (e->del((const int8 *)BENCH_DIR, key) < 0) {
+            fail(e, "del");
+        }
+    }
+    ns[OpDelete] = (now() - t) / nkeys;
+}
+
+int main(int argc, char *argv[]) {
+    const Engine *engines[] = {&list_engine, &art_engine};
+    double ns[2][OpCount];
+    uint32 i, j, tmp;
+    int op;
+
+    nkeys = (argc > 1) ? (uint32)strtoul(argv[1], NULL, 10) : BENCH_KEYS;
+    if (!nkeys) {
+        fprintf(stderr, "usage: %s [keys]\n", argv[0]);
+        return 1;
+    }
+
+    // The list engine resolves paths from the root node
+    root.n.tag = TagRoot | TagNode;
+    root.n.north = (Node *)&root;
+    root.n.path = (const int8 *)"/";
+
+    order = (uint32 *)malloc(nkeys * sizeof(uint32));
+    if (!order) {
+        perror("malloc");
+        return 1;
+    }
+    srand(42);
+    for (i = 0; i < nkeys; i++) {
+        order[i] = i;
+    }
+    for (i = nkeys - 1; i > 0; i--) {
+        j = (uint32)rand() % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    for (i = 0; i < 2; i++) {
+        run(engines[i], ns[i]);
+    }
+
+    printf("%u keys in one directory, ns/op\n", nkeys);
+    printf("%-12s %10s %10s %8s\n", "op", "list", "art", "art/list");
+    for (op = 0; op < OpCount; op++) {
+        printf("%-12s %10.1f %10.1f %7.2fx\n", op_names[op], ns[0][op], ns[1][op], ns[1][op] / ns[0][op]);
+    }
+
+    art_engine.cleanup();
+    tree_cleanup();
+    free(order);
+
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*Open-addressing hash index used by every directory to find leaves by key*/
+#include "tree.h"
+#include "slab.h"
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#define INDEX_MIN_SLOTS   8
+#define INDEX_REHASH_STEP 16    // old slots migrated per insert/remove
+
+// Marks a deleted slot so probe chains running through it stay intact
+static Leaf tombstone;
+#define TOMB (&tombstone)
+
+/**
+ * FNV-1a over the NUL-terminated key
+ * @param key The key to hash
+ * @return 32-bit hash, stored on the leaf so probes can skip most strcmp calls
+ */
+uint32 index_hash(const int8 *key) {
+    const unsigned char *p;
+    uint32 h = 2166136261u;
+
+    for (p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static Leaf *table_lookup(const Table *t, const int8 *key, uint32 hash) {
+    uint32 i;
+    Leaf *l;
+
+    if (!t->slots) {
+        return NULL;
+    }
+
+    for (i = hash & t->mask; (l = t->slots[i]); i = (i + 1) & t->mask) {
+        if (l != TOMB && l->hash == hash &&
+            strcmp((const char *)l->key, (const char *)key) == 0) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+// Caller guarantees there is at least one empty slot
+static void table_put(Table *t, Leaf *leaf) {
+    uint32 i;
+
+    for (i = leaf->hash & t->mask; t->slots[i] && t->slots[i] != TOMB; i = (i + 1) & t->mask);
+
+    if (!t->slots[i]) {
+        t->filled++;
+    }
+    t->slots[i] = leaf;
+    t->used++;
+}
+
+static Leaf *table_remove(Table *t, const int8 *key, uint32 hash) {
+    uint32 i;
+    Leaf *l;
+
+    if (!t->slots) {
+        return NULL;
+    }
+
+    for (i = hash & t->mask; (l = t->slots[i]); i = (i + 1) & t->mask) {
+        if (l != TOMB && l->hash == hash &&
+            strcmp((const char *)l->key, (const char *)key) == 0) {
+            t->slots[i] = TOMB;
+            t->used--;
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+// Move up to `steps` slots from the old table into the current one
+static void rehash_step(Index *ix, uint32 steps) {
+    Leaf *l;
+
+    while (ix->old.slots && steps--) {
+        l = ix->old.slots[ix->rehashidx];
+        if (l && l != TOMB) {
+            table_put(&ix->cur, l);
+            // A moved key must not be found in the old table once it is removed
+            ix->old.slots[ix->rehashidx] = TOMB;
+            ix->old.used--;
+        }
+
+        if (ix->rehashidx++ == ix->old.mask) {
+            slab_free(ix->old.slots, (ix->old.mask + 1) * sizeof(Leaf *));
+            memset(&ix->old, 0, sizeof(Table));
+            ix->rehashidx = 0;
+        }
+    }
+}
+
+// Start a resize: the current table becomes `old` and a fresh one takes its place
+static int index_grow(Index *ix) {
+    Leaf **slots;
+    uint32 size;
+
+    // A table full of tombstones is rebuilt at the same size
+    size = INDEX_MIN_SLOTS;
+    while (size < (ix->cur.used + 1) * 2) {
+        size <<= 1;
+    }
+    if (ix->cur.slots && size < ix->cur.mask + 1) {
+        size = ix->cur.mask + 1;
+    }
+
+    slots = (Leaf **)slab_alloc(size * sizeof(Leaf *));
+    if (!slots) {
+        return -1;
+    }
+    memset(slots, 0, size * sizeof(Leaf *));
+
+    // Never keep two generations in flight
+    rehash_step(ix, UINT32_MAX);
+
+    ix->old = ix->cur;
+    ix->rehashidx = 0;
+    ix->cur.slots = slots;
+    ix->cur.mask = size - 1;
+    ix->cur.used = 0;
+    ix->cur.filled = 0;
+
+    return 0;
+}
+
+/**
+ * Find a leaf by key
+ * @param ix The index of the directory to search
+ * @param key The key to look up
+ * @param hash index_hash(key)
+ * @return The leaf, or NULL if the key is not indexed
+ */
+Leaf *index_lookup(const Index *ix, const int8 *key, uint32 hash) {
+    Leaf *l;
+
+    l = table_lookup(&ix->cur, key, hash);
+    if (!l && ix->old.slots) {
+        l = table_lookup(&ix->old, key, hash);
+    }
+
+    return l;
+}
+
+/**
+ * Add a leaf to the index; leaf->hash must already be set and the key
+ * must not be present yet
+ * @param ix The index to insert into
+ * @param leaf The leaf to insert
+ * @return 0 on success, -1 on error
+ */
+int index_insert(Index *ix, Leaf *leaf) {
+    rehash_step(ix, INDEX_REHASH_STEP);
+
+    // Keep the load factor (tombstones included) under 3/4
+    if (!ix->cur.slots || (ix->cur.filled + 1) * 4 > (ix->cur.mask + 1) * 3) {
+        if (index_grow(ix) != 0) {
+            return -1;
+        }
+        rehash_step(ix, INDEX_REHASH_STEP);
+    }
+
+    table_put(&ix->cur, leaf);
+    return 0;
+}
+
+/**
+ * Drop a key from the index
+ * @param ix The index to remove from
+ * @param key The key to remove
+ * @param hash index_hash(key)
+ * @return The removed leaf, or NULL if the key was not indexed
+ */
+Leaf *index_remove(Index *ix, const int8 *key, uint32 hash) {
+    Leaf *l;
+
+    rehash_step(ix, INDEX_REHASH_STEP);
+
+    l = table_remove(&ix->cur, key, hash);
+    if (!l && ix->old.slots) {
+        l = table_remove(&ix->old, key, hash);
+    }
+
+    return l;
+}
+
+/**
+ * Size an empty index for n keys up front, so a bulk load never resizes
+ * @param ix The index, which must hold no keys
+ * @param n The number of keys about to be inserted
+ * @return 0 on success, -1 on error
+ */
+int index_reserve(Index *ix, uint32 n) {
+    Leaf **slots;
+    uint32 size;
+
+    if (ix->cur.used || ix->old.slots) {
+        return 0;
+    }
+
+    for (size = INDEX_MIN_SLOTS; size < UINT32_MAX / 8 && ((uint64_t)n + 1) * 4 > (uint64_t)size * 3; size <<= 1);
+    if (ix->cur.slots && size <= ix->cur.mask + 1) {
+        return 0;
+    }
+
+    slots = (Leaf **)slab_alloc(size * sizeof(Leaf *));
+    if (!slots) {
+        return -1;
+    }
+    memset(slots, 0, size * sizeof(Leaf *));
+
+    index_free(ix);
+    ix->cur.slots = slots;
+    ix->cur.mask = size - 1;
+
+    return 0;
+}
+
+/**
+ * Pick a key more or less at random: the first live slot at or after
+ * slot r of the current table (or of the old one while the current is
+ * still empty)
+ * @param ix The index to sample
+ * @param r Any random number
+ * @return A leaf of the index, NULL if it is empty
+ */
+Leaf *index_sample(const Index *ix, uint32 r) {
+    const Table *t;
+    uint32 i, n;
+    Leaf *l;
+
+    t = ix->cur.used ? &ix->cur : &ix->old;
+    if (!t->slots || !t->used) {
+        return NULL;
+    }
+
+    for (i = r & t->mask, n = 0; n <= t->mask; i = (i + 1) & t->mask, n++) {
+        l = t->slots[i];
+        if (l && l != TOMB) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+// Mirror the bits of a scan cursor, so it can be incremented from the top
+static uint32 reverse_bits(uint32 v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+// Visit the keys whose home slot is b; linear probing keeps them in the run from b to the next empty slot
+static void scan_home(const Table *t, uint32 b, IndexVisit visit, void *ctx) {
+    uint32 i;
+    Leaf *l;
+
+    for (i = b; (l = t->slots[i]); i = (i + 1) & t->mask) {
+        if (l != TOMB && (l->hash & t->mask) == b) {
+            visit(ctx, l);
+        }
+    }
+}
+
+/**
+ * One step of a full scan: visit the keys of one home slot and return the
+ * cursor of the next. As in redis, the cursor counts with its bits
+ * reversed, so a slot of a table always comes before the slots it splits
+ * into when the table doubles. Every key that stays in the index for the
+ * whole scan is visited at least once, however the index is resized in
+ * between; a key may be visited twice.
+ * @param ix The index to scan
+ * @param cursor 0 to start, then whatever the previous step returned
+ * @param visit Called for each key of the step
+ * @param ctx Passed to visit
+ * @return The next cursor, 0 once the scan is complete
+ */
+uint32 index_scan(const Index *ix, uint32 cursor, IndexVisit visit, void *ctx) {
+    const Table *small, *large;
+    uint32 v;
+
+    if (!ix->cur.slots) {
+        return 0;
+    }
+
+    v = cursor;
+    if (!ix->old.slots) {
+        scan_home(&ix->cur, v & ix->cur.mask, visit, ctx);
+        // Bits above the mask set, so the increment carries out of it
+        v |= ~ix->cur.mask;
+        v = reverse_bits(reverse_bits(v) + 1);
+    } else {
+        // Mid-rehash: the smaller table's slot, then every slot it became in the larger one
+        small = &ix->old;
+        large = &ix->cur;
+        if (small->mask > large->mask) {
+            small = &ix->cur;
+            large = &ix->old;
+        }
+        scan_home(small, v & small->mask, visit, ctx);
+        do {
+            scan_home(large, v & large->mask, visit, ctx);
+            v |= ~large->mask;
+            v = reverse_bits(reverse_bits(v) + 1);
+        } while (v & (small->mask ^ large->mask));
+    }
+
+    return v;
+}
+
+/**
+ * Start loading the slot a lookup of hash probes first. A batch of lookups
+ * calls this a few keys ahead, then index_prefetch_leaf a little later, so
+ * the cache misses of several keys are in flight at once.
+ * @param ix The index about to be searched
+ * @param hash index_hash(key)
+ */
+void index_prefetch_slot(const Index *ix, uint32 hash) {
+    if (ix->cur.slots) {
+        __builtin_prefetch(&ix->cur.slots[hash & ix->cur.mask]);
+    }
+}
+
+/**
+ * Start loading the leaf in the slot of hash: its header and the inline
+ * key after it, which spill into a second cache line. Best called once
+ * index_prefetch_slot has had time to land.
+ * @param ix The index about to be searched
+ * @param hash index_hash(key)
+ */
+void index_prefetch_leaf(const Index *ix, uint32 hash) {
+    Leaf *l;
+
+    if (!ix->cur.slots) {
+        return;
+    }
+    l = ix->cur.slots[hash & ix->cur.mask];
+    if (l && l != TOMB) {
+        __builtin_prefetch(l);
+        __builtin_prefetch(l->data);
+    }
+}
+
+// Release the tables; the leaves themselves are owned by the tree
+void index_free(Index *ix) {
+    if (ix->cur.slots) {
+        slab_free(ix->cur.slots, (ix->cur.mask + 1) * sizeof(Leaf *));
+    }
+    if (ix->old.slots) {
+        slab_free(ix->old.slots, (ix->old.mask + 1) * sizeof(Leaf *));
+    }
+    memset(ix, 0, sizeof(Index));
+}
@@ -0,0 +1,45 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+
+typedef int8_t int8;
+typedef uint32_t uint32;
+
+typedef struct s_leaf Leaf;
+
+// Called by index_scan for every key it visits
+typedef void (*IndexVisit)(void *ctx, Leaf *leaf);
+
+// One open-addressing table (linear probing, power-of-two capacity)
+typedef struct s_table {
+    Leaf **slots;
+    uint32 mask;    // capacity - 1, meaningless while slots is NULL
+    uint32 used;    // live entries
+    uint32 filled;  // live entries + tombstones
+} Table;
+
+/*
+ * Per-directory key index. New entries always go to `cur`; while a resize
+ * is in progress the previous table sits in `old` and is drained a few
+ * slots at a time by every insert/remove, so no single SET pays for a full
+ * rehash.
+ */
+typedef struct s_index {
+    Table cur;
+    Table old;
+    uint32 rehashidx;   // next slot of `old` to migrate
+} Index;
+
+uint32 index_hash(const int8 *key);
+Leaf *index_lookup(const Index *ix, const int8 *key, uint32 hash);
+int index_insert(Index *ix, Leaf *leaf);
+Leaf *index_remove(Index *ix, const int8 *key, uint32 hash);
+int index_reserve(Index *ix, uint32 n);
+Leaf *index_sample(const Index *ix, uint32 r);
+uint32 index_scan(const Index *ix, uint32 cursor, IndexVisit visit, void *ctx);
+void index_prefetch_slot(const Index *ix, uint32 hash);
+void index_prefetch_leaf(const Index *ix, uint32 hash);
+void index_free(Index *ix);
+
+#endif // INDEX_H
@@ -0,0 +1,182 @@
+/*Interned directory names shared between nodes*/
+#include "tree.h"
+#include "intern.h"
+#include "slab.h"
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define INTERN_MIN_SLOTS 64
+
+typedef struct s_name {
+    uint32 refs;
+    uint32 hash;
+    uint32 len;
+    int8 name[];
+} Name;
+
+static Name tombstone;
+#define TOMB (&tombstone)
+
+static Name **slots;
+static uint32 mask;
+static uint32 used;     // live names
+static uint32 filled;   // live names + tombstones
+static uint64 refs;
+static uint64 bytes;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define name_of(p) ((Name *)((int8 *)(p) - offsetof(Name, name)))
+
+static uint32 hash_bytes(const int8 *name, uint32 len) {
+    const unsigned char *p;
+    uint32 h = 2166136261u;
+
+    for (p = (const unsigned char *)name; len--; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static int intern_grow(void) {
+    Name **old_slots, **fresh;
+    uint32 old_mask, size, i, j;
+
+    size = INTERN_MIN_SLOTS;
+    while (size < (used + 1) * 2) {
+        size <<= 1;
+    }
+
+    fresh = (Name **)slab_alloc(size * sizeof(Name *));
+    if (!fresh) {
+        return -1;
+    }
+    memset(fresh, 0, size * sizeof(Name *));
+
+    old_slots = slots;
+    old_mask = mask;
+    slots = fresh;
+    mask = size - 1;
+    filled = used;
+
+    if (old_slots) {
+        for (i = 0; i <= old_mask; i++) {
+            if (!old_slots[i] || old_slots[i] == TOMB) {
+                continue;
+            }
+            for (j = old_slots[i]->hash & mask; slots[j]; j = (j + 1) & mask);
+            slots[j] = old_slots[i];
+        }
+        slab_free(old_slots, (old_mask + 1) * sizeof(Name *));
+    }
+
+    return 0;
+}
+
+// intern_name with intern_lock held
+static const int8 *intern_locked(const int8 *name, uint32 len) {
+    uint32 hash, i;
+    Name *n;
+
+    hash = hash_bytes(name, len);
+    if (slots) {
+        for (i = hash & mask; (n = slots[i]); i = (i + 1) & mask) {
+            if (n != TOMB && n->hash == hash && n->len == len &&
+                memcmp(n->name, name, len) == 0) {
+                n->refs++;
+                refs++;
+                return n->name;
+            }
+        }
+    }
+
+    if (!slots || (filled + 1) * 4 > (mask + 1) * 3) {
+        if (intern_grow() != 0) {
+            return NULL;
+        }
+    }
+
+    n = (Name *)slab_alloc(offsetof(Name, name) + len + 1);
+    if (!n) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    n->refs = 1;
+    n->hash = hash;
+    n->len = len;
+    memcpy(n->name, name, len);
+    n->name[len] = '\0';
+
+    for (i = hash & mask; slots[i] && slots[i] != TOMB; i = (i + 1) & mask);
+    if (!slots[i]) {
+        filled++;
+    }
+    slots[i] = n;
+    used++;
+    refs++;
+    bytes += offsetof(Name, name) + len + 1;
+
+    return n->name;
+}
+
+/**
+ * Get the shared copy of a directory name, creating it on first use
+ * @param name The name (need not be terminated)
+ * @param len Its length in bytes
+ * @return NUL-terminated interned name, NULL on error
+ */
+const int8 *intern_name(const int8 *name, uint32 len) {
+    const int8 *interned;
+
+    pthread_mutex_lock(&intern_lock);
+    interned = intern_locked(name, len);
+    pthread_mutex_unlock(&intern_lock);
+
+    return interned;
+}
+
+/**
+ * Drop one reference to an interned name
+ * @param name Pointer returned by intern_name
+ */
+void intern_release(const int8 *name) {
+    Name *n;
+    uint32 i;
+
+    if (!name) {
+        return;
+    }
+
+    pthread_mutex_lock(&intern_lock);
+    refs--;
+    n = name_of(name);
+    if (--n->refs) {
+        pthread_mutex_unlock(&intern_lock);
+        return;
+    }
+
+    for (i = n->hash & mask; slots[i] != n; i = (i + 1) & mask);
+    slots[i] = TOMB;
+    used--;
+    bytes -= offsetof(Name, name) + n->len + 1;
+    pthread_mutex_unlock(&intern_lock);
+
+    slab_free(n, offsetof(Name, name) + n->len + 1);
+}
+
+// Forget the table after its memory went away with slab_release_all()
+void intern_reset(void) {
+    slots = NULL;
+    mask = 0;
+    used = filled = 0;
+    refs = bytes = 0;
+}
+
+void intern_stats(uint64 *names, uint64 *nrefs, uint64 *nbytes) {
+    *names = used;
+    *nrefs = refs;
+    *nbytes = bytes;
+}
@@ -0,0 +1,19 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+
+typedef int8_t int8;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+/*
+ * Shared, reference-counted directory names. Thousands of per-user
+ * directories called "sessions" all point at one copy of the string.
+ */
+const int8 *intern_name(const int8 *name, uint32 len);
+void intern_release(const int8 *name);
+void intern_reset(void);
+void intern_stats(uint64 *names, uint64 *refs, uint64 *bytes);
+
+#endif // INTERN_H
@@ -0,0 +1,92 @@
+/*Tree-wide and per-directory reader/writer locks*/
+#define _GNU_SOURCE  // For pthread_rwlock_t
+#include "tree.h"
+#include "lock.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define LOCK_SHARD_BITS 10
+#define LOCK_SHARDS (1 << LOCK_SHARD_BITS)
+#define LOCK_STRIPES 64     // reader stripes of the tree lock
+
+// One cache line per shard so readers of different shards never share one
+typedef struct s_shard {
+    _Alignas(64) pthread_rwlock_t lock;
+} Shard;
+
+/*
+ * The tree lock is split into stripes. A reader takes only its own
+ * thread's stripe, so concurrent GETs on different threads write to
+ * different cache lines; a writer takes every stripe in order. Stripes
+ * prefer writers, so a steady stream of reads cannot keep MKDIR or RMDIR
+ * out, which means a thread must never take the read lock twice.
+ */
+static Shard stripes[LOCK_STRIPES];
+static Shard shards[LOCK_SHARDS];
+static atomic_uint next_stripe;
+static _Thread_local int stripe = -1;   // this thread's stripe, picked on first use
+static _Thread_local bool writing;      // whether tree_unlock releases every stripe
+
+static Shard *shard_of(const Node *node) {
+    uint64_t h = (uint64_t)(uintptr_t)node * 0x9E3779B97F4A7C15ull;
+    return &shards[h >> (64 - LOCK_SHARD_BITS)];
+}
+
+// Must run once before any other thread touches the tree
+void lock_init(void) {
+    pthread_rwlockattr_t attr;
+    int i;
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    for (i = 0; i < LOCK_STRIPES; i++) {
+        pthread_rwlock_init(&stripes[i].lock, &attr);
+    }
+    pthread_rwlockattr_destroy(&attr);
+    for (i = 0; i < LOCK_SHARDS; i++) {
+        pthread_rwlock_init(&shards[i].lock, NULL);
+    }
+}
+
+void tree_rdlock(void) {
+    if (stripe < 0) {
+        stripe = (int)(atomic_fetch_add_explicit(&next_stripe, 1, memory_order_relaxed) % LOCK_STRIPES);
+    }
+    pthread_rwlock_rdlock(&stripes[stripe].lock);
+}
+
+void tree_wrlock(void) {
+    int i;
+
+    for (i = 0; i < LOCK_STRIPES; i++) {
+        pthread_rwlock_wrlock(&stripes[i].lock);
+    }
+    writing = true;
+}
+
+void tree_unlock(void) {
+    int i;
+
+    if (!writing) {
+        pthread_rwlock_unlock(&stripes[stripe].lock);
+        return;
+    }
+    writing = false;
+    for (i = LOCK_STRIPES - 1; i >= 0; i--) {
+        pthread_rwlock_unlock(&stripes[i].lock);
+    }
+}
+
+void node_rdlock(const Node *node) {
+    pthread_rwlock_rdlock(&shard_of(node)->lock);
+}
+
+void node_wrlock(const Node *node) {
+    pthread_rwlock_wrlock(&shard_of(node)->lock);
+}
+
+void node_unlock(const Node *node) {
+    pthread_rwlock_unlock(&shard_of(node)->lock);
+}
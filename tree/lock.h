@@ -0,0 +1,32 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+typedef struct s_node Node;
+
+/*
+ * Locking for front-ends that share one tree between threads. The engine
+ * functions themselves never lock; callers take:
+ *
+ *   tree_rdlock/tree_wrlock  the directory hierarchy (search_node needs
+ *                            read, create_node needs write); readers
+ *                            only touch a stripe of their own thread,
+ *                            and waiting writers go first, so a thread
+ *                            must not take the read lock twice
+ *   node_rdlock/node_wrlock  the leaves of one directory, from a fixed set
+ *                            of hashed shards so a Node carries no lock
+ *
+ * always in that order, and never more than one directory at a time (two
+ * directories may share a shard). Leaf pointers are only valid while the
+ * directory's lock is held.
+ */
+void lock_init(void);
+
+void tree_rdlock(void);
+void tree_wrlock(void);
+void tree_unlock(void);
+
+void node_rdlock(const Node *node);
+void node_wrlock(const Node *node);
+void node_unlock(const Node *node);
+
+#endif // LOCK_H
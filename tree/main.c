@@ -0,0 +1,581 @@
+/*This the place where the whole program implementation will occur*/
+#include "tree.h"
+#include "command_handler.h"
+#include "engine.h"
+#include "resp.h"
+#include "art.h"
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Helper function to print search results
+void print_search_result(Leaf *result, const int8 *key) {
+    if (result) {
+        printf("Found key '%s' with value: %.*s\n", 
+               key, (int)result->size, result->value);
+    } else {
+        if (errno == ENOENT) {
+            printf("Key '%s' not found\n", key);
+        } else {
+            printf("Error searching for key '%s': %s\n", key, strerror(errno));
+        }
+    }
+}
+
+// Parse a copy of text, since the parser writes terminators into its buffer
+static long parse_copy(char *buf, const char *text, size_t len, RespCmd *cmd) {
+    memcpy(buf, text, len);
+    return resp_parse(buf, len, cmd);
+}
+
+// Tests 8-14: the request parser of resp.c shared with cache22
+static int test_resp(void) {
+    static const char framed[] = "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$4\r\na\r\nb\r\n*1";
+    static const char pending[] = "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$10\r\n0123";
+    static RespCmd cmd;
+    char buf[4096], payload[11];
+    RespBulk bulk;
+    size_t len, i;
+    long used;
+    char *big, *rest;
+
+    // Test 8: a framed request is binary-safe and stops where it ends
+    printf("\nTest 8: Parsing a framed request...\n");
+    used = parse_copy(buf, framed, sizeof(framed) - 1, &cmd);
+    if (used != (long)sizeof(framed) - 3 || !cmd.framed || cmd.argc != 3 ||
+        strcmp(cmd.argv[0], "SET") || strcmp(cmd.argv[1], "k") ||
+        cmd.argl[2] != 4 || memcmp(cmd.argv[2], "a\r\nb", 5)) {
+        printf("Framed request parsed wrong (%ld bytes)\n", used);
+        return 1;
+    }
+    printf("Parsed %u arguments in %ld bytes\n", cmd.argc, used);
+
+    // Test 9: an inline line splits on runs of spaces and drops its CRLF
+    printf("\nTest 9: Parsing an inline line...\n");
+    used = parse_copy(buf, "GET  key  \r\nLS\n", 15, &cmd);
+    if (used != 12 || cmd.framed || cmd.argc != 2 || strcmp(cmd.argv[0], "GET") ||
+        strcmp(cmd.argv[1], "key") || cmd.argl[1] != 3) {
+        printf("Inline line parsed wrong (%ld bytes)\n", used);
+        return 1;
+    }
+    printf("Parsed %u arguments in %ld bytes\n", cmd.argc, used);
+
+    // Test 10: anything cut short waits for more and leaves the buffer alone
+    printf("\nTest 10: Parsing partial requests...\n");
+    {
+        static const char *const cuts[] = {
+            "*3\r", "*3\r\n$3", "*3\r\n$3\r\nSE", "*3\r\n$3\r\nSET\r\n", "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$4\r\na\r", "GET key"
+        };
+        for (i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+            len = strlen(cuts[i]);
+            if (parse_copy(buf, cuts[i], len, &cmd) != 0 || memcmp(buf, cuts[i], len)) {
+                printf("Partial request '%s' did not wait for more\n", cuts[i]);
+                return 1;
+            }
+        }
+    }
+    printf("Partial headers and payloads return 0\n");
+
+    // Test 11: a payload not followed by CRLF, or a header that is not a number
+    printf("\nTest 11: Parsing malformed requests...\n");
+    if (parse_copy(buf, "*1\r\n$3\r\nGETxx", 13, &cmd) != -1 || errno != EPROTO ||
+        parse_copy(buf, "*1\r\n$3\r\nGET\n\n", 13, &cmd) != -1 || errno != EPROTO ||
+        parse_copy(buf, "*x\r\n", 4, &cmd) != -1 || errno != EPROTO ||
+        parse_copy(buf, "*1\r\n+3\r\n", 8, &cmd) != -1 || errno != EPROTO) {
+        printf("Malformed request not refused with EPROTO\n");
+        return 1;
+    }
+    printf("Bad terminators and headers give EPROTO\n");
+
+    // Test 12: too many arguments, too long a one, too much before the last
+    printf("\nTest 12: Parsing requests over the limits...\n");
+    len = (size_t)snprintf(buf, sizeof(buf), "*%d\r\n", RESP_MAX_ARGS + 1);
+    if (resp_parse(buf, len, &cmd) != -1 || errno != E2BIG) {
+        printf("%d framed arguments not refused with E2BIG\n", RESP_MAX_ARGS + 1);
+        return 1;
+    }
+    len = (size_t)snprintf(buf, sizeof(buf), "*1\r\n$%lu\r\n", RESP_MAX_BULK + 1);
+    if (resp_parse(buf, len, &cmd) != -1 || errno != E2BIG) {
+        printf("Argument over RESP_MAX_BULK not refused with E2BIG\n");
+        return 1;
+    }
+    for (len = 0, i = 0; i <= RESP_MAX_ARGS; i++) {
+        buf[len++] = 'a';
+        buf[len++] = ' ';
+    }
+    buf[len++] = '\n';
+    if (resp_parse(buf, len, &cmd) != -1 || errno != E2BIG) {
+        printf("%d inline arguments not refused with E2BIG\n", RESP_MAX_ARGS + 1);
+        return 1;
+    }
+    // Two whole arguments of RESP_MAX_BULK before the last one; the parser
+    // skips payloads by length, so only the headers' pages are ever touched
+    big = (char *)malloc(2 * (RESP_MAX_BULK + 64));
+    if (!big) {
+        printf("Failed to allocate the oversized request\n");
+        return 1;
+    }
+    len = (size_t)sprintf(big, "*3\r\n$%lu\r\n", RESP_MAX_BULK);
+    len += RESP_MAX_BULK;
+    len += (size_t)sprintf(big + len, "\r\n$%lu\r\n", RESP_MAX_BULK);
+    used = resp_parse(big, len, &cmd);
+    free(big);
+    if (used != -1 || errno != E2BIG) {
+        printf("Request over RESP_MAX_REQUEST not refused with E2BIG\n");
+        return 1;
+    }
+    printf("RESP_MAX_ARGS, RESP_MAX_BULK and RESP_MAX_REQUEST give E2BIG\n");
+
+    // Test 13: a request waiting on its last payload can take it from elsewhere
+    printf("\nTest 13: Completing a pending request with resp_attach...\n");
+    memcpy(buf, pending, sizeof(pending));
+    if (resp_pending(buf, sizeof(pending) - 1, &cmd, &bulk) != 1 || cmd.argc != 2 ||
+        bulk.offset != sizeof(pending) - 5 || bulk.len != 10 || memcmp(buf, pending, sizeof(pending))) {
+        printf("Pending payload not found\n");
+        return 1;
+    }
+    memcpy(payload, "0123456789", 10);
+    resp_attach(&cmd, payload, 10);
+    if (cmd.argc != 3 || strcmp(cmd.argv[0], "SET") || strcmp(cmd.argv[1], "k") ||
+        cmd.argv[2] != payload || cmd.argl[2] != 10 || payload[10]) {
+        printf("Attached request wrong\n");
+        return 1;
+    }
+    printf("Payload of %zu bytes attached at offset %zu\n", bulk.len, bulk.offset);
+    if (resp_pending(buf, 9, &cmd, &bulk) || resp_pending(strcpy(buf, "GET k"), 5, &cmd, &bulk) ||
+        resp_pending(strcpy(buf, framed), sizeof(framed) - 3, &cmd, &bulk)) {
+        printf("resp_pending claimed a request that is not waiting on its payload\n");
+        return 1;
+    }
+
+    // Test 14: resp_rest gives an inline value with its spaces back
+    printf("\nTest 14: Taking the rest of an inline line...\n");
+    parse_copy(buf, "SET k hello  big world \n", 24, &cmd);
+    rest = resp_rest(&cmd, 2, &len);
+    if (!rest || len != 16 || strcmp(rest, "hello  big world") || cmd.argc != 3 ||
+        resp_rest(&cmd, 3, &len)) {
+        printf("Rest of the line wrong: '%s'\n", rest ? rest : "(none)");
+        return 1;
+    }
+    printf("Rest of the line is '%s'\n", rest);
+    parse_copy(buf, framed, sizeof(framed) - 1, &cmd);
+    rest = resp_rest(&cmd, 1, &len);
+    if (rest != cmd.argv[1] || len != 1 || cmd.argc != 3) {
+        printf("resp_rest changed a framed request\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Walk state for checking that art_seek hands out keys in byte order
+typedef struct s_seekcheck {
+    uint8_t last[64];
+    uint32 last_len;
+    uint32 seen;
+    int bad;
+} SeekCheck;
+
+static int seek_check(void *ctx, const uint8_t *key, uint32 len, void *value) {
+    SeekCheck *sc = (SeekCheck *)ctx;
+    int c;
+
+    (void)value;
+    c = memcmp(sc->last, key, sc->last_len < len ? sc->last_len : len);
+    if (sc->seen && (c > 0 || (c == 0 && sc->last_len >= len))) {
+        sc->bad = 1;
+        return 1;
+    }
+    memcpy(sc->last, key, len);
+    sc->last_len = len;
+    sc->seen++;
+    return 0;
+}
+
+// Collects the keys an engine scan returns, in order
+typedef struct s_scanlist {
+    char keys[8][16];
+    uint32 n;
+} ScanList;
+
+static int scan_collect(void *ctx, char type, const int8 *name, uint64 size) {
+    ScanList *sl = (ScanList *)ctx;
+
+    (void)size;
+    if (type != 'f' || sl->n == 8) {
+        return -1;
+    }
+    snprintf(sl->keys[sl->n++], sizeof(sl->keys[0]), "%s", (const char *)name);
+    return 0;
+}
+
+// Tests 15-18: the adaptive radix tree of art.c, directly and as an engine
+static int test_art(const Engine *engine) {
+    static const int8 data[] = "0123456789";
+    uint8_t key[64], common[48];
+    Art t = {0};
+    SeekCheck sc;
+    ScanList sl;
+    const int8 *value;
+    void *old;
+    uint64 count;
+    uint32 i, j, n, nkeys;
+    int8 name[16];
+
+    // Test 15: one inner node goes from 4 to 256 children and back down.
+    // Two-byte keys that differ in the first byte all hang off the root;
+    // 167 is odd, so stepping by it visits every byte once, out of order.
+    printf("\nTest 15: Growing an ART node to 256 children and shrinking it again...\n");
+    for (i = 0; i < 256; i++) {
+        key[0] = (uint8_t)(i * 167);
+        key[1] = '.';
+        if (art_insert(&t, key, 2, &t, &old) != 0) {
+            printf("Failed to insert byte %u: %s\n", key[0], strerror(errno));
+            return 1;
+        }
+        for (j = 0; j <= i; j++) {
+            key[0] = (uint8_t)(j * 167);
+            if (art_search(&t, key, 2) != &t) {
+                printf("Byte %u lost after %u inserts\n", key[0], i + 1);
+                return 1;
+            }
+        }
+    }
+    memset(&sc, 0, sizeof(sc));
+    art_seek(&t, key, 0, seek_check, &sc);
+    if (sc.bad || sc.seen != 256 || t.size != 256) {
+        printf("Full node walked out of order (%u keys)\n", sc.seen);
+        return 1;
+    }
+    for (i = 0; i < 256; i++) {
+        key[0] = (uint8_t)(i * 167);
+        if (art_delete(&t, key, 2) != &t || art_search(&t, key, 2)) {
+            printf("Failed to delete byte %u\n", key[0]);
+            return 1;
+        }
+        for (j = i + 1; j < 256; j++) {
+            key[0] = (uint8_t)(j * 167);
+            if (art_search(&t, key, 2) != &t) {
+                printf("Byte %u lost after %u deletes\n", key[0], i + 1);
+                return 1;
+            }
+        }
+    }
+    if (t.size || t.root) {
+        printf("Tree not empty after deleting every key\n");
+        return 1;
+    }
+    printf("256 children added and removed, every lookup right on the way\n");
+
+    // Test 16: keys sharing prefixes longer than the ART_PREFIX bytes a node
+    // keeps, split at points past them; lookups must check the whole key
+    printf("\nTest 16: Keys sharing prefixes longer than ART_PREFIX...\n");
+    memset(common, 'p', sizeof(common));
+    nkeys = 0;
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 3; j++) {
+            // Keys of 40 bytes plus a terminator that split at 5, 15, 25 and 35
+            memcpy(key, common, 40);
+            key[5 + 10 * i] = (uint8_t)('a' + i);
+            key[39] = (uint8_t)('x' + j);
+            key[40] = '\0';
+            if (art_insert(&t, key, 41, &t, &old) != 0) {
+                printf("Failed to insert a long key: %s\n", strerror(errno));
+                return 1;
+            }
+            nkeys++;
+        }
+    }
+    memcpy(key, common, 40);
+    key[39] = 'x';
+    key[40] = '\0';
+    if (art_search(&t, key, 41)) {
+        printf("Found a key that was never inserted\n");
+        return 1;
+    }
+    // Differs from a stored key only past ART_PREFIX, inside a folded prefix
+    key[5] = 'a';
+    key[25] = 'q';
+    if (art_search(&t, key, 41) || art_delete(&t, key, 41)) {
+        printf("A key differing past ART_PREFIX matched a stored one\n");
+        return 1;
+    }
+    key[25] = 'p';
+    if (art_search(&t, key, 41) != &t) {
+        printf("Long key lost\n");
+        return 1;
+    }
+    memset(&sc, 0, sizeof(sc));
+    art_seek(&t, key, 0, seek_check, &sc);
+    if (sc.bad || sc.seen != nkeys) {
+        printf("Long keys walked out of order (%u of %u)\n", sc.seen, nkeys);
+        return 1;
+    }
+    for (i = 0; i < 4; i++) {
+        memcpy(key, common, 40);
+        key[5 + 10 * i] = (uint8_t)('a' + i);
+        key[39] = 'y';
+        key[40] = '\0';
+        if (art_delete(&t, key, 41) != &t) {
+            printf("Failed to delete a long key\n");
+            return 1;
+        }
+        nkeys--;
+    }
+    memset(&sc, 0, sizeof(sc));
+    art_seek(&t, key, 0, seek_check, &sc);
+    if (sc.bad || sc.seen != nkeys || t.size != nkeys) {
+        printf("Long keys wrong after deletes (%u of %u)\n", sc.seen, nkeys);
+        return 1;
+    }
+    art_free(&t, NULL);
+    printf("%u long keys found, ordered and deleted by their full bytes\n", nkeys + 4);
+
+    // Test 17: a seek from a bound between keys starts at the next one up
+    printf("\nTest 17: Seeking from the middle of the key order...\n");
+    for (i = 0; i < 1000; i++) {
+        n = (i * 7919) % 1000;
+        snprintf((char *)key, sizeof(key), "%03u", n);
+        if (art_insert(&t, key, 4, &t, &old) != 0) {
+            printf("Failed to insert '%s': %s\n", key, strerror(errno));
+            return 1;
+        }
+    }
+    memset(&sc, 0, sizeof(sc));
+    art_seek(&t, (const uint8_t *)"4995", 4, seek_check, &sc);
+    if (sc.bad || sc.seen != 500 || memcmp(sc.last, "999", 4)) {
+        printf("Seek from '4995' visited %u keys\n", sc.seen);
+        return 1;
+    }
+    art_free(&t, NULL);
+    if (engine->mkdir((const int8 *)"/sorted") != 0) {
+        printf("Failed to create /sorted: %s\n", strerror(errno));
+        return 1;
+    }
+    for (i = 0; i < 8; i++) {
+        snprintf((char *)name, sizeof(name), "k%u", (i * 5) % 8);
+        if (engine->set((const int8 *)"/sorted", name, data, sizeof(data)) != 0) {
+            printf("Failed to set '%s': %s\n", name, strerror(errno));
+            return 1;
+        }
+    }
+    memset(&sl, 0, sizeof(sl));
+    if (engine->scan((const int8 *)"/sorted", (const int8 *)"k35", scan_collect, &sl) != 0 || sl.n != 4 ||
+        strcmp(sl.keys[0], "k4") || strcmp(sl.keys[3], "k7")) {
+        printf("Scan from 'k35' returned %u keys\n", sl.n);
+        return 1;
+    }
+    printf("Seeks returned the keys after the bound in byte order\n");
+
+    // Test 18: SETRANGE replaces a value through art_setrange
+    printf("\nTest 18: Overwriting ranges through the art engine...\n");
+    if (engine->setrange((const int8 *)"/sorted", (const int8 *)"r", 3, (const int8 *)"ab", 2, &count) != 0 ||
+        count != 6 || !(value = engine->get((const int8 *)"/sorted", (const int8 *)"r", &count)) ||
+        count != 6 || memcmp(value, "\0\0\0ab", 6)) {
+        printf("New value built wrong\n");
+        return 1;
+    }
+    if (engine->setrange((const int8 *)"/sorted", (const int8 *)"r", 1, (const int8 *)"XYZW", 4, &count) != 0 ||
+        count != 6 || !(value = engine->get((const int8 *)"/sorted", (const int8 *)"r", &count)) ||
+        memcmp(value, "\0XYZW", 6)) {
+        printf("Value patched wrong\n");
+        return 1;
+    }
+    if (engine->setrange((const int8 *)"/sorted", (const int8 *)"none", 9, (const int8 *)"", 0, &count) != 0 ||
+        count != 1 || engine->get((const int8 *)"/sorted", (const int8 *)"none", &count) ||
+        engine->setrange((const int8 *)"/sorted", (const int8 *)"r", MAX_VALUE_SIZE, (const int8 *)"x", 1,
+                         &count) == 0 || errno != E2BIG ||
+        engine->stat((const int8 *)"/sorted", &i, &nkeys) != 0 || nkeys != 9) {
+        printf("Empty or oversized write changed the directory\n");
+        return 1;
+    }
+    printf("Ranges written, empty and oversized writes create nothing\n");
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const Engine *engine = &list_engine;
+    bool test = false;
+    
+    // Initialize root node if not already initialized
+    if (!(root.n.tag & TagRoot)) {
+        root.n.tag = TagRoot | TagNode;
+        root.n.north = (Node *)&root;
+        root.n.west = NULL;
+        root.n.east = NULL;
+        root.n.path = (const int8 *)"/";
+    }
+
+    // --test runs the self-check; --engine picks the storage engine for the REPL
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--test") == 0) {
+            test = true;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc && engine_find(argv[i + 1])) {
+            engine = engine_find(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--test] [--engine list|art]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    if (test) {
+        // Run tests if --test flag is provided
+        printf("\n=== Running Tests ===\n");
+        
+        // Test 1: Create and search for a leaf
+        printf("\nTest 1: Creating and searching for a leaf...\n");
+        int8 key1[128] = "test_key";
+        int8 value1[256] = "test_value";
+        Leaf *l1 = create_leaf(&root.n, key1, value1, strlen((char *)value1) + 1);
+        if (!l1) {
+            printf("Failed to create leaf: %s\n", strerror(errno));
+            return 1;
+        }
+        printf("Created leaf with key '%s' and value '%s'\n", key1, l1->value);
+        
+        // Test 2: Search for a non-existent key
+        printf("\nTest 2: Searching for a non-existent key...\n");
+        int8 non_existent_key[128] = "non_existent";
+        Leaf *search_result = search_leaf(&root.n, non_existent_key);
+        print_search_result(search_result, non_existent_key);
+
+        // Test 3: Test update functionality
+        printf("\nTest 3: Testing update functionality...\n");
+        int8 updated_value[256] = "updated_test_value";
+        printf("Updating value for key 'test_key'...\n");
+        if (update_leaf(&root.n, key1, updated_value, strlen((char *)updated_value) + 1) == 0) {
+            printf("Successfully updated the value. New value: %s\n", updated_value);
+            
+            // Verify the update
+            printf("Verifying update...\n");
+            search_result = search_leaf(&root.n, key1);
+            print_search_result(search_result, key1);
+        } else {
+            printf("Failed to update leaf: %s\n", strerror(errno));
+        }
+
+        // Test 4: Test delete functionality
+        printf("\nTest 4: Testing delete functionality...\n");
+        printf("Deleting leaf with key 'test_key'...\n");
+        if (delete_leaf(&root.n, key1) == 0) {
+            printf("Successfully deleted leaf with key 'test_key'\n");
+            
+            // Verify the leaf was deleted
+            search_result = search_leaf(&root.n, key1);
+            printf("Verifying deletion...\n");
+            print_search_result(search_result, key1);
+        } else {
+            printf("Failed to delete leaf: %s\n", strerror(errno));
+        }
+
+        // Test 5: Resolve nested paths
+        printf("\nTest 5: Resolving nested directory paths...\n");
+        Node *users = create_node(&root.n, (int8 *)"users");
+        Node *login = users ? create_node(users, (int8 *)"login") : NULL;
+        if (!login) {
+            printf("Failed to create directories: %s\n", strerror(errno));
+            return 1;
+        }
+        if (search_node(&root.n, (int8 *)"/users/login") == login &&
+            search_node(login, (int8 *)"../login/./") == login &&
+            search_node(login, (int8 *)"..") == users &&
+            !search_node(&root.n, (int8 *)"/users/missing")) {
+            printf("Paths resolved correctly\n");
+        } else {
+            printf("Path resolution failed\n");
+        }
+
+        // Test 6: Delete keys while the directory index is being resized;
+        // the old table must be big enough to outlast a few deletes
+        printf("\nTest 6: Deleting and re-looking up keys during a rehash...\n");
+        Node *rehash = create_node(&root.n, (int8 *)"rehash");
+        int8 rkey[32];
+        uint32 nkeys = 0, i;
+        while (rehash && !(rehash->index.old.slots && rehash->index.old.mask >= 1023) && nkeys < 100000) {
+            snprintf((char *)rkey, sizeof(rkey), "key%u", nkeys++);
+            if (!create_leaf(rehash, rkey, value1, strlen((char *)value1) + 1)) {
+                rehash = NULL;
+            }
+        }
+        if (!rehash || !rehash->index.old.slots) {
+            printf("Failed to start a rehash: %s\n", strerror(errno));
+            return 1;
+        }
+        // Every other key goes; each delete also migrates part of the old table,
+        // and a key must never be left in both tables, where a lookup could
+        // still reach it once it is freed
+        for (i = 0; i < nkeys; i += 2) {
+            snprintf((char *)rkey, sizeof(rkey), "key%u", i);
+            if (delete_leaf(rehash, rkey) != 0 || search_leaf(rehash, rkey) ||
+                rehash->index.cur.used + rehash->index.old.used != rehash->nleaves) {
+                printf("Key '%s' still indexed after delete\n", rkey);
+                return 1;
+            }
+        }
+        for (i = 0; i < nkeys; i++) {
+            snprintf((char *)rkey, sizeof(rkey), "key%u", i);
+            if (!search_leaf(rehash, rkey) != !(i & 1)) {
+                printf("Key '%s' %s after deletes during the rehash\n", rkey, (i & 1) ? "lost" : "found");
+                return 1;
+            }
+        }
+        printf("Deleted keys stay gone and the rest stay found (%u keys)\n", nkeys);
+
+        // Test 7: SETRANGE creates only what it writes, and within the value limit
+        printf("\nTest 7: Overwriting ranges of missing and existing keys...\n");
+        Node *ranges = create_node(&root.n, (int8 *)"ranges");
+        Leaf *r1;
+        if (!ranges) {
+            printf("Failed to create directory: %s\n", strerror(errno));
+            return 1;
+        }
+        if (setrange_leaf(ranges, (int8 *)"empty", 5, (int8 *)"", 0) || errno != ENOENT ||
+            search_leaf(ranges, (int8 *)"empty")) {
+            printf("An empty write created a missing key\n");
+            return 1;
+        }
+        if (setrange_leaf(ranges, (int8 *)"huge", MAX_VALUE_SIZE, (int8 *)"x", 1) || errno != E2BIG ||
+            search_leaf(ranges, (int8 *)"huge")) {
+            printf("A write past MAX_VALUE_SIZE was not refused\n");
+            return 1;
+        }
+        r1 = setrange_leaf(ranges, (int8 *)"short", 2, (int8 *)"ab", 2);
+        if (!r1 || r1->size != 5 || memcmp(r1->value, "\0\0ab", 5)) {
+            printf("Short value built wrong\n");
+            return 1;
+        }
+        r1 = setrange_leaf(ranges, (int8 *)"long", 100, (int8 *)"xyz", 3);
+        if (!r1 || r1->size != 104 || r1->value[99] || memcmp(r1->value + 100, "xyz", 4) ||
+            !(r1 = setrange_leaf(ranges, (int8 *)"long", 1, (int8 *)"q", 1)) || r1->size != 104 ||
+            r1->value[1] != 'q' || ranges->nleaves != 2) {
+            printf("Long value built or patched wrong\n");
+            return 1;
+        }
+        printf("Ranges written, empty and oversized writes create nothing\n");
+
+        if (test_resp() != 0) {
+            return 1;
+        }
+        
+        // With --engine art, the radix tree behind it as well
+        if (engine == &art_engine && test_art(engine) != 0) {
+            return 1;
+        }
+
+        printf("\n=== All tests completed ===\n");
+    } else {
+        // Start interactive REPL
+        start_repl(engine);
+    }
+
+    // Clean up resources; the tree's cleanup also returns every slab
+    if (engine != &list_engine) {
+        engine->cleanup();
+    }
+    tree_cleanup();
+    
+    return 0;
+}
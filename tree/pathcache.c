@@ -0,0 +1,169 @@
+/*Path-to-directory cache used by search_node to skip the per-level walk*/
+#define _GNU_SOURCE  // For strdup
+#include "tree.h"
+#include "pathcache.h"
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define PATHCACHE_MIN_SLOTS 64
+
+typedef struct s_pathent {
+    _Atomic(int8 *) path;   // owned copy, NULL for an empty slot; set last
+    uint32 hash;
+    _Atomic(Node *) node;
+} PathEnt;
+
+/*
+ * Lookups take no lock: they load the current table and probe it while
+ * puts, serialized by put_lock, fill empty slots and publish each entry by
+ * storing its path last. A full table is copied into a bigger one that
+ * replaces it, and the old one is kept on the retired list, since a lookup
+ * may still be probing it. Only pathcache_clear frees anything, and it
+ * runs when no lookup can be in flight.
+ */
+typedef struct s_pathtable {
+    PathEnt *slots;
+    uint32 mask;
+    uint32 used;
+    struct s_pathtable *retired;    // tables this one replaced
+} PathTable;
+
+static _Atomic(PathTable *) table;
+static pthread_mutex_t put_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Look up a canonical absolute path
+ * @param path The path, as produced by search_node
+ * @param hash index_hash(path)
+ * @return The cached directory, or NULL on a miss
+ */
+Node *pathcache_get(const int8 *path, uint32 hash) {
+    PathTable *t;
+    int8 *p;
+    uint32 i;
+
+    t = atomic_load_explicit(&table, memory_order_acquire);
+    if (!t) {
+        return NULL;
+    }
+
+    for (i = hash & t->mask; (p = atomic_load_explicit(&t->slots[i].path, memory_order_acquire));
+         i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == hash && strcmp((const char *)p, (const char *)path) == 0) {
+            return atomic_load_explicit(&t->slots[i].node, memory_order_acquire);
+        }
+    }
+
+    return NULL;
+}
+
+// A table twice the size of old (or the first one) holding all of its entries
+static PathTable *pathcache_grow(PathTable *old) {
+    PathTable *t;
+    uint32 size, i, j;
+
+    size = old ? (old->mask + 1) * 2 : PATHCACHE_MIN_SLOTS;
+    t = (PathTable *)malloc(sizeof(PathTable));
+    if (t) {
+        t->slots = (PathEnt *)calloc(size, sizeof(PathEnt));
+    }
+    if (!t || !t->slots) {
+        free(t);
+        errno = ENOMEM;
+        return NULL;
+    }
+    t->mask = size - 1;
+    t->used = old ? old->used : 0;
+    t->retired = old;
+
+    // Not published yet, so plain copies will do
+    for (i = 0; old && i <= old->mask; i++) {
+        if (!old->slots[i].path) {
+            continue;
+        }
+        for (j = old->slots[i].hash & t->mask; t->slots[j].path; j = (j + 1) & t->mask);
+        t->slots[j].path = atomic_load_explicit(&old->slots[i].path, memory_order_relaxed);
+        t->slots[j].hash = old->slots[i].hash;
+        t->slots[j].node = atomic_load_explicit(&old->slots[i].node, memory_order_relaxed);
+    }
+
+    return t;
+}
+
+/**
+ * Remember where a path resolves to
+ * @param path Canonical absolute path
+ * @param hash index_hash(path)
+ * @param node The directory it names
+ * @return 0 on success, -1 on error (the cache is only an accelerator)
+ */
+int pathcache_put(const int8 *path, uint32 hash, Node *node) {
+    PathTable *t, *grown;
+    int8 *copy, *p;
+    uint32 i;
+    int ret = 0;
+
+    pthread_mutex_lock(&put_lock);
+    t = atomic_load_explicit(&table, memory_order_relaxed);
+    if (!t || (t->used + 1) * 4 > (t->mask + 1) * 3) {
+        grown = pathcache_grow(t);
+        if (!grown) {
+            ret = -1;
+            goto done;
+        }
+        t = grown;
+        atomic_store_explicit(&table, t, memory_order_release);
+    }
+
+    for (i = hash & t->mask; (p = atomic_load_explicit(&t->slots[i].path, memory_order_relaxed));
+         i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == hash && strcmp((const char *)p, (const char *)path) == 0) {
+            atomic_store_explicit(&t->slots[i].node, node, memory_order_release);
+            goto done;
+        }
+    }
+
+    copy = (int8 *)strdup((const char *)path);
+    if (!copy) {
+        errno = ENOMEM;
+        ret = -1;
+        goto done;
+    }
+
+    t->slots[i].hash = hash;
+    atomic_store_explicit(&t->slots[i].node, node, memory_order_relaxed);
+    atomic_store_explicit(&t->slots[i].path, copy, memory_order_release);
+    t->used++;
+
+done:
+    pthread_mutex_unlock(&put_lock);
+    return ret;
+}
+
+/**
+ * Forget every cached path; called whenever a directory goes away. The
+ * caller must make sure no lookup or put runs meanwhile, as the tree
+ * write lock does: this is where retired tables are finally freed.
+ */
+void pathcache_clear(void) {
+    PathTable *t, *next;
+    uint32 i;
+
+    pthread_mutex_lock(&put_lock);
+    t = atomic_exchange_explicit(&table, NULL, memory_order_acq_rel);
+    if (t) {
+        // Retired tables share their paths with the newest one
+        for (i = 0; i <= t->mask; i++) {
+            free(atomic_load_explicit(&t->slots[i].path, memory_order_relaxed));
+        }
+    }
+    for (; t; t = next) {
+        next = t->retired;
+        free(t->slots);
+        free(t);
+    }
+    pthread_mutex_unlock(&put_lock);
+}
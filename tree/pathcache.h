@@ -0,0 +1,22 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stdint.h>
+
+typedef int8_t int8;
+typedef uint32_t uint32;
+
+typedef struct s_node Node;
+
+/*
+ * Global map from canonical absolute directory path ("/a/b") to its Node.
+ * Only positive results are cached, so creating a directory never needs an
+ * invalidation; anything that removes or moves directories must call
+ * pathcache_clear(), with the tree write lock held when threads share the
+ * tree. Lookups take no lock and put only contends with other puts.
+ */
+Node *pathcache_get(const int8 *path, uint32 hash);
+int pathcache_put(const int8 *path, uint32 hash, Node *node);
+void pathcache_clear(void);
+
+#endif // PATHCACHE_H
@@ -0,0 +1,247 @@
+/*Length-prefixed request framing shared by the REPL and cache22*/
+#include "resp.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Read "<n>\r\n" after a type byte. Returns the bytes used, 0 if the line
+ * has not fully arrived and -1 with errno = EPROTO if it is malformed, or
+ * E2BIG if n is over max.
+ */
+static long parse_number(const char *p, size_t len, size_t max, size_t *out) {
+    size_t i, n;
+
+    for (i = 0, n = 0; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+        n = n * 10 + (size_t)(p[i] - '0');
+        if (n > max) {
+            errno = E2BIG;
+            return -1;
+        }
+    }
+
+    if (i == len || (i + 1 == len && p[i] == '\r')) {
+        if (len >= RESP_MAX_HEADER) {
+            errno = EPROTO;
+            return -1;
+        }
+        return 0;
+    }
+    if (!i || p[i] != '\r' || p[i + 1] != '\n') {
+        errno = EPROTO;
+        return -1;
+    }
+
+    *out = n;
+    return (long)(i + 2);
+}
+
+/*
+ * Walk a framed request. With bulk set, a request that is only missing
+ * the payload of its last argument reports where that payload goes and
+ * returns 0 with bulk->len set; nothing in buf is written before the whole
+ * request is complete.
+ */
+static long parse_framed(char *buf, size_t len, RespCmd *cmd, RespBulk *bulk) {
+    size_t pos, argc, n, i;
+    long used;
+
+    used = parse_number(buf + 1, len - 1, RESP_MAX_ARGS, &argc);
+    if (used <= 0) {
+        return used;
+    }
+    pos = 1 + (size_t)used;
+
+    // Headers are skipped by length: the payload itself is never scanned
+    for (i = 0; i < argc; i++) {
+        if (pos == len) {
+            return 0;
+        }
+        if (buf[pos] != '$') {
+            errno = EPROTO;
+            return -1;
+        }
+        used = parse_number(buf + pos + 1, len - pos - 1, RESP_MAX_BULK, &n);
+        if (used <= 0) {
+            return used;
+        }
+        pos += 1 + (size_t)used;
+
+        // All but the last argument are buffered whole, so their sum is capped
+        if (i + 1 < argc && pos + n + 2 > RESP_MAX_REQUEST) {
+            errno = E2BIG;
+            return -1;
+        }
+        if (len - pos < n + 2) {
+            if (bulk && i + 1 == argc) {
+                cmd->argc = (uint32_t)i;
+                cmd->framed = true;
+                bulk->offset = pos;
+                bulk->len = n;
+            }
+            return 0;
+        }
+        if (buf[pos + n] != '\r' || buf[pos + n + 1] != '\n') {
+            errno = EPROTO;
+            return -1;
+        }
+        cmd->argv[i] = buf + pos;
+        cmd->argl[i] = n;
+        pos += n + 2;
+    }
+
+    // Only now that the whole request is here is the buffer touched
+    for (i = 0; i < argc; i++) {
+        cmd->argv[i][cmd->argl[i]] = '\0';
+    }
+    cmd->argc = (uint32_t)argc;
+    cmd->framed = true;
+    cmd->end = buf + pos;
+
+    return (long)pos;
+}
+
+static long parse_inline(char *buf, size_t len, RespCmd *cmd) {
+    char *nl, *p, *end;
+
+    nl = (char *)memchr(buf, '\n', len);
+    if (!nl) {
+        return 0;
+    }
+
+    end = nl;
+    if (end > buf && end[-1] == '\r') {
+        end--;
+    }
+    while (end > buf && end[-1] == ' ') {
+        end--;
+    }
+    *end = '\0';
+
+    // Only the first space after each word is overwritten, see resp_rest
+    cmd->argc = 0;
+    for (p = buf; p < end;) {
+        while (p < end && *p == ' ') {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        if (cmd->argc == RESP_MAX_ARGS) {
+            errno = E2BIG;
+            return -1;
+        }
+        cmd->argv[cmd->argc] = p;
+        while (p < end && *p != ' ') {
+            p++;
+        }
+        cmd->argl[cmd->argc] = (size_t)(p - cmd->argv[cmd->argc]);
+        cmd->argc++;
+        *p++ = '\0';
+    }
+    cmd->framed = false;
+    cmd->end = end;
+
+    return (long)(nl + 1 - buf);
+}
+
+/**
+ * Parse the first request in buf
+ * @param buf Received bytes; argument terminators are written into it
+ * @param len Bytes in buf
+ * @param cmd Filled with the request's arguments
+ * @return Bytes the request took, 0 if it is incomplete, -1 with errno set
+ *         (EPROTO, E2BIG) if the stream cannot be parsed any further; a
+ *         request fails with E2BIG when it has more than RESP_MAX_ARGS
+ *         arguments or one longer than RESP_MAX_BULK, and a framed one as
+ *         soon as the headers show that it would take more than
+ *         RESP_MAX_REQUEST before its last argument
+ */
+long resp_parse(char *buf, size_t len, RespCmd *cmd) {
+    if (!len) {
+        return 0;
+    }
+    if (buf[0] == '*') {
+        return parse_framed(buf, len, cmd, NULL);
+    }
+    return parse_inline(buf, len, cmd);
+}
+
+/**
+ * Check whether an incomplete framed request is only waiting for the
+ * payload of its last argument
+ * @param buf Received bytes, left untouched
+ * @param len Bytes in buf
+ * @param cmd Filled with the arguments before the last one
+ * @param bulk Filled with the payload's offset in buf and its length
+ * @return 1 if so, 0 otherwise (complete, inline, malformed or stuck
+ *         earlier); resp_parse tells those apart
+ */
+int resp_pending(char *buf, size_t len, RespCmd *cmd, RespBulk *bulk) {
+    bulk->len = 0;
+    bulk->offset = 0;
+    if (!len || buf[0] != '*' || parse_framed(buf, len, cmd, bulk) != 0) {
+        return 0;
+    }
+    return bulk->offset != 0;
+}
+
+/**
+ * Complete a request from resp_pending with its last argument
+ * @param cmd The request resp_pending filled in
+ * @param payload The argument's bytes, with room for a terminator at len
+ * @param len Bytes in payload
+ */
+void resp_attach(RespCmd *cmd, char *payload, size_t len) {
+    uint32_t i;
+
+    for (i = 0; i < cmd->argc; i++) {
+        cmd->argv[i][cmd->argl[i]] = '\0';
+    }
+    payload[len] = '\0';
+    cmd->argv[cmd->argc] = payload;
+    cmd->argl[cmd->argc] = len;
+    cmd->argc++;
+    cmd->end = payload + len;
+}
+
+/**
+ * Argument i together with everything after it. Inline lines keep the
+ * old "the value runs to the end of the line" form this way; a framed
+ * request just gets argument i back.
+ * @param cmd A parsed request
+ * @param i Index of the first argument
+ * @param len Set to the length of the result
+ * @return The argument, NULL if there is none
+ */
+char *resp_rest(RespCmd *cmd, uint32_t i, size_t *len) {
+    uint32_t j;
+
+    if (i >= cmd->argc) {
+        return NULL;
+    }
+    if (cmd->framed) {
+        *len = cmd->argl[i];
+        return cmd->argv[i];
+    }
+
+    for (j = i; j + 1 < cmd->argc; j++) {
+        cmd->argv[j][cmd->argl[j]] = ' ';
+    }
+    cmd->argc = i + 1;
+    cmd->argl[i] = (size_t)(cmd->end - cmd->argv[i]);
+
+    *len = cmd->argl[i];
+    return cmd->argv[i];
+}
+
+/**
+ * Format a reply header such as "$5\r\n" or ":1\r\n"
+ * @param buf At least RESP_MAX_HEADER bytes
+ * @param type '$' bulk, '*' array or ':' integer
+ * @param n The length, count or value (-1 for a nil bulk)
+ * @return Bytes written, without a terminator
+ */
+int resp_header(char *buf, char type, long long n) {
+    return snprintf(buf, RESP_MAX_HEADER, "%c%lld\r\n", type, n);
+}
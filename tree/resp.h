@@ -0,0 +1,50 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Only plain char here: cache22 and the tree disagree on what int8 means
+
+#define RESP_MAX_ARGS   1024
+#define RESP_MAX_BULK   (512UL * 1024 * 1024)
+#define RESP_MAX_REQUEST (1UL << 30)    // most bytes a framed request may take before its last argument
+#define RESP_MAX_HEADER 32      // "*<argc>\r\n" or "$<len>\r\n" never gets longer
+
+/*
+ * One request, parsed in place. Requests are either framed
+ *
+ *   *<argc>\r\n $<len>\r\n<bytes>\r\n ...
+ *
+ * where every argument is binary-safe, or a plain inline line split on
+ * spaces for people typing at a terminal. Every argv[i] points into the
+ * caller's buffer and is NUL-terminated there, so it stays valid until
+ * the buffer is reused; argl[i] is the real length.
+ */
+typedef struct s_respcmd {
+    uint32_t argc;
+    bool framed;                    // reply in kind: framed in, framed out
+    char *argv[RESP_MAX_ARGS];
+    size_t argl[RESP_MAX_ARGS];
+    char *end;                      // end of an inline line, for resp_rest
+} RespCmd;
+
+/*
+ * Where an incomplete framed request is stuck: its last argument's header
+ * has arrived and its payload of len bytes starts at offset. A front-end
+ * can read that payload straight into its final buffer instead of growing
+ * the receive buffer, then hand it over with resp_attach.
+ */
+typedef struct s_respbulk {
+    size_t offset;
+    size_t len;
+} RespBulk;
+
+long resp_parse(char *buf, size_t len, RespCmd *cmd);
+int resp_pending(char *buf, size_t len, RespCmd *cmd, RespBulk *bulk);
+void resp_attach(RespCmd *cmd, char *payload, size_t len);
+char *resp_rest(RespCmd *cmd, uint32_t i, size_t *len);
+int resp_header(char *buf, char type, long long n);
+
+#endif // RESP_H
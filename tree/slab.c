@@ -0,0 +1,384 @@
+/*Size-class slab allocator for nodes, leaves and short strings*/
+#include "tree.h"
+#include "slab.h"
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define SLAB_ALIGN      8
+#define SLAB_MAX_CLASSES 20
+
+typedef struct s_slabclass SlabClass;
+typedef struct s_slab Slab;
+
+// Header at the start of every slab; objects follow it
+struct s_slab {
+    Slab *prev, *next;          // class list of slabs with room left
+    Slab *all_prev, *all_next;  // every slab, for slab_release_all
+    SlabClass *cls;
+    void *free;                 // freed objects, linked through their first word
+    int8 *bump;                 // next never-used object
+    uint32 used;
+    uint32 capacity;
+};
+
+#define SLAB_HEADER (((sizeof(Slab) + 63) / 64) * 64)
+
+struct s_slabclass {
+    pthread_mutex_t lock;       // guards everything below and the class's slabs
+    const char *name;
+    uint32 size;
+    uint32 slabs;
+    uint64 used;
+    uint64 allocs;              // objects handed out since the start
+    Slab *partial;
+};
+
+// Large allocations carry this header so they can be released in bulk
+typedef struct s_large {
+    struct s_large *prev, *next;
+    size_t size;
+    size_t pad;                 // keeps the payload 16-byte aligned
+} Large;
+
+static SlabClass classes[SLAB_MAX_CLASSES];
+static uint32 nclasses;
+static uint32 max_size;
+static uint8_t lut[4096 / SLAB_ALIGN + 1];  // (size + 7) / 8 -> class index
+static Slab *all_slabs;
+static Large *large;
+static uint64 large_count, large_bytes, large_allocs;
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;  // all_slabs and large
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void slab_init(void) {
+    // Leaves are variable-sized (inline key/value), so they share these
+    static const uint32 small_sizes[] = {
+        8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 256
+    };
+    SlabClass tmp;
+    uint32 i, j, s;
+
+    classes[nclasses++] = (SlabClass){.name = "node", .size = sizeof(struct s_node)};
+
+    for (i = 0; i < sizeof(small_sizes) / sizeof(small_sizes[0]); i++) {
+        for (j = 0; j < nclasses && classes[j].size != small_sizes[i]; j++);
+        if (j == nclasses) {
+            classes[nclasses++] = (SlabClass){.name = "small", .size = small_sizes[i]};
+        }
+    }
+
+    // Smallest class first so the lookup table picks the tightest fit
+    for (i = 1; i < nclasses; i++) {
+        tmp = classes[i];
+        for (j = i; j > 0 && classes[j - 1].size > tmp.size; j--) {
+            classes[j] = classes[j - 1];
+        }
+        classes[j] = tmp;
+    }
+
+    for (i = 0; i < nclasses; i++) {
+        pthread_mutex_init(&classes[i].lock, NULL);
+    }
+
+    max_size = classes[nclasses - 1].size;
+    for (s = 0, i = 0; s <= max_size / SLAB_ALIGN; s++) {
+        while (classes[i].size < s * SLAB_ALIGN) i++;
+        lut[s] = (uint8_t)i;
+    }
+}
+
+static Slab *slab_new(SlabClass *cls) {
+    Slab *slab;
+
+    slab = (Slab *)aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+    if (!slab) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(slab, 0, sizeof(Slab));
+    slab->cls = cls;
+    slab->bump = (int8 *)slab + SLAB_HEADER;
+    slab->capacity = (SLAB_SIZE - SLAB_HEADER) / cls->size;
+
+    pthread_mutex_lock(&global_lock);
+    slab->all_next = all_slabs;
+    if (all_slabs) {
+        all_slabs->all_prev = slab;
+    }
+    all_slabs = slab;
+    pthread_mutex_unlock(&global_lock);
+
+    slab->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
+    cls->slabs++;
+
+    return slab;
+}
+
+static void partial_unlink(SlabClass *cls, Slab *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+}
+
+static void *large_alloc(size_t size) {
+    Large *l;
+
+    l = (Large *)malloc(sizeof(Large) + size);
+    if (!l) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    l->size = size;
+    l->prev = NULL;
+
+    pthread_mutex_lock(&global_lock);
+    l->next = large;
+    if (large) {
+        large->prev = l;
+    }
+    large = l;
+
+    large_count++;
+    large_allocs++;
+    large_bytes += size;
+    pthread_mutex_unlock(&global_lock);
+
+    return l + 1;
+}
+
+static void large_free(void *p) {
+    Large *l = (Large *)p - 1;
+
+    pthread_mutex_lock(&global_lock);
+    if (l->prev) {
+        l->prev->next = l->next;
+    } else {
+        large = l->next;
+    }
+    if (l->next) {
+        l->next->prev = l->prev;
+    }
+
+    large_count--;
+    large_bytes -= l->size;
+    pthread_mutex_unlock(&global_lock);
+
+    free(l);
+}
+
+/**
+ * Allocate an object from the size class that fits it
+ * @param size Bytes needed; the same size must be passed to slab_free
+ * @return Pointer to uninitialized memory, NULL with errno = ENOMEM on failure
+ */
+void *slab_alloc(size_t size) {
+    SlabClass *cls;
+    Slab *slab;
+    void *p;
+
+    pthread_once(&init_once, slab_init);
+    if (!size) {
+        size = 1;
+    }
+    if (size > max_size) {
+        return large_alloc(size);
+    }
+
+    cls = &classes[lut[(size + SLAB_ALIGN - 1) / SLAB_ALIGN]];
+    pthread_mutex_lock(&cls->lock);
+    slab = cls->partial;
+    if (!slab && !(slab = slab_new(cls))) {
+        pthread_mutex_unlock(&cls->lock);
+        return NULL;
+    }
+
+    if (slab->free) {
+        p = slab->free;
+        slab->free = *(void **)p;
+    } else {
+        p = slab->bump;
+        slab->bump += cls->size;
+    }
+
+    cls->used++;
+    cls->allocs++;
+    if (++slab->used == slab->capacity) {
+        partial_unlink(cls, slab);
+    }
+    pthread_mutex_unlock(&cls->lock);
+
+    return p;
+}
+
+/**
+ * Return an object to its slab; an emptied slab is handed back to the
+ * system unless it is the last one with room in its class
+ * @param p Pointer from slab_alloc (NULL is ignored)
+ * @param size The size that was passed to slab_alloc
+ */
+void slab_free(void *p, size_t size) {
+    SlabClass *cls;
+    Slab *slab;
+
+    if (!p) {
+        return;
+    }
+    if (!size) {
+        size = 1;
+    }
+    if (size > max_size) {
+        large_free(p);
+        return;
+    }
+
+    slab = (Slab *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1));
+    cls = slab->cls;
+
+    pthread_mutex_lock(&cls->lock);
+    *(void **)p = slab->free;
+    slab->free = p;
+    cls->used--;
+
+    if (slab->used-- == slab->capacity) {
+        // Was full: it has room again
+        slab->next = cls->partial;
+        slab->prev = NULL;
+        if (cls->partial) {
+            cls->partial->prev = slab;
+        }
+        cls->partial = slab;
+    }
+
+    if (!slab->used && (slab->prev || slab->next)) {
+        partial_unlink(cls, slab);
+        pthread_mutex_lock(&global_lock);
+        if (slab->all_prev) {
+            slab->all_prev->all_next = slab->all_next;
+        } else {
+            all_slabs = slab->all_next;
+        }
+        if (slab->all_next) {
+            slab->all_next->all_prev = slab->all_prev;
+        }
+        pthread_mutex_unlock(&global_lock);
+        cls->slabs--;
+        pthread_mutex_unlock(&cls->lock);
+        free(slab);
+        return;
+    }
+    pthread_mutex_unlock(&cls->lock);
+}
+
+/**
+ * Bytes actually reserved for a request of the given size; callers may
+ * use the slack and must pass the same size (or the original) to slab_free
+ * @param size Requested bytes
+ * @return The size of the class that would serve it
+ */
+size_t slab_usable(size_t size) {
+    pthread_once(&init_once, slab_init);
+    if (!size) {
+        size = 1;
+    }
+    if (size > max_size) {
+        return size;
+    }
+    return classes[lut[(size + SLAB_ALIGN - 1) / SLAB_ALIGN]].size;
+}
+
+// Drop every slab and large allocation at once; all outstanding pointers die.
+// Only call this once no other thread uses the allocator.
+void slab_release_all(void) {
+    Slab *slab, *next_slab;
+    Large *l, *next_large;
+    uint32 i;
+
+    for (slab = all_slabs; slab; slab = next_slab) {
+        next_slab = slab->all_next;
+        free(slab);
+    }
+    all_slabs = NULL;
+
+    for (l = large; l; l = next_large) {
+        next_large = l->next;
+        free(l);
+    }
+    large = NULL;
+    large_count = large_bytes = 0;
+
+    for (i = 0; i < nclasses; i++) {
+        classes[i].slabs = 0;
+        classes[i].used = 0;
+        classes[i].partial = NULL;
+    }
+}
+
+uint32 slab_nclasses(void) {
+    pthread_once(&init_once, slab_init);
+    return nclasses;
+}
+
+/**
+ * Copy out the statistics of one size class
+ * @param class Index below slab_nclasses()
+ * @param out Filled on success
+ * @return 0 on success, -1 if the class does not exist
+ */
+int slab_stats(uint32 class, SlabStats *out) {
+    SlabClass *cls;
+
+    if (class >= slab_nclasses() || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cls = &classes[class];
+    out->name = cls->name;
+    out->size = cls->size;
+    out->slabs = cls->slabs;
+    out->used = cls->used;
+    out->capacity = (uint64)cls->slabs * ((SLAB_SIZE - SLAB_HEADER) / cls->size);
+    return 0;
+}
+
+void slab_large_stats(uint64 *count, uint64 *bytes) {
+    *count = large_count;
+    *bytes = large_bytes;
+}
+
+/**
+ * Count every allocation served so far, from the slabs or not; the count
+ * survives slab_release_all, so the difference over a stretch of code is
+ * what that code allocated
+ * @return Allocations since the start
+ */
+uint64 slab_allocs(void) {
+    uint64 total;
+    uint32 i;
+
+    pthread_once(&init_once, slab_init);
+    pthread_mutex_lock(&global_lock);
+    total = large_allocs;
+    pthread_mutex_unlock(&global_lock);
+    for (i = 0; i < nclasses; i++) {
+        pthread_mutex_lock(&classes[i].lock);
+        total += classes[i].allocs;
+        pthread_mutex_unlock(&classes[i].lock);
+    }
+
+    return total;
+}
@@ -0,0 +1,36 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+// Every slab is one SLAB_SIZE chunk aligned to its own size
+#define SLAB_SIZE   (64 * 1024)
+
+/*
+ * Size-class statistics. Objects larger than the biggest class bypass the
+ * slabs and are tracked as "large" allocations so slab_release_all() can
+ * still drop them in one sweep.
+ */
+typedef struct s_slabstats {
+    const char *name;
+    uint32 size;        // object size of the class
+    uint32 slabs;       // slabs currently owned
+    uint64 used;        // live objects
+    uint64 capacity;    // objects the owned slabs can hold
+} SlabStats;
+
+void *slab_alloc(size_t size);
+void slab_free(void *p, size_t size);
+size_t slab_usable(size_t size);
+void slab_release_all(void);
+
+uint32 slab_nclasses(void);
+int slab_stats(uint32 class, SlabStats *out);
+void slab_large_stats(uint64 *count, uint64 *bytes);
+uint64 slab_allocs(void);
+
+#endif // SLAB_H
@@ -1,17 +1,18 @@
-/*This the place where the whole program implementation will occur*/
+/*The tree engine: directories, leaves and path resolution*/
 #define _GNU_SOURCE  // For strdup
 #include "tree.h"
-#include "command_handler.h"
+#include "pathcache.h"
+#include "slab.h"
+#include "intern.h"
+#include "art.h"
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
-#include <stdlib.h>  // For malloc, free
+#include <stdlib.h>
+#include <stddef.h>  // For offsetof
+#include <stdbool.h>
 #include <assert.h>  // For assert
-#include <strings.h> // For strcasecmp
-
-// Forward declarations
-void print_search_result(Leaf *result, const int8 *key);
-void tree_cleanup(void);
+#include <stdatomic.h>
 
 Tree root = {
     .n = {
@@ -19,11 +20,176 @@ Tree root = {
         .north = (Node *)&root,
         .west = NULL,
         .east = NULL,
-        .path = "/"
+        .path = (const int8 *)"/"
     }
 };
 
-void zero(int8 *str, int16 size) {
+// Bumped by every change; a directory keeps the value of its latest one
+static _Atomic uint64 generation;
+
+// The generation at the last tree_fence; see touch()
+static _Atomic uint64 fence;
+
+// Bytes held by leaves: the leaves themselves and their outside buffers
+static _Atomic uint64 leaf_bytes;
+
+static void charge(uint64 bytes) {
+    atomic_fetch_add_explicit(&leaf_bytes, bytes, memory_order_relaxed);
+}
+
+static void credit(uint64 bytes) {
+    atomic_fetch_sub_explicit(&leaf_bytes, bytes, memory_order_relaxed);
+}
+
+/*
+ * Mark a directory changed, and raise the subgen of it and its parents.
+ * The climb stops at the first one already above the last fence: that one
+ * was raised since the fence by a climb that went on to the root, so only
+ * the first change under a directory after each fence pays for the climb.
+ * Callers hold whatever lock covers the change and keeps n attached.
+ */
+static void touch(Node *n) {
+    uint64 g, f;
+    
+    g = atomic_fetch_add_explicit(&generation, 1, memory_order_relaxed) + 1;
+    n->gen = g;
+    f = atomic_load_explicit(&fence, memory_order_relaxed);
+    for (; atomic_load_explicit(&n->subgen, memory_order_relaxed) <= f; n = n->north) {
+        atomic_store_explicit(&n->subgen, g, memory_order_relaxed);
+        if (n->tag & TagRoot) {
+            break;
+        }
+    }
+}
+
+// Forget a directory's key order; the next order_leaves builds it anew
+static void drop_order(Node *n) {
+    if (n->order) {
+        art_free(n->order, NULL);
+        slab_free(n->order, sizeof(Art));
+        n->order = NULL;
+    }
+    n->sorting = NULL;
+}
+
+// Count an insert or delete in a key order; one that nobody walked for
+// longer than a rebuild would take goes
+static void order_upkeep(Node *n) {
+    if (atomic_fetch_add_explicit(&n->order_idle, 1, memory_order_relaxed) >= n->nleaves) {
+        drop_order(n);
+    }
+}
+
+// Put a new leaf in its directory's key order, if the directory keeps one
+static void order_add(Node *n, Leaf *leaf) {
+    void *old;
+    
+    // While order_leaves is still at it, the leaf waits for it at the tail
+    if (!n->order || n->sorting) {
+        return;
+    }
+    if (art_insert(n->order, (const uint8_t *)leaf->key,
+                   (uint32)strlen((const char *)leaf->key) + 1, leaf, &old) < 0) {
+        // Out of memory: the order is incomplete now, so it goes
+        drop_order(n);
+        return;
+    }
+    order_upkeep(n);
+}
+
+/**
+ * Keep a directory's keys in byte order (n->order, an art.h tree of Leaf
+ * pointers, keys with their terminators). The order is built a step at a
+ * time: each call adds up to budget keys and the next goes on at
+ * n->sorting, so no caller holds the directory for longer than that, and
+ * keys added or removed in between are taken care of. Once built it costs
+ * memory and one more insert or delete per key added or removed; after as
+ * many of those as the directory has keys with no call here or to
+ * order_used, it goes.
+ * @param n The directory, with nothing else using it (cache22 holds its write lock)
+ * @param budget Most keys to add in this call
+ * @return 1 once every key is in the order, 0 if it takes more calls, -1 on error (ENOMEM)
+ */
+int order_leaves(Node *n, uint32 budget) {
+    Leaf *leaf;
+    void *old;
+    
+    atomic_store_explicit(&n->order_idle, 0, memory_order_relaxed);
+    if (!n->order) {
+        n->order = (Art *)slab_alloc(sizeof(Art));
+        if (!n->order) {
+            errno = ENOMEM;
+            return -1;
+        }
+        memset(n->order, 0, sizeof(Art));
+        n->sorting = (Leaf *)n->east;
+    }
+    
+    for (leaf = n->sorting; leaf && budget; leaf = leaf->east, budget--) {
+        if (art_insert(n->order, (const uint8_t *)leaf->key,
+                       (uint32)strlen((const char *)leaf->key) + 1, leaf, &old) < 0) {
+            drop_order(n);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    n->sorting = leaf;
+    
+    return leaf ? 0 : 1;
+}
+
+/**
+ * Note a walk over a directory's complete key order, so it is kept
+ * @param n The directory; any lock on it will do
+ */
+void order_used(Node *n) {
+    atomic_store_explicit(&n->order_idle, 0, memory_order_relaxed);
+}
+
+/**
+ * Mark a directory changed for something the engine does not see itself,
+ * such as a field a front-end keeps on its leaves
+ * @param n The directory, locked by the caller
+ */
+void mark_changed(Node *n) {
+    touch(n);
+}
+
+/**
+ * The generation of the most recent change anywhere in the tree. A
+ * directory whose gen is above a value read earlier changed since then.
+ */
+uint64 tree_generation(void) {
+    return atomic_load_explicit(&generation, memory_order_relaxed);
+}
+
+/**
+ * Start a new round of change tracking. A directory whose subgen is at or
+ * below the value returned has nothing under it that changed since, and
+ * that holds for the value of any earlier fence too, so a walk for the
+ * changes since a fence can skip such subtrees whole. Other values of
+ * tree_generation() give no such promise.
+ * The caller holds off every change meanwhile (cache22 takes the tree
+ * write lock), so no climb in touch() straddles two fences.
+ * @return The generation every change so far is at or below
+ */
+uint64 tree_fence(void) {
+    uint64 g;
+    
+    g = atomic_load_explicit(&generation, memory_order_relaxed);
+    atomic_store_explicit(&fence, g, memory_order_relaxed);
+    return g;
+}
+
+/**
+ * Bytes allocated for keys and values, counted as each leaf and buffer is
+ * allocated and freed. Directories and their indexes are not included.
+ */
+uint64 tree_memory(void) {
+    return atomic_load_explicit(&leaf_bytes, memory_order_relaxed);
+}
+
+static void zero(int8 *str, int16 size) {
     int8 *p;
     int16 n;
     for (n = 0, p = str; n < size; p++, n++) {
@@ -34,12 +200,13 @@ void zero(int8 *str, int16 size) {
 Node *create_node(Node *parent, const int8 *path) {
     Node *n;
     int16 size;
+    size_t len;
 
     errno = NoError;
     assert(parent);
     
     size = sizeof(struct s_node);
-    n = (Node *)malloc(size);
+    n = (Node *)slab_alloc(size);
     if (!n) {
         errno = ENOMEM;
         return NULL;
@@ -50,12 +217,107 @@ Node *create_node(Node *parent, const int8 *path) {
     n->north = parent;
     n->west = NULL;
     n->east = NULL;
-    strncpy((char *)n->path, (char *)path, 255);
-    n->path[255] = '\0';
+    
+    // Names are shared: a thousand "sessions" directories keep one copy
+    len = strlen((const char *)path);
+    n->path = intern_name(path, len > MAX_NAME_LENGTH ? MAX_NAME_LENGTH : len);
+    if (!n->path) {
+        slab_free(n, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    // Append to the parent's subdirectory list through its tail pointer
+    n->prev = parent->last_dir;
+    if (parent->last_dir) {
+        parent->last_dir->next = n;
+    } else {
+        parent->west = n;
+    }
+    parent->last_dir = n;
+    parent->ndirs++;
+    touch(parent);
+    touch(n);
     
     return n;
 }
 
+// Copy size - 1 bytes of a value and terminate it; values may hold NULs
+static void copy_value(int8 *dst, const int8 *src, uint64 size) {
+    memcpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+/**
+ * Release a leaf and whichever of its key/value buffers live outside it
+ * @param leaf A leaf no directory holds any more (see detach_leaf)
+ */
+void free_leaf(Leaf *leaf) {
+    size_t klen;
+
+    if (!(leaf->flags & LeafKeyInline)) {
+        klen = strlen((char *)leaf->key) + 1;
+        slab_free(leaf->key, klen);
+        credit(klen);
+    }
+    if (!(leaf->flags & LeafValueInline)) {
+        slab_free(leaf->value, leaf->capacity);
+        credit(leaf->capacity);
+    }
+    credit(leaf->footprint);
+    slab_free(leaf, leaf->footprint);
+}
+
+// Replace a leaf's value, reusing the current buffer when the new value fits
+static int assign_value(Leaf *leaf, const int8 *new_value, uint64 new_size) {
+    int8 *new_value_copy;
+    size_t capacity;
+    
+    if (new_size <= leaf->capacity) {
+        copy_value(leaf->value, new_value, new_size);
+        leaf->size = new_size;
+        return 0;
+    }
+    
+    // Allocate memory for the new value, keeping the slab slack for later growth
+    capacity = slab_usable(new_size);
+    new_value_copy = (int8 *)slab_alloc(capacity);
+    if (!new_value_copy) {
+        errno = ENOMEM;
+        return -1;
+    }
+    copy_value(new_value_copy, new_value, new_size);
+    charge(capacity);
+    
+    // Free the old value unless it was inline; that space simply goes unused
+    if (!(leaf->flags & LeafValueInline)) {
+        slab_free(leaf->value, leaf->capacity);
+        credit(leaf->capacity);
+    }
+    
+    leaf->value = new_value_copy;
+    leaf->size = new_size;
+    leaf->capacity = capacity;
+    leaf->flags &= ~LeafValueInline;
+    
+    return 0;
+}
+
+// Hand a caller-allocated buffer to the leaf in place of its value
+static void take_value(Leaf *leaf, int8 *value, uint64 size, uint64 capacity) {
+    if (!(leaf->flags & LeafValueInline)) {
+        slab_free(leaf->value, leaf->capacity);
+        credit(leaf->capacity);
+    }
+    charge(capacity);
+    
+    value[size - 1] = '\0';
+    leaf->value = value;
+    leaf->size = size;
+    leaf->capacity = capacity;
+    leaf->flags &= ~LeafValueInline;
+}
+
 /**
  * Update the value of an existing leaf node
  * @param root The root node to start searching from
@@ -64,12 +326,11 @@ Node *create_node(Node *parent, const int8 *path) {
  * @param new_size The size of the new value
  * @return 0 on success, -1 on error
  */
-int update_leaf(Node *root, const int8 *key, const int8 *new_value, int16 new_size) {
+int update_leaf(Node *root, const int8 *key, const int8 *new_value, uint64 new_size) {
     Leaf *leaf;
-    int8 *new_value_copy;
     
     // Validate input parameters
-    if (!root || !key || !new_value || new_size <= 0) {
+    if (!root || !key || !new_value || !new_size) {
         errno = EINVAL;
         return -1;
     }
@@ -81,155 +342,319 @@ int update_leaf(Node *root, const int8 *key, const int8 *new_value, int16 new_si
         return -1;
     }
     
-    // Allocate memory for the new value
-    new_value_copy = (int8 *)malloc(new_size);
-    if (!new_value_copy) {
-        errno = ENOMEM;
+    if (assign_value(leaf, new_value, new_size) != 0) {
         return -1;
     }
+    touch(root);
+    return 0;
+}
+
+/**
+ * Set a key in a directory, updating it in place if it already exists
+ * @param parent The directory holding the key
+ * @param key The key to set
+ * @param value The value to store
+ * @param count The size of the value including its terminator
+ * @return The created or updated leaf, NULL on error
+ */
+Leaf *set_leaf(Node *parent, const int8 *key, const int8 *value, uint64 count) {
+    Leaf *leaf;
     
-    // Copy the new value
-    zero(new_value_copy, new_size);
-    strncpy((char *)new_value_copy, (const char *)new_value, new_size - 1);
-    new_value_copy[new_size - 1] = '\0';
+    if (!parent || !key || !value || !count) {
+        errno = EINVAL;
+        return NULL;
+    }
     
-    // Free the old value and update the leaf
-    if (leaf->value) {
-        free(leaf->value);
+    // One index probe decides between update and insert
+    leaf = index_lookup(&parent->index, key, index_hash(key));
+    if (!leaf) {
+        return create_leaf(parent, key, value, count);
     }
     
-    leaf->value = new_value_copy;
-    leaf->size = new_size;
+    if (assign_value(leaf, value, count) != 0) {
+        return NULL;
+    }
+    touch(parent);
     
-    return 0;
+    errno = NoError;
+    return leaf;
 }
 
 /**
- * Delete a leaf node with the given key from the tree
- * @param root The root node to start searching from
- * @param key The key of the leaf to delete
- * @return 0 on success, -1 on error
+ * Set a key to a value buffer the caller already filled, so a large value
+ * received from the network is stored without another copy
+ * @param parent The directory holding the key
+ * @param key The key to set
+ * @param value Buffer from slab_alloc(capacity); the leaf owns it from now
+ *              on, and on failure it is freed
+ * @param count The size of the value including its terminator, which is
+ *              written at value[count - 1]
+ * @param capacity The size passed to slab_alloc
+ * @return The created or updated leaf, NULL on error
  */
-int delete_leaf(Node *root, const int8 *key) {
-    Tree *current_tree;
-    Leaf *current_leaf = NULL, *prev_leaf = NULL;
+Leaf *adopt_leaf(Node *parent, const int8 *key, int8 *value, uint64 count, uint64 capacity) {
+    Leaf *leaf;
     
-    // Validate input parameters
-    if (!root || !key) {
+    if (!parent || !key || !value || !count || count > capacity) {
+        slab_free(value, capacity);
         errno = EINVAL;
-        return -1;
+        return NULL;
+    }
+    
+    leaf = index_lookup(&parent->index, key, index_hash(key));
+    if (!leaf && !(leaf = create_leaf(parent, key, (const int8 *)"", 1))) {
+        slab_free(value, capacity);
+        return NULL;
     }
     
-    // Start from the first leaf
-    current_tree = root->east;
-    if (current_tree) {
-        current_leaf = &(current_tree->l);
+    take_value(leaf, value, count, capacity);
+    touch(parent);
+    
+    errno = NoError;
+    return leaf;
+}
+
+/**
+ * Overwrite part of a value, creating the key or growing the value as
+ * needed; any gap before offset is filled with zero bytes. Everything is
+ * allocated before the directory changes, so a failure leaves it as it was.
+ * @param parent The directory holding the key
+ * @param key The key to change
+ * @param offset First byte to overwrite
+ * @param buf The bytes to write
+ * @param len Bytes in buf
+ * @return The changed leaf, NULL on error (E2BIG past MAX_VALUE_SIZE), or
+ *         NULL with errno ENOENT when len is 0 and the key is not there,
+ *         which writes nothing and creates nothing
+ */
+Leaf *setrange_leaf(Node *parent, const int8 *key, uint64 offset, const int8 *buf, uint64 len) {
+    int8 small[LEAF_INLINE_VALUE];
+    Leaf *leaf;
+    int8 *value;
+    uint64 end, capacity;
+    
+    if (!parent || !key || (!buf && len)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (offset > MAX_VALUE_SIZE || len > MAX_VALUE_SIZE - offset) {
+        errno = E2BIG;
+        return NULL;
     }
+    end = offset + len;
     
-    // Special case: the leaf to delete is the first one
-    if (current_leaf && strcmp((const char *)current_leaf->key, (const char *)key) == 0) {
-        if (current_leaf->east) {
-            // If there's a next leaf, update root's east pointer to point to it
-            root->east = (Tree *)current_leaf->east;
-            // Update the west pointer of the new first leaf to point back to root
-            current_leaf->east->west = (Tree *)root;
-        } else {
-            // No more leaves after this one
-            root->east = NULL;
+    leaf = index_lookup(&parent->index, key, index_hash(key));
+    if (!leaf) {
+        if (!len) {
+            errno = ENOENT;
+            return NULL;
         }
         
-        // Free the leaf's resources
-        if (current_leaf->value) {
-            free(current_leaf->value);
+        // A new key is built whole first; a short one still goes inline
+        if (end + 1 <= sizeof(small)) {
+            memset(small, 0, offset);
+            memcpy(small + offset, buf, len);
+            small[end] = '\0';
+            return create_leaf(parent, key, small, end + 1);
         }
-        free(current_leaf);
-        
-        errno = NoError;
-        return 0;
+        capacity = slab_usable(end + 1);
+        value = (int8 *)slab_alloc(capacity);
+        if (!value) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(value, 0, offset);
+        memcpy(value + offset, buf, len);
+        return adopt_leaf(parent, key, value, end + 1, capacity);
     }
     
-    // Traverse the linked list to find the leaf to delete
-    while (current_leaf) {
-        if (strcmp((const char *)current_leaf->key, (const char *)key) == 0) {
-            // Found the leaf to delete
-            if (prev_leaf) {
-                prev_leaf->east = current_leaf->east;
-            }
-            
-            // Update the west pointer of the next leaf if it exists
-            if (current_leaf->east) {
-                current_leaf->east->west = (prev_leaf) ? (Tree *)prev_leaf : (Tree *)root;
-            }
-            
-            // Free the leaf's resources
-            if (current_leaf->value) {
-                free(current_leaf->value);
-            }
-            free(current_leaf);
-            
-            errno = NoError;
-            return 0;
+    if (end + 1 > leaf->capacity) {
+        capacity = slab_usable(end + 1);
+        value = (int8 *)slab_alloc(capacity);
+        if (!value) {
+            errno = ENOMEM;
+            return NULL;
         }
-        
-        // Move to the next leaf
-        prev_leaf = current_leaf;
-        current_leaf = current_leaf->east;
+        memcpy(value, leaf->value, leaf->size);
+        take_value(leaf, value, leaf->size, capacity);
     }
     
-    // If we get here, the key was not found
-    errno = ENOENT;
-    return -1;
+    if (offset > leaf->size - 1) {
+        memset(leaf->value + leaf->size - 1, 0, offset - (leaf->size - 1));
+    }
+    if (len) {
+        memcpy(leaf->value + offset, buf, len);
+    }
+    if (end + 1 > leaf->size) {
+        leaf->size = end + 1;
+        leaf->value[end] = '\0';
+    }
+    touch(parent);
+    
+    errno = NoError;
+    return leaf;
 }
 
-// Forward declarations
-void print_search_result(Leaf *result, const int8 *key);
-
-
-Leaf *find_last_linear(Node *parent) {
-    Leaf *l;
+/**
+ * Take a leaf out of its directory without freeing it, so a large value
+ * can be released later, away from the caller's lock
+ * @param root The directory holding the key
+ * @param key The key to take out
+ * @return The leaf, now owned by the caller (see free_leaf), NULL on error
+ */
+Leaf *detach_leaf(Node *root, const int8 *key) {
+    Leaf *leaf;
     
-    if (!parent) {
+    if (!root || !key) {
         errno = EINVAL;
         return NULL;
     }
     
-    if (!parent->east) {
-        errno = NoError;
+    // Drop the key from the directory index first
+    leaf = index_remove(&root->index, key, index_hash(key));
+    if (!leaf) {
+        errno = ENOENT;
         return NULL;
     }
     
-    for (l = (Leaf *)parent->east; l->east; l = l->east);
+    // Unlink from the ordered list; west is either the parent or the previous leaf
+    if (leaf->west->n.tag & (TagNode | TagRoot)) {
+        leaf->west->n.east = (Tree *)leaf->east;
+    } else {
+        leaf->west->l.east = leaf->east;
+    }
+    if (leaf->east) {
+        leaf->east->west = leaf->west;
+    } else {
+        root->last_leaf = (leaf->west->n.tag & (TagNode | TagRoot)) ? NULL : &leaf->west->l;
+    }
+    if (root->resume == leaf) {
+        root->resume = leaf->east;
+    }
+    if (root->sorting == leaf) {
+        root->sorting = leaf->east;
+    }
+    root->nleaves--;
+    if (root->order) {
+        art_delete(root->order, (const uint8_t *)key, (uint32)strlen((const char *)key) + 1);
+        order_upkeep(root);
+    }
+    touch(root);
     
-    return l;
+    errno = NoError;
+    return leaf;
 }
 
-Leaf *create_leaf(Node *parent, const int8 *key, const int8 *value, int16 count) {
+/**
+ * Delete a leaf node with the given key from the tree
+ * @param root The root node to start searching from
+ * @param key The key of the leaf to delete
+ * @return 0 on success, -1 on error
+ */
+int delete_leaf(Node *root, const int8 *key) {
+    Leaf *leaf;
+    
+    leaf = detach_leaf(root, key);
+    if (!leaf) {
+        return -1;
+    }
+    free_leaf(leaf);
+    
+    return 0;
+}
+
+/**
+ * Delete every key of a directory, leaving its subdirectories alone
+ * @param parent The directory to empty
+ */
+void clear_leaves(Node *parent) {
+    Leaf *leaf, *next;
+    
+    for (leaf = (Leaf *)parent->east; leaf; leaf = next) {
+        next = leaf->east;
+        free_leaf(leaf);
+    }
+    index_free(&parent->index);
+    if (parent->order) {
+        art_free(parent->order, NULL);
+    }
+    parent->sorting = NULL;
+    parent->east = NULL;
+    parent->last_leaf = NULL;
+    parent->resume = NULL;
+    parent->nleaves = 0;
+    touch(parent);
+}
+
+Leaf *create_leaf(Node *parent, const int8 *key, const int8 *value, uint64 count) {
     Leaf *last_leaf, *new_leaf;
+    size_t klen, need, footprint;
+    bool key_inline, value_inline;
     
-    if (!parent || !key || !value || count <= 0) {
+    if (!parent || !key || !value || !count) {
         errno = EINVAL;
         return NULL;
     }
     
+    // Short keys and values are stored in the leaf allocation itself
+    klen = strlen((char *)key) + 1;
+    key_inline = klen <= LEAF_INLINE_KEY;
+    value_inline = count <= LEAF_INLINE_VALUE;
+    need = offsetof(Leaf, data) + (key_inline ? klen : 0) + (value_inline ? (size_t)count : 0);
+    footprint = slab_usable(need);
+    
     // Allocate and initialize new leaf first
-    new_leaf = (Leaf *)malloc(sizeof(struct s_leaf));
+    new_leaf = (Leaf *)slab_alloc(footprint);
     if (!new_leaf) {
         errno = ENOMEM;
         return NULL;
     }
     
     // Initialize the new leaf
-    zero((int8 *)new_leaf, sizeof(struct s_leaf));
+    zero((int8 *)new_leaf, offsetof(Leaf, data));
     new_leaf->tag = TagLeaf;
+    new_leaf->footprint = (uint16_t)footprint;
+    new_leaf->hash = index_hash(key);
     
-    // Find the last leaf in the parent's east direction
-    last_leaf = find_last_linear(parent);
-    if (last_leaf == NULL && errno != NoError) {
-        free(new_leaf);
+    // Copy the key
+    if (key_inline) {
+        new_leaf->key = new_leaf->data;
+        new_leaf->flags |= LeafKeyInline;
+    } else {
+        new_leaf->key = (int8 *)slab_alloc(klen);
+        if (!new_leaf->key) {
+            slab_free(new_leaf, footprint);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    memcpy(new_leaf->key, key, klen);
+    
+    // Copy the value; an inline value may grow into the slack of the slab class
+    if (value_inline) {
+        new_leaf->value = new_leaf->data + (key_inline ? klen : 0);
+        new_leaf->capacity = footprint - (size_t)(new_leaf->value - (int8 *)new_leaf);
+        new_leaf->flags |= LeafValueInline;
+        copy_value(new_leaf->value, value, count);
+        new_leaf->size = count;
+    } else if (assign_value(new_leaf, value, count) != 0) {
+        if (!key_inline) {
+            slab_free(new_leaf->key, klen);
+        }
+        slab_free(new_leaf, footprint);
+        return NULL;
+    }
+    
+    charge(footprint + (key_inline ? 0 : klen));
+    
+    // Index the key before linking so a failure leaves the list untouched
+    if (index_insert(&parent->index, new_leaf) != 0) {
+        free_leaf(new_leaf);
         return NULL;
     }
     
     // Link the new leaf to the parent or the last leaf
+    last_leaf = parent->last_leaf;
     if (!last_leaf) {
         // First leaf for this parent
         parent->east = (Tree *)new_leaf;
@@ -239,32 +664,96 @@ Leaf *create_leaf(Node *parent, const int8 *key, const int8 *value, int16 count)
         last_leaf->east = new_leaf;
         new_leaf->west = (Tree *)last_leaf;
     }
+    parent->last_leaf = new_leaf;
+    parent->nleaves++;
+    order_add(parent, new_leaf);
+    touch(parent);
     
-    // Allocate and copy the key
-    new_leaf->key = (int8 *)malloc(strlen((char *)key) + 1);
-    if (!new_leaf->key) {
-        free(new_leaf);
-        errno = ENOMEM;
-        return NULL;
+    errno = NoError;
+    return new_leaf;
+}
+
+
+/**
+ * Unlink a directory and everything below it from its parent in O(1). The
+ * subtree keeps its shape but can no longer be found; hand it to
+ * reclaim_node. The caller must hold off every other user of the tree
+ * (cache22 takes the tree write lock).
+ * @param n The directory to take out; not the root
+ * @return 0 on success, -1 on error
+ */
+int detach_node(Node *n) {
+    Node *parent;
+    
+    if (!n || (n->tag & TagRoot)) {
+        errno = EINVAL;
+        return -1;
     }
-    strcpy((char *)new_leaf->key, (char *)key);
     
-    // Allocate and copy the value
-    new_leaf->value = (int8 *)malloc(count);
-    if (!new_leaf->value) {
-        free(new_leaf);
-        errno = ENOMEM;
-        return NULL;
+    parent = n->north;
+    if (n->prev) {
+        n->prev->next = n->next;
+    } else {
+        parent->west = n->next;
     }
+    if (n->next) {
+        n->next->prev = n->prev;
+    } else {
+        parent->last_dir = n->prev;
+    }
+    n->prev = n->next = NULL;
+    parent->ndirs--;
+    touch(parent);
     
-    zero(new_leaf->value, count);
-    strncpy((char *)new_leaf->value, (char *)value, count - 1);
-    new_leaf->value[count - 1] = '\0';
-    new_leaf->size = count;
+    // Cached paths may lead into the subtree
+    pathcache_clear();
     
-    return new_leaf;
+    errno = NoError;
+    return 0;
 }
 
+/**
+ * Free part of a detached subtree: up to budget leaves and directories,
+ * deepest first, so a huge subtree goes in bounded steps
+ * @param top The directory detach_node took out
+ * @param budget Most leaves and directories to free in this call
+ * @return 1 once all of it (top included) is freed, 0 if there is more
+ */
+int reclaim_node(Node *top, uint32 budget) {
+    Node *n;
+    Leaf *leaf;
+    
+    while (budget) {
+        for (n = top; n->west; n = n->west);
+        
+        for (; budget && (leaf = (Leaf *)n->east); budget--) {
+            n->east = (Tree *)leaf->east;
+            free_leaf(leaf);
+        }
+        // The directory itself counts too: with the budget spent on its
+        // leaves it waits for the next call, or budget-- would wrap
+        if (n->east || !budget) {
+            return 0;
+        }
+        
+        // Empty now: its first-child slot in the parent passes to the next sibling
+        index_free(&n->index);
+        drop_order(n);
+        intern_release(n->path);
+        if (n == top) {
+            slab_free(n, sizeof(struct s_node));
+            return 1;
+        }
+        n->north->west = n->next;
+        if (n->next) {
+            n->next->prev = NULL;
+        }
+        slab_free(n, sizeof(struct s_node));
+        budget--;
+    }
+    
+    return 0;
+}
 
 /**
  * Search for a leaf node with the given key in the tree
@@ -273,7 +762,7 @@ Leaf *create_leaf(Node *parent, const int8 *key, const int8 *value, int16 count)
  * @return Pointer to the Leaf if found, NULL otherwise
  */
 Leaf *search_leaf(const Node *root, const int8 *key) {
-    Leaf *current_leaf;
+    Leaf *leaf;
     
     // Validate input parameters
     if (!root || !key) {
@@ -281,36 +770,88 @@ Leaf *search_leaf(const Node *root, const int8 *key) {
         return NULL;
     }
     
-    // Start from the first leaf in the east direction
-    current_leaf = (Leaf *)root->east;
+    // The directory index replaces the walk along the east list
+    leaf = index_lookup(&root->index, key, index_hash(key));
+    if (!leaf) {
+        errno = ENOENT;  // No such entry
+        return NULL;
+    }
+    
+    errno = NoError;
+    return leaf;
+}
+
+/**
+ * Write the absolute path of a directory into buf
+ * @param node The directory
+ * @param buf Destination buffer
+ * @param size Size of buf
+ * @return Length of the path, -1 on error
+ */
+int node_path(const Node *node, int8 *buf, uint32 size) {
+    const Node *n;
+    uint32 len, clen;
+    
+    if (!node || !buf || !size) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (node->tag & TagRoot) {
+        if (size < 2) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy((char *)buf, "/");
+        return 1;
+    }
+    
+    // Measure first, then fill the buffer from the end towards the root
+    for (len = 0, n = node; !(n->tag & TagRoot); n = n->north) {
+        len += strlen((const char *)n->path) + 1;
+    }
+    if (len + 1 > size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    
+    buf[len] = '\0';
+    for (clen = len, n = node; !(n->tag & TagRoot); n = n->north) {
+        uint32 nlen = strlen((const char *)n->path);
+        clen -= nlen;
+        memcpy(buf + clen, n->path, nlen);
+        buf[--clen] = '/';
+    }
     
-    // Traverse the linked list of leaves
-    while (current_leaf != NULL) {
-        // Check if the current leaf's key matches the search key
-        if (strcmp((const char *)current_leaf->key, (const char *)key) == 0) {
-            // Found the matching leaf
-            errno = NoError;
-            return current_leaf;
+    return (int)len;
+}
+
+// Find the subdirectory of parent named by the first len bytes of name
+static Node *find_child(const Node *parent, const int8 *name, uint32 len) {
+    Node *child;
+    
+    for (child = parent->west; child; child = child->next) {
+        if (strncmp((const char *)child->path, (const char *)name, len) == 0 &&
+            child->path[len] == '\0') {
+            return child;
         }
-        
-        // Move to the next leaf in the east direction
-        current_leaf = current_leaf->east;
     }
     
-    // If we get here, the key was not found
-    errno = ENOENT;  // No such entry
     return NULL;
 }
 
 /**
  * Search for a node with the given path in the tree
- * @param root The root node to start searching from
- * @param path The path to search for (e.g., "/path/to/node")
+ * @param root The directory relative paths are resolved from
+ * @param path The path to search for (e.g., "/path/to/node", "../sibling")
  * @return Pointer to the Node if found, NULL otherwise
  */
 Node *search_node(const Node *root, const int8 *path) {
-    // For now, we'll implement a simple search that only looks at the direct children
-    // This can be enhanced to handle full path traversal
+    int8 abs[MAX_PATH_LENGTH];
+    const int8 *p, *comp;
+    uint32 len, clen, start;
+    const Node *top;
+    Node *node;
     
     // Validate input parameters
     if (!root || !path) {
@@ -318,155 +859,98 @@ Node *search_node(const Node *root, const int8 *path) {
         return NULL;
     }
     
-    // Check if the path is the root
-    if (strcmp((const char *)root->path, (const char *)path) == 0) {
-        errno = NoError;
-        return (Node *)root;
-    }
-    
-    // For now, we'll just return NULL as we need to implement proper path traversal
-    errno = ENOENT;
-    return NULL;
-}
-
-// Forward declaration for print_search_result
-void print_search_result(Leaf *result, const int8 *key);
-
-// Recursive function to free all nodes and leaves
-static void free_tree(Tree *tree) {
-    if (!tree) return;
+    for (top = root; !(top->tag & TagRoot); top = top->north);
     
-    if (tree->n.tag & (TagNode | TagRoot)) {
-        // If it's a node, recursively free its children
-        if (tree->n.east) {
-            free_tree(tree->n.east);
-        }
-        // Free the node itself if it's not the root
-        if (!(tree->n.tag & TagRoot)) {
-            free(tree);
-        }
-    } else if (tree->l.tag & TagLeaf) {
-        // If it's a leaf, free its resources
-        if (tree->l.key) {
-            free(tree->l.key);
+    // Relative paths start from the absolute path of root
+    len = 0;
+    if (path[0] != '/' && !(root->tag & TagRoot)) {
+        int n = node_path(root, abs, sizeof(abs));
+        if (n < 0) {
+            return NULL;
         }
-        if (tree->l.value) {
-            free(tree->l.value);
-        }
-        // Free the leaf itself
-        free(tree);
+        len = (uint32)n;
     }
-}
-
-// Function to free all resources
-void tree_cleanup() {
-    printf("Cleaning up memory...\n");
     
-    // Start from the first child of root
-    if (root.n.east) {
-        Tree *current = root.n.east;
-        Tree *next;
+    // Canonicalize in place: drop empty and "." components, fold ".."
+    for (p = path; *p; ) {
+        while (*p == '/') p++;
+        for (comp = p; *p && *p != '/'; p++);
+        clen = (uint32)(p - comp);
         
-        // Traverse and free all siblings
-        while (current) {
-            next = (current->n.tag & (TagNode | TagRoot)) ? 
-                   current->n.east : 
-                   (Tree *)((Leaf *)current)->east;
-            
-            free_tree(current);
-            current = next;
+        if (clen == 0 || (clen == 1 && comp[0] == '.')) {
+            continue;
         }
-        
-        // Reset root's east pointer
-        root.n.east = NULL;
+        if (clen == 2 && comp[0] == '.' && comp[1] == '.') {
+            while (len > 0 && abs[len - 1] != '/') len--;
+            if (len > 0) len--;
+            continue;
+        }
+        if (len + clen + 2 > sizeof(abs)) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        abs[len++] = '/';
+        memcpy(abs + len, comp, clen);
+        len += clen;
     }
     
-    printf("Memory cleanup completed.\n");
-}
-
-// Helper function to print search results
-void print_search_result(Leaf *result, const int8 *key) {
-    if (result) {
-        printf("Found key '%s' with value: %.*s\n", 
-               key, result->size, result->value);
-    } else {
-        if (errno == ENOENT) {
-            printf("Key '%s' not found\n", key);
-        } else {
-            printf("Error searching for key '%s': %s\n", key, strerror(errno));
-        }
+    if (len == 0) {
+        errno = NoError;
+        return (Node *)top;
     }
-}
-
-int main(int argc, char *argv[]) {
-    // Initialize root node if not already initialized
-    if (!(root.n.tag & TagRoot)) {
-        root.n.tag = TagRoot | TagNode;
-        root.n.north = (Node *)&root;
-        root.n.west = NULL;
-        root.n.east = NULL;
-        strcpy((char *)root.n.path, "/");
+    abs[len] = '\0';
+    
+    // Whole-path hit: one lookup regardless of depth
+    node = pathcache_get(abs, index_hash(abs));
+    if (node) {
+        errno = NoError;
+        return node;
     }
-
-    // Check if we should run in test mode or interactive mode
-    if (argc > 1 && strcmp(argv[1], "--test") == 0) {
-        // Run tests if --test flag is provided
-        printf("\n=== Running Tests ===\n");
+    
+    // Miss: walk down from the root, caching every prefix on the way
+    node = (Node *)top;
+    for (start = 1; start <= len; start += clen + 1) {
+        for (clen = 0; abs[start + clen] && abs[start + clen] != '/'; clen++);
         
-        // Test 1: Create and search for a leaf
-        printf("\nTest 1: Creating and searching for a leaf...\n");
-        int8 key1[128] = "test_key";
-        int8 value1[256] = "test_value";
-        Leaf *l1 = create_leaf(&root.n, key1, value1, strlen((char *)value1) + 1);
-        if (!l1) {
-            printf("Failed to create leaf: %s\n", strerror(errno));
-            return 1;
+        node = find_child(node, abs + start, clen);
+        if (!node) {
+            errno = ENOENT;
+            return NULL;
         }
-        printf("Created leaf with key '%s' and value '%s'\n", key1, l1->value);
         
-        // Test 2: Search for a non-existent key
-        printf("\nTest 2: Searching for a non-existent key...\n");
-        int8 non_existent_key[128] = "non_existent";
-        Leaf *search_result = search_leaf(&root.n, non_existent_key);
-        print_search_result(search_result, non_existent_key);
-
-        // Test 3: Test update functionality
-        printf("\nTest 3: Testing update functionality...\n");
-        int8 updated_value[256] = "updated_test_value";
-        printf("Updating value for key 'test_key'...\n");
-        if (update_leaf(&root.n, key1, updated_value, strlen((char *)updated_value) + 1) == 0) {
-            printf("Successfully updated the value. New value: %s\n", updated_value);
-            
-            // Verify the update
-            printf("Verifying update...\n");
-            search_result = search_leaf(&root.n, key1);
-            print_search_result(search_result, key1);
-        } else {
-            printf("Failed to update leaf: %s\n", strerror(errno));
-        }
-
-        // Test 4: Test delete functionality
-        printf("\nTest 4: Testing delete functionality...\n");
-        printf("Deleting leaf with key 'test_key'...\n");
-        if (delete_leaf(&root.n, key1) == 0) {
-            printf("Successfully deleted leaf with key 'test_key'\n");
-            
-            // Verify the leaf was deleted
-            search_result = search_leaf(&root.n, key1);
-            printf("Verifying deletion...\n");
-            print_search_result(search_result, key1);
-        } else {
-            printf("Failed to delete leaf: %s\n", strerror(errno));
+        abs[start + clen] = '\0';
+        pathcache_put(abs, index_hash(abs), node);
+        if (start + clen < len) {
+            abs[start + clen] = '/';
         }
-
-        printf("\n=== All tests completed ===\n");
-    } else {
-        // Start interactive REPL
-        start_repl(&root.n);
     }
+    
+    errno = NoError;
+    return node;
+}
 
-    // Clean up resources
-    tree_cleanup();
+// Function to free all resources
+void tree_cleanup() {
+    printf("Cleaning up memory...\n");
     
-    return 0;
+    // Every node, leaf, string and index table lives in the slabs, so they
+    // go in one sweep instead of a walk over the whole tree
+    pathcache_clear();
+    slab_release_all();
+    intern_reset();
+    
+    // Reset root's links
+    root.n.west = NULL;
+    root.n.east = NULL;
+    root.n.last_dir = NULL;
+    root.n.last_leaf = NULL;
+    root.n.resume = NULL;
+    root.n.order = NULL;
+    root.n.sorting = NULL;
+    root.n.ndirs = 0;
+    root.n.nleaves = 0;
+    zero((int8 *)&root.n.index, sizeof(Index));
+    atomic_store_explicit(&leaf_bytes, 0, memory_order_relaxed);
+    
+    printf("Memory cleanup completed.\n");
 }
@@ -2,11 +2,20 @@
 #define TREE_H
 
 #include <stdint.h>
+#include "index.h"
+
+// Longest absolute directory path search_node will resolve
+#define MAX_PATH_LENGTH 4096
+// Longest single directory name
+#define MAX_NAME_LENGTH 255
+// Longest value setrange_leaf will build, terminator not counted
+#define MAX_VALUE_SIZE (512UL * 1024 * 1024)
 
 // Type definitions
 typedef int8_t int8;
 typedef int16_t int16;
 typedef uint32_t uint32;
+typedef uint64_t uint64;
 
 typedef enum {
     NoError = 0,
@@ -23,19 +32,52 @@ typedef union u_tree Tree;
 // Structure definitions
 struct s_node {
     Tag tag;
-    Node *north;
-    Node *west;
-    Tree *east;
-    int8 path[256];
+    Node *north;        // parent directory
+    Node *west;         // first subdirectory
+    Tree *east;         // first leaf
+    Node *prev;         // previous directory under the same parent
+    Node *next;         // next directory under the same parent
+    Node *last_dir;     // tail of the subdirectory list
+    Leaf *last_leaf;    // tail of the leaf list
+    Leaf *resume;       // where a paused walk over the leaves goes on; removals move it past themselves
+    uint32 ndirs;
+    uint32 nleaves;
+    uint64 gen;         // tree_generation() at this directory's last change
+    _Atomic uint64 subgen;  // gen of the latest change at or below here, see tree_fence
+    uint64 image;       // keys still in a mapped image (cache22 -m), else 0
+    uint64 ttl;         // lifetime in ms cache22 gives new keys here, 0 for none
+    Index index;        // leaves of this directory by key
+    struct s_art *order;    // the same in byte order once order_leaves asked for it, else NULL
+    Leaf *sorting;      // next leaf order_leaves puts in order, NULL once all are in
+    _Atomic uint32 order_idle;  // inserts and deletes in order since it was last used
+    const int8 *path;   // directory name, interned (see intern.h)
 };
 
+// Keys and values up to these sizes (terminator included) live inside the leaf
+#define LEAF_INLINE_KEY   32
+#define LEAF_INLINE_VALUE 24
+
+typedef enum {
+    LeafKeyInline = 1 << 0,     // key points into data[]
+    LeafValueInline = 1 << 1    // value points into data[]
+} LeafFlag;
+
 struct s_leaf {
     Tag tag;
+    uint32 hash;        // index_hash(key)
     Tree *west;
     Leaf *east;
     int8 *key;
     int8 *value;
-    int16 size;
+    uint64 size;        // value bytes including the terminator
+    uint64 capacity;    // bytes the current value buffer can hold
+    uint64 expires;     // unix time in ms after which the key is gone, 0 for never
+    uint64 timer;       // deadline of the expiry timer cache22 has queued for it, 0 for none
+    uint16_t footprint; // bytes allocated for the leaf itself
+    uint8_t flags;      // LeafFlag
+    _Atomic uint8_t freq;   // access frequency counter kept by cache22's eviction
+    _Atomic uint32 atime;   // access clock kept by cache22's eviction
+    int8 data[];        // inline key, then inline value
 };
 
 union u_tree {
@@ -48,15 +90,29 @@ extern Tree root;
 
 // Function declarations
 Node *create_node(Node *parent, const int8 *path);
-Leaf *create_leaf(Node *parent, const int8 *key, const int8 *value, int16 count);
+Leaf *create_leaf(Node *parent, const int8 *key, const int8 *value, uint64 count);
 Leaf *search_leaf(const Node *root, const int8 *key);
 Node *search_node(const Node *root, const int8 *path);
-int update_leaf(Node *root, const int8 *key, const int8 *new_value, int16 new_size);
+int node_path(const Node *node, int8 *buf, uint32 size);
+int update_leaf(Node *root, const int8 *key, const int8 *new_value, uint64 new_size);
+Leaf *set_leaf(Node *parent, const int8 *key, const int8 *value, uint64 count);
+Leaf *adopt_leaf(Node *parent, const int8 *key, int8 *value, uint64 count, uint64 capacity);
+Leaf *setrange_leaf(Node *parent, const int8 *key, uint64 offset, const int8 *buf, uint64 len);
 int delete_leaf(Node *root, const int8 *key);
+Leaf *detach_leaf(Node *root, const int8 *key);
+void free_leaf(Leaf *leaf);
+int detach_node(Node *n);
+int reclaim_node(Node *top, uint32 budget);
+void clear_leaves(Node *parent);
+int order_leaves(Node *n, uint32 budget);
+void order_used(Node *n);
+void mark_changed(Node *n);
+uint64 tree_generation(void);
+uint64 tree_fence(void);
+uint64 tree_memory(void);
 void tree_cleanup(void);
 
 // Helper macros
-#define find_last(x) find_last_linear(x)
 #define reterr(x) \
     do { \
         errno = (x); \
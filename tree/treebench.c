@@ -0,0 +1,751 @@
+/*treebench: microbenchmarks of the tree operations, checked against a baseline (make bench)*/
+#define _GNU_SOURCE
+#include "tree.h"
+#include "slab.h"
+#include "command_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#define BENCH_SIZES     "10,1000,100000,10000000"
+#define BENCH_OPS       1000000     // each case runs at least this many operations
+#define BENCH_ROUNDS    9           // passes over every size; a case reports the median of its rounds
+#define BENCH_BIG       1000000
+#define BENCH_BIG_ROUNDS 7          // passes that include sizes from BENCH_BIG up, which take minutes each
+#define BENCH_NOISE_K   2.0         // the threshold must be this many times a case's noise to check it
+#define BENCH_MAX_RUNS  16          // processes -n may pool the rounds of
+#define BENCH_REF_STEPS 1024        // the reference runs this many steps
+#define BENCH_PACE      4096        // every this many operations of a case
+#define BENCH_NODES     1000000     // create_node and handle_cd stop at this many directories
+#define BENCH_CD        1000        // paths handle_cd resolves per repetition, most of them cold
+#define BENCH_THRESHOLD 5.0         // percent slower than the baseline that fails the run
+#define BENCH_MAX_SIZES 16
+#define BENCH_MAX_CASES 256
+#define KEY_WIDTH       16
+
+typedef struct s_result {
+    char name[64];
+    uint64 size;
+    double ns;          // per operation, median of the rounds
+    double rel;         // median of the rounds' ns over the reference's, what the check compares
+    double noise;       // standard error of rel, in percent of it
+    double allocs;      // per operation
+    double rss;         // peak MB once the first round of its size is done
+    double samples[BENCH_ROUNDS * BENCH_MAX_RUNS];  // ns per operation of each round, fastest first once summarized
+    double refs[BENCH_ROUNDS * BENCH_MAX_RUNS];     // ns per step of the reference run alongside each, until then
+    uint32 nsamples;
+} Result;
+
+static Result results[BENCH_MAX_CASES];
+static uint32 nresults;
+static uint32 pace;         // operations left until the reference runs again
+
+static int8 (*keys)[KEY_WIDTH];     // hits at 0..n-1, misses at n..2n-1
+static int8 (*paths)[KEY_WIDTH * 2];
+static uint32 *order;               // a random permutation of 0..n-1
+static const int8 value[] = "value:0123456789";
+static const int8 other[] = "VALUE:9876543210";
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void fail(const char *what, const int8 *key) {
+    fprintf(stderr, "treebench: %s %s failed: %s\n", what, key ? (const char *)key : "", strerror(errno));
+    exit(1);
+}
+
+static uint64 rng_state = 88172645463325252ULL;
+
+static uint64 rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Timed pieces of one case, summed over the repetitions, and the
+// reference steps run among them
+typedef struct s_span {
+    double ns;
+    uint64 allocs;
+    uint64 ops;
+    double ref;
+    uint64 steps;
+} Span;
+
+/**
+ * Keep one round's measurement of a case and of the reference alongside
+ * it; summarize() turns the rounds into ns, rel and noise
+ * @param name The case, "<op>/<variant>"
+ * @param size Directory size it ran at
+ * @param s Its timed pieces
+ */
+static void record(const char *name, uint64 size, const Span *s) {
+    Result *r;
+    uint32 i;
+
+    for (i = 0; i < nresults; i++) {
+        r = &results[i];
+        if (r->size == size && strcmp(r->name, name) == 0) {
+            if (r->nsamples < BENCH_ROUNDS * BENCH_MAX_RUNS) {
+                r->refs[r->nsamples] = s->ref / s->steps;
+                r->samples[r->nsamples++] = s->ns / s->ops;
+            }
+            return;
+        }
+    }
+    if (nresults == BENCH_MAX_CASES) {
+        return;
+    }
+
+    r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->size = size;
+    r->samples[0] = s->ns / s->ops;
+    r->refs[0] = s->ref / s->steps;
+    r->nsamples = 1;
+    r->allocs = (double)s->allocs / s->ops;
+}
+
+static int by_value(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double median(double *v, uint32 n) {
+    qsort(v, n, sizeof(*v), by_value);
+    return (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/**
+ * The median of a case's rounds, in ns and relative to the reference, and
+ * its noise: how far that median may be off, in percent. That is the
+ * standard error of a median, 1.2533 times the spread of the rounds over
+ * the square root of their number, the spread being the median absolute
+ * deviation of the relative times scaled to a standard deviation
+ * (x1.4826). More rounds make it smaller; unlike best-of, one lucky round
+ * moves neither rel nor noise.
+ */
+static void summarize(Result *r) {
+    double rel[BENCH_ROUNDS * BENCH_MAX_RUNS], dev[BENCH_ROUNDS * BENCH_MAX_RUNS];
+    uint32 i;
+
+    for (i = 0; i < r->nsamples; i++) {
+        rel[i] = r->samples[i] / r->refs[i];
+    }
+    r->ns = median(r->samples, r->nsamples);
+    r->rel = median(rel, r->nsamples);
+    for (i = 0; i < r->nsamples; i++) {
+        dev[i] = (rel[i] > r->rel) ? rel[i] - r->rel : r->rel - rel[i];
+    }
+    r->noise = 100.0 * 1.2533 * 1.4826 * median(dev, r->nsamples) / sqrt(r->nsamples) / r->rel;
+}
+
+// A fresh directory under the root for one repetition
+static Node *fresh_dir(void) {
+    Node *n;
+
+    n = create_node(&root.n, (const int8 *)"bench");
+    if (!n) {
+        fail("create_node", (const int8 *)"bench");
+    }
+    return n;
+}
+
+static void drop_dir(Node *n) {
+    if (detach_node(n)) {
+        fail("detach_node", n->path);
+    }
+    reclaim_node(n, UINT32_MAX);
+}
+
+/**
+ * The reference: the same fixed work every time, a chain of multiplies
+ * each waiting on the last. It does not change with the tree code, so a
+ * case that slows down with it is the machine slowing down (a busy host, a
+ * lower clock) and not the tree; the check compares cases relative to it.
+ * A machine's speed changes within seconds, so it runs BENCH_REF_STEPS at
+ * a time among a case's operations and is timed over the same stretch. It
+ * touches no memory, so what the case leaves in the caches costs it nothing.
+ * @param s The case's span, which gets the time
+ */
+static void bench_reference(Span *s) {
+    static uint64 h = 0x9E3779B97F4A7C15ULL;
+    uint64 i;
+    double t;
+
+    t = now();
+    for (i = 0; i < BENCH_REF_STEPS; i++) {
+        h = (h ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL + i;
+    }
+    s->ref += now() - t;
+    s->steps += BENCH_REF_STEPS;
+    if (h == 1) {
+        fail("reference", NULL);
+    }
+}
+
+static void span_start(double *t, uint64 *a) {
+    *a = slab_allocs();
+    *t = now();
+}
+
+// Every BENCH_PACE operations: stop the case's clock for the reference
+static void span_pace(Span *s, double *t) {
+    s->ns += now() - *t;
+    bench_reference(s);
+    pace = BENCH_PACE;
+    *t = now();
+}
+
+static void span_stop(Span *s, double t, uint64 a, uint64 ops) {
+    s->ns += now() - t;
+    s->allocs += slab_allocs() - a;
+    s->ops += ops;
+}
+
+#define PACE(s) \
+    if (!pace--) { \
+        span_pace(&s, &t); \
+    }
+
+/**
+ * Leaves in one directory of n keys, inserted in key order or at random:
+ * create, hit and miss lookups, update and delete, repeated until each
+ * case has done BENCH_OPS operations
+ */
+static void bench_leaves(uint64 n, bool random) {
+    Span create = {0}, hit = {0}, hit50 = {0}, miss = {0}, update = {0}, del = {0};
+    const char *mode = random ? "rand" : "seq";
+    char name[64];
+    uint64 reps, r, i, k, a;
+    double t;
+    Node *d;
+
+    reps = (n >= BENCH_OPS) ? 1 : BENCH_OPS / n;
+    for (r = 0; r < reps; r++) {
+        d = fresh_dir();
+
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(create);
+            k = random ? order[i] : i;
+            if (!create_leaf(d, keys[k], value, sizeof(value))) {
+                fail("create_leaf", keys[k]);
+            }
+        }
+        span_stop(&create, t, a, n);
+
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(hit);
+            k = random ? order[i] : i;
+            if (!search_leaf(d, keys[k])) {
+                fail("search_leaf", keys[k]);
+            }
+        }
+        span_stop(&hit, t, a, n);
+
+        // Every other lookup misses
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(hit50);
+            k = (random ? order[i] : i) + ((i & 1) ? n : 0);
+            if (!search_leaf(d, keys[k]) != (k >= n)) {
+                fail("search_leaf", keys[k]);
+            }
+        }
+        span_stop(&hit50, t, a, n);
+
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(miss);
+            k = (random ? order[i] : i) + n;
+            if (search_leaf(d, keys[k])) {
+                fail("search_leaf", keys[k]);
+            }
+        }
+        span_stop(&miss, t, a, n);
+
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(update);
+            k = random ? order[i] : i;
+            if (update_leaf(d, keys[k], (r & 1) ? value : other, sizeof(value))) {
+                fail("update_leaf", keys[k]);
+            }
+        }
+        span_stop(&update, t, a, n);
+
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(del);
+            k = random ? order[i] : i;
+            if (delete_leaf(d, keys[k])) {
+                fail("delete_leaf", keys[k]);
+            }
+        }
+        span_stop(&del, t, a, n);
+
+        drop_dir(d);
+    }
+
+#define RECORD(op, s) \
+    snprintf(name, sizeof(name), op "/%s", mode); \
+    record(name, n, &s)
+    RECORD("create_leaf", create);
+    RECORD("search_leaf/hit100", hit);
+    RECORD("search_leaf/hit50", hit50);
+    RECORD("search_leaf/hit0", miss);
+    RECORD("update_leaf", update);
+    RECORD("delete_leaf", del);
+#undef RECORD
+}
+
+/**
+ * Directories: create n subdirectories of one directory, then change into
+ * some of them at random through the REPL's CD, which resolves the whole
+ * path. The directory is new each repetition, so most lookups miss the path
+ * cache and walk the children; BENCH_CD of them keeps that bounded at 1M.
+ */
+static void bench_nodes(uint64 n) {
+    static RespCmd cmd;
+    static Session session;
+    Span create = {0}, cd = {0};
+    uint64 reps, r, i, m, a;
+    double t;
+    Node *d;
+
+    m = (n < BENCH_CD) ? n : BENCH_CD;
+    session.engine = &list_engine;
+    cmd.argc = 2;
+    reps = (n >= BENCH_OPS) ? 1 : BENCH_OPS / n;
+    for (r = 0; r < reps; r++) {
+        d = fresh_dir();
+
+        span_start(&t, &a);
+        for (i = 0; i < n; i++) {
+            PACE(create);
+            // paths[i] is "/bench/<name>"
+            if (!create_node(d, paths[i] + 7)) {
+                fail("create_node", paths[i]);
+            }
+        }
+        span_stop(&create, t, a, n);
+
+        span_start(&t, &a);
+        for (i = 0; i < m; i++) {
+            PACE(cd);
+            cmd.argv[1] = (char *)paths[order[i] % n];
+            cmd.argl[1] = strlen(cmd.argv[1]);
+            handle_cd(&session, &cmd);
+        }
+        span_stop(&cd, t, a, m);
+        if (strcmp((const char *)session.cwd, (const char *)paths[order[m - 1] % n])) {
+            fail("handle_cd", paths[order[m - 1] % n]);
+        }
+
+        drop_dir(d);
+    }
+
+    record("create_node", n, &create);
+    record("handle_cd/rand", n, &cd);
+}
+
+// Keys, miss keys, directory paths and a random order for n
+static void prepare(uint64 n) {
+    uint64 i, j;
+    uint32 tmp;
+
+    free(keys);
+    free(paths);
+    free(order);
+    keys = malloc(2 * n * sizeof(*keys));
+    paths = malloc((n < BENCH_NODES ? n : BENCH_NODES) * sizeof(*paths));
+    order = malloc(n * sizeof(*order));
+    if (!keys || !paths || !order) {
+        fail("malloc", NULL);
+    }
+
+    for (i = 0; i < 2 * n; i++) {
+        snprintf((char *)keys[i], KEY_WIDTH, "%s:%010u", (i < n) ? "key" : "nah",
+                 (uint32)(i % n));
+    }
+    for (i = 0; i < n && i < BENCH_NODES; i++) {
+        snprintf((char *)paths[i], sizeof(*paths), "/bench/d%010u", (uint32)i);
+    }
+    for (i = 0; i < n; i++) {
+        order[i] = (uint32)i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = rng() % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+static double peak_rss_mb(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)ru.ru_maxrss / 1024.0;
+}
+
+/**
+ * The CPU this runs on, from /proc/cpuinfo or else uname. A baseline only
+ * means something on the machine that recorded it, so it is stored with it.
+ */
+static void machine(char *buf, size_t size) {
+    char line[256], *p;
+    struct utsname u;
+    FILE *f;
+
+    f = fopen("/proc/cpuinfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "model name", 10) == 0 && (p = strchr(line, ':'))) {
+            p += strspn(p, ": \t");
+            p[strcspn(p, "\"\n")] = 0;
+            snprintf(buf, size, "%s", p);
+            fclose(f);
+            return;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    snprintf(buf, size, "%s", uname(&u) ? "unknown" : u.machine);
+}
+
+/**
+ * Read a baseline written by save_baseline: one case per line. Baselines
+ * from before ref_ratio and noise_pct were kept read as 0 for both, and
+ * their cases are compared by ns alone.
+ * @param cpu Filled with the machine the baseline was recorded on, or ""
+ * @return Cases read, -1 if the file cannot be opened
+ */
+static int load_baseline(const char *file, Result *base, uint32 max, char *cpu) {
+    char line[256];
+    FILE *f;
+    int n;
+
+    f = fopen(file, "r");
+    if (!f) {
+        return -1;
+    }
+    n = 0;
+    cpu[0] = 0;
+    while ((uint32)n < max && fgets(line, sizeof(line), f)) {
+        base[n].rel = base[n].noise = 0;
+        if (sscanf(line, " {\"case\": \"%63[^\"]\", \"size\": %llu, \"ns_per_op\": %lf, \"allocs_per_op\": %lf, "
+                   "\"ref_ratio\": %lf, \"noise_pct\": %lf", base[n].name, (unsigned long long *)&base[n].size,
+                   &base[n].ns, &base[n].allocs, &base[n].rel, &base[n].noise) >= 4
+            && isfinite(base[n].rel) && isfinite(base[n].noise) && base[n].ns > 0) {
+            n++;
+        } else {
+            sscanf(line, " \"machine\": \"%127[^\"]\"", cpu);
+        }
+    }
+    fclose(f);
+
+    return n;
+}
+
+static int save_baseline(const char *file) {
+    char cpu[128];
+    FILE *f;
+    uint32 i;
+
+    f = fopen(file, "w");
+    if (!f) {
+        return -1;
+    }
+    machine(cpu, sizeof(cpu));
+    fprintf(f, "{\n  \"machine\": \"%s\",\n  \"threshold_pct\": %.1f,\n  \"noise_k\": %.1f,\n  \"results\": [\n",
+            cpu, BENCH_THRESHOLD, BENCH_NOISE_K);
+    for (i = 0; i < nresults; i++) {
+        fprintf(f, "    {\"case\": \"%s\", \"size\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.4f, "
+                "\"ref_ratio\": %.4f, \"noise_pct\": %.2f}%s\n", results[i].name, (unsigned long long)results[i].size,
+                results[i].ns, results[i].allocs, results[i].rel, results[i].noise, (i + 1 < nresults) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    return fclose(f);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s size,size,...] [-n runs] [-b baseline.json | -w baseline.json] [-t percent]\n",
+            prog);
+    exit(1);
+}
+
+/* Each round passes over all the sizes, so the rounds of a case are
+ * spread over the whole run and its noise includes the machine drifting
+ * under it, not just the jitter of a few seconds */
+static void bench_rounds(const uint64 *sizes, uint32 nsizes) {
+    uint32 round, i, j;
+
+    // The REPL's CD resolves from the root node
+    root.n.tag = TagRoot | TagNode;
+    root.n.north = (Node *)&root;
+    root.n.path = (const int8 *)"/";
+
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < nsizes; i++) {
+            if (sizes[i] >= BENCH_BIG && round >= BENCH_BIG_ROUNDS) {
+                continue;
+            }
+            j = nresults;
+            prepare(sizes[i]);
+            bench_leaves(sizes[i], false);
+            bench_leaves(sizes[i], true);
+            bench_nodes(sizes[i] < BENCH_NODES ? sizes[i] : BENCH_NODES);
+            for (; j < nresults; j++) {
+                results[j].rss = peak_rss_mb();
+            }
+            tree_cleanup();
+        }
+    }
+}
+
+/**
+ * One run in a process of its own, whose cases come back through a pipe
+ * and are pooled with the earlier runs'. A fresh process lays out its heap
+ * and faults in its memory anew, which shifts timings more than anything
+ * within one run does; pooling runs puts that into the noise too.
+ */
+static void bench_run(const uint64 *sizes, uint32 nsizes) {
+    static Result got[BENCH_MAX_CASES];
+    uint32 n, i, j, k;
+    int fd[2], status;
+    pid_t pid;
+    FILE *f;
+
+    fflush(stdout);
+    if (pipe(fd) || (pid = fork()) < 0) {
+        fail("fork", NULL);
+    }
+    if (!pid) {
+        close(fd[0]);
+        nresults = 0;
+        bench_rounds(sizes, nsizes);
+        f = fdopen(fd[1], "w");
+        if (!f || fwrite(&nresults, sizeof(nresults), 1, f) != 1 ||
+            fwrite(results, sizeof(Result), nresults, f) != nresults || fclose(f)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    close(fd[1]);
+    f = fdopen(fd[0], "r");
+    if (!f || fread(&n, sizeof(n), 1, f) != 1 || n > BENCH_MAX_CASES || fread(got, sizeof(Result), n, f) != n) {
+        n = 0;
+    }
+    if (f) {
+        fclose(f);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) || !n) {
+        errno = ECHILD;
+        fail("run", NULL);
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < nresults; j++) {
+            if (results[j].size == got[i].size && strcmp(results[j].name, got[i].name) == 0) {
+                break;
+            }
+        }
+        if (j == nresults) {
+            if (nresults == BENCH_MAX_CASES) {
+                continue;
+            }
+            results[nresults++] = got[i];
+            continue;
+        }
+        for (k = 0; k < got[i].nsamples && results[j].nsamples < BENCH_ROUNDS * BENCH_MAX_RUNS; k++) {
+            results[j].refs[results[j].nsamples] = got[i].refs[k];
+            results[j].samples[results[j].nsamples++] = got[i].samples[k];
+        }
+    }
+}
+
+/**
+ * Keep this process and the runs it forks on the CPU it started on.
+ * Moving between CPUs leaves the caches behind and lands on cores at
+ * different clocks, which shows up as noise; a failure only costs that.
+ */
+static void pin(void) {
+    cpu_set_t set;
+    int cpu;
+
+    cpu = sched_getcpu();
+    if (cpu < 0) {
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        fprintf(stderr, "treebench: not pinned to cpu %d: %s\n", cpu, strerror(errno));
+    }
+}
+
+/**
+ * Whether a case's noise leaves room to tell a change of the threshold:
+ * BENCH_NOISE_K times it must fit
+ * @param noise Its standard error, or the comparison's, in percent
+ */
+static bool quiet(double noise, double threshold) {
+    return BENCH_NOISE_K * noise <= threshold;
+}
+
+int main(int argc, char *argv[]) {
+    static Result base[BENCH_MAX_CASES];
+    uint64 sizes[BENCH_MAX_SIZES];
+    const char *spec, *check, *write;
+    char cpu[128], here[128];
+    double threshold, delta, noise, was;
+    uint32 nsizes, i, j, runs, compared;
+    int nbase, regressions, noisy, opt;
+    char *p, *end;
+    Result *b;
+
+    spec = BENCH_SIZES;
+    check = write = NULL;
+    threshold = BENCH_THRESHOLD;
+    runs = 1;
+    while ((opt = getopt(argc, argv, "s:n:b:w:t:")) != -1) {
+        if (opt == 's') {
+            spec = optarg;
+        } else if (opt == 'n') {
+            runs = (uint32)atoi(optarg);
+            if (!runs || runs > BENCH_MAX_RUNS) {
+                usage(argv[0]);
+            }
+        } else if (opt == 'b') {
+            check = optarg;
+        } else if (opt == 'w') {
+            write = optarg;
+        } else if (opt == 't') {
+            threshold = atof(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    for (nsizes = 0, p = (char *)spec; *p && nsizes < BENCH_MAX_SIZES; p = end + (*end == ',')) {
+        sizes[nsizes] = strtoull(p, &end, 10);
+        if (end == p || !sizes[nsizes] || sizes[nsizes] > UINT32_MAX / 2 || (*end && *end != ',')) {
+            usage(argv[0]);
+        }
+        nsizes++;
+    }
+    if (!nsizes || optind != argc) {
+        usage(argv[0]);
+    }
+
+    pin();
+    for (i = 0; i < runs; i++) {
+        bench_run(sizes, nsizes);
+    }
+
+    printf("%-26s %10s %10s %10s %10s %10s\n", "case", "size", "ns/op", "noise %", "allocs/op", "rss MB");
+    for (j = 0; j < nresults; j++) {
+        summarize(&results[j]);
+        printf("%-26s %10llu %10.1f %10.1f %10.2f %10.1f\n", results[j].name, (unsigned long long)results[j].size,
+               results[j].ns, results[j].noise, results[j].allocs, results[j].rss);
+    }
+
+    // The baseline's noise adds to every later run's, so it must be quiet
+    if (write) {
+        for (noisy = 0, j = 0; j < nresults; j++) {
+            if (!quiet(results[j].noise, threshold)) {
+                printf("NOISY %s at %llu: %.1f%% noise, too much for a %.1f%% threshold\n", results[j].name,
+                       (unsigned long long)results[j].size, results[j].noise, threshold);
+                noisy++;
+            }
+        }
+        if (noisy) {
+            printf("baseline not written: %d noisy case%s; use more runs (-n) on a quieter machine\n", noisy,
+                   (noisy == 1) ? "" : "s");
+            return 1;
+        }
+        if (save_baseline(write)) {
+            fail("writing", (const int8 *)write);
+        }
+        printf("baseline written to %s\n", write);
+        return 0;
+    }
+    if (!check) {
+        return 0;
+    }
+
+    nbase = load_baseline(check, base, BENCH_MAX_CASES, cpu);
+    if (nbase < 0) {
+        fail("reading", (const int8 *)check);
+    }
+    machine(here, sizeof(here));
+    if (strcmp(cpu, here)) {
+        printf("warning: %s was recorded on \"%s\", this is \"%s\"; make bench-baseline here first\n", check,
+               cpu[0] ? cpu : "an unknown machine", here);
+    }
+
+    /* Allocating more fails the run, and so does being slower relative to
+     * the reference by more than the threshold. The noise of the
+     * comparison is the baseline's and this run's together; when
+     * BENCH_NOISE_K times it is more than the threshold, the case cannot
+     * tell a regression from a busy machine, and that fails the run too
+     * rather than letting it through unchecked. */
+    regressions = noisy = 0;
+    compared = 0;
+    for (i = 0; i < nresults; i++) {
+        for (b = NULL, j = 0; j < (uint32)nbase; j++) {
+            if (base[j].size == results[i].size && strcmp(base[j].name, results[i].name) == 0) {
+                b = &base[j];
+                break;
+            }
+        }
+        if (!b) {
+            continue;
+        }
+        compared++;
+        if (b->rel) {
+            delta = 100.0 * (results[i].rel - b->rel) / b->rel;
+        } else {
+            delta = 100.0 * (results[i].ns - b->ns) / b->ns;
+        }
+        noise = sqrt(results[i].noise * results[i].noise + b->noise * b->noise);
+        if (!quiet(noise, threshold)) {
+            printf("NOISY %s at %llu: %.1f%% noise (%.1f%% here, %.1f%% in the baseline), too much to check "
+                   "%.1f%%\n", results[i].name, (unsigned long long)results[i].size, noise, results[i].noise,
+                   b->noise, threshold);
+            noisy++;
+        }
+        if ((quiet(noise, threshold) && delta > threshold)
+            || results[i].allocs > b->allocs * (1.0 + threshold / 100.0) + 1e-9) {
+            was = b->rel ? b->rel * results[i].ns / results[i].rel : b->ns;
+            printf("REGRESSION %s at %llu: %.1f ns/op (baseline %.1f on this machine, %+.1f%%), "
+                   "%.2f allocs/op (baseline %.2f)\n", results[i].name, (unsigned long long)results[i].size,
+                   results[i].ns, was, delta, results[i].allocs, b->allocs);
+            regressions++;
+        }
+    }
+    printf("%d regression%s and %d noisy case%s in %u of %u cases against %s (threshold %.1f%%)\n", regressions,
+           (regressions == 1) ? "" : "s", noisy, (noisy == 1) ? "" : "s", compared, nresults, check, threshold);
+
+    // A baseline that matches nothing checks nothing
+    return (regressions || noisy || !compared) ? 1 : 0;
+}